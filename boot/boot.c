@@ -0,0 +1,140 @@
+/*----------------------------------------------------------------------
+                            INCLUDES
+----------------------------------------------------------------------*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "stm32f10x.h"
+#include "stm32f10x_rcc.h"
+
+#include "ota_meta.h"
+
+/*----------------------------------------------------------------------
+                            VARIABLES
+----------------------------------------------------------------------*/
+
+extern uint32_t _estack;            /* from boot.ld                 */
+extern uint32_t _sidata;
+extern uint32_t _sdata;
+extern uint32_t _edata;
+extern uint32_t _sbss;
+extern uint32_t _ebss;
+
+/*----------------------------------------------------------------------
+                            PROCEDURES
+----------------------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+static void boot_jump( uint8_t slot ) __attribute__ ((noreturn));
+static uint8_t boot_select( void );
+void boot_reset( void ) __attribute__ ((noreturn));
+
+/*--------------------------------------------------------
+Vector table, only the stack and reset entries are used.
+The bootloader runs with interrupts disabled on the reset
+clock (HSI).
+--------------------------------------------------------*/
+__attribute__ ((section(".isr_vector"),used))
+const void *boot_vectors[] =
+{
+    &_estack,
+    (const void *)boot_reset
+};
+
+
+/*--------------------------------------------------------
+Reset entry: set up RAM, pick the slot and start it
+--------------------------------------------------------*/
+void boot_reset( void )
+{
+    memcpy( &_sdata, &_sidata, (uint32_t)&_edata - (uint32_t)&_sdata );
+    memset( &_sbss, 0, (uint32_t)&_ebss - (uint32_t)&_sbss );
+
+    boot_jump( boot_select() );
+}
+
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Start the image in a slot with its own stack and vector
+table
+--------------------------------------------------------*/
+static void boot_jump( uint8_t slot )
+{
+    const uint32_t     *vec;        /* image vector table           */
+
+    RCC_AHBPeriphClockCmd( RCC_AHBPeriph_CRC, DISABLE );
+
+    vec       = (const uint32_t *)OTA_SLOT_ADDR( slot );
+    SCB->VTOR = OTA_SLOT_ADDR( slot );
+    __set_MSP( vec[ 0 ] );
+    ( (void (*)( void ))vec[ 1 ] )();
+
+    while( 1 );
+}
+
+
+/*--------------------------------------------------------
+Pick the slot to boot. A trial image uses up one of its
+tries per boot; when they are gone, or the active image
+fails its check, the record is switched back to the other
+slot. With no boot record at all slot A is booted as it
+was flashed by the debugger.
+--------------------------------------------------------*/
+static uint8_t boot_select( void )
+{
+    const ota_meta_type *cur;       /* boot record in effect        */
+    ota_meta_type       rec;        /* rollback record              */
+    uint8_t             slot;       /* active slot                  */
+    uint8_t             other;      /* rollback slot                */
+    bool                good;       /* active slot may be booted    */
+
+    cur = ota_meta_current();
+    if( cur == NULL )
+    {
+        if( !ota_slot_valid( 0, NULL ) )
+        {
+            while( 1 );
+        }
+        return 0;
+    }
+
+    slot  = cur->active;
+    other = slot ^ 1;
+
+    good = ota_slot_valid( slot, &cur->slot[ slot ] );
+    if( good && cur->state == OTA_STATE_TRIAL )
+    {
+        good = ota_meta_use_try( cur );
+    }
+
+    if( good )
+    {
+        return slot;
+    }
+
+    if( ota_slot_valid( other, &cur->slot[ other ] ) )
+    {
+        rec        = *cur;
+        rec.active = other;
+        rec.state  = OTA_STATE_CONFIRMED;
+        ota_meta_write( &rec );
+        return other;
+    }
+
+    /*--------------------------------------------------------
+    Nothing to roll back to, keep running the active image
+    unless it is damaged
+    --------------------------------------------------------*/
+    if( !ota_slot_valid( slot, &cur->slot[ slot ] ) )
+    {
+        while( 1 );
+    }
+    return slot;
+}
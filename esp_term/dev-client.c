@@ -0,0 +1,1303 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <termios.h>
+#include "telem_wire.h"
+#include <time.h>
+#include <unistd.h>
+
+#include "cobs.h"
+#include "dev-client.h"
+
+/**************************************************
+    Defines
+**************************************************/
+#define TX_BUF_SZ       4096
+
+/**************************************************
+    Types
+**************************************************/
+typedef struct
+    {
+    int      used;              /* queued or outstanding */
+    int      sent;              /* outstanding */
+    uint8_t  seq;
+    int      tries;             /* times sent */
+    uint32_t order;             /* submission order */
+    int64_t  deadline;          /* ms, retry when reached */
+    int      enc_len;
+    uint8_t  enc[PROTO_ENC_MAX];/* encoded frame, kept for retries */
+    uint8_t  last_type;         /* type of the last reply */
+    dc_reply_cb_type cb;
+    void    *ctx;
+    }request_type;
+
+struct dc_client
+    {
+    int      fd;
+    int      window;
+    int      in_flight;
+    uint8_t  next_seq;
+    uint32_t next_order;
+    request_type req[DC_QUEUE_MAX];
+    uint8_t  rx[PROTO_ENC_MAX];
+    int      rx_len;            /* > sizeof(rx) while skipping a frame */
+    uint8_t  tx[TX_BUF_SZ];
+    int      tx_len;
+    dc_reply_cb_type unsol_cb;
+    void    *unsol_ctx;
+    dc_reply_cb_type ch_cb[PROTO_CH_CNT];
+    void    *ch_ctx[PROTO_CH_CNT];
+    dc_stats_type stats;
+    uint8_t  done_seq[DC_DONE_MEMORY];
+    uint8_t  done_type[DC_DONE_MEMORY];
+    int      done_next;
+    };
+
+typedef struct
+    {
+    int      len;
+    uint8_t *type;
+    uint8_t *buf;
+    int      max;
+    }call_type;
+
+typedef struct
+    {
+    uint32_t addr;
+    uint32_t end;
+    }range_type;
+
+typedef struct bulk bulk_type;
+
+typedef struct
+    {
+    dc_client_type *dc;
+    uint8_t  seq;               /* of the LOG_OPEN being served */
+    int      open;              /* LOG_OPEN not finished */
+    int      finished;          /* LOG_END OK with nothing missing */
+    int      error;             /* reason to stop for good */
+    uint32_t next;              /* next offset expected */
+    uint32_t limit;             /* credit granted */
+    dc_data_cb_type cb;
+    void    *ctx;
+    }log_type;
+
+typedef struct
+    {
+    bulk_type *bulk;
+    int      active;
+    uint32_t next;              /* next address expected */
+    uint32_t end;
+    }piece_type;
+
+struct bulk
+    {
+    dc_client_type *dc;
+    uint32_t addr;
+    uint8_t *out;
+    int      width;
+    uint32_t next;              /* first address not yet asked for */
+    uint32_t end;
+    range_type gaps[DC_GAPS_MAX];
+    int      gap_cnt;
+    piece_type piece[PROTO_MEM_READ_QUEUE];
+    int      error;
+    };
+
+/**************************************************
+    Prototypes
+**************************************************/
+static int add_gap(bulk_type *bulk, uint32_t addr, uint32_t end);
+static void bulk_start(bulk_type *bulk);
+static int call_cb(void *ctx, int status, uint8_t type, const uint8_t *payload, int len);
+static void complete(dc_client_type *dc, request_type *r, int status);
+static void deliver(dc_client_type *dc, const uint8_t *frame, int len);
+static int encode_frame(uint8_t *enc, uint8_t type, uint8_t flags, uint8_t seq, const void *payload, int len);
+static int flush_tx(dc_client_type *dc);
+static request_type *find_seq(dc_client_type *dc, uint8_t seq);
+static int log_cb(void *ctx, int status, uint8_t type, const uint8_t *payload, int len);
+static int64_t now_ms(void);
+static int piece_cb(void *ctx, int status, uint8_t type, const uint8_t *payload, int len);
+static int poll_once(dc_client_type *dc);
+static int queue_tx(dc_client_type *dc, request_type *r);
+static int read_rx(dc_client_type *dc);
+static void send_pending(dc_client_type *dc);
+
+/**************************************************
+    dc_open
+        Open the device's serial port raw at
+        115200 baud, non-blocking.
+**************************************************/
+dc_client_type *dc_open
+    (
+    const char *path
+    )
+{
+dc_client_type *dc;
+struct termios tio;
+int fd;
+
+fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+if( fd < 0 )
+    {
+    return NULL;
+    }
+
+tcgetattr(fd, &tio);
+cfmakeraw(&tio);
+cfsetispeed(&tio, B115200);
+cfsetospeed(&tio, B115200);
+tcsetattr(fd, TCSANOW, &tio);
+tcflush(fd, TCIOFLUSH);
+
+dc = calloc(1, sizeof(*dc));
+dc->fd = fd;
+dc->window = DC_WINDOW;
+/* Not from 0, so a new run does not repeat the last one's requests */
+dc->next_seq = (uint8_t)(getpid() ^ now_ms());
+return dc;
+}
+
+
+/**************************************************
+    dc_close
+        Fail the open requests with DC_ERR_CLOSED
+        and free the client.
+**************************************************/
+void dc_close
+    (
+    dc_client_type *dc
+    )
+{
+int i;
+
+for( i = 0; i < DC_QUEUE_MAX; i++ )
+    {
+    if( dc->req[i].used )
+        {
+        complete(dc, &dc->req[i], DC_ERR_CLOSED);
+        }
+    }
+
+close(dc->fd);
+free(dc);
+}
+
+
+/**************************************************
+    dc_fd
+**************************************************/
+int dc_fd
+    (
+    dc_client_type *dc
+    )
+{
+return dc->fd;
+}
+
+
+/**************************************************
+    dc_epoll_add
+        Edge triggered, dc_process() reads and
+        writes until the port would block so the
+        registration never has to change.
+**************************************************/
+int dc_epoll_add
+    (
+    dc_client_type *dc,
+    int             epfd
+    )
+{
+struct epoll_event ev;
+
+memset(&ev, 0, sizeof(ev));
+ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+ev.data.ptr = dc;
+return epoll_ctl(epfd, EPOLL_CTL_ADD, dc->fd, &ev);
+}
+
+
+/**************************************************
+    dc_set_window
+        Requests outstanding at once. More than
+        the device's receive slots only costs
+        retries.
+**************************************************/
+void dc_set_window
+    (
+    dc_client_type *dc,
+    int             window
+    )
+{
+dc->window = (window < 1) ? 1 : window;
+}
+
+
+/**************************************************
+    dc_set_unsolicited
+        Handler for frames that belong to no open
+        request, e.g. WATCH_DATA.
+**************************************************/
+void dc_set_unsolicited
+    (
+    dc_client_type  *dc,
+    dc_reply_cb_type cb,
+    void            *ctx
+    )
+{
+dc->unsol_cb = cb;
+dc->unsol_ctx = ctx;
+}
+
+
+/**************************************************
+    dc_set_channel
+        Tap for every frame the device sends on a
+        channel, before it is matched to a request.
+        cb returns DC_DONE when it has taken the
+        frame, DC_MORE to pass it on. NULL removes
+        the tap. Other channel numbers are ignored.
+**************************************************/
+void dc_set_channel
+    (
+    dc_client_type  *dc,
+    int              ch,
+    dc_reply_cb_type cb,
+    void            *ctx
+    )
+{
+if( ch < 0 || ch >= PROTO_CH_CNT )
+    {
+    return;
+    }
+
+dc->ch_cb[ch] = cb;
+dc->ch_ctx[ch] = ctx;
+}
+
+
+/**************************************************
+    dc_get_stats
+**************************************************/
+void dc_get_stats
+    (
+    dc_client_type *dc,
+    dc_stats_type  *stats
+    )
+{
+*stats = dc->stats;
+}
+
+
+/**************************************************
+    dc_submit
+        Queue a request, it is sent as soon as the
+        window allows. cb gets each reply frame
+        and returns DC_MORE while more frames
+        belong to the request. Returns the
+        sequence number or a DC_ERR_ code.
+**************************************************/
+int dc_submit
+    (
+    dc_client_type  *dc,
+    uint8_t          type,
+    const void      *payload,
+    int              len,
+    dc_reply_cb_type cb,
+    void            *ctx
+    )
+{
+request_type *r;
+int i;
+
+if( len < 0 || len > PROTO_PAYLOAD_MAX )
+    {
+    return DC_ERR_LEN;
+    }
+
+r = NULL;
+for( i = 0; i < DC_QUEUE_MAX && r == NULL; i++ )
+    {
+    if( !dc->req[i].used )
+        {
+        r = &dc->req[i];
+        }
+    }
+if( r == NULL )
+    {
+    return DC_ERR_FULL;
+    }
+
+/* Sequence numbers of open requests are not reused */
+do
+    {
+    dc->next_seq++;
+    }
+while( find_seq(dc, dc->next_seq) != NULL );
+
+memset(r, 0, sizeof(*r));
+r->used = 1;
+r->seq = dc->next_seq;
+r->order = dc->next_order++;
+r->cb = cb;
+r->ctx = ctx;
+
+r->enc_len = encode_frame(r->enc, type, 0, r->seq, payload, len);
+
+send_pending(dc);
+return r->seq;
+}
+
+
+/**************************************************
+    dc_post
+        Send a frame the device does not answer
+        (PROTO_F_NOREPLY), ahead of the queued
+        requests and without retries. seq ties it
+        to an open request. Returns 0 or a DC_ERR_
+        code.
+**************************************************/
+int dc_post
+    (
+    dc_client_type *dc,
+    uint8_t         type,
+    uint8_t         seq,
+    const void     *payload,
+    int             len
+    )
+{
+if( len < 0 || len > PROTO_PAYLOAD_MAX )
+    {
+    return DC_ERR_LEN;
+    }
+if( dc->tx_len + PROTO_ENC_MAX > TX_BUF_SZ )
+    {
+    return DC_ERR_FULL;
+    }
+
+dc->tx_len += encode_frame(&dc->tx[dc->tx_len], type, PROTO_F_NOREPLY, seq, payload, len);
+dc->stats.tx_frames++;
+return (flush_tx(dc) < 0) ? DC_ERR_IO : 0;
+}
+
+
+/**************************************************
+    dc_process
+        Read and handle what has arrived, retry
+        or fail timed out requests and send what
+        the window allows. Never blocks.
+**************************************************/
+int dc_process
+    (
+    dc_client_type *dc
+    )
+{
+int64_t now;
+request_type *r;
+int i;
+
+if( read_rx(dc) < 0 )
+    {
+    return DC_ERR_IO;
+    }
+
+now = now_ms();
+for( i = 0; i < DC_QUEUE_MAX; i++ )
+    {
+    r = &dc->req[i];
+    if( !r->used || !r->sent || r->deadline > now )
+        {
+        continue;
+        }
+
+    if( r->tries > DC_RETRIES )
+        {
+        dc->stats.timeouts++;
+        complete(dc, r, DC_ERR_TIMEOUT);
+        }
+    else if( queue_tx(dc, r) == 0 )
+        {
+        dc->stats.retransmits++;
+        }
+    }
+
+send_pending(dc);
+return (flush_tx(dc) < 0) ? DC_ERR_IO : 0;
+}
+
+
+/**************************************************
+    dc_timeout
+        ms until dc_process() has to run again
+        without port activity, -1 if never.
+**************************************************/
+int dc_timeout
+    (
+    dc_client_type *dc
+    )
+{
+int64_t now;
+int64_t next;
+int i;
+
+now = now_ms();
+next = -1;
+for( i = 0; i < DC_QUEUE_MAX; i++ )
+    {
+    if( dc->req[i].used && dc->req[i].sent
+     && (next < 0 || dc->req[i].deadline < next) )
+        {
+        next = dc->req[i].deadline;
+        }
+    }
+
+if( next < 0 )
+    {
+    return (dc->tx_len > 0) ? DC_TIMEOUT_MS : -1;
+    }
+return (next > now) ? (int)(next - now) : 0;
+}
+
+
+/**************************************************
+    dc_wait
+        Run the client until a request has
+        finished. Returns 0 or DC_ERR_IO.
+**************************************************/
+int dc_wait
+    (
+    dc_client_type *dc,
+    int             seq
+    )
+{
+while( find_seq(dc, (uint8_t)seq) != NULL )
+    {
+    if( poll_once(dc) < 0 )
+        {
+        return DC_ERR_IO;
+        }
+    }
+
+return 0;
+}
+
+
+/**************************************************
+    dc_call
+        Send a request and wait for its first
+        reply frame. Returns the reply payload
+        length, or a DC_ERR_ code.
+**************************************************/
+int dc_call
+    (
+    dc_client_type *dc,
+    uint8_t         type,
+    const void     *payload,
+    int             len,
+    uint8_t        *reply_type,
+    uint8_t        *reply,
+    int             reply_max
+    )
+{
+call_type call;
+int seq;
+int rc;
+
+call.len = DC_ERR_CLOSED;
+call.type = reply_type;
+call.buf = reply;
+call.max = reply_max;
+
+seq = dc_submit(dc, type, payload, len, call_cb, &call);
+if( seq < 0 )
+    {
+    return seq;
+    }
+
+rc = dc_wait(dc, seq);
+return (rc < 0) ? rc : call.len;
+}
+
+
+/**************************************************
+    dc_mem_read
+        Read a range of any length. It is asked for
+        in PROTO_MEM_READ_MAX pieces, as many at a
+        time as the device queues, so the data
+        streams back to back. A gap left by a
+        damaged frame is noted and only that part
+        asked for again once the stream has passed.
+        Returns 0 or a DC_ERR_ code.
+**************************************************/
+int dc_mem_read
+    (
+    dc_client_type *dc,
+    uint32_t        addr,
+    uint32_t        len,
+    int             width,
+    uint8_t        *out
+    )
+{
+bulk_type bulk;
+int i;
+int active;
+
+memset(&bulk, 0, sizeof(bulk));
+bulk.dc = dc;
+bulk.addr = addr;
+bulk.out = out;
+bulk.width = width;
+bulk.next = addr;
+bulk.end = addr + len;
+for( i = 0; i < PROTO_MEM_READ_QUEUE; i++ )
+    {
+    bulk.piece[i].bulk = &bulk;
+    }
+
+bulk_start(&bulk);
+do
+    {
+    active = 0;
+    for( i = 0; i < PROTO_MEM_READ_QUEUE; i++ )
+        {
+        active |= bulk.piece[i].active;
+        }
+    if( active && poll_once(dc) < 0 )
+        {
+        return DC_ERR_IO;
+        }
+    }
+while( active );
+
+return bulk.error;
+}
+
+
+/**************************************************
+    dc_log_read
+        Stream a log (PROTO_LOG_SRC_RING) or memory
+        range (PROTO_LOG_SRC_MEM, addr and len)
+        from an offset to its end, handing the data
+        to cb in order. Credit is granted
+        DC_LOG_WINDOW ahead of what has arrived.
+        After a missing frame or a stall the stream
+        is opened again at the first missing
+        offset. Ring data overwritten before it
+        was read is skipped, cb sees a jump in the
+        offset. Returns the end offset or a DC_ERR_
+        code.
+**************************************************/
+int64_t dc_log_read
+    (
+    dc_client_type *dc,
+    int             source,
+    uint32_t        addr,
+    uint32_t        len,
+    uint32_t        offset,
+    dc_data_cb_type cb,
+    void           *ctx
+    )
+{
+log_type log;
+uint8_t payload[PROTO_LOG_OPEN_SZ + 8];
+uint32_t opened_at;
+int stalls;
+int seq;
+
+memset(&log, 0, sizeof(log));
+log.dc = dc;
+log.next = offset;
+log.cb = cb;
+log.ctx = ctx;
+stalls = 0;
+
+while( 1 )
+    {
+    log.limit = log.next + DC_LOG_WINDOW;
+    payload[0] = (uint8_t)source;
+    telem_put_u32(&payload[1], log.next);
+    telem_put_u32(&payload[5], log.limit);
+    telem_put_u32(&payload[9], addr);
+    telem_put_u32(&payload[13], len);
+    seq = dc_submit(dc, PROTO_T_LOG_OPEN, payload,
+                    (source == PROTO_LOG_SRC_MEM) ? sizeof(payload) : PROTO_LOG_OPEN_SZ,
+                    log_cb, &log);
+    if( seq < 0 )
+        {
+        return seq;
+        }
+
+    log.seq = (uint8_t)seq;
+    log.open = 1;
+    opened_at = log.next;
+    while( log.open )
+        {
+        if( poll_once(dc) < 0 )
+            {
+            return DC_ERR_IO;
+            }
+        }
+
+    if( log.error < 0 )
+        {
+        return log.error;
+        }
+    if( log.finished )
+        {
+        return log.next;
+        }
+
+    /* Give up only when reopening brings nothing new */
+    stalls = (log.next == opened_at) ? stalls + 1 : 0;
+    if( stalls > DC_RETRIES )
+        {
+        return DC_ERR_LOST;
+        }
+    dc->stats.log_resumes++;
+    }
+}
+
+
+/**************************************************
+    add_gap
+**************************************************/
+static int add_gap
+    (
+    bulk_type *bulk,
+    uint32_t   addr,
+    uint32_t   end
+    )
+{
+if( bulk->gap_cnt == DC_GAPS_MAX )
+    {
+    bulk->error = DC_ERR_LOST;
+    return -1;
+    }
+
+bulk->gaps[bulk->gap_cnt].addr = addr;
+bulk->gaps[bulk->gap_cnt].end = end;
+bulk->gap_cnt++;
+return 0;
+}
+
+
+/**************************************************
+    bulk_start
+        Ask for the next pieces of a dc_mem_read(),
+        lost pieces first.
+**************************************************/
+static void bulk_start
+    (
+    bulk_type *bulk
+    )
+{
+piece_type *piece;
+uint8_t payload[7];
+uint32_t addr;
+uint32_t end;
+int i;
+
+for( i = 0; i < PROTO_MEM_READ_QUEUE && bulk->error == 0; i++ )
+    {
+    piece = &bulk->piece[i];
+    if( piece->active )
+        {
+        continue;
+        }
+
+    if( bulk->gap_cnt > 0 )
+        {
+        bulk->gap_cnt--;
+        addr = bulk->gaps[bulk->gap_cnt].addr;
+        end = bulk->gaps[bulk->gap_cnt].end;
+        bulk->dc->stats.rereads++;
+        }
+    else if( bulk->next < bulk->end )
+        {
+        addr = bulk->next;
+        end = (bulk->end - addr > PROTO_MEM_READ_MAX) ? addr + PROTO_MEM_READ_MAX : bulk->end;
+        bulk->next = end;
+        }
+    else
+        {
+        return;
+        }
+
+    telem_put_u32(payload, addr);
+    telem_put_u16(&payload[4], end - addr);
+    payload[6] = bulk->width;
+    piece->next = addr;
+    piece->end = end;
+    if( dc_submit(bulk->dc, PROTO_T_MEM_READ, payload, sizeof(payload), piece_cb, piece) < 0 )
+        {
+        bulk->error = DC_ERR_FULL;
+        return;
+        }
+    piece->active = 1;
+    }
+}
+
+
+/**************************************************
+    piece_cb
+        Collect the MEM_DATA frames of one piece.
+**************************************************/
+static int piece_cb
+    (
+    void          *ctx,
+    int            status,
+    uint8_t        type,
+    const uint8_t *payload,
+    int            len
+    )
+{
+piece_type *piece;
+bulk_type *bulk;
+uint32_t addr;
+uint32_t n;
+
+piece = ctx;
+bulk = piece->bulk;
+if( status == DC_OK && type == PROTO_T_MEM_DATA && len >= 4 )
+    {
+    addr = telem_get_u32(payload);
+    n = len - 4;
+    if( addr < piece->next || addr + n > piece->end )
+        {
+        return DC_MORE;         /* a rerun repeating what arrived */
+        }
+    if( addr > piece->next )
+        {
+        add_gap(bulk, piece->next, addr);
+        }
+    memcpy(&bulk->out[addr - bulk->addr], &payload[4], n);
+    piece->next = addr + n;
+    if( piece->next < piece->end )
+        {
+        return DC_MORE;
+        }
+    }
+else if( status == DC_OK && type == PROTO_T_STATUS && len == 1
+      && payload[0] != PROTO_ST_BUSY )
+    {
+    bulk->error = DC_ERR_DEVICE;
+    }
+else if( status == DC_OK && type != PROTO_T_STATUS )
+    {
+    return DC_MORE;
+    }
+else if( status != DC_OK )
+    {
+    bulk->error = status;
+    }
+else
+    {
+    /* Device queue full: ask again for what is missing */
+    add_gap(bulk, piece->next, piece->end);
+    }
+
+piece->active = 0;
+bulk_start(bulk);
+return DC_DONE;
+}
+
+
+/**************************************************
+    call_cb
+**************************************************/
+static int call_cb
+    (
+    void          *ctx,
+    int            status,
+    uint8_t        type,
+    const uint8_t *payload,
+    int            len
+    )
+{
+call_type *call;
+
+call = ctx;
+if( status != DC_OK )
+    {
+    call->len = status;
+    return DC_DONE;
+    }
+
+*call->type = type;
+call->len = (len < call->max) ? len : call->max;
+memcpy(call->buf, payload, call->len);
+return DC_DONE;
+}
+
+
+/**************************************************
+    complete
+        Report a final status and free the
+        request.
+**************************************************/
+static void complete
+    (
+    dc_client_type *dc,
+    request_type   *r,
+    int             status
+    )
+{
+if( r->sent )
+    {
+    dc->in_flight--;
+    }
+if( status == DC_OK )
+    {
+    dc->done_seq[dc->done_next] = r->seq;
+    dc->done_type[dc->done_next] = r->last_type;
+    dc->done_next = (dc->done_next + 1) % DC_DONE_MEMORY;
+    }
+r->used = 0;
+r->sent = 0;
+if( status != DC_OK && r->cb != NULL )
+    {
+    r->cb(r->ctx, status, 0, NULL, 0);
+    }
+}
+
+
+/**************************************************
+    deliver
+        Check a decoded frame and hand it to its
+        request.
+**************************************************/
+static void deliver
+    (
+    dc_client_type *dc,
+    const uint8_t  *frame,
+    int             len
+    )
+{
+request_type *r;
+uint16_t plen;
+const uint8_t *payload;
+int ch;
+int i;
+
+if( len < PROTO_HDR_SZ + PROTO_CRC_SZ || proto_crc8(frame, 5) != frame[5] )
+    {
+    dc->stats.bad_frames++;
+    return;
+    }
+
+plen = frame[3] | (frame[4] << 8);
+payload = &frame[PROTO_HDR_SZ];
+if( plen != len - PROTO_HDR_SZ - PROTO_CRC_SZ
+ || proto_crc16(payload, plen) != (payload[plen] | (payload[plen + 1] << 8)) )
+    {
+    dc->stats.bad_frames++;
+    return;
+    }
+
+dc->stats.rx_frames++;
+ch = PROTO_CH_OF(frame[1]);
+dc->stats.ch_frames[ch]++;
+dc->stats.ch_bytes[ch] += plen;
+if( dc->ch_cb[ch] != NULL
+ && dc->ch_cb[ch](dc->ch_ctx[ch], DC_OK, frame[0], payload, plen) == DC_DONE )
+    {
+    return;
+    }
+
+r = (frame[0] == PROTO_T_CONSOLE) ? NULL : find_seq(dc, frame[2]);
+if( r == NULL || !r->sent )
+    {
+    for( i = 0; i < DC_DONE_MEMORY; i++ )
+        {
+        if( dc->done_seq[i] == frame[2] && dc->done_type[i] == frame[0] )
+            {
+            /* The device answered a retransmitted copy as well */
+            dc->stats.late_replies++;
+            return;
+            }
+        }
+
+    if( dc->unsol_cb != NULL )
+        {
+        dc->unsol_cb(dc->unsol_ctx, DC_OK, frame[0], payload, plen);
+        }
+    else
+        {
+        dc->stats.unmatched++;
+        }
+    return;
+    }
+
+/* The device saw a damaged copy, send it again */
+if( frame[0] == PROTO_T_NAK && plen == 1
+ && (payload[0] == PROTO_NAK_CRC || payload[0] == PROTO_NAK_LEN)
+ && r->tries <= DC_RETRIES )
+    {
+    dc->stats.naks++;
+    if( queue_tx(dc, r) == 0 )
+        {
+        dc->stats.retransmits++;
+        }
+    else
+        {
+        r->deadline = 0;
+        }
+    return;
+    }
+
+r->deadline = now_ms() + DC_TIMEOUT_MS;
+r->last_type = frame[0];
+if( r->cb == NULL || r->cb(r->ctx, DC_OK, frame[0], payload, plen) != DC_MORE )
+    {
+    complete(dc, r, DC_OK);
+    }
+}
+
+
+/**************************************************
+    flush_tx
+        Write queued bytes until the port would
+        block.
+**************************************************/
+static int flush_tx
+    (
+    dc_client_type *dc
+    )
+{
+ssize_t n;
+
+while( dc->tx_len > 0 )
+    {
+    n = write(dc->fd, dc->tx, dc->tx_len);
+    if( n < 0 )
+        {
+        if( errno == EAGAIN || errno == EINTR )
+            {
+            return 0;
+            }
+        return -1;
+        }
+    memmove(dc->tx, &dc->tx[n], dc->tx_len - n);
+    dc->tx_len -= n;
+    }
+
+return 0;
+}
+
+
+/**************************************************
+    find_seq
+        Open request with a sequence number.
+**************************************************/
+static request_type *find_seq
+    (
+    dc_client_type *dc,
+    uint8_t         seq
+    )
+{
+int i;
+
+for( i = 0; i < DC_QUEUE_MAX; i++ )
+    {
+    if( dc->req[i].used && dc->req[i].seq == seq )
+        {
+        return &dc->req[i];
+        }
+    }
+
+return NULL;
+}
+
+
+/**************************************************
+    encode_frame
+        Build and COBS encode a frame with its
+        delimiter. Returns the encoded length.
+**************************************************/
+static int encode_frame
+    (
+    uint8_t    *enc,
+    uint8_t     type,
+    uint8_t     flags,
+    uint8_t     seq,
+    const void *payload,
+    int         len
+    )
+{
+uint8_t *f;
+uint16_t crc;
+int enc_len;
+
+f = &enc[1];
+f[0] = type;
+f[1] = flags;
+f[2] = seq;
+f[3] = (uint8_t)len;
+f[4] = (uint8_t)(len >> 8);
+f[5] = proto_crc8(f, 5);
+memcpy(&f[PROTO_HDR_SZ], payload, len);
+crc = proto_crc16(&f[PROTO_HDR_SZ], len);
+f[PROTO_HDR_SZ + len] = (uint8_t)crc;
+f[PROTO_HDR_SZ + len + 1] = (uint8_t)(crc >> 8);
+enc_len = cobs_encode(enc, PROTO_HDR_SZ + len + PROTO_CRC_SZ);
+enc[enc_len++] = 0;
+return enc_len;
+}
+
+
+/**************************************************
+    log_cb
+        Take the frames of one LOG_OPEN. The
+        request is ended early, to be opened
+        again, when a frame is missing.
+**************************************************/
+static int log_cb
+    (
+    void          *ctx,
+    int            status,
+    uint8_t        type,
+    const uint8_t *payload,
+    int            len
+    )
+{
+log_type *log;
+uint8_t credit[4];
+uint32_t offset;
+int skip;
+int n;
+
+log = ctx;
+if( status != DC_OK )
+    {
+    /* A stall; DC_ERR_CLOSED ends the readout */
+    if( status == DC_ERR_CLOSED )
+        {
+        log->error = status;
+        }
+    log->open = 0;
+    return DC_DONE;
+    }
+
+if( type == PROTO_T_LOG_DATA && len >= 4 )
+    {
+    offset = telem_get_u32(payload);
+    n = len - 4;
+    if( offset > log->next )
+        {
+        /* A frame is missing, open again from it */
+        log->open = 0;
+        return DC_DONE;
+        }
+
+    skip = (int)(log->next - offset);
+    if( skip < n )
+        {
+        if( log->cb(log->ctx, log->next, &payload[4 + skip], n - skip) < 0 )
+            {
+            log->error = DC_ERR_CLOSED;
+            log->open = 0;
+            return DC_DONE;
+            }
+        log->next += n - skip;
+        }
+
+    if( log->limit - log->next < DC_LOG_WINDOW / 2 )
+        {
+        log->limit = log->next + DC_LOG_WINDOW;
+        telem_put_u32(credit, log->limit);
+        dc_post(log->dc, PROTO_T_LOG_CREDIT, log->seq, credit, sizeof(credit));
+        }
+    return DC_MORE;
+    }
+
+if( type == PROTO_T_LOG_END && len == PROTO_LOG_END_SZ )
+    {
+    offset = telem_get_u32(&payload[1]);
+    if( payload[0] == PROTO_ST_OK && offset <= log->next )
+        {
+        log->finished = 1;
+        }
+    else if( payload[0] == PROTO_ST_GONE && offset > log->next )
+        {
+        /* Overwritten before it could be read */
+        log->dc->stats.log_skipped += offset - log->next;
+        log->next = offset;
+        }
+    log->open = 0;
+    return DC_DONE;
+    }
+
+if( type == PROTO_T_STATUS && len == 1 )
+    {
+    log->error = DC_ERR_DEVICE;
+    log->open = 0;
+    return DC_DONE;
+    }
+
+return DC_MORE;
+}
+
+
+/**************************************************
+    now_ms
+**************************************************/
+static int64_t now_ms
+    (
+    void
+    )
+{
+struct timespec ts;
+
+clock_gettime(CLOCK_MONOTONIC, &ts);
+return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/**************************************************
+    poll_once
+        Wait for the port or the next timeout, then
+        process.
+**************************************************/
+static int poll_once
+    (
+    dc_client_type *dc
+    )
+{
+struct pollfd pfd;
+
+pfd.fd = dc->fd;
+pfd.events = POLLIN | (dc->tx_len > 0 ? POLLOUT : 0);
+if( poll(&pfd, 1, dc_timeout(dc)) < 0 && errno != EINTR )
+    {
+    return DC_ERR_IO;
+    }
+return dc_process(dc);
+}
+
+
+/**************************************************
+    queue_tx
+        Put a request's frame in the transmit
+        buffer and start its reply timer. Fails
+        when the buffer is full; it is tried again
+        on the next dc_process().
+**************************************************/
+static int queue_tx
+    (
+    dc_client_type *dc,
+    request_type   *r
+    )
+{
+if( dc->tx_len + r->enc_len > TX_BUF_SZ )
+    {
+    return -1;
+    }
+
+memcpy(&dc->tx[dc->tx_len], r->enc, r->enc_len);
+dc->tx_len += r->enc_len;
+if( !r->sent )
+    {
+    r->sent = 1;
+    dc->in_flight++;
+    }
+r->tries++;
+r->deadline = now_ms() + DC_TIMEOUT_MS;
+dc->stats.tx_frames++;
+return 0;
+}
+
+
+/**************************************************
+    read_rx
+        Read until the port would block, splitting
+        frames at the delimiters.
+**************************************************/
+static int read_rx
+    (
+    dc_client_type *dc
+    )
+{
+uint8_t buf[512];
+ssize_t n;
+ssize_t i;
+int len;
+
+while( (n = read(dc->fd, buf, sizeof(buf))) > 0 )
+    {
+    for( i = 0; i < n; i++ )
+        {
+        if( buf[i] != 0 )
+            {
+            if( dc->rx_len < (int)sizeof(dc->rx) )
+                {
+                dc->rx[dc->rx_len] = buf[i];
+                }
+            dc->rx_len += (dc->rx_len <= (int)sizeof(dc->rx));
+            continue;
+            }
+
+        if( dc->rx_len > (int)sizeof(dc->rx) )
+            {
+            dc->stats.bad_frames++;
+            }
+        else if( dc->rx_len > 0 )
+            {
+            len = cobs_decode(dc->rx, dc->rx_len);
+            if( len < 0 )
+                {
+                dc->stats.bad_frames++;
+                }
+            else
+                {
+                deliver(dc, dc->rx, len);
+                }
+            }
+        dc->rx_len = 0;
+        }
+    }
+
+if( n < 0 && errno != EAGAIN && errno != EINTR )
+    {
+    return -1;
+    }
+return 0;
+}
+
+
+/**************************************************
+    send_pending
+        Send queued requests in submission order
+        while the window has room, then write.
+**************************************************/
+static void send_pending
+    (
+    dc_client_type *dc
+    )
+{
+request_type *next;
+int i;
+
+while( dc->in_flight < dc->window )
+    {
+    next = NULL;
+    for( i = 0; i < DC_QUEUE_MAX; i++ )
+        {
+        if( dc->req[i].used && !dc->req[i].sent
+         && (next == NULL || dc->req[i].order < next->order) )
+            {
+            next = &dc->req[i];
+            }
+        }
+
+    if( next == NULL || queue_tx(dc, next) < 0 )
+        {
+        break;
+        }
+    }
+
+flush_tx(dc);
+}
@@ -0,0 +1,125 @@
+#ifndef DEV_CLIENT_H
+#define DEV_CLIENT_H
+
+#include <stdint.h>
+
+#include "proto_wire.h"
+
+/**************************************************
+    Client for the device control protocol
+    (proto_wire.h) on a serial port.
+
+    Requests are queued with dc_submit() and sent
+    with their own sequence number, up to a window
+    of them outstanding at once; replies are
+    matched back by sequence number, so requests
+    are pipelined rather than answered one round
+    trip at a time. A request without a reply is
+    sent again after a timeout, and right away
+    when the device NAKs it as damaged, up to a
+    retry limit; the device recognizes the copy
+    (proto_wire.h). A late copy of the final reply
+    to a finished request is dropped.
+
+    dc_mem_read() streams long ranges as queued
+    reads and asks again only for the pieces lost
+    to damaged frames. dc_log_read() streams a log
+    under credit and resumes from the first
+    missing offset after a damaged frame or a
+    stall.
+
+    The device sends each frame on a logical
+    channel (proto_wire.h). dc_set_channel()
+    taps a channel's frames ahead of request
+    matching, to split the stream back out;
+    PROTO_T_CONSOLE frames never match a request
+    and go to the unsolicited handler.
+
+    Async use: add dc_fd() to an epoll set with
+    EPOLLIN | EPOLLOUT | EPOLLET (dc_epoll_add())
+    and call dc_process() when it is ready or
+    after dc_timeout() ms. Callbacks run from
+    dc_process(). The blocking calls run the same
+    loop on their own and may be mixed with it.
+**************************************************/
+
+/**************************************************
+    Defines
+**************************************************/
+#define DC_WINDOW       3       /* device receive slots (PROTO_RX_SLOTS) */
+#define DC_QUEUE_MAX    64      /* requests queued or outstanding */
+#define DC_TIMEOUT_MS   500     /* wait for a reply before retrying */
+#define DC_RETRIES      3
+#define DC_DONE_MEMORY  16      /* finished requests remembered for late replies */
+#define DC_GAPS_MAX     32      /* lost pieces of a dc_mem_read() retried */
+#define DC_LOG_WINDOW   2048    /* bytes of log credit granted ahead */
+
+/* Reply callback status */
+#define DC_OK           0       /* a frame arrived for the request */
+#define DC_ERR_TIMEOUT  -1      /* no reply after all retries */
+#define DC_ERR_CLOSED   -2      /* client closed with the request open */
+
+/* Reply callback result */
+#define DC_DONE         0       /* request finished */
+#define DC_MORE         1       /* more frames belong to the request */
+
+/* Other errors */
+#define DC_ERR_FULL     -3      /* DC_QUEUE_MAX requests already queued */
+#define DC_ERR_LEN      -4      /* payload too long */
+#define DC_ERR_IO       -5      /* port read or write failed */
+#define DC_ERR_DEVICE   -6      /* device refused, see the STATUS */
+#define DC_ERR_LOST     -7      /* more data lost than could be retried */
+
+/**************************************************
+    Types
+**************************************************/
+typedef struct dc_client dc_client_type;
+
+/* type, payload and len are only valid for DC_OK */
+typedef int (*dc_reply_cb_type)(void *ctx, int status, uint8_t type, const uint8_t *payload, int len);
+
+/* Log data in offset order, returns < 0 to stop the readout */
+typedef int (*dc_data_cb_type)(void *ctx, uint32_t offset, const uint8_t *data, int len);
+
+typedef struct
+    {
+    uint32_t tx_frames;
+    uint32_t rx_frames;
+    uint32_t retransmits;
+    uint32_t timeouts;
+    uint32_t naks;              /* NAKs that caused a retransmit */
+    uint32_t bad_frames;        /* COBS, length or CRC errors */
+    uint32_t unmatched;         /* no request and no unsolicited handler */
+    uint32_t late_replies;      /* copies of replies to finished requests */
+    uint32_t rereads;           /* dc_mem_read() pieces asked for again */
+    uint32_t log_resumes;       /* dc_log_read() streams reopened */
+    uint32_t log_skipped;       /* log bytes overwritten before they were read */
+    uint32_t ch_frames[PROTO_CH_CNT];   /* frames received by channel */
+    uint32_t ch_bytes[PROTO_CH_CNT];    /* payload bytes received by channel */
+    }dc_stats_type;
+
+/**************************************************
+    Prototypes
+**************************************************/
+dc_client_type *dc_open(const char *path);
+void dc_close(dc_client_type *dc);
+int dc_fd(dc_client_type *dc);
+int dc_epoll_add(dc_client_type *dc, int epfd);
+void dc_set_window(dc_client_type *dc, int window);
+void dc_set_unsolicited(dc_client_type *dc, dc_reply_cb_type cb, void *ctx);
+void dc_set_channel(dc_client_type *dc, int ch, dc_reply_cb_type cb, void *ctx);
+void dc_get_stats(dc_client_type *dc, dc_stats_type *stats);
+
+/* async */
+int dc_submit(dc_client_type *dc, uint8_t type, const void *payload, int len, dc_reply_cb_type cb, void *ctx);
+int dc_post(dc_client_type *dc, uint8_t type, uint8_t seq, const void *payload, int len);
+int dc_process(dc_client_type *dc);
+int dc_timeout(dc_client_type *dc);
+
+/* blocking */
+int dc_wait(dc_client_type *dc, int seq);
+int dc_call(dc_client_type *dc, uint8_t type, const void *payload, int len, uint8_t *reply_type, uint8_t *reply, int reply_max);
+int dc_mem_read(dc_client_type *dc, uint32_t addr, uint32_t len, int width, uint8_t *out);
+int64_t dc_log_read(dc_client_type *dc, int source, uint32_t addr, uint32_t len, uint32_t offset, dc_data_cb_type cb, void *ctx);
+
+#endif
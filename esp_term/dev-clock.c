@@ -0,0 +1,280 @@
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include "dev-clock.h"
+#include "telem_wire.h"
+
+/**************************************************
+    Prototypes
+**************************************************/
+static int exchange(dc_client_type *dc, dclk_sample_type *sample);
+static void fit(dclk_type *clk);
+
+/**************************************************
+    dclk_init
+**************************************************/
+void dclk_init
+    (
+    dclk_type *clk
+    )
+{
+memset(clk, 0, sizeof(*clk));
+}
+
+
+/**************************************************
+    dclk_round
+        Run one round of exchanges and refit.
+        Returns 0, or the DC_ERR_ code of the last
+        failed exchange when none got through.
+**************************************************/
+int dclk_round
+    (
+    dclk_type      *clk,
+    dc_client_type *dc,
+    int             exchanges
+    )
+{
+dclk_sample_type sample;
+dclk_sample_type best;
+int rc;
+int err;
+int i;
+
+err = DC_ERR_TIMEOUT;
+best.rtt_us = -1;
+for( i = 0; i < exchanges; i++ )
+    {
+    rc = exchange(dc, &sample);
+    if( rc < 0 )
+        {
+        err = rc;
+        continue;
+        }
+    if( best.rtt_us < 0 || sample.rtt_us < best.rtt_us )
+        {
+        best = sample;
+        }
+    }
+
+if( best.rtt_us < 0 )
+    {
+    return err;
+    }
+
+clk->hist[clk->next] = best;
+clk->next = (clk->next + 1) % DCLK_HISTORY;
+if( clk->cnt < DCLK_HISTORY )
+    {
+    clk->cnt++;
+    }
+clk->best_rtt_us = best.rtt_us;
+fit(clk);
+return 0;
+}
+
+
+/**************************************************
+    dclk_push
+        Send the fit to the device (TIME_SET).
+**************************************************/
+int dclk_push
+    (
+    const dclk_type *clk,
+    dc_client_type  *dc
+    )
+{
+uint8_t payload[PROTO_TIME_SET_SZ];
+uint8_t reply[1];
+uint8_t type;
+int rc;
+
+if( !clk->valid )
+    {
+    return DC_ERR_DEVICE;
+    }
+
+telem_put_u64(&payload[0], clk->ref_dev);
+telem_put_u64(&payload[8], clk->ref_host);
+telem_put_u32(&payload[16], (uint32_t)(int32_t)lround(clk->rate_ppb));
+telem_put_u32(&payload[20], (uint32_t)clk->error_us);
+rc = dc_call(dc, PROTO_T_TIME_SET, payload, sizeof(payload), &type, reply, sizeof(reply));
+if( rc < 0 )
+    {
+    return rc;
+    }
+return (type == PROTO_T_STATUS && rc == 1 && reply[0] == PROTO_ST_OK) ? 0 : DC_ERR_DEVICE;
+}
+
+
+/**************************************************
+    dclk_to_host
+        Convert a device time, as the device does
+        it (clksync.h).
+**************************************************/
+int64_t dclk_to_host
+    (
+    const dclk_type *clk,
+    int64_t          dev_us
+    )
+{
+int64_t d;
+
+d = dev_us - clk->ref_dev;
+return clk->ref_host + d + (int64_t)llround(d * clk->rate_ppb / 1e9);
+}
+
+
+/**************************************************
+    dclk_host_now
+**************************************************/
+int64_t dclk_host_now
+    (
+    void
+    )
+{
+struct timespec ts;
+
+clock_gettime(CLOCK_REALTIME, &ts);
+return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/**************************************************
+    exchange
+        One TIME_REQ. The request is padded to the
+        size of the reply so both directions take
+        as long on the wire.
+**************************************************/
+static int exchange
+    (
+    dc_client_type   *dc,
+    dclk_sample_type *sample
+    )
+{
+uint8_t payload[PROTO_TIME_SZ];
+uint8_t reply[PROTO_TIME_SZ];
+uint8_t type;
+int64_t t1;
+int64_t t2;
+int64_t t3;
+int64_t t4;
+int rc;
+
+memset(payload, 0, sizeof(payload));
+t1 = dclk_host_now();
+telem_put_u64(payload, t1);
+rc = dc_call(dc, PROTO_T_TIME_REQ, payload, sizeof(payload), &type, reply, sizeof(reply));
+t4 = dclk_host_now();
+if( rc < 0 )
+    {
+    return rc;
+    }
+
+/* A reply to a retransmitted copy has an older send time */
+if( type != PROTO_T_TIME_REPLY || rc != PROTO_TIME_SZ
+ || (int64_t)telem_get_u64(reply) != t1 )
+    {
+    return DC_ERR_DEVICE;
+    }
+
+t2 = telem_get_u64(&reply[8]);
+t3 = telem_get_u64(&reply[16]);
+sample->dev_us = t2 + (t3 - t2) / 2;
+sample->offset_us = ((t2 - t1) + (t3 - t4)) / 2;
+sample->rtt_us = (t4 - t1) - (t3 - t2);
+return 0;
+}
+
+
+/**************************************************
+    fit
+        Least squares line through the samples
+        with a round trip close to the best one.
+        Times are taken relative to the latest
+        sample to keep the doubles exact.
+**************************************************/
+static void fit
+    (
+    dclk_type *clk
+    )
+{
+const dclk_sample_type *last;
+const dclk_sample_type *s;
+int64_t best_rtt;
+int64_t limit;
+double x;
+double y;
+double sx;
+double sy;
+double sxx;
+double sxy;
+double span;
+double slope;
+double offset;
+double resid;
+double worst;
+int n;
+int i;
+
+last = &clk->hist[(clk->next + DCLK_HISTORY - 1) % DCLK_HISTORY];
+best_rtt = last->rtt_us;
+for( i = 0; i < clk->cnt; i++ )
+    {
+    if( clk->hist[i].rtt_us < best_rtt )
+        {
+        best_rtt = clk->hist[i].rtt_us;
+        }
+    }
+limit = best_rtt + best_rtt / 2 + DCLK_RTT_SLACK;
+
+n = 0;
+sx = sy = sxx = sxy = 0;
+span = 0;
+for( i = 0; i < clk->cnt; i++ )
+    {
+    s = &clk->hist[i];
+    if( s->rtt_us > limit )
+        {
+        continue;
+        }
+    x = (double)(s->dev_us - last->dev_us);
+    y = (double)(s->offset_us - last->offset_us);
+    sx += x;
+    sy += y;
+    sxx += x * x;
+    sxy += x * y;
+    span = (-x > span) ? -x : span;
+    n++;
+    }
+
+/* Under a second apart the rate is mostly noise */
+slope = 0;
+offset = 0;
+if( n >= 2 && span >= 1e6 )
+    {
+    slope = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+    offset = (sy - slope * sx) / n;
+    }
+
+worst = 0;
+for( i = 0; i < clk->cnt && n >= 2 && span >= 1e6; i++ )
+    {
+    s = &clk->hist[i];
+    if( s->rtt_us > limit )
+        {
+        continue;
+        }
+    x = (double)(s->dev_us - last->dev_us);
+    y = (double)(s->offset_us - last->offset_us);
+    resid = fabs(y - (offset + slope * x));
+    worst = (resid > worst) ? resid : worst;
+    }
+
+clk->ref_dev = last->dev_us;
+clk->ref_host = last->dev_us - (last->offset_us + (int64_t)llround(offset));
+clk->rate_ppb = -slope * 1e9;
+clk->error_us = (last->rtt_us + 1) / 2 + (int64_t)ceil(worst);
+clk->valid = 1;
+}
@@ -0,0 +1,69 @@
+#ifndef DEV_CLOCK_H
+#define DEV_CLOCK_H
+
+#include <stdint.h>
+
+#include "dev-client.h"
+
+/**************************************************
+    Host view of the device clock, NTP style
+    (proto_wire.h TIME_REQ).
+
+    A round is a number of exchanges, one at a
+    time; each gives the offset (device minus
+    host) at the midpoint of its round trip,
+    uncertain by up to half the round trip. The
+    exchange with the shortest round trip is kept,
+    the others waited in a queue somewhere. The
+    kept samples of recent rounds are fitted with
+    a line, offset against device time, to get the
+    rate; samples with a much longer round trip
+    than the best are left out of the fit. Rounds
+    spread over minutes give the rate, a single
+    round only the offset.
+
+    Host times are CLOCK_REALTIME in us, so they
+    line up with host logs; a step of the host
+    clock needs a fresh dclk_init().
+**************************************************/
+
+/**************************************************
+    Defines
+**************************************************/
+#define DCLK_HISTORY    16      /* rounds fitted */
+#define DCLK_EXCHANGES  8       /* default exchanges per round */
+#define DCLK_RTT_SLACK  100     /* us over 1.5 x the best round trip still fitted */
+
+/**************************************************
+    Types
+**************************************************/
+typedef struct
+    {
+    int64_t  dev_us;            /* device time, round trip midpoint */
+    int64_t  offset_us;         /* device minus host */
+    int64_t  rtt_us;            /* round trip less device time */
+    }dclk_sample_type;
+
+typedef struct
+    {
+    dclk_sample_type hist[DCLK_HISTORY];
+    int      cnt;
+    int      next;
+    int      valid;
+    int64_t  ref_dev;           /* device time of the latest round */
+    int64_t  ref_host;          /* host time at ref_dev */
+    double   rate_ppb;          /* host rate minus device rate */
+    int64_t  error_us;          /* bound on the conversion at ref_dev */
+    int64_t  best_rtt_us;       /* best round trip of the last round */
+    }dclk_type;
+
+/**************************************************
+    Prototypes
+**************************************************/
+void dclk_init(dclk_type *clk);
+int dclk_round(dclk_type *clk, dc_client_type *dc, int exchanges);
+int dclk_push(const dclk_type *clk, dc_client_type *dc);
+int64_t dclk_to_host(const dclk_type *clk, int64_t dev_us);
+int64_t dclk_host_now(void);
+
+#endif
@@ -0,0 +1,880 @@
+#include <elf.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "dev-client.h"
+#include "dev-clock.h"
+#include "telem_wire.h"
+
+/**************************************************
+    Defines
+**************************************************/
+#define DFLT_PORT       "/dev/ttyUSB0"
+#define SYM_NAME_SZ     64
+
+/**************************************************
+    Types
+**************************************************/
+typedef struct
+    {
+    char     name[SYM_NAME_SZ];
+    uint32_t addr;
+    uint32_t size;
+    }sym_type;
+
+/**************************************************
+    Prototypes
+**************************************************/
+int call_status(uint8_t type, const void *payload, int len);
+int cmd_dump(int argc, char *argv[]);
+int cmd_log(int argc, char *argv[]);
+int cmd_read(int argc, char *argv[]);
+int cmd_shell(int argc, char *argv[]);
+int cmd_watch(int argc, char *argv[]);
+int cmd_write(int argc, char *argv[]);
+int load_symbols(const char *path);
+int log_data_cb(void *ctx, uint32_t offset, const uint8_t *data, int len);
+int mem_read(uint32_t addr, uint32_t len, int width, uint8_t *out);
+int resolve(const char *arg, uint32_t *addr, uint32_t *size);
+int sync_clock(void);
+int run_line(const char *line);
+int shell_cb(void *ctx, int status, uint8_t type, const uint8_t *payload, int len);
+void stop(int sig);
+int watch_cb(void *ctx, int status, uint8_t type, const uint8_t *payload, int len);
+
+/**************************************************
+    Globals etc
+**************************************************/
+dc_client_type *dc;
+sym_type *syms;
+int       sym_cnt;
+int       watch_cnt;
+uint8_t   watch_width[PROTO_WATCH_MAX];
+int       synced;
+uint32_t  log_next;
+uint32_t  log_bytes;
+dclk_type clock_fit;
+volatile int done;
+
+/**************************************************
+    main
+        Read and write device memory and registers
+        over the USART1 control protocol. Addresses
+        can be given as symbols of the running
+        image's ELF file, optionally with an offset,
+        e.g. s_stats+4. With -s the device clock is
+        synchronized first and watch samples carry
+        host time (clksync.h).
+
+        usage: dev_mem [-d tty] [-e firmware.elf] [-s] cmd ...
+            read  <addr> [len] [width]
+            write <addr> <value> [width]
+            dump  <addr> <len> <file>
+            log   <file> [offset]
+            logmem <addr> <len> <file> [offset]
+            watch <period ms> <addr>[:width] ...
+            shell [command line]
+**************************************************/
+int main
+    (
+    int     argc,
+    char   *argv[]
+    )
+{
+int opt;
+const char *port;
+const char *elf;
+
+port = DFLT_PORT;
+elf = NULL;
+while( (opt = getopt(argc, argv, "+d:e:s")) != -1 )
+    {
+    switch( opt )
+        {
+        case 'd':
+            port = optarg;
+            break;
+        case 'e':
+            elf = optarg;
+            break;
+        case 's':
+            synced = 1;
+            break;
+        default:
+            optind = argc;
+            break;
+        }
+    }
+
+if( optind >= argc )
+    {
+    fprintf(stderr, "usage: %s [-d tty] [-e firmware.elf] [-s] read|write|dump|watch|shell ...\n", argv[0]);
+    return 1;
+    }
+
+if( elf != NULL && load_symbols(elf) < 0 )
+    {
+    return 1;
+    }
+
+dc = dc_open(port);
+if( dc == NULL )
+    {
+    perror(port);
+    return 1;
+    }
+
+if( synced && sync_clock() < 0 )
+    {
+    return 1;
+    }
+
+argc -= optind;
+argv += optind;
+if( strcmp(argv[0], "read") == 0 )
+    {
+    return cmd_read(argc, argv);
+    }
+if( strcmp(argv[0], "write") == 0 )
+    {
+    return cmd_write(argc, argv);
+    }
+if( strcmp(argv[0], "dump") == 0 )
+    {
+    return cmd_dump(argc, argv);
+    }
+if( strcmp(argv[0], "log") == 0 || strcmp(argv[0], "logmem") == 0 )
+    {
+    return cmd_log(argc, argv);
+    }
+if( strcmp(argv[0], "watch") == 0 )
+    {
+    return cmd_watch(argc, argv);
+    }
+if( strcmp(argv[0], "shell") == 0 )
+    {
+    return cmd_shell(argc, argv);
+    }
+
+fprintf(stderr, "unknown command %s\n", argv[0]);
+return 1;
+}
+
+
+/**************************************************
+    cmd_read
+        Print memory as hex words of the access
+        width. A symbol's size is the default length.
+**************************************************/
+int cmd_read
+    (
+    int   argc,
+    char *argv[]
+    )
+{
+uint32_t addr;
+uint32_t len;
+int width;
+uint8_t *buf;
+uint32_t i;
+uint32_t value;
+
+if( argc < 2 || resolve(argv[1], &addr, &len) < 0 )
+    {
+    fprintf(stderr, "read <addr> [len] [width]\n");
+    return 1;
+    }
+
+if( argc > 2 )
+    {
+    len = strtoul(argv[2], NULL, 0);
+    }
+width = (argc > 3) ? atoi(argv[3]) : 4;
+if( len == 0 )
+    {
+    len = width;
+    }
+
+buf = malloc(len);
+if( mem_read(addr, len, width, buf) < 0 )
+    {
+    free(buf);
+    return 1;
+    }
+
+for( i = 0; i < len; i += width )
+    {
+    if( i % 16 == 0 )
+        {
+        printf("%s%08x:", i ? "\n" : "", addr + i);
+        }
+    value = 0;
+    memcpy(&value, &buf[i], width);
+    printf(" %0*x", width * 2, value);
+    }
+printf("\n");
+
+free(buf);
+return 0;
+}
+
+
+/**************************************************
+    cmd_write
+**************************************************/
+int cmd_write
+    (
+    int   argc,
+    char *argv[]
+    )
+{
+uint32_t addr;
+uint32_t size;
+uint32_t value;
+int width;
+uint8_t payload[9];
+
+if( argc < 3 || resolve(argv[1], &addr, &size) < 0 )
+    {
+    fprintf(stderr, "write <addr> <value> [width]\n");
+    return 1;
+    }
+
+value = strtoul(argv[2], NULL, 0);
+width = (argc > 3) ? atoi(argv[3])
+      : (size == 1 || size == 2) ? (int)size : 4;
+
+telem_put_u32(payload, addr);
+payload[4] = width;
+memcpy(&payload[5], &value, width);
+return (call_status(PROTO_T_MEM_WRITE, payload, 5 + width) == PROTO_ST_OK) ? 0 : 1;
+}
+
+
+/**************************************************
+    cmd_dump
+        Save a memory range to a binary file.
+**************************************************/
+int cmd_dump
+    (
+    int   argc,
+    char *argv[]
+    )
+{
+uint32_t addr;
+uint32_t len;
+uint8_t *buf;
+FILE *f;
+int rc;
+
+if( argc < 4 || resolve(argv[1], &addr, &len) < 0 )
+    {
+    fprintf(stderr, "dump <addr> <len> <file>\n");
+    return 1;
+    }
+
+len = strtoul(argv[2], NULL, 0);
+buf = malloc(len);
+if( mem_read(addr, len, (addr % 4 || len % 4) ? 1 : 4, buf) < 0 )
+    {
+    free(buf);
+    return 1;
+    }
+
+rc = 1;
+f = fopen(argv[3], "wb");
+if( f == NULL )
+    {
+    perror(argv[3]);
+    }
+else
+    {
+    if( fwrite(buf, 1, len, f) == len )
+        {
+        rc = 0;
+        printf("%u bytes from %08x written to %s\n", len, addr, argv[3]);
+        }
+    fclose(f);
+    }
+
+free(buf);
+return rc;
+}
+
+
+/**************************************************
+    cmd_log
+        Read out the device log ring, or a memory
+        range such as a log kept in flash, into a
+        file. Given an offset the readout resumes
+        there and the file is appended to, e.g.
+        with the offset printed by a run that was
+        cut short.
+**************************************************/
+int cmd_log
+    (
+    int   argc,
+    char *argv[]
+    )
+{
+uint32_t addr;
+uint32_t len;
+uint32_t offset;
+int source;
+const char *path;
+FILE *f;
+int64_t end;
+struct timespec t0;
+struct timespec t1;
+double secs;
+dc_stats_type stats;
+
+source = PROTO_LOG_SRC_RING;
+addr = 0;
+len = 0;
+if( strcmp(argv[0], "logmem") == 0 )
+    {
+    if( argc < 4 || argc > 5 || resolve(argv[1], &addr, &len) < 0 )
+        {
+        fprintf(stderr, "logmem <addr> <len> <file> [offset]\n");
+        return 1;
+        }
+    source = PROTO_LOG_SRC_MEM;
+    len = strtoul(argv[2], NULL, 0);
+    argc -= 2;
+    argv += 2;
+    }
+else if( argc < 2 || argc > 3 )
+    {
+    fprintf(stderr, "log <file> [offset]\n");
+    return 1;
+    }
+
+path = argv[1];
+offset = (argc == 3) ? strtoul(argv[2], NULL, 0) : 0;
+f = fopen(path, (argc == 3) ? "ab" : "wb");
+if( f == NULL )
+    {
+    perror(path);
+    return 1;
+    }
+
+log_next = offset;
+clock_gettime(CLOCK_MONOTONIC, &t0);
+end = dc_log_read(dc, source, addr, len, offset, log_data_cb, f);
+clock_gettime(CLOCK_MONOTONIC, &t1);
+fclose(f);
+
+dc_get_stats(dc, &stats);
+if( end < 0 )
+    {
+    fprintf(stderr, "log readout failed: %d, resume with offset %u\n",
+            (int)end, log_next);
+    return 1;
+    }
+
+secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+printf("%u bytes to %s, up to offset %u, %.0f bytes/s, %u resumes, %u bytes overwritten\n",
+       log_bytes, path, (uint32_t)end, log_bytes / secs, stats.log_resumes,
+       stats.log_skipped);
+return 0;
+}
+
+
+/**************************************************
+    log_data_cb
+**************************************************/
+int log_data_cb
+    (
+    void          *ctx,
+    uint32_t       offset,
+    const uint8_t *data,
+    int            len
+    )
+{
+log_next = offset + len;
+log_bytes += len;
+return (fwrite(data, 1, len, ctx) == (size_t)len) ? 0 : -1;
+}
+
+
+/**************************************************
+    cmd_watch
+        Print watch samples until interrupted, one
+        line per sample. The device is told to stop
+        on exit.
+**************************************************/
+int cmd_watch
+    (
+    int   argc,
+    char *argv[]
+    )
+{
+uint8_t payload[PROTO_PAYLOAD_MAX];
+uint32_t addr;
+uint32_t size;
+int i;
+char *colon;
+struct pollfd pfd;
+
+if( argc < 3 || argc - 2 > PROTO_WATCH_MAX )
+    {
+    fprintf(stderr, "watch <period ms> <addr>[:width] ... (up to %d)\n", PROTO_WATCH_MAX);
+    return 1;
+    }
+
+telem_put_u16(payload, strtoul(argv[1], NULL, 0));
+watch_cnt = argc - 2;
+for( i = 0; i < watch_cnt; i++ )
+    {
+    colon = strchr(argv[2 + i], ':');
+    if( colon != NULL )
+        {
+        *colon = '\0';
+        }
+    if( resolve(argv[2 + i], &addr, &size) < 0 )
+        {
+        return 1;
+        }
+    watch_width[i] = (colon != NULL) ? (uint32_t)atoi(colon + 1)
+                   : (size == 1 || size == 2) ? size : 4;
+    telem_put_u32(&payload[2 + i * PROTO_WATCH_ENTRY_SZ], addr);
+    payload[2 + i * PROTO_WATCH_ENTRY_SZ + 4] = watch_width[i];
+    }
+
+dc_set_unsolicited(dc, watch_cb, NULL);
+if( call_status(PROTO_T_WATCH, payload, 2 + watch_cnt * PROTO_WATCH_ENTRY_SZ) != PROTO_ST_OK )
+    {
+    return 1;
+    }
+
+signal(SIGINT, stop);
+pfd.fd = dc_fd(dc);
+pfd.events = POLLIN;
+while( !done )
+    {
+    poll(&pfd, 1, -1);
+    if( dc_process(dc) < 0 )
+        {
+        return 1;
+        }
+    }
+
+telem_put_u16(payload, 0);
+call_status(PROTO_T_WATCH, payload, 2);
+return 0;
+}
+
+
+/**************************************************
+    watch_cb
+        Print the samples of a WATCH_DATA frame.
+**************************************************/
+int watch_cb
+    (
+    void          *ctx,
+    int            status,
+    uint8_t        type,
+    const uint8_t *payload,
+    int            len
+    )
+{
+static uint32_t drops;
+uint32_t value;
+int64_t ms;
+int64_t host;
+int n;
+int i;
+int j;
+const uint8_t *p;
+
+(void)ctx;
+if( status != DC_OK || type != PROTO_T_WATCH_DATA || len < PROTO_WATCH_HDR_SZ )
+    {
+    return DC_DONE;
+    }
+
+if( telem_get_u16(payload) != drops )
+    {
+    drops = telem_get_u16(payload);
+    printf("# %u samples dropped on the device\n", drops);
+    }
+
+n = payload[2];
+p = &payload[PROTO_WATCH_HDR_SZ];
+for( i = 0; i < n; i++ )
+    {
+    if( synced )
+        {
+        /* Samples carry the low 32 bits of the ms tick count */
+        ms = (clock_fit.ref_dev / 1000 & ~(int64_t)0xFFFFFFFF) | telem_get_u32(p);
+        if( ms > clock_fit.ref_dev / 1000 + 0x80000000LL )
+            {
+            ms -= 0x100000000LL;
+            }
+        host = dclk_to_host(&clock_fit, ms * 1000);
+        printf("%lld.%06lld", (long long)(host / 1000000), (long long)(host % 1000000));
+        }
+    else
+        {
+        printf("%10u", telem_get_u32(p));
+        }
+    p += 4;
+    for( j = 0; j < watch_cnt; j++ )
+        {
+        value = 0;
+        memcpy(&value, p, watch_width[j]);
+        printf(" %0*x", watch_width[j] * 2, value);
+        p += watch_width[j];
+        }
+    printf("\n");
+    }
+fflush(stdout);
+
+return DC_DONE;
+}
+
+
+/**************************************************
+    cmd_shell
+        Run one device shell command given on the
+        command line, or read commands from stdin.
+**************************************************/
+int cmd_shell
+    (
+    int   argc,
+    char *argv[]
+    )
+{
+char line[PROTO_PAYLOAD_MAX];
+int len;
+int i;
+
+if( argc > 1 )
+    {
+    len = 0;
+    for( i = 1; i < argc && len < (int)sizeof(line); i++ )
+        {
+        len += snprintf(&line[len], sizeof(line) - len, "%s%s", i > 1 ? " " : "", argv[i]);
+        }
+    return (run_line(line) == PROTO_ST_OK) ? 0 : 1;
+    }
+
+while( printf("> "), fflush(stdout), fgets(line, sizeof(line), stdin) != NULL )
+    {
+    line[strcspn(line, "\r\n")] = '\0';
+    run_line(line);
+    }
+printf("\n");
+
+return 0;
+}
+
+
+/**************************************************
+    run_line
+        Send a shell line and print its output up
+        to the STATUS that ends it. Output keeps
+        coming while a command runs, so the timeout
+        only applies between frames.
+**************************************************/
+int run_line
+    (
+    const char *line
+    )
+{
+int status;
+int seq;
+
+status = -1;
+seq = dc_submit(dc, PROTO_T_SHELL, line, strlen(line), shell_cb, &status);
+if( seq < 0 || dc_wait(dc, seq) < 0 )
+    {
+    return -1;
+    }
+
+if( status == PROTO_ST_BUSY )
+    {
+    printf("busy\n");
+    }
+return status;
+}
+
+
+/**************************************************
+    shell_cb
+**************************************************/
+int shell_cb
+    (
+    void          *ctx,
+    int            status,
+    uint8_t        type,
+    const uint8_t *payload,
+    int            len
+    )
+{
+if( status != DC_OK )
+    {
+    fprintf(stderr, "no reply\n");
+    return DC_DONE;
+    }
+
+if( type == PROTO_T_SHELL_OUT )
+    {
+    fwrite(payload, 1, len, stdout);
+    fflush(stdout);
+    return DC_MORE;
+    }
+
+if( type == PROTO_T_STATUS && len == 1 )
+    {
+    *(int *)ctx = payload[0];
+    }
+return DC_DONE;
+}
+
+
+/**************************************************
+    mem_read
+**************************************************/
+int mem_read
+    (
+    uint32_t addr,
+    uint32_t len,
+    int      width,
+    uint8_t *out
+    )
+{
+int rc;
+
+rc = dc_mem_read(dc, addr, len, width, out);
+if( rc < 0 )
+    {
+    fprintf(stderr, "read failed (%d)\n", rc);
+    return -1;
+    }
+return 0;
+}
+
+
+/**************************************************
+    call_status
+        Send a request answered by a STATUS, print
+        and return the status.
+**************************************************/
+int call_status
+    (
+    uint8_t     type,
+    const void *payload,
+    int         len
+    )
+{
+uint8_t reply[PROTO_PAYLOAD_MAX];
+uint8_t reply_type;
+int n;
+
+n = dc_call(dc, type, payload, len, &reply_type, reply, sizeof(reply));
+if( n != 1 || reply_type != PROTO_T_STATUS )
+    {
+    fprintf(stderr, "no reply\n");
+    return -1;
+    }
+
+if( reply[0] != PROTO_ST_OK )
+    {
+    fprintf(stderr, "device status %u\n", reply[0]);
+    }
+return reply[0];
+}
+
+
+/**************************************************
+    resolve
+        Turn a number, symbol or symbol+offset into
+        an address. size is the symbol's size, 0 for
+        plain numbers.
+**************************************************/
+int resolve
+    (
+    const char *arg,
+    uint32_t   *addr,
+    uint32_t   *size
+    )
+{
+char name[SYM_NAME_SZ];
+const char *plus;
+char *end;
+uint32_t offset;
+int i;
+
+*addr = strtoul(arg, &end, 0);
+*size = 0;
+if( end != arg && *end == '\0' )
+    {
+    return 0;
+    }
+
+plus = strchr(arg, '+');
+offset = (plus != NULL) ? strtoul(plus + 1, NULL, 0) : 0;
+snprintf(name, sizeof(name), "%.*s", plus ? (int)(plus - arg) : (int)strlen(arg), arg);
+
+for( i = 0; i < sym_cnt; i++ )
+    {
+    if( strcmp(syms[i].name, name) == 0 )
+        {
+        *addr = syms[i].addr + offset;
+        *size = (offset < syms[i].size) ? syms[i].size - offset : 0;
+        return 0;
+        }
+    }
+
+fprintf(stderr, "unknown symbol %s%s\n", name, sym_cnt ? "" : " (no -e file)");
+return -1;
+}
+
+
+/**************************************************
+    load_symbols
+        Collect the object and function symbols of
+        an ELF32 image.
+**************************************************/
+int load_symbols
+    (
+    const char *path
+    )
+{
+FILE *f;
+long len;
+uint8_t *img;
+const Elf32_Ehdr *eh;
+const Elf32_Shdr *sh;
+const Elf32_Sym *sym;
+const char *strtab;
+int i;
+uint32_t j;
+uint32_t cnt;
+
+f = fopen(path, "rb");
+if( f == NULL )
+    {
+    perror(path);
+    return -1;
+    }
+
+fseek(f, 0, SEEK_END);
+len = ftell(f);
+fseek(f, 0, SEEK_SET);
+img = malloc(len);
+if( fread(img, 1, len, f) != (size_t)len )
+    {
+    perror(path);
+    fclose(f);
+    free(img);
+    return -1;
+    }
+fclose(f);
+
+eh = (const Elf32_Ehdr *)img;
+if( len < (long)sizeof(*eh) || memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0
+ || eh->e_ident[EI_CLASS] != ELFCLASS32
+ || eh->e_shoff + (long)eh->e_shnum * sizeof(*sh) > (unsigned long)len )
+    {
+    fprintf(stderr, "%s: not an ELF32 file\n", path);
+    free(img);
+    return -1;
+    }
+
+sh = (const Elf32_Shdr *)&img[eh->e_shoff];
+for( i = 0; i < eh->e_shnum; i++ )
+    {
+    if( sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum )
+        {
+        continue;
+        }
+
+    sym = (const Elf32_Sym *)&img[sh[i].sh_offset];
+    strtab = (const char *)&img[sh[sh[i].sh_link].sh_offset];
+    cnt = sh[i].sh_size / sizeof(*sym);
+    syms = realloc(syms, (sym_cnt + cnt) * sizeof(*syms));
+    for( j = 0; j < cnt; j++ )
+        {
+        if( ELF32_ST_TYPE(sym[j].st_info) != STT_OBJECT
+         && ELF32_ST_TYPE(sym[j].st_info) != STT_FUNC )
+            {
+            continue;
+            }
+        snprintf(syms[sym_cnt].name, SYM_NAME_SZ, "%s", &strtab[sym[j].st_name]);
+        syms[sym_cnt].addr = sym[j].st_value;
+        if( ELF32_ST_TYPE(sym[j].st_info) == STT_FUNC )
+            {
+            syms[sym_cnt].addr &= ~1;   /* Thumb bit */
+            }
+        syms[sym_cnt].size = sym[j].st_size;
+        sym_cnt++;
+        }
+    }
+
+free(img);
+if( sym_cnt == 0 )
+    {
+    fprintf(stderr, "%s: no symbols\n", path);
+    return -1;
+    }
+
+return 0;
+}
+
+
+/**************************************************
+    stop
+**************************************************/
+void stop
+    (
+    int sig
+    )
+{
+(void)sig;
+done = 1;
+}
+
+
+/**************************************************
+    sync_clock
+        Two rounds of clock exchanges a second
+        apart, so the fit has a rate to go on,
+        then send it to the device.
+**************************************************/
+int sync_clock
+    (
+    void
+    )
+{
+int rc;
+
+dclk_init(&clock_fit);
+rc = dclk_round(&clock_fit, dc, DCLK_EXCHANGES);
+if( rc == 0 )
+    {
+    sleep(1);
+    rc = dclk_round(&clock_fit, dc, DCLK_EXCHANGES);
+    }
+if( rc == 0 )
+    {
+    rc = dclk_push(&clock_fit, dc);
+    }
+if( rc < 0 )
+    {
+    fprintf(stderr, "clock sync failed: %d\n", rc);
+    return -1;
+    }
+
+fprintf(stderr, "# clock synchronized, +-%lld us, rate %.0f ppb\n",
+        (long long)clock_fit.error_us, clock_fit.rate_ppb);
+return 0;
+}
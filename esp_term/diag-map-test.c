@@ -0,0 +1,73 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "diag_map.h"
+
+/**************************************************
+    Types
+**************************************************/
+typedef struct
+{
+    uint32_t    addr;
+    uint32_t    len;
+    bool        write;
+    bool        ok;
+} access_type;
+
+/**************************************************
+    Globals etc
+**************************************************/
+const access_type accesses[] =
+{
+    { 0x08000000, 4,          false, true  },   /* flash start */
+    { 0x0801FFFC, 4,          false, true  },   /* flash end */
+    { 0x0801FFFE, 4,          false, false },   /* across the end */
+    { 0x08000000, 4,          true,  false },   /* flash is read only */
+    { 0x08030000, 4,          false, false },   /* past the flash */
+    { 0x08030000, 0,          false, false },
+    { 0x20001FFC, 4,          true,  true  },   /* SRAM end */
+    { 0x20002000, 1,          false, false },   /* past the SRAM */
+    { 0x30000000, 4,          true,  false },   /* past the SRAM, far */
+    { 0x40000BFC, 4,          true,  true  },   /* TIM4 */
+    { 0x40000C00, 4,          true,  false },   /* gap after TIM4 */
+    { 0x40000C00, 4,          false, false },
+    { 0x40007C00, 4,          false, false },   /* gap after DAC, CEC */
+    { 0x40023400, 4,          false, false },   /* past the CRC */
+    { 0xE00FFFFC, 4,          false, true  },   /* ROM table end */
+    { 0xE0100000, 4,          false, false },   /* past the ROM table */
+    { 0xFFFFFFFC, 8,          false, false },   /* wraps the address */
+    { 0x20000000, 0xFFFFFFFF, false, false },   /* wraps the length */
+};
+
+/**************************************************
+    main
+        Check the diagnostics memory map (src/
+        diag_map.c) against accesses inside, across
+        and past its regions. Exits non-zero when an
+        access is judged wrongly, so the build fails.
+**************************************************/
+int main(void)
+{
+unsigned i;
+int failed;
+
+failed = 0;
+for( i = 0; i < sizeof(accesses) / sizeof(accesses[0]); i++ )
+    {
+    if( diag_map_check(accesses[i].addr, accesses[i].len, accesses[i].write) != accesses[i].ok )
+        {
+        printf("%s of %u at 0x%08X: %s, expected %s\n",
+               accesses[i].write ? "write" : "read", accesses[i].len,
+               accesses[i].addr, accesses[i].ok ? "rejected" : "allowed",
+               accesses[i].ok ? "allowed" : "rejected");
+        failed = 1;
+        }
+    }
+
+if( !failed )
+    {
+    printf("diag_map_test: ok\n");
+    }
+return failed;
+}
@@ -10,6 +10,8 @@
 #include <errno.h>
 
 #include "esp-at.h"
+#include "dev-client.h"
+#include "dev-clock.h"
 
 /**************************************************
     Defines
@@ -38,6 +40,16 @@ void close_port(void *in);
 void port_input(void *in);
 void reset(void *in);
 void mode_inquiry(void *in);
+void dev_open(void *in);
+void dev_ping(void *in);
+void dev_shell(void *in);
+void dev_stats(void *in);
+void dev_sync(void *in);
+void dev_demux(void *in);
+int console_cb(void *ctx, int status, uint8_t type, const uint8_t *payload, int len);
+int demux_cb(void *ctx, int status, uint8_t type, const uint8_t *payload, int len);
+int ping_cb(void *ctx, int status, uint8_t type, const uint8_t *payload, int len);
+int shell_cb(void *ctx, int status, uint8_t type, const uint8_t *payload, int len);
 
 /**************************************************
     Globals etc
@@ -46,6 +58,11 @@ fd_set fds;
 fd_set fds_new;
 int    maxfd;
 int    check_port;
+dc_client_type *dev;
+dclk_type dev_clock;
+int    ping_left;
+struct timeval ping_start;
+FILE  *demux_file[PROTO_CH_CNT];
 volatile int done;
 cmd_list_type cmd_list[] =
 {
@@ -56,6 +73,12 @@ cmd_list_type cmd_list[] =
 { "Send AT cmd", AT },
 { "Send reset cmd", reset },
 { "Mode Inquiry", mode_inquiry },
+{ "Open device <tty>", dev_open },
+{ "Device ping <count>", dev_ping },
+{ "Device shell <cmd>", dev_shell },
+{ "Device stats", dev_stats },
+{ "Device clock sync <exchanges>", dev_sync },
+{ "Device demux <channel> [file]", dev_demux },
 { "Exit", done_cmd }
 };
 
@@ -70,15 +93,13 @@ cmd_list_type cmd_list[] =
 **************************************************/
 
 int main
-    ( 
-    void   *argv, 
-    int     argn 
+    (
+    void
     )
 {
-int in;
-char line[512];
-size_t ln_size;
 struct timeval tv;
+int nfds;
+int ms;
 
 
 done = 0;
@@ -100,16 +121,36 @@ while( !done )
     /* Use the select as delay in reading the port */
     tv.tv_usec = 0;
     tv.tv_sec = 1;
-    select(maxfd, &fds_new, NULL, NULL, &tv);
+    nfds = maxfd;
+    if( dev != NULL )
+        {
+        /* Device replies and retries are handled here */
+        FD_SET(dc_fd(dev), &fds_new);
+        nfds = (dc_fd(dev) >= nfds) ? dc_fd(dev) + 1 : nfds;
+        ms = dc_timeout(dev);
+        if( ms >= 0 && ms < 1000 )
+            {
+            tv.tv_sec = 0;
+            tv.tv_usec = ms * 1000;
+            }
+        }
+    select(nfds, &fds_new, NULL, NULL, &tv);
     if(FD_ISSET(STDIN_FILENO, &fds_new))
         {
         user_input(NULL);
         }
+    if( dev != NULL && dc_process(dev) < 0 )
+        {
+        printf("Device port error\n");
+        dc_close(dev);
+        dev = NULL;
+        }
     if( check_port != -1 )
         {
         port_input(NULL);
         }
     }
+return 0;
 }
 
 
@@ -121,17 +162,23 @@ void user_input
     void *in
     )
 {
-int i, read_num;
+int i;
 char input[BUF_SIZE];
 char *endptr;
+char *num;
 
+(void)in;
 memset( input, 0, BUF_SIZE );
-read_num = read( 0, input, BUF_SIZE);
-i = strtol(strtok( input, " "), &endptr, 10);
+if( read( 0, input, BUF_SIZE - 1 ) <= 0
+ || (num = strtok( input, " " )) == NULL )
+    {
+    return;
+    }
+i = strtol(num, &endptr, 10);
 // printf("Input Num: %d\n", i);
-if( endptr != input
+if( endptr != num
  && i >= 0 
- && i < cnt_of_array(cmd_list) )
+ && i < (int)cnt_of_array(cmd_list) )
     {
     printf("CMD(%s): ", cmd_list[i].info);
     cmd_list[i].cmd((void*)input);
@@ -150,6 +197,7 @@ char *port_in;
 char p[] = "/dev/ttyUSB0";
 struct termios options;
 
+(void)in;
 port_in = p;
 errno = 0;
 check_port = open(port_in, O_RDWR | O_NOCTTY | O_NONBLOCK);
@@ -201,6 +249,7 @@ void close_port
     void *in
     )
 {
+(void)in;
 if( check_port != -1 )
     {
     printf("Closing port\n");
@@ -226,6 +275,7 @@ int read_num;
 char input[BUF_SIZE];
 int cnt;
 
+(void)in;
 cnt = 1;
 memset( input, 0, BUF_SIZE );
 errno = 0;
@@ -253,6 +303,7 @@ void done_cmd
     void *in
     )
 {
+(void)in;
 printf("Sending exit\n");
 close_port(NULL);
 done = 1;
@@ -267,8 +318,9 @@ void help
     )
 {
 int i;
+(void)in;
 printf("--- Help Info ---\n");
-for( i = 0; i < cnt_of_array(cmd_list); i++ )
+for( i = 0; i < (int)cnt_of_array(cmd_list); i++ )
     {
     printf("%d - %s\n", i, cmd_list[i].info);
     }
@@ -284,6 +336,7 @@ void AT
 {
 int i;
 char buf[BUF_SIZE];
+(void)in;
 i = 0;
 memcpy( &buf[i], "AT", sizeof("AT"));
 i += sizeof("AT");
@@ -308,6 +361,7 @@ char buf[BUF_SIZE];
 // "AT+RST" + 0x0D 0x0A
 unsigned char cmd[] = { 0x41, 0x54, 0x2B, 0x52, 0x53, 0x54, 0x0D, 0x0A };
 
+(void)in;
 i = 0;
 memcpy( &buf[i], RST, sizeof(RST));
 i += sizeof(RST);
@@ -329,16 +383,368 @@ void mode_inquiry
     void *in
     )
 {
-int i;
-char buf[BUF_SIZE];
-
 // "AT+CWMODE?" + 0x0D 0x0A
 unsigned char cmd[] = { 0x41, 0x54, 0x2B, 0x43, 0x57, 0x4D, 0x4F, 0x44, 0x45, 0x3F, 0x0D, 0x0A }; 
 
+(void)in;
 printf("mode_inquiry\n");
 write( check_port, cmd, sizeof(cmd));
 
 }
 
 
+/**************************************************
+   dev_open
+        Open the device's control protocol port
+        (USART1), separate from the ESP8266 port.
+**************************************************/
+void dev_open
+    (
+    void *in
+    )
+{
+char *path;
+int i;
+
+(void)in;
+path = strtok(NULL, " \r\n");
+if( path == NULL )
+    {
+    path = "/dev/ttyUSB1";
+    }
+
+if( dev != NULL )
+    {
+    dc_close(dev);
+    }
+
+dev = dc_open(path);
+dclk_init(&dev_clock);
+if( dev != NULL )
+    {
+    dc_set_unsolicited(dev, console_cb, NULL);
+    for( i = 0; i < PROTO_CH_CNT; i++ )
+        {
+        if( demux_file[i] != NULL )
+            {
+            dc_set_channel(dev, i, demux_cb, demux_file[i]);
+            }
+        }
+    }
+printf("%s %s\n", dev ? "Opened device" : "Problem opening device", path);
+}
+
+
+/**************************************************
+   dev_ping
+        Pipeline a number of pings and report the
+        round trip rate once all are answered.
+**************************************************/
+void dev_ping
+    (
+    void *in
+    )
+{
+char *arg;
+uint8_t payload[64];
+int cnt;
+int i;
+
+(void)in;
+if( dev == NULL || ping_left > 0 )
+    {
+    printf("Device not open or ping running\n");
+    return;
+    }
+
+arg = strtok(NULL, " \r\n");
+cnt = (arg != NULL) ? atoi(arg) : 1;
+if( cnt < 1 || cnt > DC_QUEUE_MAX )
+    {
+    cnt = DC_QUEUE_MAX;
+    }
+
+memset(payload, 0x55, sizeof(payload));
+gettimeofday(&ping_start, NULL);
+ping_left = cnt;
+for( i = 0; i < cnt; i++ )
+    {
+    dc_submit(dev, PROTO_T_PING, payload, sizeof(payload), ping_cb, NULL);
+    }
+printf("%d pings queued\n", cnt);
+}
+
+
+/**************************************************
+   ping_cb
+**************************************************/
+int ping_cb
+    (
+    void          *ctx,
+    int            status,
+    uint8_t        type,
+    const uint8_t *payload,
+    int            len
+    )
+{
+struct timeval now;
+double secs;
+
+(void)ctx;
+(void)payload;
+(void)len;
+if( status != DC_OK || type != PROTO_T_PONG )
+    {
+    printf("ping failed: %d\n", status);
+    }
+
+if( --ping_left == 0 )
+    {
+    gettimeofday(&now, NULL);
+    secs = (now.tv_sec - ping_start.tv_sec) + (now.tv_usec - ping_start.tv_usec) / 1e6;
+    printf("pings done in %.3f s\n", secs);
+    }
+return DC_DONE;
+}
+
+
+/**************************************************
+   dev_shell
+        Run a device shell command, its output is
+        printed as it arrives.
+**************************************************/
+void dev_shell
+    (
+    void *in
+    )
+{
+char *line;
+
+(void)in;
+if( dev == NULL )
+    {
+    printf("Device not open\n");
+    return;
+    }
+
+line = strtok(NULL, "\r\n");
+if( line == NULL )
+    {
+    line = "help";
+    }
+
+printf("\n");
+dc_submit(dev, PROTO_T_SHELL, line, strlen(line), shell_cb, NULL);
+}
+
+
+/**************************************************
+   shell_cb
+**************************************************/
+int shell_cb
+    (
+    void          *ctx,
+    int            status,
+    uint8_t        type,
+    const uint8_t *payload,
+    int            len
+    )
+{
+(void)ctx;
+if( status != DC_OK )
+    {
+    printf("shell: no reply\n");
+    return DC_DONE;
+    }
+
+if( type == PROTO_T_SHELL_OUT )
+    {
+    fwrite(payload, 1, len, stdout);
+    fflush(stdout);
+    return DC_MORE;
+    }
+
+if( type == PROTO_T_STATUS && len == 1 && payload[0] != PROTO_ST_OK )
+    {
+    printf("shell status %u\n", payload[0]);
+    }
+return DC_DONE;
+}
+
+
+/**************************************************
+   dev_stats
+**************************************************/
+void dev_stats
+    (
+    void *in
+    )
+{
+dc_stats_type stats;
+int i;
+
+(void)in;
+if( dev == NULL )
+    {
+    printf("Device not open\n");
+    return;
+    }
+
+dc_get_stats(dev, &stats);
+printf("tx %u rx %u retransmits %u timeouts %u naks %u bad %u unmatched %u\n",
+       stats.tx_frames, stats.rx_frames, stats.retransmits, stats.timeouts,
+       stats.naks, stats.bad_frames, stats.unmatched);
+for( i = 0; i < PROTO_CH_CNT; i++ )
+    {
+    printf("channel %d: %u frames %u bytes%s\n", i, stats.ch_frames[i],
+           stats.ch_bytes[i], (demux_file[i] != NULL) ? ", demuxed" : "");
+    }
+}
+
+
+/**************************************************
+   dev_sync
+        Run a clock sync round and send the result
+        to the device. Rounds a while apart refine
+        the rate.
+**************************************************/
+void dev_sync
+    (
+    void *in
+    )
+{
+char *arg;
+int exchanges;
+int rc;
+int64_t host;
+
+(void)in;
+if( dev == NULL )
+    {
+    printf("Device not open\n");
+    return;
+    }
+
+arg = strtok(NULL, " \r\n");
+exchanges = (arg != NULL) ? atoi(arg) : DCLK_EXCHANGES;
+if( exchanges < 1 )
+    {
+    printf("Bad exchange count\n");
+    return;
+    }
+
+rc = dclk_round(&dev_clock, dev, exchanges);
+if( rc == 0 )
+    {
+    rc = dclk_push(&dev_clock, dev);
+    }
+if( rc < 0 )
+    {
+    printf("sync failed: %d\n", rc);
+    return;
+    }
+
+host = dclk_to_host(&dev_clock, dev_clock.ref_dev);
+printf("device %lld.%06lld s = host %lld.%06lld s, +-%lld us, rate %.1f ppb, rtt %lld us\n",
+       (long long)(dev_clock.ref_dev / 1000000), (long long)(dev_clock.ref_dev % 1000000),
+       (long long)(host / 1000000), (long long)(host % 1000000),
+       (long long)dev_clock.error_us, dev_clock.rate_ppb,
+       (long long)dev_clock.best_rtt_us);
+}
+
+
+/**************************************************
+   dev_demux
+        Split a channel out of the device's stream:
+        the payload of each frame on it is appended
+        to a file, console text instead of being
+        printed. Without a file the channel is no
+        longer split out.
+**************************************************/
+void dev_demux
+    (
+    void *in
+    )
+{
+char *arg;
+char *path;
+int ch;
+
+(void)in;
+arg = strtok(NULL, " \r\n");
+path = strtok(NULL, " \r\n");
+ch = (arg != NULL) ? atoi(arg) : -1;
+if( ch < 0 || ch >= PROTO_CH_CNT )
+    {
+    printf("Channel 0..%d: control, console, log, bulk\n", PROTO_CH_CNT - 1);
+    return;
+    }
 
+if( demux_file[ch] != NULL )
+    {
+    fclose(demux_file[ch]);
+    demux_file[ch] = NULL;
+    }
+
+if( path != NULL )
+    {
+    demux_file[ch] = fopen(path, "ab");
+    if( demux_file[ch] == NULL )
+        {
+        printf("Problem opening %s: %s\n", path, strerror(errno));
+        }
+    }
+
+if( dev != NULL )
+    {
+    dc_set_channel(dev, ch, (demux_file[ch] != NULL) ? demux_cb : NULL, demux_file[ch]);
+    }
+printf("Channel %d %s%s\n", ch, (demux_file[ch] != NULL) ? "to " : "not split out",
+       (demux_file[ch] != NULL) ? path : "");
+}
+
+
+/**************************************************
+   console_cb
+        Unsolicited frames: print the device's
+        console text.
+**************************************************/
+int console_cb
+    (
+    void          *ctx,
+    int            status,
+    uint8_t        type,
+    const uint8_t *payload,
+    int            len
+    )
+{
+(void)ctx;
+if( status == DC_OK && type == PROTO_T_CONSOLE )
+    {
+    fwrite(payload, 1, len, stdout);
+    fflush(stdout);
+    }
+return DC_DONE;
+}
+
+
+/**************************************************
+   demux_cb
+        Channel tap: append the payload to the
+        channel's file. Replies still go on to
+        their requests.
+**************************************************/
+int demux_cb
+    (
+    void          *ctx,
+    int            status,
+    uint8_t        type,
+    const uint8_t *payload,
+    int            len
+    )
+{
+(void)status;
+fwrite(payload, 1, len, (FILE *)ctx);
+fflush((FILE *)ctx);
+return (type == PROTO_T_CONSOLE) ? DC_DONE : DC_MORE;
+}
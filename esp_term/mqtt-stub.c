@@ -0,0 +1,525 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/**************************************************
+    Defines
+**************************************************/
+#define DFLT_PORT       1883
+#define MAX_CLIENTS     8
+#define MAX_SUBS        8           /* filters per client */
+#define FILTER_MAX      64
+#define BUF_SZ          4096        /* unparsed bytes per client */
+
+/**************************************************
+    Types
+**************************************************/
+typedef struct
+    {
+    int      sock;                  /* -1 if the slot is free */
+    char     id[24];
+    char     filters[MAX_SUBS][FILTER_MAX + 1];
+    int      filter_cnt;
+    uint8_t  buf[BUF_SZ];
+    int      used;
+    uint32_t reads;                 /* TCP reads */
+    uint32_t publishes;             /* PUBLISH packets received */
+    }client_type;
+
+/**************************************************
+    Prototypes
+**************************************************/
+void drop_client(client_type *cli);
+int handle_packet(client_type *cli, uint8_t type, const uint8_t *body, uint32_t len);
+void route(const client_type *from, const uint8_t *body, uint32_t len, int qos);
+int send_all(int sock, const void *buf, uint32_t len);
+void stop(int sig);
+int topic_match(const char *filter, const char *topic, int len);
+
+/**************************************************
+    Globals etc
+**************************************************/
+client_type clients[MAX_CLIENTS];
+int    no_puback;
+int    verbose;
+volatile int done;
+
+/**************************************************
+    main
+        Stand-in MQTT 3.1.1 broker for trying the
+        device client without Mosquitto: accepts
+        every CONNECT, grants subscriptions at QoS 1
+        at most, routes PUBLISH packets at QoS 0 and
+        answers PINGREQ. Each TCP read is printed with
+        the PUBLISH packets it held, to show batching.
+
+        usage: mqtt_stub [-p port] [-n] [-v]
+            -n  never send PUBACK, to exercise resends
+**************************************************/
+int main
+    (
+    int     argc,
+    char   *argv[]
+    )
+{
+int lsock;
+int sock;
+int opt;
+int port;
+int on;
+int i;
+int n;
+int max_fd;
+uint32_t pubs;
+fd_set fds;
+struct timeval tv;
+struct sockaddr_in addr;
+client_type *cli;
+
+port = DFLT_PORT;
+while( (opt = getopt(argc, argv, "p:nv")) != -1 )
+    {
+    switch( opt )
+        {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'n':
+            no_puback = 1;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-p port] [-n] [-v]\n", argv[0]);
+            return 1;
+        }
+    }
+
+lsock = socket(AF_INET, SOCK_STREAM, 0);
+if( lsock < 0 )
+    {
+    perror("socket");
+    return 1;
+    }
+
+on = 1;
+setsockopt(lsock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+memset(&addr, 0, sizeof(addr));
+addr.sin_family = AF_INET;
+addr.sin_addr.s_addr = htonl(INADDR_ANY);
+addr.sin_port = htons(port);
+if( bind(lsock, (struct sockaddr *)&addr, sizeof(addr)) < 0
+ || listen(lsock, 4) < 0 )
+    {
+    perror("bind");
+    return 1;
+    }
+
+for( i = 0; i < MAX_CLIENTS; i++ )
+    {
+    clients[i].sock = -1;
+    }
+
+signal(SIGINT, stop);
+signal(SIGPIPE, SIG_IGN);
+printf("MQTT stub broker on TCP port %d\n", port);
+
+while( !done )
+    {
+    FD_ZERO(&fds);
+    FD_SET(lsock, &fds);
+    max_fd = lsock;
+    for( i = 0; i < MAX_CLIENTS; i++ )
+        {
+        if( clients[i].sock >= 0 )
+            {
+            FD_SET(clients[i].sock, &fds);
+            if( clients[i].sock > max_fd )
+                {
+                max_fd = clients[i].sock;
+                }
+            }
+        }
+
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+    if( select(max_fd + 1, &fds, NULL, NULL, &tv) <= 0 )
+        {
+        continue;
+        }
+
+    if( FD_ISSET(lsock, &fds) )
+        {
+        sock = accept(lsock, NULL, NULL);
+        for( i = 0; i < MAX_CLIENTS && clients[i].sock >= 0; i++ )
+            {
+            }
+
+        if( sock >= 0 && i == MAX_CLIENTS )
+            {
+            close(sock);
+            }
+        else if( sock >= 0 )
+            {
+            memset(&clients[i], 0, sizeof(clients[i]));
+            clients[i].sock = sock;
+            }
+        }
+
+    for( i = 0; i < MAX_CLIENTS; i++ )
+        {
+        cli = &clients[i];
+        if( cli->sock < 0 || !FD_ISSET(cli->sock, &fds) )
+            {
+            continue;
+            }
+
+        n = read(cli->sock, &cli->buf[cli->used], BUF_SZ - cli->used);
+        if( n <= 0 )
+            {
+            drop_client(cli);
+            continue;
+            }
+
+        cli->used += n;
+        cli->reads++;
+        pubs = cli->publishes;
+
+        /* Take every complete packet off the front */
+        while( cli->sock >= 0 && cli->used >= 2 )
+            {
+            uint32_t len = 0;
+            int shift = 0;
+            int pos = 1;
+
+            while( pos < cli->used && pos <= 4 )
+                {
+                len |= (uint32_t)(cli->buf[pos] & 0x7F) << shift;
+                shift += 7;
+                if( (cli->buf[pos++] & 0x80) == 0 )
+                    {
+                    break;
+                    }
+                }
+
+            if( (cli->buf[pos - 1] & 0x80) != 0 )
+                {
+                if( pos > 4 )
+                    {
+                    drop_client(cli);
+                    }
+                break;
+                }
+
+            if( pos + len > BUF_SZ )
+                {
+                drop_client(cli);
+                break;
+                }
+
+            if( cli->used < (int)(pos + len) )
+                {
+                break;
+                }
+
+            if( handle_packet(cli, cli->buf[0], &cli->buf[pos], len) < 0 )
+                {
+                drop_client(cli);
+                break;
+                }
+
+            cli->used -= pos + len;
+            memmove(cli->buf, &cli->buf[pos + len], cli->used);
+            }
+
+        if( cli->sock >= 0 && cli->publishes != pubs )
+            {
+            printf("%s: read %d bytes, %u PUBLISH\n", cli->id, n, cli->publishes - pubs);
+            }
+        }
+    }
+
+close(lsock);
+return 0;
+}
+
+
+/**************************************************
+    drop_client
+**************************************************/
+void drop_client
+    (
+    client_type *cli
+    )
+{
+printf("%s: closed after %u reads, %u PUBLISH\n", cli->id[0] ? cli->id : "?",
+       cli->reads, cli->publishes);
+close(cli->sock);
+cli->sock = -1;
+}
+
+
+/**************************************************
+    handle_packet
+        Answer one control packet, -1 to drop the
+        client.
+**************************************************/
+int handle_packet
+    (
+    client_type   *cli,
+    uint8_t        type,
+    const uint8_t *body,
+    uint32_t       len
+    )
+{
+uint8_t reply[8];
+uint32_t pos;
+uint16_t n;
+int qos;
+
+switch( type & 0xF0 )
+    {
+    case 0x10:                      /* CONNECT */
+        if( len < 12 || memcmp(body, "\0\4MQTT", 6) != 0 )
+            {
+            return -1;
+            }
+        n = (body[10] << 8) | body[11];
+        if( 12u + n > len || n >= sizeof(cli->id) )
+            {
+            return -1;
+            }
+        memcpy(cli->id, &body[12], n);
+        cli->id[n] = '\0';
+        printf("%s: connected, keep alive %u s\n", cli->id, (body[8] << 8) | body[9]);
+        reply[0] = 0x20;
+        reply[1] = 2;
+        reply[2] = 0;
+        reply[3] = 0;
+        return send_all(cli->sock, reply, 4);
+
+    case 0x30:                      /* PUBLISH */
+        qos = (type >> 1) & 3;
+        if( len < 2 || qos > 1 )
+            {
+            return -1;
+            }
+        n = (body[0] << 8) | body[1];
+        if( 2u + n + 2u * qos > len )
+            {
+            return -1;
+            }
+        cli->publishes++;
+        if( verbose )
+            {
+            printf("%s: PUBLISH %.*s%s, %u bytes\n", cli->id, n, &body[2],
+                   (type & 0x08) ? " DUP" : "", len - 2 - n - 2 * qos);
+            }
+        route(cli, body, len, qos);
+        if( qos == 1 && !no_puback )
+            {
+            reply[0] = 0x40;
+            reply[1] = 2;
+            reply[2] = body[2 + n];
+            reply[3] = body[3 + n];
+            return send_all(cli->sock, reply, 4);
+            }
+        return 0;
+
+    case 0x40:                      /* PUBACK */
+        return 0;
+
+    case 0x80:                      /* SUBSCRIBE, one filter kept per packet */
+        if( len < 5 )
+            {
+            return -1;
+            }
+        n = (body[2] << 8) | body[3];
+        pos = 4 + n;
+        if( pos >= len || n > FILTER_MAX )
+            {
+            return -1;
+            }
+        reply[0] = 0x90;
+        reply[1] = 3;
+        reply[2] = body[0];
+        reply[3] = body[1];
+        reply[4] = body[pos] > 1 ? 1 : body[pos];
+        if( cli->filter_cnt == MAX_SUBS )
+            {
+            reply[4] = 0x80;
+            }
+        else
+            {
+            memcpy(cli->filters[cli->filter_cnt], &body[4], n);
+            cli->filters[cli->filter_cnt++][n] = '\0';
+            printf("%s: subscribed to %.*s\n", cli->id, n, &body[4]);
+            }
+        return send_all(cli->sock, reply, 5);
+
+    case 0xC0:                      /* PINGREQ */
+        if( verbose )
+            {
+            printf("%s: PINGREQ\n", cli->id);
+            }
+        reply[0] = 0xD0;
+        reply[1] = 0;
+        return send_all(cli->sock, reply, 2);
+
+    case 0xE0:                      /* DISCONNECT */
+        return -1;
+
+    default:
+        return -1;
+    }
+}
+
+
+/**************************************************
+    route
+        Send a PUBLISH at QoS 0 to every client with a
+        matching filter, the sender included.
+**************************************************/
+void route
+    (
+    const client_type *from,
+    const uint8_t     *body,
+    uint32_t           len,
+    int                qos
+    )
+{
+uint8_t pkt[BUF_SZ + 8];
+uint16_t topic_len;
+uint32_t out_len;
+uint32_t pos;
+int i;
+int j;
+
+(void)from;
+topic_len = (body[0] << 8) | body[1];
+
+/* Same topic, no packet identifier */
+out_len = len - 2 * qos;
+pos = 0;
+pkt[pos++] = 0x30;
+do
+    {
+    pkt[pos] = out_len & 0x7F;
+    out_len >>= 7;
+    if( out_len )
+        {
+        pkt[pos] |= 0x80;
+        }
+    pos++;
+    } while( out_len );
+memcpy(&pkt[pos], body, 2 + topic_len);
+pos += 2 + topic_len;
+memcpy(&pkt[pos], &body[2 + topic_len + 2 * qos], len - 2 - topic_len - 2 * qos);
+pos += len - 2 - topic_len - 2 * qos;
+
+for( i = 0; i < MAX_CLIENTS; i++ )
+    {
+    for( j = 0; clients[i].sock >= 0 && j < clients[i].filter_cnt; j++ )
+        {
+        if( topic_match(clients[i].filters[j], (const char *)&body[2], topic_len) )
+            {
+            send_all(clients[i].sock, pkt, pos);
+            break;
+            }
+        }
+    }
+}
+
+
+/**************************************************
+    send_all
+**************************************************/
+int send_all
+    (
+    int         sock,
+    const void *buf,
+    uint32_t    len
+    )
+{
+const uint8_t *p = buf;
+int n;
+
+while( len > 0 )
+    {
+    n = write(sock, p, len);
+    if( n <= 0 )
+        {
+        return -1;
+        }
+    p += n;
+    len -= n;
+    }
+return 0;
+}
+
+
+/**************************************************
+    stop
+**************************************************/
+void stop
+    (
+    int sig
+    )
+{
+(void)sig;
+done = 1;
+}
+
+
+/**************************************************
+    topic_match
+        '+' matches one level, '#' the rest and the
+        parent level.
+**************************************************/
+int topic_match
+    (
+    const char *filter,
+    const char *topic,
+    int         len
+    )
+{
+int i = 0;
+
+if( len > 0 && topic[0] == '$' && (filter[0] == '+' || filter[0] == '#') )
+    {
+    return 0;
+    }
+
+for( ; *filter; filter++ )
+    {
+    if( *filter == '#' )
+        {
+        return 1;
+        }
+    if( *filter == '+' )
+        {
+        while( i < len && topic[i] != '/' )
+            {
+            i++;
+            }
+        continue;
+        }
+    if( i >= len )
+        {
+        return strcmp(filter, "/#") == 0;
+        }
+    if( *filter != topic[i++] )
+        {
+        return 0;
+        }
+    }
+return i == len;
+}
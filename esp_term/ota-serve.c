@@ -0,0 +1,293 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "ota_layout.h"
+
+/**************************************************
+    Defines
+**************************************************/
+#define DFLT_PORT       5002
+#define LINE_SZ         64
+
+/**************************************************
+    Prototypes
+**************************************************/
+uint8_t *load_image(const char *path, uint32_t *size);
+int read_line(int sock, char *line, int size);
+void serve(int sock);
+int send_all(int sock, const void *buf, uint32_t len);
+
+/**************************************************
+    Globals etc
+**************************************************/
+const char *image_path[OTA_SLOT_CNT];
+uint32_t    version;
+
+/**************************************************
+    main
+        Serve OTA images to devices, one at a time.
+        Each image must be linked for its slot
+        (ldscripts/mem.ld, mem_slot_b.ld).
+
+        usage: ota_serve -V version -a slot_a.bin
+                         -b slot_b.bin [-p port]
+**************************************************/
+int main
+    (
+    int     argc,
+    char   *argv[]
+    )
+{
+int lsock;
+int sock;
+int opt;
+int port;
+int on;
+struct sockaddr_in addr;
+socklen_t addr_len;
+
+port = DFLT_PORT;
+while( (opt = getopt(argc, argv, "p:V:a:b:")) != -1 )
+    {
+    switch( opt )
+        {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'V':
+            version = strtoul(optarg, NULL, 0);
+            break;
+        case 'a':
+            image_path[0] = optarg;
+            break;
+        case 'b':
+            image_path[1] = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s -V version -a slot_a.bin -b slot_b.bin [-p port]\n", argv[0]);
+            return 1;
+        }
+    }
+
+if( version == 0 || image_path[0] == NULL || image_path[1] == NULL )
+    {
+    fprintf(stderr, "usage: %s -V version -a slot_a.bin -b slot_b.bin [-p port]\n", argv[0]);
+    return 1;
+    }
+
+lsock = socket(AF_INET, SOCK_STREAM, 0);
+if( lsock < 0 )
+    {
+    perror("socket");
+    return 1;
+    }
+
+on = 1;
+setsockopt(lsock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+memset(&addr, 0, sizeof(addr));
+addr.sin_family = AF_INET;
+addr.sin_addr.s_addr = htonl(INADDR_ANY);
+addr.sin_port = htons(port);
+if( bind(lsock, (struct sockaddr *)&addr, sizeof(addr)) < 0
+ || listen(lsock, 4) < 0 )
+    {
+    perror("bind");
+    return 1;
+    }
+
+printf("Serving version %u on TCP port %d\n", version, port);
+while( 1 )
+    {
+    addr_len = sizeof(addr);
+    sock = accept(lsock, (struct sockaddr *)&addr, &addr_len);
+    if( sock < 0 )
+        {
+        perror("accept");
+        continue;
+        }
+
+    printf("%s connected\n", inet_ntoa(addr.sin_addr));
+    serve(sock);
+    close(sock);
+    }
+
+return 0;
+}
+
+
+/**************************************************
+    serve
+        Run the exchange of ota_layout.h with one
+        device.
+**************************************************/
+void serve
+    (
+    int sock
+    )
+{
+char line[LINE_SZ];
+char slot_name;
+unsigned long running;
+int slot;
+uint8_t *image;
+uint32_t size;
+ota_img_hdr_type hdr;
+
+if( read_line(sock, line, sizeof(line)) < 0
+ || sscanf(line, "OTA %c %lu", &slot_name, &running) != 2
+ || (slot_name != 'A' && slot_name != 'B') )
+    {
+    printf("bad request\n");
+    return;
+    }
+
+slot = slot_name - 'A';
+printf("device runs version %lu, wants slot %c\n", running, slot_name);
+
+image = load_image(image_path[slot], &size);
+if( image == NULL )
+    {
+    return;
+    }
+
+hdr.magic = OTA_IMG_MAGIC;
+hdr.version = version;
+hdr.size = size;
+hdr.crc = ota_crc32(0xFFFFFFFF, (const uint32_t *)image, size / 4);
+if( send_all(sock, &hdr, sizeof(hdr)) < 0 )
+    {
+    free(image);
+    return;
+    }
+
+/* The device erases the slot before it asks for the data */
+if( read_line(sock, line, sizeof(line)) < 0 || strcmp(line, "GET") != 0 )
+    {
+    printf("device declined the image\n");
+    free(image);
+    return;
+    }
+
+if( send_all(sock, image, size) == 0 )
+    {
+    printf("sent %u bytes, crc %08x\n", size, hdr.crc);
+    }
+
+free(image);
+}
+
+
+/**************************************************
+    load_image
+        Read a binary image, padded with 0xFF to a
+        multiple of 4 bytes.
+**************************************************/
+uint8_t *load_image
+    (
+    const char *path,
+    uint32_t   *size
+    )
+{
+FILE *f;
+long len;
+uint8_t *image;
+
+f = fopen(path, "rb");
+if( f == NULL )
+    {
+    perror(path);
+    return NULL;
+    }
+
+fseek(f, 0, SEEK_END);
+len = ftell(f);
+fseek(f, 0, SEEK_SET);
+if( len <= 0 || len > OTA_SLOT_SZ )
+    {
+    fprintf(stderr, "%s: size %ld does not fit a slot\n", path, len);
+    fclose(f);
+    return NULL;
+    }
+
+*size = (len + 3) & ~3;
+image = malloc(*size);
+memset(image, 0xFF, *size);
+if( fread(image, 1, len, f) != (size_t)len )
+    {
+    perror(path);
+    free(image);
+    image = NULL;
+    }
+
+fclose(f);
+return image;
+}
+
+
+/**************************************************
+    read_line
+        Read one '\n' terminated line, without the
+        terminator.
+**************************************************/
+int read_line
+    (
+    int   sock,
+    char *line,
+    int   size
+    )
+{
+int len;
+char c;
+
+len = 0;
+while( recv(sock, &c, 1, 0) == 1 )
+    {
+    if( c == '\n' )
+        {
+        line[len] = '\0';
+        return len;
+        }
+    if( len < size - 1 )
+        {
+        line[len++] = c;
+        }
+    }
+
+return -1;
+}
+
+
+/**************************************************
+    send_all
+**************************************************/
+int send_all
+    (
+    int         sock,
+    const void *buf,
+    uint32_t    len
+    )
+{
+const uint8_t *p;
+ssize_t n;
+
+p = buf;
+while( len > 0 )
+    {
+    n = send(sock, p, len, 0);
+    if( n <= 0 )
+        {
+        perror("send");
+        return -1;
+        }
+    p += n;
+    len -= n;
+    }
+
+return 0;
+}
@@ -0,0 +1,195 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shell_hash.h"
+
+/**************************************************
+    Defines
+**************************************************/
+#define CMD_MAX         SHELL_HASH_SZ
+#define NAME_SZ         32
+#define LINE_SZ         256
+#define CMD_TAG         "SHELL_CMD( \""
+
+/**************************************************
+    Prototypes
+**************************************************/
+int scan_file(const char *path);
+int write_table(const char *path, int16_t seed, const uint8_t *slots);
+
+/**************************************************
+    Globals etc
+**************************************************/
+shell_cmd_type cmds[CMD_MAX];
+char           names[CMD_MAX][NAME_SZ];
+uint16_t       cmd_cnt;
+
+/**************************************************
+    main
+        Search a hash seed that gives every shell
+        command defined in the given sources a
+        dispatch slot of its own (src/shell_hash.c)
+        and write it to a header for shell_init().
+        Every command in the sources is counted, also
+        those of modules switched off, so the seed
+        fits any build. Exits non-zero when no seed
+        is found, so a command set the shell would
+        have to search fails the build instead.
+
+        usage: shell_seed header file...
+**************************************************/
+int main
+    (
+    int     argc,
+    char   *argv[]
+    )
+{
+uint8_t slots[SHELL_HASH_SZ];
+int16_t seed;
+int i;
+
+if( argc < 3 )
+    {
+    fprintf(stderr, "usage: %s header file...\n", argv[0]);
+    return 2;
+    }
+
+cmd_cnt = 0;
+for( i = 2; i < argc; i++ )
+    {
+    if( scan_file(argv[i]) < 0 )
+        {
+        return 2;
+        }
+    }
+
+seed = shell_hash_build(cmds, cmd_cnt, slots);
+if( seed == SHELL_NO_SEED )
+    {
+    fprintf(stderr, "shell_seed: no seed in %d tries for %u command(s) in %d slots\n",
+            SHELL_SEED_TRIES, cmd_cnt, SHELL_HASH_SZ);
+    return 1;
+    }
+
+if( write_table(argv[1], seed, slots) < 0 )
+    {
+    return 2;
+    }
+
+printf("shell_seed: %u command(s), %d slots, seed %d\n", cmd_cnt, SHELL_HASH_SZ, seed);
+return 0;
+}
+
+
+/**************************************************
+    scan_file
+        Add the name of every SHELL_CMD() in a
+        source file to the command list.
+**************************************************/
+int scan_file
+    (
+    const char *path
+    )
+{
+FILE *f;
+char line[LINE_SZ];
+char *name;
+char *end;
+int i;
+
+f = fopen(path, "r");
+if( f == NULL )
+    {
+    perror(path);
+    return -1;
+    }
+
+while( fgets(line, sizeof(line), f) != NULL )
+    {
+    name = strstr(line, CMD_TAG);
+    if( name == NULL || strncmp(line, "#define", 7) == 0 )
+        {
+        continue;
+        }
+    name += strlen(CMD_TAG);
+    end = strchr(name, '"');
+    if( end == NULL || end - name >= NAME_SZ || cmd_cnt >= CMD_MAX )
+        {
+        fprintf(stderr, "%s: bad command or too many commands: %s", path, line);
+        fclose(f);
+        return -1;
+        }
+
+    for( i = 0; i < cmd_cnt; i++ )
+        {
+        if( strncmp(names[i], name, end - name) == 0 && names[i][end - name] == '\0' )
+            {
+            fprintf(stderr, "%s: command defined twice: %s", path, line);
+            fclose(f);
+            return -1;
+            }
+        }
+
+    memcpy(names[cmd_cnt], name, end - name);
+    names[cmd_cnt][end - name] = '\0';
+    cmds[cmd_cnt].name = names[cmd_cnt];
+    cmd_cnt++;
+    }
+
+fclose(f);
+return 0;
+}
+
+
+/**************************************************
+    write_table
+        Write the seed to the header, with the slot
+        of each command for reference. Slots hold
+        command indices in link order in the
+        firmware, so only the seed is used there.
+**************************************************/
+int write_table
+    (
+    const char    *path,
+    int16_t        seed,
+    const uint8_t *slots
+    )
+{
+FILE *f;
+int i;
+
+f = fopen(path, "w");
+if( f == NULL )
+    {
+    perror(path);
+    return -1;
+    }
+
+fprintf(f, "#ifndef _SHELL_TABLE_H\n"
+           "#define _SHELL_TABLE_H\n"
+           "\n"
+           "/*--------------------------------------------------------\n"
+           "Generated by esp_term/shell-seed.c from the SHELL_CMD()s\n"
+           "in src/, do not edit. Slots for seed %d:\n"
+           "\n", seed);
+for( i = 0; i < SHELL_HASH_SZ; i++ )
+    {
+    if( slots[i] != SHELL_NO_CMD )
+        {
+        fprintf(f, "    %2d  %s\n", i, names[slots[i]]);
+        }
+    }
+fprintf(f, "--------------------------------------------------------*/\n"
+           "#define SHELL_SEED          %-8d/* perfect hash seed            */\n"
+           "\n"
+           "#endif\n", seed);
+
+if( fclose(f) != 0 )
+    {
+    perror(path);
+    return -1;
+    }
+return 0;
+}
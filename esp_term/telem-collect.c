@@ -0,0 +1,280 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "telem-decode.h"
+
+/**************************************************
+    Defines
+**************************************************/
+#define DFLT_PORT       5001
+#define DFLT_INTERVAL   10      /* seconds between reports */
+#define MAX_DEVICES     256
+
+/**************************************************
+    Types
+**************************************************/
+typedef struct
+    {
+    uint16_t id;
+    tdec_seq_type seq;
+    uint32_t records;
+    }device_type;
+
+/**************************************************
+    Prototypes
+**************************************************/
+void handle_dgram(const uint8_t *buf, int len, const struct sockaddr_in *from);
+device_type *find_device(uint16_t id);
+void print_record(void *ctx, uint32_t t, uint8_t metric, int32_t value);
+void report(void);
+void stop(int sig);
+
+/**************************************************
+    Globals etc
+**************************************************/
+device_type devices[MAX_DEVICES];
+int    device_cnt;
+int    verbose;
+uint32_t bad_dgrams;
+volatile int done;
+
+/**************************************************
+    main
+        Receive telemetry datagrams and report loss
+        and reordering per device.
+
+        usage: telem_collect [-p port] [-i interval] [-v]
+**************************************************/
+int main
+    (
+    int     argc,
+    char   *argv[]
+    )
+{
+int sock;
+int opt;
+int port;
+int interval;
+int len;
+uint8_t buf[TELEM_DGRAM_MAX + 1];
+struct sockaddr_in addr;
+socklen_t addr_len;
+fd_set fds;
+struct timeval tv;
+time_t next_report;
+
+port = DFLT_PORT;
+interval = DFLT_INTERVAL;
+while( (opt = getopt(argc, argv, "p:i:v")) != -1 )
+    {
+    switch( opt )
+        {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'i':
+            interval = atoi(optarg);
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-p port] [-i interval] [-v]\n", argv[0]);
+            return 1;
+        }
+    }
+
+sock = socket(AF_INET, SOCK_DGRAM, 0);
+if( sock < 0 )
+    {
+    perror("socket");
+    return 1;
+    }
+
+memset(&addr, 0, sizeof(addr));
+addr.sin_family = AF_INET;
+addr.sin_addr.s_addr = htonl(INADDR_ANY);
+addr.sin_port = htons(port);
+if( bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 )
+    {
+    perror("bind");
+    return 1;
+    }
+
+signal(SIGINT, stop);
+printf("Listening for telemetry on UDP port %d\n", port);
+
+next_report = time(NULL) + interval;
+while( !done )
+    {
+    FD_ZERO(&fds);
+    FD_SET(sock, &fds);
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+    if( select(sock + 1, &fds, NULL, NULL, &tv) > 0 )
+        {
+        addr_len = sizeof(addr);
+        len = recvfrom(sock, buf, sizeof(buf), 0, (struct sockaddr *)&addr, &addr_len);
+        if( len > 0 )
+            {
+            handle_dgram(buf, len, &addr);
+            }
+        }
+
+    if( time(NULL) >= next_report )
+        {
+        report();
+        next_report = time(NULL) + interval;
+        }
+    }
+
+report();
+close(sock);
+return 0;
+}
+
+
+/**************************************************
+    handle_dgram
+        Both record versions are accepted, devices
+        are updated one at a time.
+**************************************************/
+void handle_dgram
+    (
+    const uint8_t            *buf,
+    int                       len,
+    const struct sockaddr_in *from
+    )
+{
+device_type *dev;
+char line[64];
+int records;
+
+/* Check the records before the datagram is counted */
+if( tdec_check(buf, len) < 0
+ || (records = tdec_records(buf, len, NULL, NULL)) < 0 )
+    {
+    bad_dgrams++;
+    return;
+    }
+
+dev = find_device(telem_get_u16(&buf[2]));
+if( dev == NULL )
+    {
+    bad_dgrams++;
+    return;
+    }
+
+if( !tdec_track_seq(&dev->seq, telem_get_u32(&buf[4]), telem_get_u32(&buf[8])) )
+    {
+    return;
+    }
+dev->records += records;
+
+if( verbose )
+    {
+    snprintf(line, sizeof(line), "%s dev %u seq %u", inet_ntoa(from->sin_addr),
+             dev->id, telem_get_u32(&buf[4]));
+    tdec_records(buf, len, print_record, line);
+    }
+}
+
+
+/**************************************************
+    find_device
+        Find or add the tracking data of a device.
+**************************************************/
+device_type *find_device
+    (
+    uint16_t id
+    )
+{
+int i;
+
+for( i = 0; i < device_cnt; i++ )
+    {
+    if( devices[i].id == id )
+        {
+        return &devices[i];
+        }
+    }
+
+if( device_cnt == MAX_DEVICES )
+    {
+    return NULL;
+    }
+
+memset(&devices[device_cnt], 0, sizeof(devices[device_cnt]));
+devices[device_cnt].id = id;
+return &devices[device_cnt++];
+}
+
+
+/**************************************************
+    print_record
+        ctx is the datagram description.
+**************************************************/
+void print_record
+    (
+    void    *ctx,
+    uint32_t t,
+    uint8_t  metric,
+    int32_t  value
+    )
+{
+printf("%s t %u id %u value %d\n", (const char *)ctx, t, metric, value);
+}
+
+
+/**************************************************
+    report
+**************************************************/
+void report
+    (
+    void
+    )
+{
+int i;
+device_type *dev;
+uint32_t expected;
+uint32_t lost;
+
+printf("--- Telemetry report, %d device(s), %u bad datagram(s) ---\n",
+       device_cnt, bad_dgrams);
+for( i = 0; i < device_cnt; i++ )
+    {
+    dev = &devices[i];
+    lost = tdec_lost(&dev->seq);
+    expected = dev->seq.received + lost;
+    printf("dev %5u: seq %u..%u rcvd %u lost %u (%.2f%%) reordered %u dup %u old %u reboots %u records %u\n",
+           dev->id, dev->seq.first_seq, dev->seq.max_seq, dev->seq.received, lost,
+           expected ? 100.0 * lost / expected : 0.0,
+           dev->seq.reordered, dev->seq.duplicates, dev->seq.too_old, dev->seq.resets,
+           dev->records);
+    }
+fflush(stdout);
+}
+
+
+/**************************************************
+    stop
+**************************************************/
+void stop
+    (
+    int sig
+    )
+{
+(void)sig;
+done = 1;
+}
@@ -0,0 +1,141 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "telem-decode.h"
+
+/**************************************************
+    Prototypes
+**************************************************/
+int check(const char *name, const tdec_seq_type *trk, uint32_t resets,
+          uint32_t dups, uint32_t too_old, uint32_t lost);
+void feed(tdec_seq_type *trk, uint32_t first, uint32_t last,
+          uint32_t t0, uint32_t step);
+
+/**************************************************
+    Globals etc
+**************************************************/
+int failed;
+
+/**************************************************
+    main
+        Feed tdec_track_seq() the sequence numbers
+        and base times of a few known streams and
+        check what it counts. Exits non-zero when a
+        count is wrong, so the build fails.
+**************************************************/
+int main(void)
+{
+tdec_seq_type trk;
+uint32_t seq;
+
+/* early reboot: well inside the first window */
+memset(&trk, 0, sizeof(trk));
+feed(&trk, 0, 20, 1000, 1000);
+feed(&trk, 0, 30, 700, 1003);
+check("early reboot", &trk, 1, 0, 0, 0);
+
+/* reboot late in a boot watched from its start */
+memset(&trk, 0, sizeof(trk));
+feed(&trk, 0, 99, 500, 1000);
+feed(&trk, 0, 49, 800, 997);
+check("watched boot", &trk, 1, 0, 0, 0);
+
+/* reboot in a boot joined part way */
+memset(&trk, 0, sizeof(trk));
+feed(&trk, 5000, 5099, 5000000, 1000);
+feed(&trk, 0, 9, 300, 1000);
+check("joined boot", &trk, 1, 0, 0, 0);
+
+/* reboot with a datagram lost on either side */
+memset(&trk, 0, sizeof(trk));
+feed(&trk, 0, 4, 1000, 1000);
+feed(&trk, 6, 10, 7000, 1000);
+feed(&trk, 0, 2, 900, 1000);
+feed(&trk, 4, 10, 4900, 1000);
+check("lost both", &trk, 1, 0, 0, 2);
+
+/* late and repeated datagrams of one boot */
+memset(&trk, 0, sizeof(trk));
+for( seq = 0; seq < 40; seq++ )
+    {
+    if( seq != 7 )
+        {
+        tdec_track_seq(&trk, seq, 1000 * seq);
+        }
+    }
+tdec_track_seq(&trk, 7, 7000);
+tdec_track_seq(&trk, 12, 12000);
+tdec_track_seq(&trk, 39, 39000);
+tdec_track_seq(&trk, 0, 0);
+check("reorder", &trk, 0, 3, 0, 0);
+if( trk.reordered != 1 )
+    {
+    printf("reorder: reordered %u, expected 1\n", trk.reordered);
+    failed = 1;
+    }
+
+/* datagrams that share a base time */
+memset(&trk, 0, sizeof(trk));
+feed(&trk, 0, 9, 0, 0);
+tdec_track_seq(&trk, 4, 0);
+check("same time", &trk, 0, 1, 0, 0);
+
+if( !failed )
+    {
+    printf("telem_decode_test: ok\n");
+    }
+return failed;
+}
+
+/**************************************************
+    feed
+        Track sequence numbers first..last with base
+        times rising by step from t0.
+**************************************************/
+void feed
+    (
+    tdec_seq_type *trk,
+    uint32_t       first,
+    uint32_t       last,
+    uint32_t       t0,
+    uint32_t       step
+    )
+{
+uint32_t seq;
+
+for( seq = first; seq <= last; seq++ )
+    {
+    tdec_track_seq(trk, seq, t0 + step * (seq - first));
+    }
+}
+
+/**************************************************
+    check
+        Compare the counts of a tracker with those
+        expected. Returns 0 when they match.
+**************************************************/
+int check
+    (
+    const char          *name,
+    const tdec_seq_type *trk,
+    uint32_t             resets,
+    uint32_t             dups,
+    uint32_t             too_old,
+    uint32_t             lost
+    )
+{
+if( trk->resets == resets
+ && trk->duplicates == dups
+ && trk->too_old == too_old
+ && tdec_lost(trk) == lost )
+    {
+    return 0;
+    }
+
+printf("%s: resets %u dups %u too_old %u lost %u, expected %u %u %u %u\n",
+       name, trk->resets, trk->duplicates, trk->too_old, tdec_lost(trk),
+       resets, dups, too_old, lost);
+failed = 1;
+return 1;
+}
@@ -0,0 +1,289 @@
+#include <stddef.h>
+
+#include "telem-decode.h"
+
+
+/**************************************************
+    tdec_check
+        Check the header of a datagram against its
+        length. Returns the record version, or -1.
+**************************************************/
+int tdec_check
+    (
+    const uint8_t *buf,
+    int            len
+    )
+{
+if( len < TELEM_HDR_SZ
+ || buf[0] != TELEM_MAGIC
+ || (buf[1] != 1 && buf[1] != TELEM_VERSION)
+ || TELEM_HDR_SZ + telem_get_u16(&buf[12]) != len )
+    {
+    return -1;
+    }
+
+return buf[1];
+}
+
+
+/**************************************************
+    tdec_records
+        Count the records of a checked datagram,
+        passing each to cb if it is not NULL.
+        Returns -1 if they are malformed.
+**************************************************/
+int tdec_records
+    (
+    const uint8_t   *buf,
+    int              len,
+    tdec_rec_cb_type cb,
+    void            *ctx
+    )
+{
+uint32_t t;
+uint32_t v;
+int32_t value;
+int32_t *last;
+int pos;
+int n;
+int records;
+uint8_t metric;
+telem_hist_type hist;
+
+t = telem_get_u32(&buf[8]);
+hist.cnt = 0;
+records = 0;
+for( pos = TELEM_HDR_SZ; pos < len; records++ )
+    {
+    if( buf[1] == 1 )
+        {
+        if( len - pos < TELEM_REC_SZ )
+            {
+            return -1;
+            }
+        metric = buf[pos];
+        t = telem_get_u32(&buf[8]) + telem_get_u16(&buf[pos + 1]);
+        value = (int32_t)telem_get_u32(&buf[pos + 3]);
+        pos += TELEM_REC_SZ;
+        }
+    else
+        {
+        metric = buf[pos++];
+        n = varenc_get_uvar(&buf[pos], len - pos, &v);
+        if( n == 0 )
+            {
+            return -1;
+            }
+        pos += n;
+        t += v;
+        n = varenc_get_uvar(&buf[pos], len - pos, &v);
+        if( n == 0 )
+            {
+            return -1;
+            }
+        pos += n;
+        last = telem_hist_slot(&hist, metric);
+        value = (int32_t)((uint32_t)(last ? *last : 0) + (uint32_t)varenc_unzigzag(v));
+        if( last != NULL )
+            {
+            *last = value;
+            }
+        }
+
+    if( cb != NULL )
+        {
+        cb(ctx, t, metric, value);
+        }
+    }
+
+return records;
+}
+
+
+/**************************************************
+    tdec_rebooted
+        Check a datagram against those of the
+        current boot. Within a boot sequence numbers
+        and base times rise together, a datagram that
+        breaks that order is from a new boot: the
+        device counts from 0 again and its ms clock
+        restarts. A datagram with the sequence number
+        of one seen already is a duplicate only if
+        its base time is the same too.
+
+        The order is checked against the first and
+        the highest sequence number seen, and against
+        the nearest ones on either side in the
+        window, so a reboot is seen whether it comes
+        early or late in the previous boot, and
+        whether that boot was watched from its start.
+        Beyond the window a datagram older than the
+        first one seen is from a new boot too. A
+        reboot that reproduces the previous boot's
+        timing to the ms is not seen.
+**************************************************/
+static int tdec_rebooted
+    (
+    const tdec_seq_type *trk,
+    uint32_t             seq,
+    uint32_t             t
+    )
+{
+int32_t ds;
+int32_t dt;
+uint32_t behind;
+uint32_t n;
+
+ds = (int32_t)(seq - trk->first_seq);
+dt = (int32_t)(t - trk->first_t);
+if( (ds > 0 && dt < 0) || (ds < 0 && dt > 0) || (ds == 0 && dt != 0) )
+    {
+    return 1;
+    }
+
+ds = (int32_t)(seq - trk->max_seq);
+dt = (int32_t)(t - trk->seen_t[trk->max_seq % TDEC_SEQ_WINDOW]);
+if( (ds > 0 && dt < 0) || (ds < 0 && dt > 0) || (ds == 0 && dt != 0) )
+    {
+    return 1;
+    }
+
+if( ds >= 0 )
+    {
+    return 0;
+    }
+
+/* Older than the first seen and beyond the window: no
+   datagram is that late, the device counts again */
+behind = trk->max_seq - seq;
+if( behind >= TDEC_SEQ_WINDOW )
+    {
+    return (int32_t)(t - trk->first_t) < 0;
+    }
+
+if( trk->seen & ((uint64_t)1 << behind) )
+    {
+    return t != trk->seen_t[seq % TDEC_SEQ_WINDOW];
+    }
+
+/* nearest seen on either side: n behind the highest one */
+for( n = behind + 1; n < TDEC_SEQ_WINDOW; n++ )
+    {
+    if( trk->seen & ((uint64_t)1 << n) )
+        {
+        if( (int32_t)(t - trk->seen_t[(trk->max_seq - n) % TDEC_SEQ_WINDOW]) < 0 )
+            {
+            return 1;
+            }
+        break;
+        }
+    }
+for( n = behind; n-- > 0; )
+    {
+    if( trk->seen & ((uint64_t)1 << n) )
+        {
+        return (int32_t)(t - trk->seen_t[(trk->max_seq - n) % TDEC_SEQ_WINDOW]) > 0;
+        }
+    }
+return 0;
+}
+
+
+/**************************************************
+    tdec_track_seq
+        Account for one sequence number and the base
+        time of its datagram. A bitmap of the last
+        TDEC_SEQ_WINDOW sequence numbers tells a late
+        datagram from a duplicate. A device reboot
+        (tdec_rebooted()) restarts the range; what
+        was lost before it is kept.
+        Returns 0 for a duplicate.
+**************************************************/
+int tdec_track_seq
+    (
+    tdec_seq_type *trk,
+    uint32_t       seq,
+    uint32_t       t
+    )
+{
+uint32_t ahead;
+uint32_t behind;
+
+if( trk->boot_received != 0 && tdec_rebooted(trk, seq, t) )
+    {
+    trk->boot_lost = tdec_lost(trk);
+    trk->boot_received = 0;
+    trk->resets++;
+    }
+
+if( trk->boot_received == 0 )
+    {
+    trk->first_seq = seq;
+    trk->first_t = t;
+    trk->max_seq = seq;
+    trk->seen = 1;
+    trk->seen_t[seq % TDEC_SEQ_WINDOW] = t;
+    trk->boot_received = 1;
+    trk->received++;
+    return 1;
+    }
+
+if( (int32_t)(seq - trk->max_seq) > 0 )
+    {
+    ahead = seq - trk->max_seq;
+    trk->seen = ( ahead >= TDEC_SEQ_WINDOW ) ? 0 : trk->seen << ahead;
+    trk->seen |= 1;
+    trk->seen_t[seq % TDEC_SEQ_WINDOW] = t;
+    trk->max_seq = seq;
+    trk->boot_received++;
+    trk->received++;
+    return 1;
+    }
+
+behind = trk->max_seq - seq;
+if( behind >= TDEC_SEQ_WINDOW )
+    {
+    trk->too_old++;
+    trk->boot_received++;
+    trk->received++;
+    return 1;
+    }
+
+if( trk->seen & ((uint64_t)1 << behind) )
+    {
+    trk->duplicates++;
+    return 0;
+    }
+
+/* A late datagram fills a gap, it is not lost after all */
+trk->seen |= (uint64_t)1 << behind;
+trk->seen_t[seq % TDEC_SEQ_WINDOW] = t;
+trk->reordered++;
+trk->boot_received++;
+trk->received++;
+return 1;
+}
+
+
+/**************************************************
+    tdec_lost
+        Datagrams missing between the first and the
+        highest sequence number seen, added up over
+        device reboots.
+**************************************************/
+uint32_t tdec_lost
+    (
+    const tdec_seq_type *trk
+    )
+{
+uint32_t expected;
+
+if( trk->boot_received == 0 )
+    {
+    return trk->boot_lost;
+    }
+
+expected = trk->max_seq - trk->first_seq + 1;
+return trk->boot_lost
+     + ( ( expected > trk->boot_received ) ? expected - trk->boot_received : 0 );
+}
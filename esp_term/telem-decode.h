@@ -0,0 +1,54 @@
+#ifndef TELEM_DECODE_H
+#define TELEM_DECODE_H
+
+#include <stdint.h>
+
+#include "telem_wire.h"
+
+/**************************************************
+    Telemetry datagram decoding (telem_wire.h) and
+    sequence accounting, shared by the collectors.
+
+    A datagram is checked whole before any record
+    is passed on, so a malformed one costs only
+    itself. Over TCP datagrams are sent back to
+    back, the header gives each one's length.
+**************************************************/
+
+/**************************************************
+    Defines
+**************************************************/
+#define TDEC_SEQ_WINDOW 64      /* datagrams tracked for duplicates */
+
+/**************************************************
+    Types
+**************************************************/
+typedef struct
+    {
+    uint32_t first_seq;         /* since the last device reboot */
+    uint32_t first_t;           /* base time of the first datagram seen */
+    uint32_t max_seq;
+    uint64_t seen;              /* bit n: max_seq - n was received */
+    uint32_t seen_t[TDEC_SEQ_WINDOW];
+                                /* base time of sequence number n at
+                                   n % TDEC_SEQ_WINDOW, if seen */
+    uint32_t boot_received;     /* unique datagrams since the reboot */
+    uint32_t boot_lost;         /* lost before the reboot */
+    uint32_t resets;            /* device reboots seen */
+    uint32_t received;          /* unique datagrams */
+    uint32_t duplicates;
+    uint32_t reordered;         /* arrived after a later sequence number */
+    uint32_t too_old;           /* reordered beyond the window, not checked */
+    }tdec_seq_type;
+
+typedef void (*tdec_rec_cb_type)(void *ctx, uint32_t t, uint8_t metric, int32_t value);
+
+/**************************************************
+    Prototypes
+**************************************************/
+int tdec_check(const uint8_t *buf, int len);
+int tdec_records(const uint8_t *buf, int len, tdec_rec_cb_type cb, void *ctx);
+int tdec_track_seq(tdec_seq_type *trk, uint32_t seq, uint32_t t);
+uint32_t tdec_lost(const tdec_seq_type *trk);
+
+#endif
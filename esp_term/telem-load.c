@@ -0,0 +1,374 @@
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "telem_wire.h"
+
+/**************************************************
+    Defines
+**************************************************/
+#define DFLT_HOST       "127.0.0.1"
+#define DFLT_PORT       5001
+#define DFLT_DEVICES    1000
+#define DFLT_RATE       1.0     /* datagrams per second per device */
+#define DFLT_RECORDS    8       /* records per datagram */
+#define DFLT_SECONDS    10
+#define SEND_BATCH      64      /* datagrams per sendmmsg() */
+#define METRICS         4       /* metrics a device reports */
+
+/**************************************************
+    Types
+**************************************************/
+typedef struct
+    {
+    uint16_t id;
+    uint32_t seq;
+    uint32_t ticks;             /* device ms clock */
+    int32_t  value[METRICS];
+    int      sock;              /* TCP connection, -1 over UDP */
+    }device_type;
+
+/**************************************************
+    Prototypes
+**************************************************/
+int build_dgram(device_type *dev, uint8_t *buf, int records);
+int64_t now_ms(void);
+int send_tcp(device_type *dev, const uint8_t *buf, int len);
+void stop(int sig);
+
+/**************************************************
+    Globals etc
+**************************************************/
+volatile int done;
+
+/**************************************************
+    main
+        Simulate devices sending version 2 telemetry
+        (telem_wire.h) to a collector, for
+        benchmarking telem_serve. Over UDP all devices
+        share one socket and datagrams go out in
+        batches; over TCP each device has its own
+        connection. The total rate is spread evenly
+        over the devices in turn.
+
+        usage: telem_load [-h host] [-p port] [-n devices]
+            [-r rate] [-k records] [-t seconds]
+            [-i first_id] [-T]
+**************************************************/
+int main
+    (
+    int     argc,
+    char   *argv[]
+    )
+{
+const char *host;
+int port;
+int dev_cnt;
+double rate;
+int records;
+int seconds;
+int first_id;
+int tcp;
+int opt;
+int sock;
+int i;
+int n;
+int batch;
+int next_dev;
+uint64_t sent;
+uint64_t errors;
+uint64_t due;
+int64_t start;
+int64_t elapsed;
+device_type *devs;
+struct sockaddr_in addr;
+struct rlimit lim;
+static uint8_t bufs[SEND_BATCH][TELEM_DGRAM_MAX];
+struct mmsghdr msgs[SEND_BATCH];
+struct iovec iovs[SEND_BATCH];
+
+host = DFLT_HOST;
+port = DFLT_PORT;
+dev_cnt = DFLT_DEVICES;
+rate = DFLT_RATE;
+records = DFLT_RECORDS;
+seconds = DFLT_SECONDS;
+first_id = 1;
+tcp = 0;
+while( (opt = getopt(argc, argv, "h:p:n:r:k:t:i:T")) != -1 )
+    {
+    switch( opt )
+        {
+        case 'h':
+            host = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'n':
+            dev_cnt = atoi(optarg);
+            break;
+        case 'r':
+            rate = atof(optarg);
+            break;
+        case 'k':
+            records = atoi(optarg);
+            break;
+        case 't':
+            seconds = atoi(optarg);
+            break;
+        case 'i':
+            first_id = atoi(optarg);
+            break;
+        case 'T':
+            tcp = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-h host] [-p port] [-n devices] [-r rate] [-k records]"
+                    " [-t seconds] [-i first_id] [-T]\n", argv[0]);
+            return 1;
+        }
+    }
+
+if( dev_cnt < 1 || first_id + dev_cnt > 65536 || rate <= 0
+ || records < 1 || TELEM_HDR_SZ + records * TELEM_REC_MAX > TELEM_DGRAM_MAX )
+    {
+    fprintf(stderr, "bad device count, rate or record count\n");
+    return 1;
+    }
+
+memset(&addr, 0, sizeof(addr));
+addr.sin_family = AF_INET;
+addr.sin_port = htons(port);
+if( inet_pton(AF_INET, host, &addr.sin_addr) != 1 )
+    {
+    fprintf(stderr, "bad address %s\n", host);
+    return 1;
+    }
+
+if( getrlimit(RLIMIT_NOFILE, &lim) == 0 )
+    {
+    lim.rlim_cur = lim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &lim);
+    }
+signal(SIGPIPE, SIG_IGN);
+
+devs = calloc(dev_cnt, sizeof(*devs));
+if( devs == NULL )
+    {
+    perror("calloc");
+    return 1;
+    }
+
+sock = -1;
+if( !tcp )
+    {
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if( sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 )
+        {
+        perror("udp");
+        return 1;
+        }
+    }
+
+for( i = 0; i < dev_cnt; i++ )
+    {
+    devs[i].id = first_id + i;
+    devs[i].ticks = rand();
+    devs[i].sock = -1;
+    if( tcp )
+        {
+        devs[i].sock = socket(AF_INET, SOCK_STREAM, 0);
+        if( devs[i].sock < 0
+         || connect(devs[i].sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 )
+            {
+            perror("tcp");
+            return 1;
+            }
+        }
+    }
+
+for( i = 0; i < SEND_BATCH; i++ )
+    {
+    iovs[i].iov_base = bufs[i];
+    memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+signal(SIGINT, stop);
+printf("%d device(s) over %s, %.1f datagram(s)/s each, %d record(s) per datagram\n",
+       dev_cnt, tcp ? "TCP" : "UDP", rate, records);
+
+sent = 0;
+errors = 0;
+next_dev = 0;
+start = now_ms();
+while( !done && (elapsed = now_ms() - start) < seconds * 1000LL )
+    {
+    due = (uint64_t)(rate * dev_cnt * elapsed / 1000.0);
+    if( due <= sent )
+        {
+        usleep(1000);
+        continue;
+        }
+
+    batch = ( due - sent > SEND_BATCH ) ? SEND_BATCH : (int)(due - sent);
+    for( i = 0; i < batch; i++ )
+        {
+        iovs[i].iov_len = build_dgram(&devs[next_dev], bufs[i], records);
+        if( tcp && send_tcp(&devs[next_dev], bufs[i], iovs[i].iov_len) < 0 )
+            {
+            errors++;
+            }
+        next_dev = (next_dev + 1) % dev_cnt;
+        }
+
+    if( !tcp )
+        {
+        n = sendmmsg(sock, msgs, batch, 0);
+        if( n < batch )
+            {
+            /* ENOBUFS and the like: the datagrams are lost, as from a device */
+            errors += batch - ( n < 0 ? 0 : n );
+            }
+        }
+    sent += batch;
+    }
+
+elapsed = now_ms() - start;
+printf("sent %llu datagram(s) in %.1f s, %.0f/s, %llu record(s)/s, %llu error(s)\n",
+       (unsigned long long)sent, elapsed / 1000.0, sent * 1000.0 / elapsed,
+       (unsigned long long)(sent * records * 1000 / elapsed), (unsigned long long)errors);
+
+for( i = 0; i < dev_cnt; i++ )
+    {
+    if( devs[i].sock >= 0 )
+        {
+        close(devs[i].sock);
+        }
+    }
+free(devs);
+return 0;
+}
+
+
+/**************************************************
+    build_dgram
+        Build the next datagram of a device, coded
+        like the firmware does (telemetry.c), and
+        return its length.
+**************************************************/
+int build_dgram
+    (
+    device_type *dev,
+    uint8_t     *buf,
+    int          records
+    )
+{
+telem_hist_type hist;
+int32_t *last;
+int32_t value;
+uint8_t metric;
+int len;
+int i;
+
+buf[0] = TELEM_MAGIC;
+buf[1] = TELEM_VERSION;
+telem_put_u16(&buf[2], dev->id);
+telem_put_u32(&buf[4], dev->seq++);
+telem_put_u32(&buf[8], dev->ticks);
+
+hist.cnt = 0;
+len = TELEM_HDR_SZ;
+for( i = 0; i < records; i++ )
+    {
+    metric = i % METRICS;
+    dev->value[metric] += rand() % 21 - 10;
+    value = dev->value[metric];
+
+    buf[len++] = metric;
+    len += varenc_put_uvar(&buf[len], i == 0 ? 0 : 10);
+    last = telem_hist_slot(&hist, metric);
+    len += varenc_put_uvar(&buf[len], varenc_zigzag(value - (last ? *last : 0)));
+    if( last != NULL )
+        {
+        *last = value;
+        }
+    }
+
+dev->ticks += 10 * records;
+telem_put_u16(&buf[12], len - TELEM_HDR_SZ);
+return len;
+}
+
+
+/**************************************************
+    now_ms
+**************************************************/
+int64_t now_ms
+    (
+    void
+    )
+{
+struct timespec ts;
+
+clock_gettime(CLOCK_MONOTONIC, &ts);
+return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+
+/**************************************************
+    send_tcp
+        Write a whole datagram to the connection of
+        a device.
+**************************************************/
+int send_tcp
+    (
+    device_type   *dev,
+    const uint8_t *buf,
+    int            len
+    )
+{
+int n;
+
+while( len > 0 )
+    {
+    n = write(dev->sock, buf, len);
+    if( n < 0 && errno == EINTR )
+        {
+        continue;
+        }
+    if( n <= 0 )
+        {
+        return -1;
+        }
+    buf += n;
+    len -= n;
+    }
+return 0;
+}
+
+
+/**************************************************
+    stop
+**************************************************/
+void stop
+    (
+    int sig
+    )
+{
+(void)sig;
+done = 1;
+}
@@ -0,0 +1,819 @@
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "telem-decode.h"
+
+/**************************************************
+    Defines
+**************************************************/
+#define DFLT_PORT       5001
+#define DFLT_INTERVAL   10      /* seconds between reports */
+#define DFLT_FLUSH_MS   1000    /* device buffers written at least this often */
+#define DFLT_DIR        "telem"
+#define MAX_WORKERS     64
+#define MAX_DEVICES     65536   /* device ids are 16 bit */
+#define RING_SLOTS      4096    /* datagrams queued per worker, 2^n */
+#define MAX_EVENTS      64      /* epoll events per wait */
+#define RECV_BATCH      32      /* datagrams per recvmmsg() */
+#define UDP_RCVBUF      (8 << 20)
+#define OUT_SZ          8192    /* CSV buffered per device */
+#define OUT_LINE_MAX    48      /* longest CSV line */
+#define FD_CACHE        256     /* device files kept open per worker */
+
+/**************************************************
+    Types
+**************************************************/
+typedef struct
+    {
+    uint16_t len;
+    uint8_t  buf[TELEM_DGRAM_MAX];
+    }slot_type;
+
+typedef struct
+    {
+    uint16_t id;
+    tdec_seq_type seq;
+    uint32_t cur_seq;           /* datagram being written out */
+    uint32_t records;
+    int      fd;                /* -1 if not in the file cache */
+    int      fd_slot;
+    int      dirty;             /* on the dirty list */
+    int      out_len;
+    char     out[OUT_SZ];
+    }device_type;
+
+typedef struct
+    {
+    pthread_t thread;
+    int       idx;
+    int       efd;              /* eventfd, wakes the worker */
+    slot_type *slots;           /* single producer ring, the I/O thread */
+    _Atomic uint32_t head;
+    _Atomic uint32_t tail;
+    _Atomic int sleeping;
+    int       kick;             /* I/O thread: queued since the last wake up */
+    uint32_t  drops;            /* I/O thread: ring full */
+    device_type **dirty;        /* devices with unwritten CSV */
+    int       dirty_cnt;
+    device_type *fd_devs[FD_CACHE];
+    int       fd_cnt;
+    int       fd_next;          /* next file cache slot to evict */
+    _Atomic uint64_t dgrams;
+    _Atomic uint64_t records;
+    _Atomic uint64_t dups;
+    _Atomic uint64_t bad;
+    _Atomic uint64_t writes;
+    _Atomic uint64_t bytes;
+    _Atomic uint32_t devices;
+    }worker_type;
+
+typedef struct
+    {
+    int     fd;
+    int     used;
+    uint8_t buf[2 * TELEM_DGRAM_MAX];
+    }conn_type;
+
+/**************************************************
+    Prototypes
+**************************************************/
+void accept_conns(int lsock, int epfd);
+void dispatch(const uint8_t *buf, int len);
+void flush_device(worker_type *w, device_type *dev);
+void put_record(void *ctx, uint32_t t, uint8_t metric, int32_t value);
+void read_conn(conn_type *conn, int epfd);
+void read_udp(int sock);
+void report(int final, double secs);
+void stop(int sig);
+void wake_workers(void);
+void *worker_main(void *arg);
+void worker_dgram(worker_type *w, const uint8_t *buf, int len);
+
+/**************************************************
+    Globals etc
+**************************************************/
+worker_type workers[MAX_WORKERS];
+int    worker_cnt;
+device_type *devices[MAX_DEVICES]; /* each used only by worker id % worker_cnt */
+const char *out_dir;
+int    flush_ms;
+uint32_t bad_dgrams;            /* I/O thread: failed the header check */
+uint32_t conns_open;
+volatile int done;
+
+/**************************************************
+    main
+        Receive telemetry from many devices over UDP
+        and TCP on one port, decode it and append the
+        records of each device to <dir>/<id>.csv.
+
+        One thread waits on epoll and reads; it hands
+        each datagram to the worker owning its device
+        (id modulo the worker count) through a ring,
+        so a device is only ever touched by one
+        thread. Workers buffer the CSV of each device
+        and write it when the buffer fills or the
+        flush interval is over.
+
+        usage: telem_serve [-p port] [-w workers]
+            [-d dir] [-f flush_ms] [-i interval]
+**************************************************/
+int main
+    (
+    int     argc,
+    char   *argv[]
+    )
+{
+int usock;
+int lsock;
+int epfd;
+int opt;
+int port;
+int interval;
+int on;
+int i;
+int n;
+uint64_t one = 1;
+struct sockaddr_in addr;
+struct epoll_event ev;
+struct epoll_event events[MAX_EVENTS];
+struct rlimit lim;
+time_t start;
+time_t next_report;
+
+port = DFLT_PORT;
+interval = DFLT_INTERVAL;
+flush_ms = DFLT_FLUSH_MS;
+out_dir = DFLT_DIR;
+worker_cnt = sysconf(_SC_NPROCESSORS_ONLN);
+while( (opt = getopt(argc, argv, "p:w:d:f:i:")) != -1 )
+    {
+    switch( opt )
+        {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'w':
+            worker_cnt = atoi(optarg);
+            break;
+        case 'd':
+            out_dir = optarg;
+            break;
+        case 'f':
+            flush_ms = atoi(optarg);
+            break;
+        case 'i':
+            interval = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-p port] [-w workers] [-d dir] [-f flush_ms] [-i interval]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+if( worker_cnt < 1 )
+    {
+    worker_cnt = 1;
+    }
+if( worker_cnt > MAX_WORKERS )
+    {
+    worker_cnt = MAX_WORKERS;
+    }
+
+if( mkdir(out_dir, 0755) < 0 && errno != EEXIST )
+    {
+    perror(out_dir);
+    return 1;
+    }
+
+/* One connection per device plus the file caches */
+if( getrlimit(RLIMIT_NOFILE, &lim) == 0 )
+    {
+    lim.rlim_cur = lim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &lim);
+    }
+
+memset(&addr, 0, sizeof(addr));
+addr.sin_family = AF_INET;
+addr.sin_addr.s_addr = htonl(INADDR_ANY);
+addr.sin_port = htons(port);
+
+usock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+lsock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+if( usock < 0 || lsock < 0 )
+    {
+    perror("socket");
+    return 1;
+    }
+
+on = UDP_RCVBUF;
+setsockopt(usock, SOL_SOCKET, SO_RCVBUF, &on, sizeof(on));
+on = 1;
+setsockopt(lsock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+if( bind(usock, (struct sockaddr *)&addr, sizeof(addr)) < 0
+ || bind(lsock, (struct sockaddr *)&addr, sizeof(addr)) < 0
+ || listen(lsock, 512) < 0 )
+    {
+    perror("bind");
+    return 1;
+    }
+
+epfd = epoll_create1(0);
+ev.events = EPOLLIN;
+ev.data.ptr = &usock;
+epoll_ctl(epfd, EPOLL_CTL_ADD, usock, &ev);
+ev.data.ptr = &lsock;
+epoll_ctl(epfd, EPOLL_CTL_ADD, lsock, &ev);
+
+for( i = 0; i < worker_cnt; i++ )
+    {
+    workers[i].idx = i;
+    workers[i].efd = eventfd(0, EFD_NONBLOCK);
+    workers[i].slots = malloc(RING_SLOTS * sizeof(slot_type));
+    workers[i].dirty = malloc(MAX_DEVICES / worker_cnt * sizeof(device_type *) + sizeof(device_type *));
+    if( workers[i].efd < 0 || workers[i].slots == NULL || workers[i].dirty == NULL )
+        {
+        perror("worker");
+        return 1;
+        }
+    pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+    }
+
+signal(SIGINT, stop);
+signal(SIGTERM, stop);
+printf("Listening for telemetry on UDP and TCP port %d, %d worker(s), writing to %s/\n",
+       port, worker_cnt, out_dir);
+
+start = time(NULL);
+next_report = start + interval;
+while( !done )
+    {
+    n = epoll_wait(epfd, events, MAX_EVENTS, 1000);
+    for( i = 0; i < n; i++ )
+        {
+        if( events[i].data.ptr == &usock )
+            {
+            read_udp(usock);
+            }
+        else if( events[i].data.ptr == &lsock )
+            {
+            accept_conns(lsock, epfd);
+            }
+        else
+            {
+            read_conn(events[i].data.ptr, epfd);
+            }
+        }
+
+    wake_workers();
+
+    if( time(NULL) >= next_report )
+        {
+        report(0, difftime(time(NULL), start));
+        next_report = time(NULL) + interval;
+        }
+    }
+
+/* Workers write what they have before they go */
+for( i = 0; i < worker_cnt; i++ )
+    {
+    if( write(workers[i].efd, &one, sizeof(one)) < 0 )
+        {
+        perror("eventfd");
+        }
+    pthread_join(workers[i].thread, NULL);
+    }
+
+report(1, difftime(time(NULL), start));
+return 0;
+}
+
+
+/**************************************************
+    accept_conns
+        Take all pending TCP connections.
+**************************************************/
+void accept_conns
+    (
+    int lsock,
+    int epfd
+    )
+{
+int fd;
+conn_type *conn;
+struct epoll_event ev;
+
+while( (fd = accept4(lsock, NULL, NULL, SOCK_NONBLOCK)) >= 0 )
+    {
+    conn = malloc(sizeof(*conn));
+    if( conn == NULL )
+        {
+        close(fd);
+        continue;
+        }
+    conn->fd = fd;
+    conn->used = 0;
+    ev.events = EPOLLIN;
+    ev.data.ptr = conn;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    conns_open++;
+    }
+}
+
+
+/**************************************************
+    dispatch
+        Queue a datagram for the worker owning its
+        device. The header is checked here, the
+        records by the worker.
+**************************************************/
+void dispatch
+    (
+    const uint8_t *buf,
+    int            len
+    )
+{
+worker_type *w;
+uint32_t head;
+slot_type *slot;
+
+if( tdec_check(buf, len) < 0 )
+    {
+    bad_dgrams++;
+    return;
+    }
+
+w = &workers[telem_get_u16(&buf[2]) % worker_cnt];
+head = atomic_load_explicit(&w->head, memory_order_relaxed);
+if( head - atomic_load_explicit(&w->tail, memory_order_acquire) == RING_SLOTS )
+    {
+    w->drops++;
+    return;
+    }
+
+slot = &w->slots[head % RING_SLOTS];
+slot->len = len;
+memcpy(slot->buf, buf, len);
+atomic_store_explicit(&w->head, head + 1, memory_order_release);
+w->kick = 1;
+}
+
+
+/**************************************************
+    flush_device
+        Append the buffered CSV of a device to its
+        file. Files are kept open in a small cache
+        per worker, the oldest opened is closed to
+        make room.
+**************************************************/
+void flush_device
+    (
+    worker_type *w,
+    device_type *dev
+    )
+{
+char path[256];
+device_type *old;
+int n;
+int done_len;
+
+if( dev->out_len == 0 )
+    {
+    return;
+    }
+
+if( dev->fd < 0 )
+    {
+    if( w->fd_cnt == FD_CACHE )
+        {
+        old = w->fd_devs[w->fd_next];
+        close(old->fd);
+        old->fd = -1;
+        dev->fd_slot = w->fd_next;
+        w->fd_next = (w->fd_next + 1) % FD_CACHE;
+        }
+    else
+        {
+        dev->fd_slot = w->fd_cnt++;
+        }
+
+    snprintf(path, sizeof(path), "%s/%u.csv", out_dir, dev->id);
+    dev->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    w->fd_devs[dev->fd_slot] = dev;
+    if( dev->fd < 0 )
+        {
+        perror(path);
+        dev->out_len = 0;
+        return;
+        }
+    }
+
+for( done_len = 0; done_len < dev->out_len; done_len += n )
+    {
+    n = write(dev->fd, &dev->out[done_len], dev->out_len - done_len);
+    if( n <= 0 )
+        {
+        perror("write");
+        break;
+        }
+    }
+
+atomic_fetch_add_explicit(&w->writes, 1, memory_order_relaxed);
+atomic_fetch_add_explicit(&w->bytes, dev->out_len, memory_order_relaxed);
+dev->out_len = 0;
+}
+
+
+/**************************************************
+    put_record
+        Add one CSV line, seq,t,metric,value, to the
+        buffer of a device (ctx).
+**************************************************/
+void put_record
+    (
+    void    *ctx,
+    uint32_t t,
+    uint8_t  metric,
+    int32_t  value
+    )
+{
+device_type *dev = ctx;
+
+dev->out_len += snprintf(&dev->out[dev->out_len], OUT_SZ - dev->out_len,
+                         "%u,%u,%u,%d\n", dev->cur_seq, t, metric, value);
+}
+
+
+/**************************************************
+    read_conn
+        Read a TCP connection and queue each whole
+        datagram in it. A stream that does not start
+        with a datagram header is dropped.
+**************************************************/
+void read_conn
+    (
+    conn_type *conn,
+    int        epfd
+    )
+{
+int n;
+int pos;
+int len;
+
+while( 1 )
+    {
+    n = read(conn->fd, &conn->buf[conn->used], sizeof(conn->buf) - conn->used);
+    if( n < 0 && (errno == EAGAIN || errno == EINTR) )
+        {
+        return;
+        }
+    if( n <= 0 )
+        {
+        break;
+        }
+    conn->used += n;
+
+    for( pos = 0; conn->used - pos >= TELEM_HDR_SZ; pos += len )
+        {
+        len = TELEM_HDR_SZ + telem_get_u16(&conn->buf[pos + 12]);
+        if( conn->buf[pos] != TELEM_MAGIC || len > TELEM_DGRAM_MAX )
+            {
+            bad_dgrams++;
+            goto drop;
+            }
+        if( conn->used - pos < len )
+            {
+            break;
+            }
+        dispatch(&conn->buf[pos], len);
+        }
+
+    conn->used -= pos;
+    memmove(conn->buf, &conn->buf[pos], conn->used);
+    }
+
+drop:
+epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+close(conn->fd);
+free(conn);
+conns_open--;
+}
+
+
+/**************************************************
+    read_udp
+        Read the socket dry, RECV_BATCH datagrams per
+        system call.
+**************************************************/
+void read_udp
+    (
+    int sock
+    )
+{
+static uint8_t bufs[RECV_BATCH][TELEM_DGRAM_MAX + 1];
+struct mmsghdr msgs[RECV_BATCH];
+struct iovec iovs[RECV_BATCH];
+int i;
+int n;
+
+for( i = 0; i < RECV_BATCH; i++ )
+    {
+    iovs[i].iov_base = bufs[i];
+    iovs[i].iov_len = sizeof(bufs[i]);
+    memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+do
+    {
+    n = recvmmsg(sock, msgs, RECV_BATCH, MSG_DONTWAIT, NULL);
+    for( i = 0; i < n; i++ )
+        {
+        dispatch(bufs[i], msgs[i].msg_len);
+        }
+    } while( n == RECV_BATCH );
+}
+
+
+/**************************************************
+    report
+        Totals and rates since the start. The final
+        report adds the loss per device, when the
+        workers are gone.
+**************************************************/
+void report
+    (
+    int    final,
+    double secs
+    )
+{
+uint64_t dgrams = 0;
+uint64_t records = 0;
+uint64_t dups = 0;
+uint64_t bad = bad_dgrams;
+uint64_t writes = 0;
+uint64_t bytes = 0;
+uint64_t drops = 0;
+uint64_t lost = 0;
+uint64_t reordered = 0;
+uint32_t devs = 0;
+worker_type *w;
+int i;
+
+for( i = 0; i < worker_cnt; i++ )
+    {
+    w = &workers[i];
+    dgrams += atomic_load(&w->dgrams);
+    records += atomic_load(&w->records);
+    dups += atomic_load(&w->dups);
+    bad += atomic_load(&w->bad);
+    writes += atomic_load(&w->writes);
+    bytes += atomic_load(&w->bytes);
+    devs += atomic_load(&w->devices);
+    drops += w->drops;
+    }
+
+if( secs < 1 )
+    {
+    secs = 1;
+    }
+
+printf("--- %s: %u device(s), %u connection(s) ---\n", final ? "Final" : "Report",
+       devs, conns_open);
+printf("datagrams %llu (%.0f/s) records %llu (%.0f/s) dup %llu bad %llu dropped %llu\n",
+       (unsigned long long)dgrams, dgrams / secs, (unsigned long long)records,
+       records / secs, (unsigned long long)dups, (unsigned long long)bad,
+       (unsigned long long)drops);
+printf("writes %llu, %.1f MB, %.1f records per write\n", (unsigned long long)writes,
+       bytes / 1e6, writes ? (double)records / writes : 0.0);
+
+if( final )
+    {
+    for( i = 0; i < MAX_DEVICES; i++ )
+        {
+        if( devices[i] != NULL )
+            {
+            lost += tdec_lost(&devices[i]->seq);
+            reordered += devices[i]->seq.reordered;
+            }
+        }
+    printf("lost %llu reordered %llu\n", (unsigned long long)lost,
+           (unsigned long long)reordered);
+    }
+fflush(stdout);
+}
+
+
+/**************************************************
+    stop
+**************************************************/
+void stop
+    (
+    int sig
+    )
+{
+(void)sig;
+done = 1;
+}
+
+
+/**************************************************
+    wake_workers
+        Wake the workers that were given datagrams
+        and have gone to sleep, one eventfd write
+        each per epoll round.
+**************************************************/
+void wake_workers
+    (
+    void
+    )
+{
+uint64_t one = 1;
+int i;
+
+for( i = 0; i < worker_cnt; i++ )
+    {
+    if( !workers[i].kick )
+        {
+        continue;
+        }
+    workers[i].kick = 0;
+
+    /* Pairs with the fence in worker_main(), no wake up is lost */
+    atomic_thread_fence(memory_order_seq_cst);
+    if( atomic_load_explicit(&workers[i].sleeping, memory_order_relaxed) )
+        {
+        if( write(workers[i].efd, &one, sizeof(one)) < 0 )
+            {
+            perror("eventfd");
+            }
+        }
+    }
+}
+
+
+/**************************************************
+    worker_dgram
+        Decode one datagram into the CSV buffer of
+        its device.
+**************************************************/
+void worker_dgram
+    (
+    worker_type   *w,
+    const uint8_t *buf,
+    int            len
+    )
+{
+device_type *dev;
+uint16_t id;
+int records;
+
+records = tdec_records(buf, len, NULL, NULL);
+if( records < 0 )
+    {
+    atomic_fetch_add_explicit(&w->bad, 1, memory_order_relaxed);
+    return;
+    }
+
+id = telem_get_u16(&buf[2]);
+dev = devices[id];
+if( dev == NULL )
+    {
+    dev = calloc(1, sizeof(*dev));
+    if( dev == NULL )
+        {
+        return;
+        }
+    dev->id = id;
+    dev->fd = -1;
+    devices[id] = dev;
+    atomic_fetch_add_explicit(&w->devices, 1, memory_order_relaxed);
+    }
+
+dev->cur_seq = telem_get_u32(&buf[4]);
+if( !tdec_track_seq(&dev->seq, dev->cur_seq, telem_get_u32(&buf[8])) )
+    {
+    atomic_fetch_add_explicit(&w->dups, 1, memory_order_relaxed);
+    return;
+    }
+
+/* Room for the records of a whole datagram */
+if( OUT_SZ - dev->out_len < ((len - TELEM_HDR_SZ) / 3 + 1) * OUT_LINE_MAX )
+    {
+    flush_device(w, dev);
+    }
+
+tdec_records(buf, len, put_record, dev);
+dev->records += records;
+if( !dev->dirty )
+    {
+    dev->dirty = 1;
+    w->dirty[w->dirty_cnt++] = dev;
+    }
+
+atomic_fetch_add_explicit(&w->dgrams, 1, memory_order_relaxed);
+atomic_fetch_add_explicit(&w->records, records, memory_order_relaxed);
+}
+
+
+/**************************************************
+    worker_main
+        Drain the ring, write the dirty devices every
+        flush interval and sleep on the eventfd when
+        there is nothing to do.
+**************************************************/
+void *worker_main
+    (
+    void *arg
+    )
+{
+worker_type *w = arg;
+struct pollfd pfd;
+struct timespec now;
+int64_t now_ms;
+int64_t next_flush;
+uint32_t tail;
+uint64_t cnt;
+int idle;
+int i;
+
+pfd.fd = w->efd;
+pfd.events = POLLIN;
+clock_gettime(CLOCK_MONOTONIC, &now);
+next_flush = now.tv_sec * 1000LL + now.tv_nsec / 1000000 + flush_ms;
+
+while( 1 )
+    {
+    idle = 1;
+    tail = atomic_load_explicit(&w->tail, memory_order_relaxed);
+    while( tail != atomic_load_explicit(&w->head, memory_order_acquire) )
+        {
+        worker_dgram(w, w->slots[tail % RING_SLOTS].buf, w->slots[tail % RING_SLOTS].len);
+        atomic_store_explicit(&w->tail, ++tail, memory_order_release);
+        idle = 0;
+        }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    now_ms = now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+    if( now_ms >= next_flush || done )
+        {
+        for( i = 0; i < w->dirty_cnt; i++ )
+            {
+            flush_device(w, w->dirty[i]);
+            w->dirty[i]->dirty = 0;
+            }
+        w->dirty_cnt = 0;
+        next_flush = now_ms + flush_ms;
+        }
+
+    if( done && tail == atomic_load(&w->head) )
+        {
+        break;
+        }
+
+    if( !idle )
+        {
+        continue;
+        }
+
+    /* Say we sleep, then look once more: pairs with wake_workers() */
+    atomic_store_explicit(&w->sleeping, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    if( tail == atomic_load_explicit(&w->head, memory_order_relaxed) && !done )
+        {
+        poll(&pfd, 1, (int)(next_flush - now_ms));
+        if( read(w->efd, &cnt, sizeof(cnt)) < 0 )
+            {
+            cnt = 0;
+            }
+        }
+    atomic_store_explicit(&w->sleeping, 0, memory_order_relaxed);
+    }
+
+for( i = 0; i < w->fd_cnt; i++ )
+    {
+    close(w->fd_devs[i]->fd);
+    }
+return NULL;
+}
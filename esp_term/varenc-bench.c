@@ -0,0 +1,311 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "varenc.h"
+
+/**************************************************
+    Defines
+**************************************************/
+#define LINE_SZ         256
+#define DFLT_SYNTH      10000
+#define RUNS            20
+
+/**************************************************
+    Prototypes
+**************************************************/
+int load(FILE *f, int hex);
+double now_ns(void);
+void synthesize(int count);
+
+/**************************************************
+    Globals etc
+**************************************************/
+int32_t *records;
+int      rec_cnt;
+int      rec_cap;
+int      fields;
+long     text_sz;
+
+/**************************************************
+    main
+        Measure varenc.h on recorded samples: one
+        record per line, whitespace separated
+        integer columns, '#' lines skipped. With -x
+        the columns after the first are hex, as
+        printed by dev_mem watch. Without a file a
+        synthetic sensor trace is used.
+
+        usage: varenc_bench [-x] [-n records] [file]
+**************************************************/
+int main
+    (
+    int     argc,
+    char   *argv[]
+    )
+{
+FILE *f;
+uint8_t *out;
+int32_t rec[VARENC_FIELDS_MAX];
+varenc_ctx_type ctx;
+long cap;
+long len;
+long pos;
+double t0;
+double enc_ns;
+double dec_ns;
+int16_t n;
+int opt;
+int hex;
+int synth;
+int run;
+int i;
+
+hex = 0;
+synth = DFLT_SYNTH;
+while( (opt = getopt(argc, argv, "xn:")) != -1 )
+    {
+    switch( opt )
+        {
+        case 'x':
+            hex = 1;
+            break;
+        case 'n':
+            synth = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-x] [-n records] [file]\n", argv[0]);
+            return 1;
+        }
+    }
+
+if( optind < argc )
+    {
+    f = fopen(argv[optind], "r");
+    if( f == NULL )
+        {
+        perror(argv[optind]);
+        return 1;
+        }
+    if( load(f, hex) < 0 )
+        {
+        fclose(f);
+        return 1;
+        }
+    fclose(f);
+    printf("%s: %d records of %d fields\n", argv[optind], rec_cnt, fields);
+    }
+else
+    {
+    synthesize(synth);
+    printf("synthetic trace: %d records of %d fields\n", rec_cnt, fields);
+    }
+
+if( rec_cnt == 0 )
+    {
+    fprintf(stderr, "no records\n");
+    return 1;
+    }
+
+cap = (long)rec_cnt * VARENC_REC_MAX + VARENC_UVAR_MAX;
+out = malloc(cap);
+
+/* Encode, best of RUNS to keep scheduling noise out */
+enc_ns = 0;
+len = 0;
+for( run = 0; run < RUNS; run++ )
+    {
+    t0 = now_ns();
+    varenc_init(&ctx, fields);
+    len = 0;
+    for( i = 0; i < rec_cnt; i++ )
+        {
+        len += varenc_put(&ctx, &records[i * fields], &out[len], 0xFFFF);
+        }
+    len += varenc_flush(&ctx, &out[len], 0xFFFF);
+    t0 = now_ns() - t0;
+    if( run == 0 || t0 < enc_ns )
+        {
+        enc_ns = t0;
+        }
+    }
+
+/* Decode and check the round trip */
+dec_ns = 0;
+for( run = 0; run < RUNS; run++ )
+    {
+    t0 = now_ns();
+    varenc_init(&ctx, fields);
+    pos = 0;
+    for( i = 0; i < rec_cnt; i++ )
+        {
+        n = varenc_get(&ctx, &out[pos], (len - pos > 0xFFFF) ? 0xFFFF : len - pos, rec);
+        if( n < 0 || memcmp(rec, &records[i * fields], fields * sizeof(int32_t)) != 0 )
+            {
+            fprintf(stderr, "round trip failed at record %d\n", i);
+            return 1;
+            }
+        pos += n;
+        }
+    t0 = now_ns() - t0;
+    if( pos != len )
+        {
+        fprintf(stderr, "round trip left %ld bytes\n", len - pos);
+        return 1;
+        }
+    if( run == 0 || t0 < dec_ns )
+        {
+        dec_ns = t0;
+        }
+    }
+
+if( text_sz > 0 )
+    {
+    printf("text    %8ld bytes  %5.2f bytes/rec\n", text_sz, (double)text_sz / rec_cnt);
+    }
+printf("fixed   %8ld bytes  %5.2f bytes/rec\n", (long)rec_cnt * fields * 4, fields * 4.0);
+printf("varenc  %8ld bytes  %5.2f bytes/rec  %.1fx fixed",
+       len, (double)len / rec_cnt, (double)rec_cnt * fields * 4 / len);
+if( text_sz > 0 )
+    {
+    printf("  %.1fx text", (double)text_sz / len);
+    }
+printf("\n");
+printf("encode  %.1f ns/rec  decode %.1f ns/rec (host)\n",
+       enc_ns / rec_cnt, dec_ns / rec_cnt);
+
+free(out);
+free(records);
+return 0;
+}
+
+
+/**************************************************
+    load
+        Read the records of a file, all lines must
+        have the number of columns of the first.
+**************************************************/
+int load
+    (
+    FILE *f,
+    int   hex
+    )
+{
+char line[LINE_SZ];
+char *p;
+char *end;
+int32_t rec[VARENC_FIELDS_MAX];
+int n;
+int line_no;
+
+line_no = 0;
+while( fgets(line, sizeof(line), f) != NULL )
+    {
+    line_no++;
+    if( line[0] == '#' )
+        {
+        continue;
+        }
+
+    n = 0;
+    p = line;
+    while( 1 )
+        {
+        while( *p == ' ' || *p == '\t' || *p == ',' )
+            {
+            p++;
+            }
+        if( *p == '\n' || *p == '\0' )
+            {
+            break;
+            }
+        if( n == VARENC_FIELDS_MAX )
+            {
+            fprintf(stderr, "line %d: more than %d columns\n", line_no, VARENC_FIELDS_MAX);
+            return -1;
+            }
+        rec[n] = (int32_t)strtoul(p, &end, (hex && n > 0) ? 16 : 10);
+        if( end == p )
+            {
+            fprintf(stderr, "line %d: not a number\n", line_no);
+            return -1;
+            }
+        n++;
+        p = end;
+        }
+
+    if( n == 0 )
+        {
+        continue;
+        }
+    if( fields == 0 )
+        {
+        fields = n;
+        }
+    if( n != fields )
+        {
+        fprintf(stderr, "line %d: %d columns, expected %d\n", line_no, n, fields);
+        return -1;
+        }
+
+    if( rec_cnt == rec_cap )
+        {
+        rec_cap = rec_cap ? rec_cap * 2 : 1024;
+        records = realloc(records, (size_t)rec_cap * fields * sizeof(int32_t));
+        }
+    memcpy(&records[rec_cnt * fields], rec, fields * sizeof(int32_t));
+    rec_cnt++;
+    text_sz += strlen(line);
+    }
+
+return 0;
+}
+
+
+/**************************************************
+    synthesize
+        A sensor sampled every 10 ms with some
+        jitter: time, a value that wanders by a few
+        counts, a slow drift and an event counter.
+        The text size is that of printing it.
+**************************************************/
+void synthesize
+    (
+    int count
+    )
+{
+int32_t *r;
+int i;
+
+fields = 4;
+rec_cnt = count;
+records = malloc((size_t)count * fields * sizeof(int32_t));
+srand(1);
+for( i = 0; i < count; i++ )
+    {
+    r = &records[i * fields];
+    r[0] = i * 10 + (rand() % 8 == 0);
+    r[1] = (i ? r[1 - fields] : 2048) + rand() % 7 - 3;
+    r[2] = 25000 + i / 100;
+    r[3] = (i ? r[3 - fields] : 0) + (rand() % 64 == 0);
+    text_sz += snprintf(NULL, 0, "%d %d %d %d\n", r[0], r[1], r[2], r[3]);
+    }
+}
+
+
+/**************************************************
+    now_ns
+**************************************************/
+double now_ns
+    (
+    void
+    )
+{
+struct timespec ts;
+
+clock_gettime(CLOCK_MONOTONIC, &ts);
+return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
@@ -0,0 +1,25 @@
+#ifndef _ASYNC_H
+#define _ASYNC_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define ASYNC_ERR_NOMEM     -1      /* no free frame in the pool    */
+
+/*--------------------------------------------------------
+Coroutine driver layer (async.hpp). async_poll() resumes
+every coroutine whose event has happened; call it from
+the main loop, after the pollers of the drivers awaited
+(esp_at_poll() for AT commands).
+--------------------------------------------------------*/
+void async_poll( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,365 @@
+#ifndef _ASYNC_HPP
+#define _ASYNC_HPP
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+extern "C" {
+#include "esp_at.h"
+#include "esp_uart.h"
+#include "timer.h"
+#include "uart_print.h"
+}
+#include "async.h"
+
+/*--------------------------------------------------------
+C++20 coroutines over the drivers' completion events, so
+a sequence like "send an AT command, wait for OK with a
+timeout, wait 100 ms, ..." is written top to bottom but
+suspends without a stack of its own:
+
+    using join_pool = async::frame_pool< 96, 1 >;
+
+    async::task< join_pool > join( void )
+    {
+        if( co_await async::at_cmd( "AT+CWJAP_CUR?", 1000 ) != ESP_AT_OK )
+        {
+            co_return -1;
+        }
+        co_await async::sleep( 100 );
+        ...
+    }
+
+    async::spawn( join() );
+
+Frames come from the fixed pool named by the task type,
+never the heap; a task that finds its pool full is
+invalid (task::valid()) and awaiting it gives
+ASYNC_ERR_NOMEM. The compiler does not reveal frame
+sizes before link time, so the pool layout is checked at
+compile time and each allocation against the slot size
+when it is made; frame_pool::largest shows what a slot
+needs ("async" shell command).
+
+Everything here runs in the main loop: coroutines are
+resumed by async_poll(), and driver callbacks only mark
+their awaiter done. A task may be destroyed before it
+finishes; the wait it is suspended in is withdrawn and
+an AT command it issued completes without it.
+--------------------------------------------------------*/
+namespace async
+{
+
+/*--------------------------------------------------------
+Fixed pool of coroutine frames, one per pool type
+--------------------------------------------------------*/
+template< std::size_t SLOT_SZ, std::size_t SLOTS >
+class frame_pool
+{
+    static_assert( SLOTS > 0 && SLOTS <= 32, "slots are tracked in a 32 bit mask" );
+    static_assert( SLOT_SZ >= 16 && SLOT_SZ % 8 == 0, "slots must keep frames 8 byte aligned" );
+    static_assert( SLOT_SZ * SLOTS <= 1024, "a frame pool should not take an eighth of RAM" );
+
+public:
+    static constexpr std::size_t slot_sz = SLOT_SZ;
+    static constexpr std::size_t slots   = SLOTS;
+
+    static inline std::size_t largest;  /* largest frame asked for  */
+    static inline uint16_t    fails;    /* frames not given         */
+
+    static void *alloc( std::size_t sz ) noexcept
+    {
+        if( sz > largest )
+        {
+            largest = sz;
+        }
+
+        for( std::size_t i = 0; sz <= SLOT_SZ && i < SLOTS; i++ )
+        {
+            if( ( s_used & ( 1u << i ) ) == 0 )
+            {
+                s_used |= 1u << i;
+                return s_slots[ i ];
+            }
+        }
+
+        fails++;
+        return nullptr;
+    }
+
+    static void free( void *frame ) noexcept
+    {
+        s_used &= ~( 1u << ( ( static_cast< uint8_t * >( frame ) - s_slots[ 0 ] ) / SLOT_SZ ) );
+    }
+
+private:
+    alignas( 8 ) static inline uint8_t s_slots[ SLOTS ][ SLOT_SZ ];
+    static inline uint32_t  s_used;     /* slot bit mask            */
+};
+
+/*--------------------------------------------------------
+Something a coroutine waits for. ready() is called from
+async_poll() until it returns true, then the coroutine
+is resumed. The node lives in the coroutine's frame, so
+destroying a suspended coroutine takes it off the list.
+--------------------------------------------------------*/
+struct wait_node;
+
+void cancel( wait_node *node );
+
+struct wait_node
+{
+    bool                  ( *ready )( wait_node *node );
+    std::coroutine_handle<> handle;     /* set while on the list    */
+    wait_node            *next;
+
+    ~wait_node() { if( handle ) cancel( this ); }
+
+    bool await_ready( void ) const noexcept { return false; }
+};
+
+void wait( wait_node *node, std::coroutine_handle<> handle );
+
+/*--------------------------------------------------------
+Coroutine returning an int32_t status. Tasks start when
+awaited, or with spawn(), which lets a task run on its
+own and returns its frame to the pool when it ends.
+--------------------------------------------------------*/
+template< class POOL >
+class task
+{
+public:
+    struct promise_type;
+    using handle_type = std::coroutine_handle< promise_type >;
+
+    struct final_awaiter
+    {
+        bool await_ready( void ) const noexcept { return false; }
+
+        std::coroutine_handle<> await_suspend( handle_type h ) noexcept
+        {
+            std::coroutine_handle<> cont = h.promise().cont;
+
+            if( h.promise().detached )
+            {
+                h.destroy();
+            }
+            return cont ? cont : std::noop_coroutine();
+        }
+
+        void await_resume( void ) const noexcept {}
+    };
+
+    struct promise_type
+    {
+        int32_t                 result   = 0;
+        std::coroutine_handle<> cont;
+        bool                    detached = false;
+
+        static void *operator new( std::size_t sz ) noexcept { return POOL::alloc( sz ); }
+        static void operator delete( void *frame ) noexcept { POOL::free( frame ); }
+
+        static task get_return_object_on_allocation_failure( void ) noexcept { return task( nullptr ); }
+        task get_return_object( void ) noexcept { return task( handle_type::from_promise( *this ) ); }
+
+        std::suspend_always initial_suspend( void ) const noexcept { return {}; }
+        final_awaiter final_suspend( void ) const noexcept { return {}; }
+        void return_value( int32_t value ) noexcept { result = value; }
+        void unhandled_exception( void ) noexcept { abort(); }
+    };
+
+    struct awaiter
+    {
+        handle_type h;
+
+        bool await_ready( void ) const noexcept { return !h || h.done(); }
+
+        std::coroutine_handle<> await_suspend( std::coroutine_handle<> cont ) noexcept
+        {
+            h.promise().cont = cont;
+            return h;
+        }
+
+        int32_t await_resume( void ) const noexcept
+        {
+            return h ? h.promise().result : ASYNC_ERR_NOMEM;
+        }
+    };
+
+    explicit task( handle_type h ) noexcept : m_h( h ) {}
+    task( task &&other ) noexcept : m_h( other.m_h ) { other.m_h = nullptr; }
+    task( const task & ) = delete;
+    task &operator=( const task & ) = delete;
+    task &operator=( task &&other ) noexcept
+    {
+        if( this != &other )
+        {
+            if( m_h )
+            {
+                m_h.destroy();
+            }
+            m_h = other.m_h;
+            other.m_h = nullptr;
+        }
+        return *this;
+    }
+    ~task() { if( m_h ) m_h.destroy(); }
+
+    bool valid( void ) const noexcept { return static_cast< bool >( m_h ); }
+    bool done( void ) const noexcept { return !m_h || m_h.done(); }
+    int32_t result( void ) const noexcept { return m_h ? m_h.promise().result : ASYNC_ERR_NOMEM; }
+
+    /* Run a task kept by its owner up to its first wait */
+    void start( void ) noexcept { if( m_h && !m_h.done() ) m_h.resume(); }
+
+    awaiter operator co_await() && noexcept { return awaiter{ m_h }; }
+    awaiter operator co_await() & noexcept { return awaiter{ m_h }; }
+
+    /* Hand the frame over to the task itself */
+    handle_type release( void ) noexcept
+    {
+        handle_type h = m_h;
+
+        m_h = nullptr;
+        return h;
+    }
+
+private:
+    handle_type m_h;
+};
+
+/*--------------------------------------------------------
+Run a task on its own, false if it got no frame
+--------------------------------------------------------*/
+template< class POOL >
+bool spawn( task< POOL > &&t ) noexcept
+{
+    typename task< POOL >::handle_type h = t.release();
+
+    if( !h )
+    {
+        return false;
+    }
+
+    h.promise().detached = true;
+    h.resume();
+    return true;
+}
+
+/*--------------------------------------------------------
+Resume on the next async_poll()
+--------------------------------------------------------*/
+struct yield : wait_node
+{
+    static bool poll( wait_node * ) { return true; }
+
+    void await_suspend( std::coroutine_handle<> h ) noexcept { ready = poll; wait( this, h ); }
+    void await_resume( void ) const noexcept {}
+};
+
+/*--------------------------------------------------------
+Resume after a number of timer ticks (ms)
+--------------------------------------------------------*/
+struct sleep : wait_node
+{
+    timer_ticks_t       deadline;
+
+    explicit sleep( timer_ticks_t ms ) noexcept : deadline( timer_get_ticks() + ms ) {}
+
+    static bool poll( wait_node *node )
+    {
+        return timer_expired( static_cast< sleep * >( node )->deadline );
+    }
+
+    bool await_ready( void ) const noexcept { return timer_expired( deadline ); }
+    void await_suspend( std::coroutine_handle<> h ) noexcept { ready = poll; wait( this, h ); }
+    void await_resume( void ) const noexcept {}
+};
+
+/*--------------------------------------------------------
+Issue an AT command once the engine is free and resume
+with its result, ESP_AT_TIMEOUT if the engine stays busy
+for timeout ms or the command gets no reply in timeout ms
+--------------------------------------------------------*/
+struct at_cmd : wait_node
+{
+    const char         *cmd;
+    timer_ticks_t       timeout;
+    timer_ticks_t       deadline;   /* engine busy for too long */
+    bool                issued = false;
+    bool                done   = false;
+    esp_at_result_type  result = ESP_AT_TIMEOUT;
+
+    at_cmd( const char *c, timer_ticks_t t = ESP_AT_TIMEOUT_DFLT ) noexcept
+        : cmd( c ), timeout( t ), deadline( timer_get_ticks() + t ) {}
+
+    ~at_cmd() { if( issued && !done ) esp_at_forget( this ); }
+
+    static void done_cb( esp_at_result_type res, void *ctx )
+    {
+        static_cast< at_cmd * >( ctx )->result = res;
+        static_cast< at_cmd * >( ctx )->done   = true;
+    }
+
+    static bool poll( wait_node *node )
+    {
+        at_cmd *a = static_cast< at_cmd * >( node );
+
+        if( !a->issued && !esp_at_busy() )
+        {
+            a->issued = esp_at_cmd( a->cmd, a->timeout, done_cb, a );
+        }
+        return a->done || ( !a->issued && timer_expired( a->deadline ) );
+    }
+
+    void await_suspend( std::coroutine_handle<> h ) noexcept { ready = poll; wait( this, h ); }
+    esp_at_result_type await_resume( void ) const noexcept { return result; }
+};
+
+/*--------------------------------------------------------
+Wait for a UART 2 DMA transfer (esp_uart_write_dma()) to
+complete
+--------------------------------------------------------*/
+struct esp_tx_done : wait_node
+{
+    static bool poll( wait_node * ) { return !esp_uart_tx_busy(); }
+
+    bool await_ready( void ) const noexcept { return !esp_uart_tx_busy(); }
+    void await_suspend( std::coroutine_handle<> h ) noexcept { ready = poll; wait( this, h ); }
+    void await_resume( void ) const noexcept {}
+};
+
+/*--------------------------------------------------------
+Wait for bytes on UART 1 and resume with up to len of
+them, 0 after timeout ms or a uart_read() error code.
+Nothing arrives while the control protocol owns UART 1
+receive.
+--------------------------------------------------------*/
+struct uart_rx : wait_node
+{
+    uint8_t            *buf;
+    uint16_t            len;
+    timer_ticks_t       deadline;
+    int16_t             got = 0;
+
+    uart_rx( void *b, uint16_t l, timer_ticks_t timeout ) noexcept
+        : buf( static_cast< uint8_t * >( b ) ), len( l ), deadline( timer_get_ticks() + timeout ) {}
+
+    static bool poll( wait_node *node )
+    {
+        uart_rx *r = static_cast< uart_rx * >( node );
+
+        r->got = static_cast< int16_t >( uart_read( r->buf, r->len ) );
+        return r->got != 0 || timer_expired( r->deadline );
+    }
+
+    bool await_ready( void ) noexcept { return poll( this ) && got != 0; }
+    void await_suspend( std::coroutine_handle<> h ) noexcept { ready = poll; wait( this, h ); }
+    int16_t await_resume( void ) const noexcept { return got; }
+};
+
+}   /* namespace async */
+
+#endif
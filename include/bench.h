@@ -0,0 +1,88 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/*--------------------------------------------------------
+Set to 1 to build the benchmark. It takes about 500 bytes
+of RAM, which the default build does not have to spare,
+and needs a debugger or QEMU as the semihosting host.
+--------------------------------------------------------*/
+#ifndef BENCH_ENABLE
+#define BENCH_ENABLE        0
+#endif
+
+/*--------------------------------------------------------
+Set to 1 for builds run under QEMU (-semihosting), which
+has no debugger to detect. Otherwise files are only
+opened while a debugger is attached, as a semihosting
+call without one is a hard fault.
+--------------------------------------------------------*/
+#ifndef BENCH_SEMIHOSTING
+#define BENCH_SEMIHOSTING   0
+#endif
+
+#define BENCH_CHUNK_SZ      128     /* bytes per SYS_READ           */
+#define BENCH_FRAME_MAX     256     /* decoded frame or output      */
+
+#define BENCH_ERR_HOST      -1      /* no semihosting host          */
+#define BENCH_ERR_TARGET    -2      /* unknown target               */
+#define BENCH_ERR_OPEN      -3      /* host could not open a file   */
+#define BENCH_ERR_BUSY      -4      /* a run is in progress         */
+
+/*--------------------------------------------------------
+Benchmark targets, the interface the input is fed to
+--------------------------------------------------------*/
+typedef enum
+{
+    BENCH_T_UART,                   /* UART 1 receive path, one     */
+                                    /* frame per main loop pass     */
+    BENCH_T_ESP,                    /* ESP8266 response parser      */
+    BENCH_T_COBS,                   /* COBS frame decoder           */
+    BENCH_T_CNT
+} bench_target_type;
+
+/*--------------------------------------------------------
+Result of the last run. Cycles count only the target's
+own work (DWT CYCCNT), the run time is from start to end
+of file including the host's file access.
+--------------------------------------------------------*/
+typedef struct
+{
+    bench_target_type   target;     /* target fed                   */
+    uint32_t            bytes;      /* input bytes fed              */
+    uint32_t            cycles;     /* cycles in the target         */
+    uint32_t            run_us;     /* run time, us                 */
+    uint32_t            items;      /* frames or lines produced     */
+    uint32_t            out_bytes;  /* bytes written to the output  */
+    uint32_t            errors;     /* target errors and drops      */
+} bench_result_type;
+
+/*--------------------------------------------------------
+Benchmark input over ARM semihosting. A recorded file on
+the host (a UART capture, sample data) is read with
+SYS_READ a chunk per bench_poll() and fed to a driver
+interface, and what the target produces is written to an
+output file with SYS_WRITE:
+
+   uart   the control protocol sees the bytes as if they
+          had arrived on UART 1; no output file
+   esp    response lines, then +IPD payload of link 0,
+          as the AT layer would read them
+   cobs   each decoded frame, after its length as u16 LE
+
+A summary goes to the host console (":tt"). Under QEMU
+the run is started from the semihosting command line,
+"... bench <target> <input> [output]", and the firmware
+exits when it is done; otherwise from the shell.
+--------------------------------------------------------*/
+void bench_init( void );
+void bench_poll( void );
+int8_t bench_start( const char *target, const char *in_path,
+                    const char *out_path );
+bool bench_active( void );
+void bench_get_result( bench_result_type *result );
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef _BRIDGE_H
+#define _BRIDGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "timer.h"
+
+
+/*--------------------------------------------------------
+Set to 1, for every file, to run as a transparent UART 1
+to TCP bridge instead of the control protocol (main.c).
+The shell and the modules only the control protocol uses
+are left out.
+--------------------------------------------------------*/
+#ifndef BRIDGE_ENABLE
+#define BRIDGE_ENABLE       0
+#endif
+
+/*--------------------------------------------------------
+Bridge configuration
+--------------------------------------------------------*/
+typedef struct
+{
+    const char         *host;       /* TCP server address           */
+    uint16_t            port;       /* TCP server port              */
+    uint8_t             link;       /* ESP8266 link id, 0-4         */
+    uint16_t            flush_size; /* send once this many bytes    */
+    timer_ticks_t       flush_idle; /* send after console idle, ms  */
+} bridge_cfg_type;
+
+/*--------------------------------------------------------
+Bridge statistics. Latency is measured from the poll that
+first sees a byte to the end of its transfer (SEND OK for
+UART 1 -> Wi-Fi, DMA complete for Wi-Fi -> UART 1).
+--------------------------------------------------------*/
+typedef struct
+{
+    uint32_t            up_bytes;   /* UART 1 -> Wi-Fi bytes        */
+    uint32_t            down_bytes; /* Wi-Fi -> UART 1 bytes        */
+    uint32_t            up_sends;   /* CIPSEND batches              */
+    uint32_t            up_errors;  /* failed CIPSEND batches       */
+    uint32_t            up_overruns;/* RX ring lapped unsent data,  */
+                                    /* which was dropped            */
+    uint32_t            connects;   /* TCP connections opened       */
+    uint32_t            up_rate;    /* up bytes/s, last second      */
+    uint32_t            down_rate;  /* down bytes/s, last second    */
+    timer_ticks_t       up_lat_last;/* last batch latency, ms       */
+    timer_ticks_t       up_lat_max; /* worst batch latency, ms      */
+    uint32_t            up_lat_sum; /* sum of batch latencies, ms   */
+    timer_ticks_t       down_lat_last;
+                                    /* last transfer latency, ms    */
+    timer_ticks_t       down_lat_max;
+                                    /* worst transfer latency, ms   */
+} bridge_stats_type;
+
+/*--------------------------------------------------------
+Transparent UART 1 <-> TCP bridge. While running the
+bridge owns UART 1, both directions use DMA and the
+console receive interrupt is disabled.
+--------------------------------------------------------*/
+void bridge_start( const bridge_cfg_type *cfg );
+void bridge_stop( void );
+void bridge_poll( void );
+bool bridge_connected( void );
+void bridge_get_stats( bridge_stats_type *stats );
+
+#endif
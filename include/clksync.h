@@ -0,0 +1,42 @@
+#ifndef _CLKSYNC_H
+#define _CLKSYNC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/*--------------------------------------------------------
+Host clock view. The host measures the offset between the
+two clocks with TIME_REQ exchanges (proto_wire.h), fits
+offset and rate over several rounds and sends the result
+with TIME_SET; device times are then converted as
+
+   host = ref_host + d + d * rate_ppb / 1e9,
+   d    = device - ref_device
+
+Receive times are taken in the UART interrupt at the
+frame delimiter, send times just before the reply is
+encoded, both with timer_get_us().
+--------------------------------------------------------*/
+typedef struct
+{
+    uint64_t            ref_dev;    /* device reference time, us    */
+    uint64_t            ref_host;   /* host time at ref_dev, us     */
+    int32_t             rate_ppb;   /* host rate minus device rate  */
+    uint32_t            error_us;   /* bound given by the host      */
+    uint64_t            set_at;     /* device time of the TIME_SET, */
+                                    /* 0 if never synchronized      */
+} clksync_type;
+
+/*--------------------------------------------------------
+Answer TIME_REQ and take TIME_SET. The conversions use
+the state of the last TIME_SET and must be called from
+the main loop, not from interrupts. proto_init() must be
+called first.
+--------------------------------------------------------*/
+void clksync_init( void );
+bool clksync_to_host( uint64_t dev_us, uint64_t *host_us );
+bool clksync_host_now( uint64_t *host_us );
+void clksync_get( clksync_type *sync );
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef _COBS_H
+#define _COBS_H
+
+#include <stdint.h>
+
+
+#define COBS_BLOCK_MAX      254     /* longest run without a code   */
+#define COBS_ERR            -1      /* malformed encoded data       */
+
+/*--------------------------------------------------------
+Consistent Overhead Byte Stuffing, in place. Encoded data
+contains no 0x00 bytes so 0x00 can delimit frames.
+
+cobs_encode() takes len bytes of data at buf[ 1 ] and
+encodes them into buf[ 0 ] .. buf[ len ]. len must not be
+more than COBS_BLOCK_MAX, it returns len + 1, or 0 if len
+is too long.
+
+cobs_decode() decodes len bytes at buf, without the
+delimiter, to the start of buf and returns the decoded
+length, or COBS_ERR.
+--------------------------------------------------------*/
+uint16_t cobs_encode( uint8_t *buf, uint16_t len );
+int16_t cobs_decode( uint8_t *buf, uint16_t len );
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef _CONN_H
+#define _CONN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "net.h"
+#include "timer.h"
+
+
+/*--------------------------------------------------------
+Set to 1 to build the pool, for clients that use it. It
+takes about 400 bytes of RAM and 640 bytes of the socket
+budget (net.h) for each connection open.
+--------------------------------------------------------*/
+#ifndef CONN_ENABLE
+#define CONN_ENABLE         0
+#endif
+
+#define CONN_CNT            3       /* pooled connections           */
+#define CONN_DNS_CNT        4       /* host names cached            */
+#define CONN_RX_SZ          128     /* socket receive buffer        */
+#define CONN_TX_SZ          512     /* socket transmit buffer       */
+#define CONN_DNS_TTL_DFLT   600     /* cached address lifetime, s   */
+#define CONN_IDLE_DFLT      120000  /* idle connection kept, ms     */
+#define CONN_KEEPALIVE_DFLT 60      /* TCP keep alive, s            */
+
+#define CONN_ERR_FULL       -1      /* every connection in use      */
+#define CONN_ERR_NET        -2      /* no socket or buffer space    */
+
+/*--------------------------------------------------------
+Connection manager settings
+--------------------------------------------------------*/
+typedef struct
+{
+    uint16_t            dns_ttl;    /* cached address lifetime, s   */
+    timer_ticks_t       idle;       /* idle connection kept, ms     */
+    uint16_t            keepalive;  /* TCP keep alive, s, 0 for none*/
+} conn_cfg_type;
+
+/*--------------------------------------------------------
+Connection manager statistics
+--------------------------------------------------------*/
+typedef struct
+{
+    uint32_t            gets;       /* conn_get() calls answered    */
+    uint32_t            reused;     /* ... with a warm connection   */
+    uint16_t            opens;      /* connections opened           */
+    uint16_t            idle_closes;/* closed after the idle time   */
+    uint16_t            dns_hits;   /* opened with a cached address */
+    uint16_t            lookups;    /* AT+CIPDOMAIN issued          */
+    uint16_t            lookup_fails;
+                                    /* lookups with no address      */
+    uint16_t            moves;      /* connections given a new      */
+                                    /* address                      */
+} conn_stats_type;
+
+/*--------------------------------------------------------
+Pool of persistent TCP connections (net.h) for clients
+that talk to the same servers again and again.
+
+conn_get() hands out a warm idle connection to the same
+host and port when there is one, so a request costs a
+single CIPSEND; otherwise it opens one, with the cached
+address of the host if it has one. The connection is
+persistent: it is reopened in the background when lost
+and data sent meanwhile goes out once it is back. The
+module probes it with TCP keep alives while idle.
+conn_put() gives it back to the pool, where it is kept
+for the idle time.
+
+Host addresses are resolved with AT+CIPDOMAIN and cached
+for the TTL, the module does not report the one of the
+DNS record. An address in use is resolved again when it
+expires or its connection has been down for a while; a
+changed address is used from the next reopen.
+
+net_init() must be called first, conn_poll() from the
+main loop.
+--------------------------------------------------------*/
+void conn_init( const conn_cfg_type *cfg );
+void conn_poll( void );
+int8_t conn_get( const char *host, uint16_t port, net_cb_type cb, void *ctx );
+void conn_put( int8_t sock );
+void conn_get_stats( conn_stats_type *stats );
+
+#endif
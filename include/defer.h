@@ -0,0 +1,62 @@
+#ifndef _DEFER_H
+#define _DEFER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#define DEFER_PRIO_HIGH     0       /* device data, run first       */
+#define DEFER_PRIO_NORMAL   1
+#define DEFER_PRIO_LOW      2
+#define DEFER_PRIO_CNT      3
+
+typedef void (*defer_fn_type)( void );
+
+/*--------------------------------------------------------
+A piece of deferred work, owned by the module queuing it
+and set up once with defer_setup()
+--------------------------------------------------------*/
+typedef struct defer_work_type
+{
+    defer_fn_type       fn;         /* work to run                  */
+    uint8_t             prio;       /* DEFER_PRIO_...               */
+    volatile bool       queued;     /* waiting to run               */
+    struct defer_work_type
+                       *next;       /* next in its priority list    */
+} defer_work_type;
+
+/*--------------------------------------------------------
+Deferred statistics
+--------------------------------------------------------*/
+typedef struct
+{
+    uint32_t            runs[ DEFER_PRIO_CNT ];
+                                    /* work run, by priority        */
+    uint32_t            coalesced;  /* queued while already queued  */
+    uint16_t            max_backlog;/* most items queued at once    */
+} defer_stats_type;
+
+/*--------------------------------------------------------
+Deferred interrupt work. An interrupt handler does only
+what the hardware needs (reading the data register) and
+queues the rest with defer_queue(), which pends PendSV.
+PendSV runs at the lowest priority, so every interrupt
+can preempt it, and runs the queued work highest
+priority first, in queuing order within a priority,
+until none is left. Work queued again before it has run
+runs once.
+
+Main loop code that shares data with deferred work
+brackets it with defer_lock() / defer_unlock(), which
+hold off PendSV (and SysTick, at the same level) but no
+device interrupt. defer_init() must be called before any
+interrupt is enabled.
+--------------------------------------------------------*/
+void defer_init( void );
+void defer_setup( defer_work_type *work, defer_fn_type fn, uint8_t prio );
+void defer_queue( defer_work_type *work );
+uint32_t defer_lock( void );
+void defer_unlock( uint32_t prev );
+void defer_get_stats( defer_stats_type *stats );
+
+#endif
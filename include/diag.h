@@ -0,0 +1,25 @@
+#ifndef _DIAG_H
+#define _DIAG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#define DIAG_RING_SZ        256     /* watch sample ring, bytes     */
+#define DIAG_FLUSH_TICKS    50      /* longest a sample waits, ms   */
+
+/*--------------------------------------------------------
+Live memory and register access over the control protocol
+(proto_wire.h): bulk reads streamed as MEM_DATA frames,
+writes, and a watch list sampled from the tick interrupt
+into a ring and streamed in batches. Only flash, system
+memory, SRAM, peripherals and the Cortex-M3 system space
+can be reached; reads of registers with read side
+effects (e.g. USART DR) have those effects.
+proto_init() must be called first.
+--------------------------------------------------------*/
+void diag_init( void );
+void diag_poll( void );
+bool diag_readable( uint32_t addr, uint32_t len );
+
+#endif
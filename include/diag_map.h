@@ -0,0 +1,15 @@
+#ifndef _DIAG_MAP_H
+#define _DIAG_MAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*--------------------------------------------------------
+Memory map the diagnostics may reach. Kept apart from
+diag.c so the host build can check it (esp_term/
+diag-map-test.c). True if the whole range lies in one
+region, and that region is writable for a write.
+--------------------------------------------------------*/
+bool diag_map_check( uint32_t addr, uint32_t len, bool write );
+
+#endif
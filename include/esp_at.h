@@ -0,0 +1,67 @@
+#ifndef _ESP_AT_H
+#define _ESP_AT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "timer.h"
+
+
+#define ESP_AT_SEND_MAX     2048    /* largest CIPSEND payload      */
+#define ESP_AT_URC_MAX      4       /* unsolicited line handlers    */
+#define ESP_AT_TIMEOUT_DFLT 2000    /* default command timeout, ms  */
+
+/*--------------------------------------------------------
+Final result of an AT command or CIPSEND
+--------------------------------------------------------*/
+typedef enum
+{
+    ESP_AT_OK,
+    ESP_AT_ERROR,
+    ESP_AT_TIMEOUT
+} esp_at_result_type;
+
+typedef void (*esp_at_done_cb_type)( esp_at_result_type result, void *ctx );
+typedef void (*esp_at_urc_cb_type)( const char *line );
+
+/*--------------------------------------------------------
+Command statistics
+--------------------------------------------------------*/
+typedef struct
+{
+    uint32_t            cmds;       /* commands issued              */
+    uint32_t            sends;      /* CIPSEND transfers issued     */
+    uint32_t            send_bytes; /* CIPSEND payload bytes        */
+    uint32_t            send_overhead;
+                                    /* CIPSEND command bytes        */
+    uint32_t            send_ticks; /* CIPSEND to SEND OK time, ms  */
+    uint16_t            errors;     /* ERROR / FAIL results         */
+    uint16_t            timeouts;   /* commands that timed out      */
+} esp_at_stats_type;
+
+/*--------------------------------------------------------
+Non-blocking AT command engine on top of the UART 2 line
+parser. One command is outstanding at a time, callers
+check esp_at_busy() and retry on a later poll. Lines
+that are not a response to the current command (link
+CONNECT / CLOSED, WIFI DISCONNECT, ...) go to the
+registered unsolicited line handlers.
+--------------------------------------------------------*/
+void esp_at_init( void );
+void esp_at_poll( void );
+bool esp_at_busy( void );
+bool esp_at_cmd( const char *cmd, timer_ticks_t timeout,
+                 esp_at_done_cb_type done_cb, void *ctx );
+bool esp_at_send( uint8_t link, const void *data, uint16_t len,
+                  timer_ticks_t timeout, esp_at_done_cb_type done_cb,
+                  void *ctx );
+bool esp_at_send_split( uint8_t link, const void *data1, uint16_t len1,
+                        const void *data2, uint16_t len2,
+                        timer_ticks_t timeout, esp_at_done_cb_type done_cb,
+                        void *ctx );
+void esp_at_forget( void *ctx );
+const char *esp_at_info( void );
+bool esp_at_add_urc_handler( esp_at_urc_cb_type urc_cb );
+void esp_at_get_stats( esp_at_stats_type *stats );
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef _ESP_IPD_H
+#define _ESP_IPD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#define ESP_LINK_CNT        5       /* links 0-4 with AT+CIPMUX=1   */
+#define ESP_LINE_SZ         48      /* max response line length     */
+#define ESP_LINE_CNT        4       /* number of queued lines       */
+
+/*--------------------------------------------------------
+Parser statistics
+--------------------------------------------------------*/
+typedef struct
+{
+    uint32_t            payload_bytes;
+                                    /* +IPD bytes routed to links   */
+    uint32_t            payload_drops;
+                                    /* +IPD bytes with no room      */
+    uint16_t            line_drops; /* lines lost, queue was full   */
+    uint16_t            hdr_errors; /* malformed +IPD headers       */
+    uint16_t            prompts;    /* CIPSEND '>' prompts seen     */
+} esp_ipd_stats_type;
+
+/*--------------------------------------------------------
+The parser is fed one byte at a time by the UART 2 RX
+deferred work (esp_uart.c). Response lines are queued
+for the AT command layer, while +IPD,<id>,<len>:<payload>
+data is written straight into the ring buffer attached
+to link <id>.
+--------------------------------------------------------*/
+void esp_ipd_init( void );
+void esp_ipd_feed( uint8_t byte );
+void esp_ipd_link_attach( uint8_t link, uint8_t *buf, uint16_t buf_sz );
+uint8_t *esp_ipd_link_buf( uint8_t link, uint16_t *buf_sz );
+uint16_t esp_ipd_link_avail( uint8_t link );
+uint16_t esp_ipd_link_span( uint8_t link, const uint8_t **span );
+void esp_ipd_link_consume( uint8_t link, uint16_t bytes );
+uint16_t esp_ipd_link_read( uint8_t link, void *buf, uint16_t bytes );
+const char *esp_ipd_line( void );
+void esp_ipd_line_release( void );
+bool esp_ipd_prompt( void );
+void esp_ipd_get_stats( esp_ipd_stats_type *stats );
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef _ESP_LINK_H
+#define _ESP_LINK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "timer.h"
+
+
+/*--------------------------------------------------------
+Supervisor configuration
+--------------------------------------------------------*/
+typedef struct
+{
+    const char         *ssid;       /* access point to rejoin       */
+    const char         *pass;       /* access point password        */
+    timer_ticks_t       probe_period;
+                                    /* time between probes, ms      */
+    timer_ticks_t       backoff_min;/* first retry delay, ms        */
+    timer_ticks_t       backoff_max;/* longest retry delay, ms      */
+} esp_link_cfg_type;
+
+/*--------------------------------------------------------
+Supervisor statistics. Reconnect times run from the loss
+of the link to WIFI GOT IP.
+--------------------------------------------------------*/
+typedef struct
+{
+    uint16_t            outages;    /* link losses detected         */
+    uint16_t            probes;     /* probes issued                */
+    uint16_t            probe_fails;/* probes that found no link    */
+    uint16_t            probe_oks;  /* probes that found the link   */
+    uint16_t            rejoins;    /* AT+CWJAP_CUR issued          */
+    uint16_t            soft_resets;/* AT+RST issued                */
+    uint16_t            hard_resets;/* reset pin toggled            */
+    uint16_t            reconnects; /* outages recovered            */
+    uint32_t            reconnect_last;
+                                    /* last reconnect time, ms      */
+    uint32_t            reconnect_max;
+                                    /* longest reconnect time, ms   */
+    uint32_t            reconnect_total;
+                                    /* sum of reconnect times, ms   */
+} esp_link_stats_type;
+
+/*--------------------------------------------------------
+ESP8266 link supervisor. The link is probed with
+AT+CWJAP? when the module has been quiet for a probe
+period, and is declared down on a failed probe, a
+WIFI DISCONNECT line or repeated command timeouts.
+Recovery escalates from rejoining the access point to
+AT+RST to the reset pin, with an exponential, jittered
+delay between attempts. While the link is down the
+socket layer is held (net_set_link()) and persistent
+sockets keep their queued data. esp_at_init() and
+net_init() must be called first.
+--------------------------------------------------------*/
+void esp_link_init( const esp_link_cfg_type *cfg );
+void esp_link_poll( void );
+bool esp_link_up( void );
+void esp_link_get_stats( esp_link_stats_type *stats );
+
+#endif
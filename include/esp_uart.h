@@ -0,0 +1,30 @@
+#ifndef _ESP_UART_H
+#define _ESP_UART_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stm32f10x.h"
+#include "stm32f10x_dma.h"
+#include "stm32f10x_gpio.h"
+#include "stm32f10x_rcc.h"
+#include "stm32f10x_usart.h"
+
+
+/*--------------------------------------------------------
+UART 2 is wired to the ESP8266 module. All received bytes
+are handed to the +IPD stream parser (esp_ipd.h), by
+deferred work (defer.h) queued from the RX interrupt.
+Transmit is blocking, or through DMA 1 channel 7 for
+payload data which must then stay valid until
+esp_uart_tx_busy() returns false.
+--------------------------------------------------------*/
+void esp_uart_init( uint32_t baud_rate );
+uint16_t esp_uart_write( const void *buf, uint16_t bytes );
+void esp_uart_write_byte( uint8_t byte );
+void esp_uart_write_cmd( const char *cmd );
+bool esp_uart_write_dma( const void *buf, uint16_t bytes );
+bool esp_uart_tx_busy( void );
+uint16_t esp_uart_rx_drops( void );
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef _LOGBUF_H
+#define _LOGBUF_H
+
+#include <stdint.h>
+
+
+#define LOGBUF_SZ           512     /* log ring, bytes, 2^n         */
+#define LOGBUF_LINE_MAX     80      /* longest logbuf_printf() line */
+
+/*--------------------------------------------------------
+Log ring and bulk log readout. Text logged with
+logbuf_printf() is kept in a RAM ring, each line stamped
+with the ms tick count; when the ring is full the oldest
+bytes are overwritten. The ring, or any readable memory
+range such as a log kept in flash, is streamed to the
+host on request (PROTO_T_LOG_OPEN, proto_wire.h) under
+the host's credit, one frame per logbuf_poll(). Memory
+ranges are copied byte by byte, registers are better
+read with MEM_READ. proto_init() must be called first.
+--------------------------------------------------------*/
+void logbuf_init( void );
+void logbuf_poll( void );
+void logbuf_write( const void *data, uint16_t len );
+void logbuf_printf( const char *fmt, ... )
+    __attribute__ ((format (printf, 1, 2)));
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <stdint.h>
+
+#include "timer.h"
+
+
+/*--------------------------------------------------------
+Set to 1 to build the endpoint. It takes about 1.1K of
+RAM, most of it the snapshot, and 640 bytes of the socket
+budget (net.h) while two scrapes are served.
+--------------------------------------------------------*/
+#ifndef METRICS_ENABLE
+#define METRICS_ENABLE      0
+#endif
+
+#define METRICS_PORT_DFLT   9100    /* scrape port                  */
+#define METRICS_PERIOD_DFLT 1000    /* snapshot refresh, ms         */
+#define METRICS_TEXT_SZ     1024    /* snapshot, header and body    */
+#define METRICS_CLIENT_CNT  2       /* scrapes served at once       */
+
+/*--------------------------------------------------------
+Endpoint statistics
+--------------------------------------------------------*/
+typedef struct
+{
+    uint32_t            scrapes;    /* snapshots served             */
+    uint32_t            snapshots;  /* snapshots completed          */
+    uint16_t            refused;    /* connections over the limit   */
+    uint16_t            truncated;  /* snapshots that did not fit   */
+    uint16_t            len;        /* length of the last snapshot  */
+} metrics_stats_type;
+
+/*--------------------------------------------------------
+Metrics endpoint. A TCP server (AT+CIPSERVER) answers any
+HTTP request with a snapshot of the device counters,
+queue depths and uptime in the Prometheus text format.
+
+The snapshot, HTTP header included, is rebuilt every
+period in the background, one group of metrics per
+metrics_poll(). A scrape only copies the finished text to
+the socket and sees the counters as they were up to a
+period ago; a scrape arriving during a rebuild waits the
+few polls it takes, a rebuild waits for the scrapes
+being sent.
+
+net_init() must be called first, metrics_poll() from the
+main loop.
+--------------------------------------------------------*/
+int8_t metrics_init( uint16_t port, timer_ticks_t period );
+void metrics_poll( void );
+void metrics_get_stats( metrics_stats_type *stats );
+
+#endif
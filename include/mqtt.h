@@ -0,0 +1,113 @@
+#ifndef _MQTT_H
+#define _MQTT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "timer.h"
+
+
+/*--------------------------------------------------------
+Set to 1 to build the client. It takes about 1.4K of RAM
+and 768 bytes of the socket budget (net.h), which the
+default build does not have to spare.
+--------------------------------------------------------*/
+#ifndef MQTT_ENABLE
+#define MQTT_ENABLE         0
+#endif
+
+#define MQTT_TOPIC_MAX      64      /* longest topic or filter      */
+#define MQTT_CLIENT_ID_MAX  23      /* longest id brokers must take */
+#define MQTT_SUBS_MAX       4       /* subscriptions                */
+#define MQTT_INFLIGHT_MAX   4       /* QoS 1 publishes not yet acked*/
+#define MQTT_QOS1_PKT_MAX   128     /* QoS 1 PUBLISH kept to resend */
+#define MQTT_RX_PKT_MAX     160     /* longest packet received,     */
+                                    /* longer ones are skipped      */
+#define MQTT_KEEPALIVE_DFLT 60      /* keep alive, s                */
+#define MQTT_BATCH_DFLT     50      /* publish coalescing, ms       */
+#define MQTT_RESEND_MS      5000    /* QoS 1 wait for the PUBACK    */
+
+#define MQTT_ERR_STATE      -1      /* not connected to the broker  */
+#define MQTT_ERR_LEN        -2      /* topic or packet too long     */
+#define MQTT_ERR_FULL       -3      /* no room to send or keep it   */
+#define MQTT_ERR_ARG        -4      /* bad QoS or argument          */
+
+/*--------------------------------------------------------
+Client states
+--------------------------------------------------------*/
+typedef enum
+{
+    MQTT_IDLE,                      /* mqtt_init() not called       */
+    MQTT_TCP,                       /* opening the TCP connection   */
+    MQTT_CONNECTING,                /* CONNECT sent, no CONNACK yet */
+    MQTT_CONNECTED,                 /* session up                   */
+    MQTT_RETRY                      /* waiting to reconnect         */
+} mqtt_state_type;
+
+/*--------------------------------------------------------
+Broker connection, the strings are copied
+--------------------------------------------------------*/
+typedef struct
+{
+    const char         *host;       /* broker address               */
+    uint16_t            port;       /* broker port, 1883            */
+    const char         *client_id;  /* client identifier            */
+    uint16_t            keepalive;  /* keep alive, s, 0 for none    */
+    timer_ticks_t       batch;      /* publishes queued this long   */
+                                    /* go out in one CIPSEND, ms    */
+} mqtt_cfg_type;
+
+/*--------------------------------------------------------
+Received message, the topic is not NUL terminated
+--------------------------------------------------------*/
+typedef void (*mqtt_msg_cb_type)( const char *topic, uint16_t topic_len,
+                                  const uint8_t *payload, uint16_t len,
+                                  void *ctx );
+
+/*--------------------------------------------------------
+Client statistics
+--------------------------------------------------------*/
+typedef struct
+{
+    uint32_t            published;  /* PUBLISH packets queued       */
+    uint32_t            acked;      /* QoS 1 publishes acknowledged */
+    uint32_t            received;   /* PUBLISH packets received     */
+    uint16_t            resent;     /* QoS 1 publishes sent again   */
+    uint16_t            dropped;    /* received packets too long or */
+                                    /* matching no subscription     */
+    uint16_t            pings;      /* PINGREQ sent                 */
+    uint16_t            connects;   /* sessions established         */
+    uint16_t            refused;    /* CONNACK refusals, SUBACK     */
+                                    /* failures                     */
+    uint8_t             last_rc;    /* last CONNACK return code     */
+} mqtt_stats_type;
+
+/*--------------------------------------------------------
+MQTT 3.1.1 client over a TCP socket (net.h). Packets are
+built in a static buffer and queued on the socket; QoS 0
+and QoS 1 publishes queued within the batching window go
+out together as one CIPSEND, control packets right away.
+QoS 1 publishes are kept until their PUBACK and sent
+again, flagged DUP, after MQTT_RESEND_MS or a reconnect.
+Received PUBLISH packets go to the callback of every
+subscription whose filter matches, '+' and '#' included;
+QoS 2 is not supported, subscriptions ask for QoS 1 at
+most.
+
+The session is clean: subscriptions are sent again on
+every connect. A PINGREQ goes out once nothing has been
+sent for the keep alive period; a broker that stays
+silent for half a period more is dropped and the client
+reconnects. net_init() must be called first, mqtt_poll()
+from the main loop.
+--------------------------------------------------------*/
+void mqtt_init( const mqtt_cfg_type *cfg );
+void mqtt_poll( void );
+int8_t mqtt_publish( const char *topic, const void *payload, uint16_t len,
+                     uint8_t qos );
+int8_t mqtt_subscribe( const char *filter, uint8_t qos, mqtt_msg_cb_type cb,
+                       void *ctx );
+mqtt_state_type mqtt_get_state( void );
+void mqtt_get_stats( mqtt_stats_type *stats );
+
+#endif
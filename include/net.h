@@ -0,0 +1,107 @@
+#ifndef _NET_H
+#define _NET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_ipd.h"
+#include "timer.h"
+
+
+#define NET_SOCK_CNT        ESP_LINK_CNT
+                                    /* sockets, one per ESP8266 link*/
+#ifndef NET_BUF_BUDGET
+#define NET_BUF_BUDGET      576     /* bytes shared by all sockets, */
+#endif                              /* one OTA transfer; raise for  */
+                                    /* MQTT_ENABLE etc.             */
+#define NET_HOST_SZ         32      /* longest host name / address  */
+#define NET_FLUSH_DELAY_DFLT 20     /* default write coalescing, ms */
+
+#define NET_ERR_NO_SOCK     -1      /* all sockets in use           */
+#define NET_ERR_NO_MEM      -2      /* buffer budget exhausted      */
+#define NET_ERR_BAD_SOCK    -3      /* not an open socket           */
+#define NET_ERR_CLOSED      -4      /* connection has been closed   */
+#define NET_ERR_BUSY        -5      /* a server is already listening*/
+
+/*--------------------------------------------------------
+Readiness events passed to socket callbacks
+--------------------------------------------------------*/
+#define NET_EV_CONNECTED    0x01    /* connection established       */
+#define NET_EV_READABLE     0x02    /* new data for net_recv()      */
+#define NET_EV_WRITABLE     0x04    /* TX space freed after a short */
+                                    /* net_send()                   */
+#define NET_EV_CLOSED       0x08    /* peer closed the connection   */
+#define NET_EV_ERROR        0x10    /* connect failed               */
+#define NET_EV_ACCEPT       0x20    /* listener: new socket accepted*/
+
+typedef enum
+{
+    NET_TCP,
+    NET_UDP
+} net_proto_type;
+
+typedef void (*net_cb_type)( int8_t sock, uint8_t events, void *ctx );
+
+/*--------------------------------------------------------
+Write coalescing statistics. Efficiency is the share of
+payload in the bytes written to the module for CIPSEND,
+the command round trip is timed from the CIPSEND command
+to SEND OK.
+--------------------------------------------------------*/
+typedef struct
+{
+    uint32_t            writes;     /* net_send() calls with data   */
+    uint32_t            sends;      /* CIPSEND chunks issued        */
+    uint32_t            payload_bytes;
+                                    /* bytes sent in those chunks   */
+    uint16_t            bytes_per_send;
+                                    /* average chunk size           */
+    uint8_t             efficiency_pct;
+                                    /* payload / all CIPSEND bytes  */
+    uint16_t            ms_per_send;/* average CIPSEND round trip   */
+    uint16_t            reopens;    /* persistent sockets reopened  */
+} net_stats_type;
+
+/*--------------------------------------------------------
+BSD-like sockets over the ESP8266 AT command set using
+multiple connection mode (AT+CIPMUX=1). Every call is
+non-blocking, progress is made and callbacks are run
+from net_poll(). Receive and transmit buffers for each
+socket are carved out of a fixed NET_BUF_BUDGET pool.
+A socket that signalled NET_EV_CLOSED or NET_EV_ERROR
+keeps its buffers until net_close() is called.
+
+Small writes are coalesced Nagle style: queued data goes
+out as one CIPSEND of up to ESP_AT_SEND_MAX bytes once
+the TX buffer holds a full chunk, the flush delay since
+the oldest unsent byte has expired, or net_push() is
+called. A flush delay of 0 sends as soon as possible.
+
+A persistent socket survives the loss of its connection:
+it is reopened once the Wi-Fi link is up (net_set_link())
+and data queued meanwhile, bounded by its TX buffer, goes
+out after it reconnects. NET_EV_CONNECTED is signalled
+again for every reconnection.
+--------------------------------------------------------*/
+void net_init( void );
+void net_poll( void );
+int8_t net_connect( net_proto_type proto, const char *host, uint16_t port,
+                    uint16_t rx_sz, uint16_t tx_sz, net_cb_type cb,
+                    void *ctx );
+int8_t net_listen( uint16_t port, uint16_t rx_sz, uint16_t tx_sz,
+                   net_cb_type cb, void *ctx );
+void net_set_callback( int8_t sock, net_cb_type cb, void *ctx );
+int16_t net_send( int8_t sock, const void *buf, uint16_t bytes );
+int16_t net_recv( int8_t sock, void *buf, uint16_t bytes );
+int8_t net_close( int8_t sock );
+bool net_is_open( int8_t sock );
+void net_set_flush_delay( int8_t sock, timer_ticks_t delay );
+void net_set_persist( int8_t sock, bool persist );
+void net_set_keepalive( int8_t sock, uint16_t seconds );
+void net_set_host( int8_t sock, const char *host );
+void net_set_link( bool up );
+void net_push( int8_t sock );
+uint16_t net_tx_pending( int8_t sock );
+void net_get_stats( net_stats_type *stats );
+
+#endif
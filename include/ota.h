@@ -0,0 +1,57 @@
+#ifndef _OTA_H
+#define _OTA_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ota_meta.h"
+
+
+#define OTA_ERR_BUSY        -1      /* an update is in progress     */
+#define OTA_ERR_NO_SOCK     -2      /* could not open a socket      */
+
+/*--------------------------------------------------------
+Update states
+--------------------------------------------------------*/
+typedef enum
+{
+    OTA_IDLE,                       /* no update started            */
+    OTA_CONNECT,                    /* waiting for the connection   */
+    OTA_HEADER,                     /* waiting for the image header */
+    OTA_ERASE,                      /* erasing the inactive slot    */
+    OTA_DATA,                       /* programming the image        */
+    OTA_DONE,                       /* verified, boots on next reset*/
+    OTA_FAILED                      /* aborted, see ota_status_type */
+} ota_state_type;
+
+/*--------------------------------------------------------
+Update progress
+--------------------------------------------------------*/
+typedef struct
+{
+    ota_state_type      state;      /* update state                 */
+    uint8_t             slot;       /* slot being written           */
+    uint32_t            version;    /* version being installed      */
+    uint32_t            size;       /* image bytes                  */
+    uint32_t            received;   /* image bytes programmed       */
+    const char         *error;      /* reason for OTA_FAILED        */
+} ota_status_type;
+
+/*--------------------------------------------------------
+Over the air update into the inactive application slot
+(ota_layout.h). The image is streamed from a TCP server
+straight into flash, 64 bytes at a time, then its CRC is
+checked from flash and a trial boot record is written.
+The new image runs after the next reset and must call
+ota_confirm() or the bootloader rolls back to the old
+one. net_init() must be called first, ota_poll() from the
+main loop.
+--------------------------------------------------------*/
+int8_t ota_start( const char *host, uint16_t port );
+void ota_poll( void );
+void ota_get_status( ota_status_type *status );
+uint8_t ota_running_slot( void );
+uint32_t ota_running_version( void );
+void ota_confirm( void );
+
+#endif
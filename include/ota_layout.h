@@ -0,0 +1,77 @@
+#ifndef _OTA_LAYOUT_H
+#define _OTA_LAYOUT_H
+
+#include <stdint.h>
+
+
+/*--------------------------------------------------------
+Flash layout, shared by the bootloader, the application
+and the host image server. 128K of flash in 1K pages, it
+must agree with ldscripts/mem.ld, ldscripts/mem_slot_b.ld
+and boot/boot.ld.
+
+ 0x08000000   8K  bootloader
+ 0x08002000   2K  boot records, one per page
+ 0x08002800  59K  application slot A
+ 0x08011400  59K  application slot B
+--------------------------------------------------------*/
+#define OTA_PAGE_SZ         0x400
+#define OTA_BOOT_ADDR       0x08000000
+#define OTA_META_ADDR       0x08002000
+#define OTA_META_PAGES      2
+#define OTA_SLOT_A_ADDR     0x08002800
+#define OTA_SLOT_B_ADDR     0x08011400
+#define OTA_SLOT_SZ         0xEC00
+#define OTA_SLOT_CNT        2
+#define OTA_SLOT_ADDR( s )  ( ( s ) == 0 ? OTA_SLOT_A_ADDR : OTA_SLOT_B_ADDR )
+#define OTA_RAM_ADDR        0x20000000
+#define OTA_RAM_SZ          0x2000
+
+/*--------------------------------------------------------
+Image transfer over TCP, all fields little endian.
+
+ device -> server  "OTA <A|B> <running version>\n"
+ server -> device  ota_img_hdr_type
+ device -> server  "GET\n" once the slot has been erased
+ server -> device  size bytes of image
+
+An image is linked for the slot it is requested for. The
+size is a multiple of 4, the server pads with 0xFF. The
+CRC is the one the STM32 CRC unit computes over the image
+words, see ota_crc32().
+--------------------------------------------------------*/
+#define OTA_IMG_MAGIC       0x3141544F  /* "OTA1"                   */
+#define OTA_IMG_HDR_SZ      16
+
+typedef struct
+{
+    uint32_t            magic;      /* OTA_IMG_MAGIC                */
+    uint32_t            version;    /* image version, must increase */
+    uint32_t            size;       /* image bytes                  */
+    uint32_t            crc;        /* ota_crc32() of the image     */
+} ota_img_hdr_type;
+
+/*--------------------------------------------------------
+Software version of the STM32 CRC unit, CRC-32 with
+polynomial 0x04C11DB7 over 32 bit words, MSB first, no
+reflection or final XOR. Start with crc = 0xFFFFFFFF.
+--------------------------------------------------------*/
+static inline uint32_t ota_crc32( uint32_t crc, const uint32_t *words,
+                                  uint32_t cnt )
+{
+    uint32_t            i;          /* word index                   */
+    uint8_t             bit;        /* bit index                    */
+
+    for( i = 0; i < cnt; i++ )
+    {
+        crc ^= words[ i ];
+        for( bit = 0; bit < 32; bit++ )
+        {
+            crc = ( crc & 0x80000000 ) ? ( crc << 1 ) ^ 0x04C11DB7 : crc << 1;
+        }
+    }
+
+    return crc;
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef _OTA_META_H
+#define _OTA_META_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ota_layout.h"
+
+
+#define OTA_META_MAGIC      0x544F4F42  /* "BOOT"                   */
+#define OTA_TRIAL_BOOTS     4       /* boots a new image gets to    */
+                                    /* call ota_confirm()           */
+
+/*--------------------------------------------------------
+Boot record states
+--------------------------------------------------------*/
+#define OTA_STATE_CONFIRMED 0x5A    /* active slot is known good    */
+#define OTA_STATE_TRIAL     0xA5    /* active slot not yet confirmed*/
+
+/*--------------------------------------------------------
+Slot contents. A size of 0 means the image was not
+installed by OTA (e.g. flashed by the debugger) and can
+only be checked by its vector table.
+--------------------------------------------------------*/
+typedef struct
+{
+    uint32_t            version;    /* image version                */
+    uint32_t            size;       /* image bytes, 0 if unknown    */
+    uint32_t            crc;        /* ota_crc32() of the image     */
+} ota_slot_info_type;
+
+/*--------------------------------------------------------
+Boot record. Records are written alternately to the two
+record pages with an increasing sequence number, the
+newest one with a good CRC is in effect. A half written
+record fails its CRC and the previous one stays in
+effect, so switching slots is atomic.
+
+The bootloader clears one tries[] entry per boot of a
+trial image, once they are used up it rolls back.
+--------------------------------------------------------*/
+typedef struct
+{
+    uint32_t            magic;      /* OTA_META_MAGIC               */
+    uint32_t            seq;        /* newest record wins           */
+    uint8_t             active;     /* slot to boot                 */
+    uint8_t             state;      /* OTA_STATE_...                */
+    uint16_t            reserved;
+    ota_slot_info_type  slot[ OTA_SLOT_CNT ];
+    uint32_t            crc;        /* ota_crc32() of fields above  */
+    uint16_t            tries[ OTA_TRIAL_BOOTS ];
+                                    /* 0xFFFF until used            */
+} ota_meta_type;
+
+/*--------------------------------------------------------
+Boot record and flash access, shared by the bootloader and
+the application's OTA receiver. Flash is unlocked only
+for the duration of each call.
+--------------------------------------------------------*/
+const ota_meta_type *ota_meta_current( void );
+bool ota_meta_write( ota_meta_type *rec );
+bool ota_meta_use_try( const ota_meta_type *rec );
+bool ota_slot_valid( uint8_t slot, const ota_slot_info_type *info );
+bool ota_flash_erase( uint32_t addr );
+bool ota_flash_write( uint32_t addr, const void *data, uint32_t bytes );
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef _PROTO_H
+#define _PROTO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "proto_wire.h"
+
+
+#define PROTO_RX_SLOTS      3       /* frames buffered for the loop */
+#define PROTO_HANDLER_MAX   12      /* registered message types     */
+#define PROTO_DUP_SLOTS     8       /* requests remembered to catch */
+                                    /* retransmissions              */
+#define PROTO_DUP_REPLY_MAX 4       /* longest final reply replayed */
+
+#define PROTO_ERR_FULL      -1      /* handler table full           */
+#define PROTO_ERR_LEN       -2      /* payload too long             */
+
+/*--------------------------------------------------------
+Received frame. The payload points into the receive
+buffer and is only valid while the handler runs.
+--------------------------------------------------------*/
+typedef struct
+{
+    uint8_t             type;       /* message type                 */
+    uint8_t             flags;      /* header flags                 */
+    uint8_t             seq;        /* sequence number              */
+    uint16_t            len;        /* payload length               */
+    uint8_t            *payload;    /* decoded payload              */
+    uint64_t            rx_us;      /* arrival of its last byte,    */
+                                    /* timer_get_us()               */
+} proto_frame_type;
+
+typedef void (*proto_handler_type)( const proto_frame_type *frame );
+
+/*--------------------------------------------------------
+Protocol statistics. Each error costs only the frame it
+occurred in.
+--------------------------------------------------------*/
+typedef struct
+{
+    uint32_t            rx_frames;  /* frames handled               */
+    uint32_t            tx_frames;  /* frames sent                  */
+    uint16_t            cobs_errors;/* malformed COBS data          */
+    uint16_t            hdr_errors; /* short frame or header CRC    */
+    uint16_t            len_errors; /* length does not match frame  */
+    uint16_t            crc_errors; /* payload CRC mismatch         */
+    uint16_t            overflows;  /* frame too long or no free    */
+                                    /* receive slot                 */
+    uint16_t            unknown;    /* no handler for the type      */
+    uint16_t            duplicates; /* retransmitted requests       */
+} proto_stats_type;
+
+/*--------------------------------------------------------
+Binary control protocol on UART 1 (proto_wire.h). Bytes
+are collected into receive slots by the UART interrupt
+until a delimiter; proto_poll() decodes each frame in its
+slot and calls the handler registered for its type,
+answering with PROTO_T_NAK when it can not. Frames are
+built and encoded in place in the transmit buffer, a
+payload written to proto_tx_payload() is not copied.
+Each frame is queued on the UART 1 channel of its request
+or type (proto_wire.h), and stdio output is sent as
+PROTO_T_CONSOLE frames. PROTO_T_PING is answered by the
+protocol itself.
+
+A request's last reply is sent with proto_reply(), which
+ends the request for duplicate detection (proto_wire.h);
+proto_send() is for the frames before it and for
+unsolicited ones.
+--------------------------------------------------------*/
+void proto_init( void );
+void proto_poll( void );
+int8_t proto_register( uint8_t type, proto_handler_type handler );
+uint8_t *proto_tx_payload( void );
+int8_t proto_send( uint8_t type, uint8_t flags, uint8_t seq,
+                   const void *payload, uint16_t len );
+int8_t proto_reply( uint8_t type, uint8_t seq, const void *payload,
+                    uint16_t len );
+void proto_get_stats( proto_stats_type *stats );
+
+#endif
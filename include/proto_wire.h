@@ -0,0 +1,270 @@
+#ifndef _PROTO_WIRE_H
+#define _PROTO_WIRE_H
+
+#include <stdint.h>
+
+
+/*--------------------------------------------------------
+USART1 control protocol frame, shared by the firmware and
+the host tools. A frame is COBS encoded (cobs.h) and
+followed by a 0x00 delimiter, so a receiver resyncs on
+the next delimiter after any error. Multi byte fields are
+little endian.
+
+ Header, PROTO_HDR_SZ bytes:
+   0      message type, PROTO_T_...
+   1      flags, PROTO_F_...
+   2      sequence number, echoed in the reply
+   3..4   payload length
+   5      CRC-8 of bytes 0..4, proto_crc8()
+
+ Payload, length bytes, then its CRC-16, proto_crc16()
+
+A frame is at most COBS_BLOCK_MAX bytes so it encodes
+into one more byte, which lets it be encoded in place.
+
+Requests carry the sender's sequence number and every
+reply to them echoes it, so a host may keep several
+requests outstanding. A host resends a request that
+got no reply, unchanged. The device remembers its
+recent requests by type, sequence number and payload
+CRC: a copy of one still being served is dropped, a
+copy of a finished one gets its final reply again when
+that was short (a STATUS), otherwise it is run again,
+which only requests that just read (PING, MEM_READ,
+TIME_REQ) have.
+--------------------------------------------------------*/
+#define PROTO_HDR_SZ        6
+#define PROTO_CRC_SZ        2
+#define PROTO_PAYLOAD_MAX   128
+#define PROTO_FRAME_MAX     ( PROTO_HDR_SZ + PROTO_PAYLOAD_MAX + PROTO_CRC_SZ )
+#define PROTO_ENC_MAX       ( PROTO_FRAME_MAX + 2 )
+                                    /* + COBS code byte + delimiter */
+
+/*--------------------------------------------------------
+Header flags. A request with PROTO_F_NOREPLY gets no
+reply, not even a NAK, and is not remembered for
+duplicate detection; it must be safe to lose or repeat.
+--------------------------------------------------------*/
+#define PROTO_F_NOREPLY     0x01
+
+/*--------------------------------------------------------
+Logical channels. UART 1 is shared by several streams,
+so the device tags each frame it sends with a channel in
+the top bits of the flags and queues it per channel
+(uart_mux_write()). A control frame goes out as soon as
+the frame being sent has ended, the other channels share
+what is left by weight. Every frame of a request's reply
+goes on one channel, so they stay in order:
+
+   CONTROL   PONG, NAK, TIME_REPLY, the STATUS of
+             requests that only get one, stderr text
+   CONSOLE   SHELL_OUT and its STATUS, stdout text
+   LOG       LOG_DATA and LOG_END
+   BULK      MEM_DATA and its STATUS, WATCH_DATA
+
+Hosts send with channel 0; receivers that do not know
+channels may ignore the bits.
+--------------------------------------------------------*/
+#define PROTO_F_CH_MASK     0xC0
+#define PROTO_F_CH_SHIFT    6
+#define PROTO_F_CH( ch )    ( (uint8_t)( (ch) << PROTO_F_CH_SHIFT ) )
+#define PROTO_CH_OF( flags ) ( ( (flags) & PROTO_F_CH_MASK ) >> PROTO_F_CH_SHIFT )
+
+#define PROTO_CH_CONTROL    0
+#define PROTO_CH_CONSOLE    1
+#define PROTO_CH_LOG        2
+#define PROTO_CH_BULK       3
+#define PROTO_CH_CNT        4
+
+/*--------------------------------------------------------
+Message types
+--------------------------------------------------------*/
+#define PROTO_T_PING        0x01    /* echoed back as PROTO_T_PONG  */
+#define PROTO_T_PONG        0x02
+#define PROTO_T_NAK         0x03    /* payload: PROTO_NAK_... code  */
+
+/*--------------------------------------------------------
+Negative acknowledge reasons. Frames with a bad header
+CRC are dropped without a NAK, their fields can not be
+trusted.
+--------------------------------------------------------*/
+#define PROTO_NAK_CRC       1       /* payload CRC mismatch         */
+#define PROTO_NAK_TYPE      2       /* no handler for the type      */
+#define PROTO_NAK_LEN       3       /* length does not match frame  */
+
+/*--------------------------------------------------------
+Memory access, see diag.h. Addresses are 32 bit, width is
+the access size in bytes (1, 2 or 4); address and length
+must be multiples of it.
+
+ PROTO_T_MEM_READ    addr, len u16, width u8
+                     answered by MEM_DATA frames of up to
+                     PROTO_MEM_CHUNK bytes, sent back to
+                     back, or a STATUS
+ PROTO_T_MEM_DATA    addr, data
+ PROTO_T_MEM_WRITE   addr, width u8, data
+                     answered by a STATUS
+ PROTO_T_STATUS      status u8, PROTO_ST_...
+ PROTO_T_WATCH       period ms u16, then { addr, width u8 }
+                     per watched address; period 0 stops
+                     answered by a STATUS
+ PROTO_T_WATCH_DATA  drops u16, count u8, then count
+                     samples of { ms ticks u32, value per
+                     watched address in its width }
+--------------------------------------------------------*/
+#define PROTO_T_MEM_READ    0x10
+#define PROTO_T_MEM_DATA    0x11
+#define PROTO_T_MEM_WRITE   0x12
+#define PROTO_T_STATUS      0x13
+#define PROTO_T_WATCH       0x14
+#define PROTO_T_WATCH_DATA  0x15
+
+#define PROTO_MEM_CHUNK     ( PROTO_PAYLOAD_MAX - 4 )
+#define PROTO_MEM_READ_MAX  4096    /* longest MEM_READ             */
+#define PROTO_MEM_READ_QUEUE 2      /* MEM_READs the device queues, */
+                                    /* more are answered BUSY       */
+#define PROTO_WATCH_MAX     8       /* addresses watched at once    */
+#define PROTO_WATCH_ENTRY_SZ 5      /* addr + width                 */
+#define PROTO_WATCH_HDR_SZ  3       /* WATCH_DATA drops + count     */
+
+#define PROTO_ST_OK         0
+#define PROTO_ST_BAD_ADDR   1       /* outside the accessible map   */
+#define PROTO_ST_BAD_LEN    2       /* bad length or width          */
+#define PROTO_ST_BUSY       3       /* read queue full,             */
+                                    /* or a command still running   */
+#define PROTO_ST_NO_CMD     4       /* unknown shell command        */
+#define PROTO_ST_FAIL       5       /* shell command failed,        */
+                                    /* or log readout replaced      */
+#define PROTO_ST_GONE       6       /* log data overwritten         */
+
+/*--------------------------------------------------------
+Device shell, see shell.h
+
+ PROTO_T_SHELL       command line, text without a
+                     terminator
+                     answered by any number of SHELL_OUT
+                     frames, then a STATUS once the command
+                     has finished
+ PROTO_T_SHELL_OUT   output text
+--------------------------------------------------------*/
+#define PROTO_T_SHELL       0x20
+#define PROTO_T_SHELL_OUT   0x21
+
+/*--------------------------------------------------------
+Clock synchronization, see clksync.h. Times are 64 bit
+microseconds: device times from timer_get_us(), host
+times from the host's realtime clock.
+
+ PROTO_T_TIME_REQ    host send time, then padding to
+                     PROTO_TIME_SZ so both directions
+                     take as long on the wire
+                     answered by a TIME_REPLY
+ PROTO_T_TIME_REPLY  host send time echoed, device
+                     receive time, device send time
+ PROTO_T_TIME_SET    device reference time, host time at
+                     the reference, rate s32 in parts per
+                     billion (host minus device), error
+                     bound u32 in us
+                     answered by a STATUS
+--------------------------------------------------------*/
+#define PROTO_T_TIME_REQ    0x30
+#define PROTO_T_TIME_REPLY  0x31
+#define PROTO_T_TIME_SET    0x32
+
+#define PROTO_TIME_SZ       24      /* TIME_REQ and TIME_REPLY      */
+#define PROTO_TIME_SET_SZ   24
+
+/*--------------------------------------------------------
+Log readout, see logbuf.h. A stream is a run of bytes
+addressed by offset: the log ring's offsets count every
+byte logged since reset, a memory range's count from its
+start. The host grants credit as a limit offset the
+device may send up to, and moves it on as it absorbs the
+data; a lost grant is made good by the next one.
+
+ PROTO_T_LOG_OPEN    source u8, offset u32, limit u32,
+                     then for PROTO_LOG_SRC_MEM addr u32,
+                     len u32
+                     answered by LOG_DATA frames, then a
+                     LOG_END; a new LOG_OPEN ends the
+                     stream before it with PROTO_ST_FAIL
+ PROTO_T_LOG_CREDIT  limit u32, sent PROTO_F_NOREPLY
+ PROTO_T_LOG_DATA    offset u32, data; the payload CRC is
+                     the chunk's checksum
+ PROTO_T_LOG_END     status u8, end offset u32; for
+                     PROTO_ST_GONE the oldest offset
+                     left, the ring has overwritten the
+                     data before it
+
+Frames of a stream follow on in offset order, so a jump
+in the offset means a frame was lost.
+
+A stream that gets no new credit for PROTO_LOG_IDLE_MS
+while it is held up is ended with PROTO_ST_BUSY.
+--------------------------------------------------------*/
+#define PROTO_T_LOG_OPEN    0x40
+#define PROTO_T_LOG_CREDIT  0x41
+#define PROTO_T_LOG_DATA    0x42
+#define PROTO_T_LOG_END     0x43
+
+#define PROTO_LOG_SRC_RING  0       /* log ring in RAM              */
+#define PROTO_LOG_SRC_MEM   1       /* memory range, e.g. flash     */
+
+#define PROTO_LOG_OPEN_SZ   9       /* without the memory range     */
+#define PROTO_LOG_CHUNK     ( PROTO_PAYLOAD_MAX - 4 )
+#define PROTO_LOG_END_SZ    5
+#define PROTO_LOG_IDLE_MS   2000
+
+/*--------------------------------------------------------
+Console text, the device's stdout and stderr (_write.c)
+
+ PROTO_T_CONSOLE     output text, sent unsolicited with
+                     sequence number 0; it never belongs
+                     to a request
+--------------------------------------------------------*/
+#define PROTO_T_CONSOLE     0x50
+
+/*--------------------------------------------------------
+CRC-8, polynomial 0x07, initial value 0
+--------------------------------------------------------*/
+static inline uint8_t proto_crc8( const uint8_t *p, uint16_t len )
+{
+    uint8_t             crc;        /* running CRC                  */
+    uint8_t             bit;        /* bit index                    */
+
+    crc = 0;
+    while( len-- > 0 )
+    {
+        crc ^= *p++;
+        for( bit = 0; bit < 8; bit++ )
+        {
+            crc = ( crc & 0x80 ) ? (uint8_t)( ( crc << 1 ) ^ 0x07 ) : (uint8_t)( crc << 1 );
+        }
+    }
+
+    return crc;
+}
+
+/*--------------------------------------------------------
+CRC-16/CCITT-FALSE, polynomial 0x1021, initial 0xFFFF
+--------------------------------------------------------*/
+static inline uint16_t proto_crc16( const uint8_t *p, uint16_t len )
+{
+    uint16_t            crc;        /* running CRC                  */
+    uint8_t             bit;        /* bit index                    */
+
+    crc = 0xFFFF;
+    while( len-- > 0 )
+    {
+        crc ^= (uint16_t)( *p++ << 8 );
+        for( bit = 0; bit < 8; bit++ )
+        {
+            crc = ( crc & 0x8000 ) ? (uint16_t)( ( crc << 1 ) ^ 0x1021 ) : (uint16_t)( crc << 1 );
+        }
+    }
+
+    return crc;
+}
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef _SHELL_H
+#define _SHELL_H
+
+#include <stdint.h>
+
+
+#define SHELL_LINE_MAX      64      /* longest command line         */
+#define SHELL_ARGS_MAX      8       /* arguments, with the name     */
+#define SHELL_HASH_SZ       64      /* dispatch table slots, 2^n    */
+
+/*--------------------------------------------------------
+Command results. A command returning SHELL_MORE is called
+again from the next shell_poll() with the same arguments
+and context, so long work is done a step at a time.
+--------------------------------------------------------*/
+#define SHELL_DONE          0       /* finished                     */
+#define SHELL_MORE          1       /* call again                   */
+#define SHELL_FAIL          -1      /* finished with an error       */
+#define SHELL_USAGE         -2      /* bad arguments, prints usage  */
+
+#define SHELL_ERR_HASH      -1      /* shell_table.h is stale,      */
+                                    /* lookups search the table     */
+
+/*--------------------------------------------------------
+State kept for a running command, zeroed before its first
+call
+--------------------------------------------------------*/
+typedef struct
+{
+    uint16_t            step;       /* command defined state        */
+    uint32_t            val[ 3 ];   /* command defined values       */
+} shell_ctx_type;
+
+typedef int8_t (*shell_fn_type)( shell_ctx_type *ctx, uint8_t argc,
+                                 char *argv[] );
+
+typedef struct
+{
+    const char         *name;       /* command name                 */
+    const char         *usage;      /* arguments and description    */
+    shell_fn_type       fn;         /* command function             */
+} shell_cmd_type;
+
+/*--------------------------------------------------------
+Define a command in any module. The entries are collected
+by the linker between __shell_cmds_start and
+__shell_cmds_end (sections.ld), so there is no central
+list to edit. A bridge build (BRIDGE_ENABLE, bridge.h)
+has no shell: the entries are left for the compiler to
+drop, so they keep no module in the image.
+--------------------------------------------------------*/
+#if defined( BRIDGE_ENABLE ) && ( BRIDGE_ENABLE )
+#define SHELL_CMD( _name, _usage, _fn )                                 \
+    static const shell_cmd_type s_shell_cmd_##_fn                       \
+    __attribute__ ((unused)) =                                          \
+    { _name, _usage, _fn }
+#else
+#define SHELL_CMD( _name, _usage, _fn )                                 \
+    static const shell_cmd_type s_shell_cmd_##_fn                       \
+    __attribute__ ((section(".shell_cmds"),used,aligned(4))) =          \
+    { _name, _usage, _fn }
+#endif
+
+/*--------------------------------------------------------
+Command shell on the control protocol (PROTO_T_SHELL).
+The host build searches a hash seed that maps every
+command to its own slot and generates shell_table.h;
+shell_init() places the commands with it in one pass, so
+a line is dispatched with one hash and one compare. If
+the seed does not fit the linked commands it returns
+SHELL_ERR_HASH and commands are found by a search of the
+table instead; the shell still works. The line is split into arguments
+in place in the shell's line buffer, which is kept until
+the command has finished; one command runs at a time
+and a line received meanwhile is answered with
+PROTO_ST_BUSY.
+Output from shell_printf() is sent in SHELL_OUT frames.
+proto_init() must be called first.
+--------------------------------------------------------*/
+int8_t shell_init( void );
+void shell_poll( void );
+void shell_printf( const char *fmt, ... )
+    __attribute__ ((format(printf, 1, 2)));
+
+#endif
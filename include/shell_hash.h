@@ -0,0 +1,27 @@
+#ifndef _SHELL_HASH_H
+#define _SHELL_HASH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "shell.h"
+
+
+#define SHELL_NO_CMD        0xFF    /* empty dispatch slot          */
+#define SHELL_SEED_TRIES    256     /* hash seeds tried             */
+#define SHELL_NO_SEED       -1      /* no collision free seed       */
+
+/*--------------------------------------------------------
+Perfect hash for the shell's dispatch table. Kept apart
+from shell.c so the host build can search a seed for the
+real command names (esp_term/shell-seed.c) and generate
+shell_table.h; the firmware only places its commands
+with that seed.
+--------------------------------------------------------*/
+uint32_t shell_hash( const char *name, uint32_t seed );
+bool shell_hash_place( const shell_cmd_type *cmds, uint16_t cnt,
+                       uint32_t seed, uint8_t slots[ SHELL_HASH_SZ ] );
+int16_t shell_hash_build( const shell_cmd_type *cmds, uint16_t cnt,
+                          uint8_t slots[ SHELL_HASH_SZ ] );
+
+#endif
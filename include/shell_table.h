@@ -0,0 +1,27 @@
+#ifndef _SHELL_TABLE_H
+#define _SHELL_TABLE_H
+
+/*--------------------------------------------------------
+Generated by esp_term/shell-seed.c from the SHELL_CMD()s
+in src/, do not edit. Slots for seed 9:
+
+     1  conn
+     4  mux
+     5  bench
+    16  proto
+    18  async
+    20  help
+    21  vect
+    23  md
+    24  log
+    25  clock
+    34  uptime
+    51  mqtt
+    54  venc
+    55  defer
+    58  metrics
+    63  ota
+--------------------------------------------------------*/
+#define SHELL_SEED          9       /* perfect hash seed            */
+
+#endif
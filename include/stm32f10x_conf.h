@@ -72,6 +72,8 @@
   #define assert_param(expr) ((void)0)
 #endif /* USE_FULL_ASSERT */
 
+/* VECT_TAB_SRAM would point VTOR at RAM before anything is there,
+   vect_init() (vect.h) copies the table to RAM instead */
 //#define  VECT_TAB_SRAM
 
 #endif /* __STM32F10x_CONF_H */
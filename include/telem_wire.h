@@ -0,0 +1,119 @@
+#ifndef _TELEM_WIRE_H
+#define _TELEM_WIRE_H
+
+#include <stdint.h>
+
+#include "varenc.h"
+
+
+/*--------------------------------------------------------
+Telemetry datagram layout, shared by the firmware and the
+host collector. All fields are little endian.
+
+ Header, TELEM_HDR_SZ bytes:
+   0      magic  TELEM_MAGIC
+   1      version TELEM_VERSION
+   2..3   device id
+   4..7   sequence number, +1 per datagram
+   8..11  base time, device ms ticks
+   12..13 length of the records that follow
+
+ Version 1 record, TELEM_REC_SZ bytes:
+   0      metric id
+   1..2   ms since the base time
+   3..6   value, signed
+
+ Version 2 record, up to TELEM_REC_MAX bytes (varenc.h):
+   metric id
+   varint, ms since the previous record or the base time
+   zigzag varint, value minus the metric's previous value
+          in the datagram, or minus 0 for its first one
+
+Each datagram is coded on its own so a lost one does not
+affect the next. Only the first TELEM_METRIC_MAX metrics
+of a datagram are tracked, later ones are coded against
+0 (telem_hist_slot()).
+--------------------------------------------------------*/
+#define TELEM_MAGIC         0x54
+#define TELEM_VERSION       2
+#define TELEM_HDR_SZ        14
+#define TELEM_REC_SZ        7
+#define TELEM_REC_MAX       ( 1 + 2 * VARENC_UVAR_MAX )
+#define TELEM_METRIC_MAX    8
+#define TELEM_DGRAM_MAX     512     /* largest datagram sent        */
+
+/*--------------------------------------------------------
+Previous values of the metrics in a datagram
+--------------------------------------------------------*/
+typedef struct
+{
+    uint8_t             cnt;        /* metrics tracked              */
+    uint8_t             id[ TELEM_METRIC_MAX ];
+                                    /* metric ids                   */
+    int32_t             last[ TELEM_METRIC_MAX ];
+                                    /* previous value per metric    */
+} telem_hist_type;
+
+static inline void telem_put_u16( uint8_t *p, uint16_t v )
+{
+    p[ 0 ] = (uint8_t)v;
+    p[ 1 ] = (uint8_t)( v >> 8 );
+}
+
+static inline void telem_put_u32( uint8_t *p, uint32_t v )
+{
+    p[ 0 ] = (uint8_t)v;
+    p[ 1 ] = (uint8_t)( v >> 8 );
+    p[ 2 ] = (uint8_t)( v >> 16 );
+    p[ 3 ] = (uint8_t)( v >> 24 );
+}
+
+static inline void telem_put_u64( uint8_t *p, uint64_t v )
+{
+    telem_put_u32( p, (uint32_t)v );
+    telem_put_u32( p + 4, (uint32_t)( v >> 32 ) );
+}
+
+static inline uint16_t telem_get_u16( const uint8_t *p )
+{
+    return (uint16_t)( p[ 0 ] | ( p[ 1 ] << 8 ) );
+}
+
+static inline uint32_t telem_get_u32( const uint8_t *p )
+{
+    return (uint32_t)p[ 0 ] | ( (uint32_t)p[ 1 ] << 8 )
+         | ( (uint32_t)p[ 2 ] << 16 ) | ( (uint32_t)p[ 3 ] << 24 );
+}
+
+static inline uint64_t telem_get_u64( const uint8_t *p )
+{
+    return telem_get_u32( p ) | ( (uint64_t)telem_get_u32( p + 4 ) << 32 );
+}
+
+/*--------------------------------------------------------
+Previous value of a metric, added with 0 when first seen,
+NULL when the table is full
+--------------------------------------------------------*/
+static inline int32_t *telem_hist_slot( telem_hist_type *hist, uint8_t id )
+{
+    uint8_t             i;          /* loop counter                 */
+
+    for( i = 0; i < hist->cnt; i++ )
+    {
+        if( hist->id[ i ] == id )
+        {
+            return &hist->last[ i ];
+        }
+    }
+
+    if( hist->cnt == TELEM_METRIC_MAX )
+    {
+        return NULL;
+    }
+
+    hist->id[ hist->cnt ]   = id;
+    hist->last[ hist->cnt ] = 0;
+    return &hist->last[ hist->cnt++ ];
+}
+
+#endif
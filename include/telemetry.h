@@ -0,0 +1,44 @@
+#ifndef _TELEMETRY_H
+#define _TELEMETRY_H
+
+#include <stdint.h>
+
+#include "timer.h"
+#include "telem_wire.h"
+
+
+/*--------------------------------------------------------
+Set to 1 to build the uplink and the "venc" encoder
+benchmark. They take about 600 bytes of RAM and 273 bytes
+of the socket budget (net.h).
+--------------------------------------------------------*/
+#ifndef TELEM_ENABLE
+#define TELEM_ENABLE        0
+#endif
+
+/*--------------------------------------------------------
+Publisher statistics
+--------------------------------------------------------*/
+typedef struct
+{
+    uint32_t            records;    /* records queued               */
+    uint32_t            drops;      /* records lost, batch full     */
+    uint32_t            dgrams;     /* datagrams sent               */
+    uint32_t            seq;        /* next sequence number         */
+    uint16_t            reconnects; /* UDP socket reopened          */
+} telem_stats_type;
+
+/*--------------------------------------------------------
+Batched UDP telemetry uplink. Records are packed into a
+datagram (telem_wire.h) that is sent once the batching
+window since its first record has expired or it is full.
+Each datagram is one CIPSEND, the collector uses the
+sequence numbers to account for loss and reordering.
+--------------------------------------------------------*/
+void telem_init( const char *host, uint16_t port, uint16_t device_id,
+                 timer_ticks_t window );
+void telem_put( uint8_t id, int32_t value );
+void telem_poll( void );
+void telem_get_stats( telem_stats_type *stats );
+
+#endif
@@ -11,10 +11,16 @@
 // ----------------------------------------------------------------------------
 
 #define TIMER_FREQUENCY_HZ (1000u)
+#define TIMER_TICK_HANDLERS (4u)
 
 typedef uint32_t timer_ticks_t;
 
+// Called from the SysTick interrupt on every tick.
+typedef void (*timer_tick_handler_t) (void);
+
 extern volatile timer_ticks_t timer_delayCount;
+extern volatile timer_ticks_t timer_ticks;
+extern volatile uint32_t timer_wraps;
 
 extern void
 timer_start (void);
@@ -22,6 +28,30 @@ timer_start (void);
 extern void
 timer_sleep (timer_ticks_t ticks);
 
+// Returns 0, or -1 if all TIMER_TICK_HANDLERS are taken.
+extern int
+timer_add_tick_handler (timer_tick_handler_t handler);
+
+// Microseconds since timer_start(), from the tick count and the
+// SysTick counter. Safe to call with interrupts disabled and from
+// interrupts of any priority.
+extern uint64_t
+timer_get_us (void);
+
+// Milliseconds since timer_start(), wraps after ~49 days.
+static inline timer_ticks_t
+timer_get_ticks (void)
+{
+  return timer_ticks;
+}
+
+// True once the tick counter has reached the deadline, wrap safe.
+static inline int
+timer_expired (timer_ticks_t deadline)
+{
+  return (int32_t) (timer_ticks - deadline) >= 0;
+}
+
 // ----------------------------------------------------------------------------
 
 #endif // TIMER_H_
@@ -1,6 +1,7 @@
 #ifndef _USART_PRINT_H
 #define _USART_PRINT_H
 
+#include <stdbool.h>
 #include <stdio.h>
 
 #include "stm32f10x.h"
@@ -11,16 +12,75 @@
 
 #define ERR_UART_RX_BUF_FULL	-1
 #define ERR_UART_OVERRUN    	-2
+#define ERR_UART_MUX_ARG    	-3
+
+#define UART_MUX_CH_CNT     4       /* transmit channels            */
+#define UART_MUX_CH_URGENT  0       /* strict priority              */
+#define UART_MUX_CH_CONSOLE 1       /* uart_write()                 */
+#define UART_MUX_UNIT_MAX   144     /* longest write sent unbroken  */
+#define UART_MUX_QUANTUM_MIN 32     /* channel share, bytes per     */
+#define UART_MUX_QUANTUM_MAX 1024   /* turn                         */
 
 /*--------------------------------------------------------
 TODO add other UART releated errors (e.g. framing error)
 --------------------------------------------------------*/
 
 
+/*--------------------------------------------------------
+Receive handler, called from the UART 1 interrupt with
+each byte instead of buffering it for uart_read()
+--------------------------------------------------------*/
+typedef void (*uart_rx_handler_type)( uint8_t byte );
+
+/*--------------------------------------------------------
+Console handler, called with stdio output instead of
+writing it raw; urgent is set for stderr
+--------------------------------------------------------*/
+typedef uint16_t (*uart_console_type)( const void *buf, uint16_t bytes,
+                                       bool urgent );
+
+/*--------------------------------------------------------
+Transmit channel statistics
+--------------------------------------------------------*/
+typedef struct
+{
+    uint32_t            units;      /* units sent                   */
+    uint32_t            bytes;      /* bytes sent, without headers  */
+    uint16_t            waits;      /* writes that waited for room  */
+    uint16_t            max_queued; /* most bytes queued at once    */
+} uart_mux_stats_type;
+
+
+/*--------------------------------------------------------
+UART 1 driver. Writes are queued and sent by the TX
+interrupt, multiplexed over UART_MUX_CH_CNT channels with
+a ring each. A write is queued as units that the
+interrupt sends whole, changing channel only between
+them: the urgent channel first, the others in turn by
+the bytes per turn set with uart_mux_config(), so bulk
+data never holds up urgent output for more than the unit
+on the wire. uart_write() queues on the console channel
+and uart_write_urgent() on the urgent one; writes wait
+only for ring space. uart_read() never waits.
+
+uart_stdio_init() routes stdin, stdout and stderr here
+(_write.c, _read.c); a protocol sharing UART 1 takes
+stdio output over with uart_set_console().
+--------------------------------------------------------*/
 void uart_init( uint32_t baud_rate );
+void uart_stdio_init( void );
 uint16_t uart_read( void *buf, uint16_t bytes );
 uint16_t uart_write( const void *buf, uint16_t bytes );
+uint16_t uart_write_urgent( const void *buf, uint16_t bytes );
+uint16_t uart_mux_write( uint8_t ch, const void *buf, uint16_t bytes );
+int8_t uart_mux_config( uint8_t ch, uint16_t quantum );
+void uart_mux_get_stats( uint8_t ch, uart_mux_stats_type *stats );
+void uart_set_console( uart_console_type handler );
+uint16_t uart_console( const void *buf, uint16_t bytes, bool urgent );
 void uart_write_byte( uint8_t byte );
 void uart_write_msg( char *msg );
+void uart_flush( void );
+void uart_set_rx_handler( uart_rx_handler_type handler );
+void uart_inject( const void *buf, uint16_t bytes );
 
 #endif
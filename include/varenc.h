@@ -0,0 +1,83 @@
+#ifndef _VARENC_H
+#define _VARENC_H
+
+#include <stdint.h>
+
+
+#define VARENC_FIELDS_MAX   7       /* fields per record            */
+#define VARENC_UVAR_MAX     5       /* longest 32 bit varint        */
+#define VARENC_REC_MAX      ( 1 + VARENC_FIELDS_MAX * VARENC_UVAR_MAX )
+                                    /* longest encoded record       */
+#define VARENC_RUN_MAX      0x3FFF  /* longest run in one token     */
+
+#define VARENC_ERR_ROOM     -1      /* output buffer too small      */
+#define VARENC_ERR_DATA     -2      /* malformed input              */
+
+/*--------------------------------------------------------
+Record stream state, one for the encoder and one for the
+decoder of a stream. A record is a fixed number of 32 bit
+fields; values are coded as differences from the same
+field of the previous record, starting from 0.
+--------------------------------------------------------*/
+typedef struct
+{
+    uint8_t             fields;     /* fields per record            */
+    uint16_t            run;        /* repeats not yet written, or  */
+                                    /* not yet returned             */
+    int32_t             prev[ VARENC_FIELDS_MAX ];
+                                    /* previous record              */
+    int32_t             delta[ VARENC_FIELDS_MAX ];
+                                    /* previous record's deltas     */
+} varenc_ctx_type;
+
+/*--------------------------------------------------------
+Zigzag mapping, small negative numbers become small
+unsigned ones: 0, -1, 1, -2 .. -> 0, 1, 2, 3 ..
+--------------------------------------------------------*/
+static inline uint32_t varenc_zigzag( int32_t v )
+{
+    return ( (uint32_t)v << 1 ) ^ (uint32_t)( v >> 31 );
+}
+
+static inline int32_t varenc_unzigzag( uint32_t v )
+{
+    return (int32_t)( v >> 1 ) ^ -(int32_t)( v & 1 );
+}
+
+/*--------------------------------------------------------
+Varints: 7 bits per byte, least significant first, bit 7
+set on all but the last byte. varenc_put_uvar() returns
+the bytes written (1 .. VARENC_UVAR_MAX), varenc_get_uvar()
+the bytes read or 0 if the input ends or is too long.
+--------------------------------------------------------*/
+uint8_t varenc_put_uvar( uint8_t *p, uint32_t v );
+uint8_t varenc_get_uvar( const uint8_t *p, uint16_t len, uint32_t *v );
+
+/*--------------------------------------------------------
+Record stream. Each record starts with a varint token:
+
+ token bit 0 clear: a record follows. Bits 1.. are a mask
+   of the fields whose delta is not 0, each of those
+   follows as a zigzag varint in field order.
+ token bit 0 set: bits 1.. are a count of records whose
+   deltas are all the same as the record before them.
+
+A counter stepping at a steady rate, or a value that does
+not change, costs nothing while it keeps doing so, and a
+run of such records costs one token.
+
+varenc_put() returns the bytes written, 0 when the record
+was taken into a run; varenc_flush() writes a pending run
+and must be called before the stream is sent.
+varenc_get() decodes one record and returns the bytes
+used, 0 for a record of a run, VARENC_ERR_DATA when the
+input is malformed or ends inside a record.
+--------------------------------------------------------*/
+void varenc_init( varenc_ctx_type *ctx, uint8_t fields );
+int16_t varenc_put( varenc_ctx_type *ctx, const int32_t *rec,
+                    uint8_t *out, uint16_t room );
+int16_t varenc_flush( varenc_ctx_type *ctx, uint8_t *out, uint16_t room );
+int16_t varenc_get( varenc_ctx_type *ctx, const uint8_t *in, uint16_t len,
+                    int32_t *rec );
+
+#endif
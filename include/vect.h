@@ -0,0 +1,52 @@
+#ifndef _VECT_H
+#define _VECT_H
+
+#include <stdint.h>
+
+#include "stm32f10x.h"
+
+
+/*--------------------------------------------------------
+Set to 0 to leave the vector table in flash. Handlers
+are then only those linked by name, and vect_set() fails
+so drivers keep their generic handlers.
+--------------------------------------------------------*/
+#ifndef VECT_RAM
+#define VECT_RAM            1
+#endif
+
+#define VECT_SYS_CNT        16      /* stack pointer and exceptions */
+#define VECT_IRQ_CNT        68      /* most of any STM32F10x        */
+#define VECT_CNT            ( VECT_SYS_CNT + VECT_IRQ_CNT )
+#define VECT_ALIGN          512     /* VTOR: a power of 2 the table */
+                                    /* fits in                      */
+
+#define VECT_ERR_FLASH      -1      /* table is not in RAM          */
+#define VECT_ERR_IRQ        -2      /* no such vector               */
+
+typedef void (*vect_handler_type)( void );
+
+/* Vector table the image is linked with, vectors_stm32f10x.c */
+extern vect_handler_type const __isr_vectors[];
+
+/*--------------------------------------------------------
+Vector table in RAM. vect_init() copies the table the
+image was started with (set by SystemInit() or the
+bootloader) and points VTOR at the copy; vect_set() then
+swaps the handler of any interrupt, or of a system
+exception from NMI_IRQn on, at run time.
+
+A driver with several modes installs a handler written
+for the mode it is in, instead of testing the mode in a
+generic handler on every interrupt. The generic handler
+stays linked by name, it runs when the table is in flash
+(VECT_RAM 0, or before vect_init()).
+
+A swap is a single word store, an interrupt sees either
+handler whole. Call vect_init() first thing in main().
+--------------------------------------------------------*/
+void vect_init( void );
+int8_t vect_set( IRQn_Type irq, vect_handler_type handler );
+vect_handler_type vect_get( IRQn_Type irq );
+
+#endif
@@ -0,0 +1,70 @@
+//
+// This file is part of the µOS++ III distribution.
+// Copyright (c) 2014 Liviu Ionescu.
+//
+
+// Do not include on semihosting and when freestanding
+#if !defined(OS_USE_SEMIHOSTING) && !(__STDC_HOSTED__ == 0)
+
+// ----------------------------------------------------------------------------
+
+#include <errno.h>
+#include "uart_print.h"
+
+// ----------------------------------------------------------------------------
+
+// The input side of _write.c: read() on the input file descriptor
+// returns what UART 1 has received so far, and never waits. With
+// nothing received, or after a receive error, it fails with EAGAIN,
+// which the stdio layer reports as EOF with the error flag set.
+
+// Nothing arrives here while the control protocol has taken over
+// receive (proto_init()).
+
+// These override the weak stubs in newlib/_syscalls.c.
+
+int
+_read (int fd, char* buf, int nbyte);
+
+int
+_isatty (int fd);
+
+int
+_read (int fd, char* buf, int nbyte)
+{
+  uint16_t n;
+
+  if (fd != 0)
+    {
+      errno = EBADF;
+      return -1;
+    }
+
+  n = uart_read (buf, (nbyte > 0xFFFF) ? 0xFFFF : (uint16_t) nbyte);
+  if (n == 0 || (int16_t) n < 0)
+    {
+      errno = EAGAIN;
+      return -1;
+    }
+
+  return n;
+}
+
+// The console is a terminal, so newlib line buffers stdout even
+// before uart_stdio_init() sets it up.
+
+int
+_isatty (int fd)
+{
+  if (fd >= 0 && fd <= 2)
+    {
+      return 1;
+    }
+
+  errno = EBADF;
+  return 0;
+}
+
+// ----------------------------------------------------------------------------
+
+#endif // !defined(OS_USE_SEMIHOSTING) && !(__STDC_HOSTED__ == 0)
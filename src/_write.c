@@ -9,7 +9,9 @@
 // ----------------------------------------------------------------------------
 
 #include <errno.h>
+#include <sys/types.h>
 #include "diag/Trace.h"
+#include "uart_print.h"
 
 // ----------------------------------------------------------------------------
 
@@ -19,9 +21,11 @@
 // Based on the file descriptor, it can send arrays of characters to
 // different physical devices.
 
-// Currently only the output and error file descriptors are tested,
-// and the characters are forwarded to the trace device, mainly
-// for demonstration purposes. Adjust it for your specific needs.
+// The output and error file descriptors go to UART 1, the console,
+// through uart_console(): output on the console channel, errors on
+// the urgent one, ahead of everything else queued. Once the control
+// protocol has taken over UART 1 both are sent as PROTO_T_CONSOLE
+// frames. Under TRACE a copy also goes to the trace device.
 
 // For freestanding applications this file is not used and can be safely
 // ignored.
@@ -30,19 +34,34 @@ ssize_t
 _write (int fd, const char* buf, size_t nbyte);
 
 ssize_t
-_write (int fd __attribute__((unused)), const char* buf __attribute__((unused)),
-	size_t nbyte __attribute__((unused)))
+_write (int fd, const char* buf, size_t nbyte)
 {
-#if defined(TRACE)
-  // STDOUT and STDERR are routed to the trace device
-  if (fd == 1 || fd == 2)
+  size_t done;
+  uint16_t chunk;
+
+  if (fd != 1 && fd != 2)
     {
-      return trace_write (buf, nbyte);
+      errno = EBADF;
+      return -1;
     }
+
+#if defined(TRACE)
+  trace_write (buf, nbyte);
 #endif // TRACE
 
-  errno = ENOSYS;
-  return -1;
+  if (fd == 2)
+    {
+      chunk = (nbyte > 0xFFFF) ? 0xFFFF : (uint16_t) nbyte;
+      return uart_console (buf, chunk, true);
+    }
+
+  for (done = 0; done < nbyte; done += chunk)
+    {
+      chunk = (nbyte - done > 0xFFFF) ? 0xFFFF : (uint16_t) (nbyte - done);
+      uart_console (buf + done, chunk, false);
+    }
+
+  return nbyte;
 }
 
 // ----------------------------------------------------------------------------
@@ -0,0 +1,314 @@
+/*----------------------------------------------------------------------
+                            INCLUDES
+----------------------------------------------------------------------*/
+
+#include <cstdlib>
+
+#include "async.hpp"
+
+extern "C" {
+#include "shell.h"
+}
+
+/*----------------------------------------------------------------------
+                            CONSTANTS
+----------------------------------------------------------------------*/
+
+#define ASYNC_BENCH_STEPS   1000    /* default "async" steps        */
+#define ASYNC_BENCH_CHUNK   100     /* steps run per shell step     */
+
+/*----------------------------------------------------------------------
+                            TYPES
+----------------------------------------------------------------------*/
+
+/*--------------------------------------------------------
+The callback state machine the "async" command measures
+against: a poll function per pending operation, state
+kept in a struct by its owner
+--------------------------------------------------------*/
+typedef struct async_sm_type
+{
+    bool                ( *step )( struct async_sm_type *sm );
+                                    /* advance, true when finished  */
+    uint8_t             state;      /* current state                */
+    uint32_t            left;       /* steps left                   */
+} async_sm_type;
+
+using bench_pool = async::frame_pool< 64, 1 >;
+
+/*--------------------------------------------------------
+Yield that only the "async" command's own polls resume,
+so the main loop's async_poll() neither runs nor is timed
+against the benchmark between shell steps
+--------------------------------------------------------*/
+struct bench_yield : async::wait_node
+{
+    static bool poll( wait_node * );
+
+    void await_suspend( std::coroutine_handle<> h ) noexcept { ready = poll; async::wait( this, h ); }
+    void await_resume( void ) const noexcept {}
+};
+
+/*----------------------------------------------------------------------
+                            VARIABLES
+----------------------------------------------------------------------*/
+
+static async::wait_node *s_waiting; /* suspended coroutines         */
+static async::wait_node *s_polled;  /* rest of the list being       */
+                                    /* polled by async_poll()       */
+static bool             s_bench_run;/* bench_yield may resume       */
+static async::task< bench_pool >::handle_type
+                        s_bench;    /* benchmark coroutine          */
+static async_sm_type    s_sm;       /* benchmark state machine      */
+
+/*----------------------------------------------------------------------
+                            PROCEDURES
+----------------------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+static async::task< bench_pool > async_bench_coro( uint32_t steps );
+static bool async_bench_sm( async_sm_type *sm );
+static int8_t async_shell( shell_ctx_type *ctx, uint8_t argc, char *argv[] );
+
+SHELL_CMD( "async", "[steps], coroutine vs callback cost", async_shell );
+
+
+/*--------------------------------------------------------
+Suspend a coroutine until node->ready() returns true
+--------------------------------------------------------*/
+void async::wait( wait_node *node, std::coroutine_handle<> handle )
+{
+    node->handle = handle;
+    node->next   = s_waiting;
+    s_waiting    = node;
+}
+
+
+/*--------------------------------------------------------
+Take a node off the waiting list, or off the part of it
+async_poll() has yet to check, when its coroutine is
+destroyed while suspended
+--------------------------------------------------------*/
+void async::cancel( wait_node *node )
+{
+    /*--------------------------------------------------------
+    Local variables
+    --------------------------------------------------------*/
+    async::wait_node  **link;       /* pointer to the node checked  */
+
+    for( link = &s_waiting; *link != nullptr; link = &( *link )->next )
+    {
+        if( *link == node )
+        {
+            *link = node->next;
+            break;
+        }
+    }
+
+    for( link = &s_polled; *link != nullptr; link = &( *link )->next )
+    {
+        if( *link == node )
+        {
+            *link = node->next;
+            break;
+        }
+    }
+
+    node->handle = nullptr;
+}
+
+
+/*--------------------------------------------------------
+Resume the coroutines whose wait is over. The list is
+taken whole, so coroutines that wait again while being
+resumed are checked on the next pass. A coroutine
+resumed here may destroy others that are still to be
+checked; cancel() takes them off s_polled.
+--------------------------------------------------------*/
+extern "C" void async_poll( void )
+{
+    /*--------------------------------------------------------
+    Local variables
+    --------------------------------------------------------*/
+    async::wait_node   *node;       /* node being checked           */
+    std::coroutine_handle<> handle; /* coroutine to resume          */
+
+    s_polled  = s_waiting;
+    s_waiting = nullptr;
+
+    while( s_polled != nullptr )
+    {
+        node     = s_polled;
+        s_polled = node->next;
+        if( node->ready( node ) )
+        {
+            handle       = node->handle;
+            node->handle = nullptr;
+            handle.resume();
+        }
+        else
+        {
+            node->next = s_waiting;
+            s_waiting  = node;
+        }
+    }
+}
+
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Ready when polled by the "async" command
+--------------------------------------------------------*/
+bool bench_yield::poll( wait_node * )
+{
+    return s_bench_run;
+}
+
+
+/*--------------------------------------------------------
+Wait steps times for the next poll
+--------------------------------------------------------*/
+static async::task< bench_pool > async_bench_coro( uint32_t steps )
+{
+    for( uint32_t i = 0; i < steps; i++ )
+    {
+        co_await bench_yield();
+    }
+
+    co_return static_cast< int32_t >( steps );
+}
+
+
+/*--------------------------------------------------------
+The same as a state machine
+--------------------------------------------------------*/
+static bool async_bench_sm( async_sm_type *sm )
+{
+    switch( sm->state )
+    {
+        case 0:
+            if( sm->left == 0 )
+            {
+                sm->state = 1;
+                return true;
+            }
+            sm->left--;
+            return false;
+
+        default:
+            return true;
+    }
+}
+
+
+/*--------------------------------------------------------
+Shell: async [steps]. Runs a coroutine that yields steps
+times and a callback state machine of the same steps,
+both driven by a poll loop, and prints cycles per step
+and the RAM each keeps. Each shell step runs at most
+ASYNC_BENCH_CHUNK steps, so the main loop keeps going;
+ctx->step is the phase, val[] the steps and the cycles
+counted so far.
+--------------------------------------------------------*/
+static int8_t async_shell( shell_ctx_type *ctx, uint8_t argc, char *argv[] )
+{
+    /*--------------------------------------------------------
+    Local variables
+    --------------------------------------------------------*/
+    uint32_t            start;      /* cycle count at start         */
+    uint32_t            i;          /* loop counter                 */
+
+    switch( ctx->step )
+    {
+        case 0:
+            if( argc > 2 )
+            {
+                return SHELL_USAGE;
+            }
+
+            ctx->val[ 0 ] = ( argc == 2 ) ? strtoul( argv[ 1 ], nullptr, 0 ) : ASYNC_BENCH_STEPS;
+            if( ctx->val[ 0 ] == 0 )
+            {
+                return SHELL_USAGE;
+            }
+
+            CoreDebug->DEMCR = CoreDebug->DEMCR | CoreDebug_DEMCR_TRCENA_Msk;
+            DWT->CTRL        = DWT->CTRL | DWT_CTRL_CYCCNTENA_Msk;
+
+            s_bench = async_bench_coro( ctx->val[ 0 ] ).release();
+            if( !s_bench )
+            {
+                shell_printf( "no frame, %u bytes needed, slot is %u\n",
+                              (unsigned)bench_pool::largest, (unsigned)bench_pool::slot_sz );
+                return SHELL_FAIL;
+            }
+
+            start = DWT->CYCCNT;
+            s_bench.resume();
+            ctx->val[ 1 ] = DWT->CYCCNT - start;
+            ctx->step     = 1;
+            return SHELL_MORE;
+
+        case 1:
+            /*--------------------------------------------------------
+            Coroutine. Other coroutines waiting are polled and
+            resumed in the same async_poll() calls, their cost is
+            counted too; they are few.
+            --------------------------------------------------------*/
+            s_bench_run = true;
+            start       = DWT->CYCCNT;
+            for( i = 0; i < ASYNC_BENCH_CHUNK && !s_bench.done(); i++ )
+            {
+                async_poll();
+            }
+            ctx->val[ 1 ] += DWT->CYCCNT - start;
+            s_bench_run    = false;
+
+            if( !s_bench.done() )
+            {
+                return SHELL_MORE;
+            }
+
+            s_bench.destroy();
+            s_bench = nullptr;
+
+            s_sm.step     = async_bench_sm;
+            s_sm.state    = 0;
+            s_sm.left     = ctx->val[ 0 ];
+            ctx->val[ 2 ] = 0;
+            ctx->step     = 2;
+            return SHELL_MORE;
+
+        default:
+            /*--------------------------------------------------------
+            State machine through a poll of its own
+            --------------------------------------------------------*/
+            start = DWT->CYCCNT;
+            for( i = 0; i < ASYNC_BENCH_CHUNK && s_sm.step != nullptr; i++ )
+            {
+                if( s_sm.step( &s_sm ) )
+                {
+                    s_sm.step = nullptr;
+                }
+            }
+            ctx->val[ 2 ] += DWT->CYCCNT - start;
+
+            if( s_sm.step != nullptr )
+            {
+                return SHELL_MORE;
+            }
+            break;
+    }
+
+    shell_printf( "coroutine %lu cyc/step, frame %u bytes in a %u byte slot\n",
+                  (unsigned long)( ctx->val[ 1 ] / ctx->val[ 0 ] ), (unsigned)bench_pool::largest,
+                  (unsigned)bench_pool::slot_sz );
+    shell_printf( "callback  %lu cyc/step, state %u bytes\n",
+                  (unsigned long)( ctx->val[ 2 ] / ctx->val[ 0 ] ), (unsigned)sizeof( async_sm_type ) );
+    return SHELL_DONE;
+}
@@ -0,0 +1,646 @@
+/*----------------------------------------------------------------------
+                            INCLUDES
+----------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "stm32f10x.h"
+#include "arm/semihosting.h"
+
+#include "bench.h"
+#include "cobs.h"
+#include "esp_ipd.h"
+#include "proto.h"
+#include "shell.h"
+#include "timer.h"
+#include "uart_print.h"
+
+#if( BENCH_ENABLE )
+
+/*----------------------------------------------------------------------
+                            CONSTANTS
+----------------------------------------------------------------------*/
+
+#define BENCH_MODE_RB       1       /* SYS_OPEN "rb"                */
+#define BENCH_MODE_W        4       /* SYS_OPEN "w"                 */
+#define BENCH_MODE_WB       5       /* SYS_OPEN "wb"                */
+#define BENCH_CMDLINE_SZ    80      /* semihosting command line     */
+#define BENCH_REPORT_SZ     128     /* summary line                 */
+
+/*----------------------------------------------------------------------
+                            VARIABLES
+----------------------------------------------------------------------*/
+
+static const char * const s_names[ BENCH_T_CNT ] =
+                        { "uart", "esp", "cobs" };
+                                    /* target names                 */
+static bench_result_type s_result;  /* current or last run          */
+static bool             s_active;   /* a run is in progress         */
+static bool             s_exit;     /* exit when the run is done    */
+static int32_t          s_in;       /* input file handle            */
+static int32_t          s_out;      /* output file handle, or -1    */
+static uint8_t         *s_link_buf; /* link 0 buffer before the run */
+static uint16_t         s_link_sz;  /* and its size                 */
+static uint64_t         s_start_us; /* start of the run             */
+static uint32_t         s_err_base; /* target errors at the start   */
+static uint8_t          s_chunk[ BENCH_CHUNK_SZ ];
+                                    /* input read from the host     */
+static uint16_t         s_chunk_len;/* bytes in s_chunk             */
+static uint16_t         s_chunk_pos;/* next byte to feed            */
+static uint8_t          s_frame[ BENCH_FRAME_MAX ];
+                                    /* COBS frame, or link 0 ring   */
+static uint16_t         s_frame_len;/* encoded bytes in s_frame     */
+static bool             s_frame_skip;
+                                    /* dropping an overlong frame   */
+
+/*----------------------------------------------------------------------
+                            PROCEDURES
+----------------------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+static uint32_t bench_errors( void );
+static void bench_feed_cobs( void );
+static void bench_feed_esp( void );
+static void bench_feed_uart( void );
+static void bench_finish( void );
+static void bench_host_close( int32_t handle );
+static int32_t bench_host_open( const char *path, uint32_t mode );
+static bool bench_host_present( void );
+static uint32_t bench_host_read( int32_t handle, void *buf, uint32_t len );
+static uint32_t bench_host_write( int32_t handle, const void *buf,
+                                  uint32_t len );
+static int8_t bench_shell( shell_ctx_type *ctx, uint8_t argc, char *argv[] );
+
+SHELL_CMD( "bench", "<uart|esp|cobs> <file> [out], replay a host file",
+           bench_shell );
+
+
+/*--------------------------------------------------------
+Start the run given on the semihosting command line, if
+any. The firmware exits when it is done.
+--------------------------------------------------------*/
+void bench_init( void )
+{
+    /*--------------------------------------------------------
+    Local variables
+    --------------------------------------------------------*/
+    char                cmdline[ BENCH_CMDLINE_SZ ];
+                                    /* host command line            */
+    char               *argv[ 4 ];  /* bench and its arguments      */
+    char               *tok;        /* next word                    */
+    uint32_t            blk[ 2 ];   /* SYS_GET_CMDLINE block        */
+    uint8_t             argc;       /* words from "bench" on        */
+
+    memset( &s_result, 0, sizeof( s_result ) );
+    s_active = false;
+
+    if( !bench_host_present() )
+    {
+        return;
+    }
+
+    blk[ 0 ] = (uint32_t)cmdline;
+    blk[ 1 ] = sizeof( cmdline ) - 1;
+    if( call_host( SEMIHOSTING_SYS_GET_CMDLINE, blk ) != 0 )
+    {
+        return;
+    }
+    cmdline[ blk[ 1 ] ] = '\0';
+
+    /*--------------------------------------------------------
+    The words before "bench" are the host's, e.g. the image
+    name
+    --------------------------------------------------------*/
+    argc = 0;
+    for( tok = strtok( cmdline, " " ); tok != NULL && argc < 4; tok = strtok( NULL, " " ) )
+    {
+        if( argc > 0 || strcmp( tok, "bench" ) == 0 )
+        {
+            argv[ argc++ ] = tok;
+        }
+    }
+
+    if( argc < 3 )
+    {
+        return;
+    }
+
+    if( bench_start( argv[ 1 ], argv[ 2 ], ( argc == 4 ) ? argv[ 3 ] : NULL ) < 0 )
+    {
+        report_exception( ADP_Stopped_RunTimeError );
+    }
+    s_exit = true;
+}
+
+
+/*--------------------------------------------------------
+Feed the next chunk of a run
+--------------------------------------------------------*/
+void bench_poll( void )
+{
+    if( !s_active )
+    {
+        return;
+    }
+
+    switch( s_result.target )
+    {
+        case BENCH_T_UART:
+            bench_feed_uart();
+            break;
+
+        case BENCH_T_ESP:
+            bench_feed_esp();
+            break;
+
+        default:
+            bench_feed_cobs();
+            break;
+    }
+}
+
+
+/*--------------------------------------------------------
+Open the files and start a run, fed by bench_poll()
+--------------------------------------------------------*/
+int8_t bench_start( const char *target, const char *in_path,
+                    const char *out_path )
+{
+    /*--------------------------------------------------------
+    Local variables
+    --------------------------------------------------------*/
+    uint8_t             t;          /* target index                 */
+
+    if( s_active )
+    {
+        return BENCH_ERR_BUSY;
+    }
+
+    if( !bench_host_present() )
+    {
+        return BENCH_ERR_HOST;
+    }
+
+    for( t = 0; t < BENCH_T_CNT && strcmp( target, s_names[ t ] ) != 0; t++ );
+    if( t == BENCH_T_CNT )
+    {
+        return BENCH_ERR_TARGET;
+    }
+
+    s_in = bench_host_open( in_path, BENCH_MODE_RB );
+    if( s_in < 0 )
+    {
+        return BENCH_ERR_OPEN;
+    }
+
+    s_out = -1;
+    if( out_path != NULL && t != BENCH_T_UART )
+    {
+        s_out = bench_host_open( out_path, BENCH_MODE_WB );
+        if( s_out < 0 )
+        {
+            bench_host_close( s_in );
+            return BENCH_ERR_OPEN;
+        }
+    }
+
+    memset( &s_result, 0, sizeof( s_result ) );
+    s_result.target = (bench_target_type)t;
+    s_chunk_len     = 0;
+    s_chunk_pos     = 0;
+    s_frame_len     = 0;
+    s_frame_skip    = false;
+
+    /*--------------------------------------------------------
+    The ESP8266 is shut out for the run, its bytes would mix
+    with the file's. Received bytes already queued have been
+    parsed by the time the interrupt is off, deferred work
+    preempts the main loop.
+    --------------------------------------------------------*/
+    if( t == BENCH_T_ESP )
+    {
+        s_link_buf = esp_ipd_link_buf( 0, &s_link_sz );
+        esp_ipd_link_attach( 0, s_frame, sizeof( s_frame ) );
+        NVIC_DisableIRQ( USART2_IRQn );
+    }
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL        |= DWT_CTRL_CYCCNTENA_Msk;
+
+    s_err_base = bench_errors();
+    s_start_us = timer_get_us();
+    s_active   = true;
+    return 0;
+}
+
+
+/*--------------------------------------------------------
+True while a run is in progress
+--------------------------------------------------------*/
+bool bench_active( void )
+{
+    return s_active;
+}
+
+
+/*--------------------------------------------------------
+Get the result of the current or last run
+--------------------------------------------------------*/
+void bench_get_result( bench_result_type *result )
+{
+    *result = s_result;
+}
+
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Error and drop count kept by the target
+--------------------------------------------------------*/
+static uint32_t bench_errors( void )
+{
+    /*--------------------------------------------------------
+    Local variables
+    --------------------------------------------------------*/
+    proto_stats_type    proto;      /* protocol statistics          */
+    esp_ipd_stats_type  ipd;        /* parser statistics            */
+
+    switch( s_result.target )
+    {
+        case BENCH_T_UART:
+            proto_get_stats( &proto );
+            return (uint32_t)proto.cobs_errors + proto.hdr_errors
+                 + proto.len_errors + proto.crc_errors + proto.overflows;
+
+        case BENCH_T_ESP:
+            esp_ipd_get_stats( &ipd );
+            return ipd.payload_drops + ipd.line_drops + ipd.hdr_errors;
+
+        default:
+            return 0;
+    }
+}
+
+
+/*--------------------------------------------------------
+Decode a chunk of COBS frames, each 0x00 delimited, and
+write the frames out
+--------------------------------------------------------*/
+static void bench_feed_cobs( void )
+{
+    /*--------------------------------------------------------
+    Local variables
+    --------------------------------------------------------*/
+    uint32_t            start;      /* cycle count at start         */
+    uint16_t            len;        /* bytes read                   */
+    uint16_t            i;          /* byte index                   */
+    int16_t             n;          /* decoded length               */
+
+    len = bench_host_read( s_in, s_chunk, sizeof( s_chunk ) );
+    if( len == 0 )
+    {
+        bench_finish();
+        return;
+    }
+    s_result.bytes += len;
+
+    /*--------------------------------------------------------
+    Frames are decoded after a two byte length slot
+    --------------------------------------------------------*/
+    start = DWT->CYCCNT;
+    for( i = 0; i < len; i++ )
+    {
+        if( s_chunk[ i ] != 0 )
+        {
+            if( s_frame_skip )
+            {
+                continue;
+            }
+
+            if( s_frame_len == sizeof( s_frame ) - 2 )
+            {
+                s_result.errors++;
+                s_frame_skip = true;
+                continue;
+            }
+
+            s_frame[ 2 + s_frame_len++ ] = s_chunk[ i ];
+            continue;
+        }
+
+        n = ( s_frame_len > 0 && !s_frame_skip )
+            ? cobs_decode( &s_frame[ 2 ], s_frame_len ) : 0;
+        s_frame_len  = 0;
+        s_frame_skip = false;
+
+        if( n < 0 )
+        {
+            s_result.errors++;
+            continue;
+        }
+
+        if( n > 0 )
+        {
+            s_result.items++;
+            s_frame[ 0 ] = (uint8_t)n;
+            s_frame[ 1 ] = (uint8_t)( n >> 8 );
+
+            s_result.cycles += DWT->CYCCNT - start;
+            s_result.out_bytes += bench_host_write( s_out, s_frame, n + 2 );
+            start = DWT->CYCCNT;
+        }
+    }
+    s_result.cycles += DWT->CYCCNT - start;
+}
+
+
+/*--------------------------------------------------------
+Feed a chunk to the ESP8266 parser, then write out what
+it queued
+--------------------------------------------------------*/
+static void bench_feed_esp( void )
+{
+    /*--------------------------------------------------------
+    Local variables
+    --------------------------------------------------------*/
+    const char         *line;       /* queued response line         */
+    uint32_t            start;      /* cycle count at start         */
+    uint16_t            len;        /* bytes read or copied         */
+    uint16_t            i;          /* byte index                   */
+
+    len = bench_host_read( s_in, s_chunk, sizeof( s_chunk ) );
+    if( len == 0 )
+    {
+        bench_finish();
+        return;
+    }
+    s_result.bytes += len;
+
+    start = DWT->CYCCNT;
+    for( i = 0; i < len; i++ )
+    {
+        esp_ipd_feed( s_chunk[ i ] );
+    }
+    s_result.cycles += DWT->CYCCNT - start;
+
+    /*--------------------------------------------------------
+    Drain after every chunk, so nothing is dropped that the
+    AT layer would have read in time
+    --------------------------------------------------------*/
+    while( ( line = esp_ipd_line() ) != NULL )
+    {
+        len = strlen( line );
+        memcpy( s_chunk, line, len );
+        s_chunk[ len++ ] = '\n';
+        esp_ipd_line_release();
+
+        s_result.items++;
+        s_result.out_bytes += bench_host_write( s_out, s_chunk, len );
+    }
+
+    while( ( len = esp_ipd_link_read( 0, s_chunk, sizeof( s_chunk ) ) ) > 0 )
+    {
+        s_result.out_bytes += bench_host_write( s_out, s_chunk, len );
+    }
+}
+
+
+/*--------------------------------------------------------
+Feed the UART 1 receive path up to and including the
+next frame delimiter, so the protocol's receive slots are
+emptied by the main loop in between as they would be at
+line rate
+--------------------------------------------------------*/
+static void bench_feed_uart( void )
+{
+    /*--------------------------------------------------------
+    Local variables
+    --------------------------------------------------------*/
+    const uint8_t      *delim;      /* next delimiter, if any       */
+    uint32_t            start;      /* cycle count at start         */
+    uint16_t            len;        /* bytes to feed                */
+
+    if( s_chunk_pos == s_chunk_len )
+    {
+        s_chunk_pos = 0;
+        s_chunk_len = bench_host_read( s_in, s_chunk, sizeof( s_chunk ) );
+        if( s_chunk_len == 0 )
+        {
+            bench_finish();
+            return;
+        }
+        s_result.bytes += s_chunk_len;
+    }
+
+    len   = s_chunk_len - s_chunk_pos;
+    delim = memchr( &s_chunk[ s_chunk_pos ], 0, len );
+    if( delim != NULL )
+    {
+        len = delim - &s_chunk[ s_chunk_pos ] + 1;
+        s_result.items++;
+    }
+
+    start = DWT->CYCCNT;
+    uart_inject( &s_chunk[ s_chunk_pos ], len );
+    s_result.cycles += DWT->CYCCNT - start;
+
+    s_chunk_pos += len;
+}
+
+
+/*--------------------------------------------------------
+End the run: close the files, give the ESP8266 and link 0
+back to their owner and print the summary on the host
+console
+--------------------------------------------------------*/
+static void bench_finish( void )
+{
+    /*--------------------------------------------------------
+    Local variables
+    --------------------------------------------------------*/
+    char                report[ BENCH_REPORT_SZ ];
+                                    /* summary line                 */
+    int32_t             tt;         /* host console handle          */
+    int                 len;        /* summary length               */
+
+    s_result.run_us  = (uint32_t)( timer_get_us() - s_start_us );
+    s_result.errors += bench_errors() - s_err_base;
+
+    bench_host_close( s_in );
+    if( s_out >= 0 )
+    {
+        bench_host_close( s_out );
+    }
+
+    if( s_result.target == BENCH_T_ESP )
+    {
+        esp_ipd_link_attach( 0, s_link_buf, s_link_sz );
+        NVIC_EnableIRQ( USART2_IRQn );
+    }
+
+    len = snprintf( report, sizeof( report ),
+                    "bench %s: %lu bytes %lu cyc (%lu cyc/byte) %lu us, "
+                    "%lu items %lu out %lu errors\n",
+                    s_names[ s_result.target ],
+                    (unsigned long)s_result.bytes,
+                    (unsigned long)s_result.cycles,
+                    (unsigned long)( s_result.bytes ? s_result.cycles / s_result.bytes : 0 ),
+                    (unsigned long)s_result.run_us,
+                    (unsigned long)s_result.items,
+                    (unsigned long)s_result.out_bytes,
+                    (unsigned long)s_result.errors );
+
+    if( len >= (int)sizeof( report ) )
+    {
+        len = sizeof( report ) - 1;
+    }
+
+    tt = bench_host_open( ":tt", BENCH_MODE_W );
+    if( tt >= 0 && len > 0 )
+    {
+        bench_host_write( tt, report, len );
+    }
+    if( tt >= 0 )
+    {
+        bench_host_close( tt );
+    }
+
+    s_active = false;
+    if( s_exit )
+    {
+        report_exception( ADP_Stopped_ApplicationExit );
+    }
+}
+
+
+/*--------------------------------------------------------
+SYS_CLOSE
+--------------------------------------------------------*/
+static void bench_host_close( int32_t handle )
+{
+    uint32_t            blk[ 1 ];   /* SYS_CLOSE block              */
+
+    blk[ 0 ] = handle;
+    call_host( SEMIHOSTING_SYS_CLOSE, blk );
+}
+
+
+/*--------------------------------------------------------
+SYS_OPEN, returns the handle or -1
+--------------------------------------------------------*/
+static int32_t bench_host_open( const char *path, uint32_t mode )
+{
+    uint32_t            blk[ 3 ];   /* SYS_OPEN block               */
+
+    blk[ 0 ] = (uint32_t)path;
+    blk[ 1 ] = mode;
+    blk[ 2 ] = strlen( path );
+    return call_host( SEMIHOSTING_SYS_OPEN, blk );
+}
+
+
+/*--------------------------------------------------------
+True if a semihosting call will be answered rather than
+fault
+--------------------------------------------------------*/
+static bool bench_host_present( void )
+{
+#if( BENCH_SEMIHOSTING ) || defined( OS_USE_SEMIHOSTING )
+    return true;
+#else
+    return ( CoreDebug->DHCSR & CoreDebug_DHCSR_C_DEBUGEN_Msk ) != 0;
+#endif
+}
+
+
+/*--------------------------------------------------------
+SYS_READ, returns the bytes read, 0 at end of file or on
+an error
+--------------------------------------------------------*/
+static uint32_t bench_host_read( int32_t handle, void *buf, uint32_t len )
+{
+    uint32_t            blk[ 3 ];   /* SYS_READ block               */
+    uint32_t            left;       /* bytes not read               */
+
+    blk[ 0 ] = handle;
+    blk[ 1 ] = (uint32_t)buf;
+    blk[ 2 ] = len;
+    left = (uint32_t)call_host( SEMIHOSTING_SYS_READ, blk );
+
+    return ( left > len ) ? 0 : len - left;
+}
+
+
+/*--------------------------------------------------------
+SYS_WRITE, returns the bytes written. Nothing is written
+without an output file.
+--------------------------------------------------------*/
+static uint32_t bench_host_write( int32_t handle, const void *buf,
+                                  uint32_t len )
+{
+    uint32_t            blk[ 3 ];   /* SYS_WRITE block              */
+    uint32_t            left;       /* bytes not written            */
+
+    if( handle < 0 )
+    {
+        return 0;
+    }
+
+    blk[ 0 ] = handle;
+    blk[ 1 ] = (uint32_t)buf;
+    blk[ 2 ] = len;
+    left = (uint32_t)call_host( SEMIHOSTING_SYS_WRITE, blk );
+
+    return ( left > len ) ? 0 : len - left;
+}
+
+
+/*--------------------------------------------------------
+Shell: bench <target> <file> [out]. The run is fed by the
+main loop, the command waits for it.
+--------------------------------------------------------*/
+static int8_t bench_shell( shell_ctx_type *ctx, uint8_t argc, char *argv[] )
+{
+    /*--------------------------------------------------------
+    Local variables
+    --------------------------------------------------------*/
+    bench_result_type   result;     /* finished run                 */
+    int8_t              err;        /* bench_start() result         */
+
+    if( ctx->step == 0 )
+    {
+        if( argc < 3 || argc > 4 )
+        {
+            return SHELL_USAGE;
+        }
+
+        err = bench_start( argv[ 1 ], argv[ 2 ], ( argc == 4 ) ? argv[ 3 ] : NULL );
+        if( err < 0 )
+        {
+            shell_printf( "bench failed %d\n", err );
+            return ( err == BENCH_ERR_TARGET ) ? SHELL_USAGE : SHELL_FAIL;
+        }
+
+        ctx->step = 1;
+        return SHELL_MORE;
+    }
+
+    if( bench_active() )
+    {
+        return SHELL_MORE;
+    }
+
+    bench_get_result( &result );
+    shell_printf( "%lu bytes %lu cyc %lu us\n", (unsigned long)result.bytes,
+                  (unsigned long)result.cycles, (unsigned long)result.run_us );
+    shell_printf( "%lu items %lu out %lu errors\n", (unsigned long)result.items,
+                  (unsigned long)result.out_bytes, (unsigned long)result.errors );
+    return SHELL_DONE;
+}
+
+#endif
@@ -0,0 +1,545 @@
+/*----------------------------------------------------------------------
+                            INCLUDES
+----------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "stm32f10x.h"
+#include "stm32f10x_dma.h"
+#include "stm32f10x_rcc.h"
+#include "stm32f10x_usart.h"
+
+#include "bridge.h"
+#include "esp_at.h"
+#include "esp_ipd.h"
+
+/*----------------------------------------------------------------------
+                            CONSTANTS
+----------------------------------------------------------------------*/
+
+#define BRIDGE_RX_BUF_SZ    1024    /* UART 1 RX DMA ring size      */
+#define BRIDGE_DOWN_BUF_SZ  512     /* +IPD payload ring size       */
+#define BRIDGE_CMD_SZ       64      /* CIPSTART command string      */
+#define BRIDGE_SEND_TIMEOUT 1000    /* CIPSEND timeout, ms          */
+#define BRIDGE_CONN_TIMEOUT 10000   /* CIPSTART timeout, ms         */
+#define BRIDGE_RETRY_TICKS  2000    /* wait before reconnecting, ms */
+#define BRIDGE_RATE_TICKS   1000    /* throughput window, ms        */
+
+#define BRIDGE_RX_DMA       DMA1_Channel5
+                                    /* DMA channel for USART1_RX    */
+#define BRIDGE_TX_DMA       DMA1_Channel4
+                                    /* DMA channel for USART1_TX    */
+#define BRIDGE_TX_DMA_TC    DMA1_FLAG_TC4
+                                    /* TX transfer complete flag    */
+#define BRIDGE_RX_DMA_HT    DMA1_FLAG_HT5
+                                    /* RX ring half way mark passed */
+#define BRIDGE_RX_DMA_TC    DMA1_FLAG_TC5
+                                    /* RX ring end passed           */
+#define BRIDGE_RX_MARK_SLACK 1      /* DMA bytes a mark flag can    */
+                                    /* trail the write index by     */
+
+/*----------------------------------------------------------------------
+                            TYPES
+----------------------------------------------------------------------*/
+
+typedef enum                        /* bridge connection state      */
+{
+    BRIDGE_STOPPED,                 /* not running                  */
+    BRIDGE_MUX,                     /* enabling multiple links      */
+    BRIDGE_CONNECT,                 /* TCP connection being opened  */
+    BRIDGE_RUNNING,                 /* forwarding data              */
+    BRIDGE_RETRY                    /* waiting to reconnect         */
+} bridge_state_type;
+
+/*----------------------------------------------------------------------
+                            VARIABLES
+----------------------------------------------------------------------*/
+
+static uint8_t          s_rx_buf[ BRIDGE_RX_BUF_SZ ];
+                                    /* UART 1 RX DMA ring           */
+static uint8_t          s_down_buf[ BRIDGE_DOWN_BUF_SZ ];
+                                    /* +IPD payload ring            */
+static bridge_cfg_type  s_cfg;      /* bridge configuration         */
+static bridge_state_type
+                        s_state;    /* connection state             */
+static timer_ticks_t    s_retry_at; /* reconnect time               */
+
+static uint16_t         s_rx_rd;    /* next RX byte to send         */
+static uint16_t         s_rx_seen;  /* DMA write index last seen    */
+static uint16_t         s_rx_pend;  /* unsent bytes in the ring     */
+static timer_ticks_t    s_rx_last;  /* time new RX data last seen   */
+static bool             s_up_open;  /* unsent batch has a start time*/
+static timer_ticks_t    s_up_first; /* first byte of unsent batch   */
+static timer_ticks_t    s_up_start; /* first byte of batch in flight*/
+static uint16_t         s_up_len;   /* CIPSEND bytes in flight      */
+static bool             s_up_busy;  /* CIPSEND in flight            */
+static bool             s_up_stale; /* batch in flight was lost to  */
+                                    /* an overrun                   */
+
+static uint16_t         s_down_len; /* TX DMA bytes in flight       */
+static bool             s_down_busy;/* TX DMA in flight             */
+static timer_ticks_t    s_down_start;
+                                    /* TX DMA data first seen       */
+
+static timer_ticks_t    s_rate_start;
+                                    /* throughput window start      */
+static uint32_t         s_rate_up;  /* up bytes at window start     */
+static uint32_t         s_rate_down;/* down bytes at window start   */
+static bridge_stats_type
+                        s_stats;    /* bridge statistics            */
+
+/*----------------------------------------------------------------------
+                            PROCEDURES
+----------------------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+static void bridge_connect( void );
+static void bridge_connect_done( esp_at_result_type result, void *ctx );
+static void bridge_mux_done( esp_at_result_type result, void *ctx );
+static void bridge_poll_down( void );
+static void bridge_poll_up( void );
+static bool bridge_rx_lapped( uint16_t mark, uint16_t delta );
+static void bridge_setup_dma( void );
+static void bridge_up_done( esp_at_result_type result, void *ctx );
+static void bridge_urc( const char *line );
+
+
+/*--------------------------------------------------------
+Start bridging UART 1 to a TCP connection
+--------------------------------------------------------*/
+void bridge_start( const bridge_cfg_type *cfg )
+{
+    s_cfg = *cfg;
+    if( s_cfg.flush_size == 0 || s_cfg.flush_size > ESP_AT_SEND_MAX )
+    {
+        s_cfg.flush_size = ESP_AT_SEND_MAX;
+    }
+
+    memset( &s_stats, 0, sizeof( s_stats ) );
+    s_rx_rd      = 0;
+    s_rx_seen    = 0;
+    s_rx_pend    = 0;
+    s_up_open    = false;
+    s_up_busy    = false;
+    s_up_stale   = false;
+    s_down_busy  = false;
+    s_rate_start = timer_get_ticks();
+    s_rate_up    = 0;
+    s_rate_down  = 0;
+
+    esp_ipd_link_attach( s_cfg.link, s_down_buf, sizeof( s_down_buf ) );
+    esp_at_add_urc_handler( bridge_urc );
+    bridge_setup_dma();
+
+    s_state = BRIDGE_MUX;
+}
+
+
+/*--------------------------------------------------------
+Stop bridging and give UART 1 back to interrupt mode
+--------------------------------------------------------*/
+void bridge_stop( void )
+{
+    if( s_state == BRIDGE_STOPPED )
+    {
+        return;
+    }
+
+    DMA_Cmd( BRIDGE_RX_DMA, DISABLE );
+    DMA_Cmd( BRIDGE_TX_DMA, DISABLE );
+    USART_DMACmd( USART1, USART_DMAReq_Rx | USART_DMAReq_Tx, DISABLE );
+    USART_ITConfig( USART1, USART_IT_RXNE, ENABLE );
+
+    esp_ipd_link_attach( s_cfg.link, NULL, 0 );
+    s_state = BRIDGE_STOPPED;
+}
+
+
+/*--------------------------------------------------------
+Move data in both directions. Call this from the main
+loop together with esp_at_poll().
+--------------------------------------------------------*/
+void bridge_poll( void )
+{
+    timer_ticks_t       now;        /* current time                 */
+
+    if( s_state == BRIDGE_STOPPED )
+    {
+        return;
+    }
+
+    now = timer_get_ticks();
+
+    if( ( s_state == BRIDGE_MUX || s_state == BRIDGE_RETRY )
+     && !esp_at_busy() )
+    {
+        if( s_state == BRIDGE_MUX )
+        {
+            esp_at_cmd( "AT+CIPMUX=1", ESP_AT_TIMEOUT_DFLT, bridge_mux_done, NULL );
+        }
+        else if( timer_expired( s_retry_at ) )
+        {
+            bridge_connect();
+        }
+    }
+
+    bridge_poll_up();
+    bridge_poll_down();
+
+    /*--------------------------------------------------------
+    Throughput over the last window
+    --------------------------------------------------------*/
+    if( now - s_rate_start >= BRIDGE_RATE_TICKS )
+    {
+        s_stats.up_rate   = ( s_stats.up_bytes - s_rate_up ) * 1000 / ( now - s_rate_start );
+        s_stats.down_rate = ( s_stats.down_bytes - s_rate_down ) * 1000 / ( now - s_rate_start );
+        s_rate_up    = s_stats.up_bytes;
+        s_rate_down  = s_stats.down_bytes;
+        s_rate_start = now;
+    }
+}
+
+
+/*--------------------------------------------------------
+Check if the TCP connection is up
+--------------------------------------------------------*/
+bool bridge_connected( void )
+{
+    return ( s_state == BRIDGE_RUNNING );
+}
+
+
+/*--------------------------------------------------------
+Get a copy of the bridge statistics
+--------------------------------------------------------*/
+void bridge_get_stats( bridge_stats_type *stats )
+{
+    *stats = s_stats;
+}
+
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Open the TCP connection
+--------------------------------------------------------*/
+static void bridge_connect( void )
+{
+    char                cmd[ BRIDGE_CMD_SZ ];
+                                    /* CIPSTART command string      */
+
+    snprintf( cmd, sizeof( cmd ), "AT+CIPSTART=%u,\"TCP\",\"%s\",%u",
+              s_cfg.link, s_cfg.host, s_cfg.port );
+
+    if( esp_at_cmd( cmd, BRIDGE_CONN_TIMEOUT, bridge_connect_done, NULL ) )
+    {
+        s_state = BRIDGE_CONNECT;
+    }
+}
+
+
+/*--------------------------------------------------------
+CIPSTART finished
+--------------------------------------------------------*/
+static void bridge_connect_done( esp_at_result_type result, void *ctx )
+{
+    (void)ctx;
+
+    if( s_state != BRIDGE_CONNECT )
+    {
+        return;
+    }
+
+    if( result == ESP_AT_OK
+     || strcmp( esp_at_info(), "ALREADY CONNECTED" ) == 0 )
+    {
+        s_stats.connects++;
+        s_state = BRIDGE_RUNNING;
+    }
+    else
+    {
+        s_retry_at = timer_get_ticks() + BRIDGE_RETRY_TICKS;
+        s_state    = BRIDGE_RETRY;
+    }
+}
+
+
+/*--------------------------------------------------------
+CIPMUX finished, the link id needs multiple connections.
+The module refuses CIPMUX while a link is open, which is
+fine as it is already in multiple connection mode then.
+If it really failed, CIPSTART fails and is retried.
+--------------------------------------------------------*/
+static void bridge_mux_done( esp_at_result_type result, void *ctx )
+{
+    (void)result;
+    (void)ctx;
+
+    if( s_state == BRIDGE_MUX )
+    {
+        bridge_connect();
+    }
+}
+
+
+/*--------------------------------------------------------
+Wi-Fi -> UART 1. Payload spans are sent by DMA straight
+out of the +IPD ring and released once transmitted.
+--------------------------------------------------------*/
+static void bridge_poll_down( void )
+{
+    const uint8_t      *span;       /* contiguous payload run       */
+    timer_ticks_t       lat;        /* transfer latency             */
+
+    if( s_down_busy )
+    {
+        if( DMA_GetFlagStatus( BRIDGE_TX_DMA_TC ) == RESET )
+        {
+            return;
+        }
+
+        DMA_ClearFlag( BRIDGE_TX_DMA_TC );
+        DMA_Cmd( BRIDGE_TX_DMA, DISABLE );
+        esp_ipd_link_consume( s_cfg.link, s_down_len );
+
+        lat = timer_get_ticks() - s_down_start;
+        s_stats.down_bytes   += s_down_len;
+        s_stats.down_lat_last = lat;
+        if( lat > s_stats.down_lat_max )
+        {
+            s_stats.down_lat_max = lat;
+        }
+        s_down_busy = false;
+    }
+
+    s_down_len = esp_ipd_link_span( s_cfg.link, &span );
+    if( s_down_len == 0 )
+    {
+        return;
+    }
+
+    s_down_start = timer_get_ticks();
+    BRIDGE_TX_DMA->CMAR = (uint32_t)span;
+    DMA_SetCurrDataCounter( BRIDGE_TX_DMA, s_down_len );
+    s_down_busy = true;
+    DMA_Cmd( BRIDGE_TX_DMA, ENABLE );
+}
+
+
+/*--------------------------------------------------------
+UART 1 -> Wi-Fi. Data is batched in the RX DMA ring and
+sent straight out of it once the size threshold is hit
+or the console has gone idle. If the DMA has come round
+to unsent data, what is in the ring can no longer be
+told apart from older bytes: all of it is dropped and
+counted as an overrun. With half the ring or more
+received since the last poll and both marks passed, a
+lap cannot be ruled out and is assumed; the loop polls
+far more often than that at any console baud rate.
+--------------------------------------------------------*/
+static void bridge_poll_up( void )
+{
+    timer_ticks_t       now;        /* current time                 */
+    uint16_t            wr;         /* DMA write index              */
+    uint16_t            delta;      /* bytes written since the last */
+                                    /* poll, less whole laps        */
+    uint16_t            len;        /* contiguous bytes to send     */
+    bool                ht;         /* half way mark passed         */
+    bool                tc;         /* end of ring passed           */
+
+    ht = ( DMA_GetFlagStatus( BRIDGE_RX_DMA_HT ) != RESET );
+    tc = ( DMA_GetFlagStatus( BRIDGE_RX_DMA_TC ) != RESET );
+    DMA_ClearFlag( BRIDGE_RX_DMA_HT | BRIDGE_RX_DMA_TC );
+
+    now = timer_get_ticks();
+    wr  = BRIDGE_RX_BUF_SZ - DMA_GetCurrDataCounter( BRIDGE_RX_DMA );
+    if( wr == BRIDGE_RX_BUF_SZ )
+    {
+        wr = 0;
+    }
+
+    delta = ( wr + BRIDGE_RX_BUF_SZ - s_rx_seen ) % BRIDGE_RX_BUF_SZ;
+    if( ( ht && bridge_rx_lapped( BRIDGE_RX_BUF_SZ / 2, delta ) )
+     || ( tc && bridge_rx_lapped( 0, delta ) )
+     || ( ht && tc && delta >= BRIDGE_RX_BUF_SZ / 2 )
+     || s_rx_pend + delta >= BRIDGE_RX_BUF_SZ )
+    {
+        s_stats.up_overruns++;
+        s_rx_rd    = wr;
+        s_rx_seen  = wr;
+        s_rx_pend  = 0;
+        s_up_open  = false;
+        s_up_stale = s_up_busy;
+        return;
+    }
+    s_rx_pend += delta;
+
+    if( wr != s_rx_seen )
+    {
+        s_rx_seen = wr;
+        s_rx_last = now;
+        if( !s_up_open )
+        {
+            s_up_open  = true;
+            s_up_first = now;
+        }
+    }
+
+    if( s_up_busy || s_state != BRIDGE_RUNNING || esp_at_busy() )
+    {
+        return;
+    }
+
+    if( s_rx_pend == 0 )
+    {
+        return;
+    }
+
+    if( s_rx_pend < s_cfg.flush_size && now - s_rx_last < s_cfg.flush_idle )
+    {
+        return;
+    }
+
+    len = ( wr > s_rx_rd ) ? wr - s_rx_rd : BRIDGE_RX_BUF_SZ - s_rx_rd;
+    if( len > ESP_AT_SEND_MAX )
+    {
+        len = ESP_AT_SEND_MAX;
+    }
+
+    if( esp_at_send( s_cfg.link, &s_rx_buf[ s_rx_rd ], len,
+                     BRIDGE_SEND_TIMEOUT, bridge_up_done, NULL ) )
+    {
+        s_up_len   = len;
+        s_up_busy  = true;
+        s_up_start = s_up_first;
+        s_up_open  = false;
+    }
+}
+
+
+/*--------------------------------------------------------
+Check a RX DMA mark whose flag is set (the half way point
+or the end of the ring) for a lap the write index does
+not show. The flag is explained if moving delta bytes on
+from the index last seen passes the mark. The flags are
+read before the index, so a mark passed just before the
+last poll read it sets its flag again after that poll
+cleared it: that is explained by the index last seen
+being only just past the mark. Any other flag means a
+whole lap, which passes both marks.
+--------------------------------------------------------*/
+static bool bridge_rx_lapped( uint16_t mark, uint16_t delta )
+{
+    uint16_t            to;         /* bytes from seen to the mark  */
+    uint16_t            past;       /* bytes seen is past the mark  */
+
+    to   = ( mark + BRIDGE_RX_BUF_SZ - s_rx_seen ) % BRIDGE_RX_BUF_SZ;
+    past = ( s_rx_seen + BRIDGE_RX_BUF_SZ - mark ) % BRIDGE_RX_BUF_SZ;
+
+    return ( to > delta && past > BRIDGE_RX_MARK_SLACK );
+}
+
+
+/*--------------------------------------------------------
+Setup UART 1 DMA: RX into a circular ring, TX from the
++IPD payload spans
+--------------------------------------------------------*/
+static void bridge_setup_dma( void )
+{
+    DMA_InitTypeDef     DMA_InitStructure;
+
+    RCC_AHBPeriphClockCmd( RCC_AHBPeriph_DMA1, ENABLE );
+    USART_ITConfig( USART1, USART_IT_RXNE, DISABLE );
+
+    DMA_DeInit( BRIDGE_RX_DMA );
+    DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)&USART1->DR;
+    DMA_InitStructure.DMA_MemoryBaseAddr = (uint32_t)s_rx_buf;
+    DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralSRC;
+    DMA_InitStructure.DMA_BufferSize = BRIDGE_RX_BUF_SZ;
+    DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+    DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+    DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+    DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+    DMA_InitStructure.DMA_Mode = DMA_Mode_Circular;
+    DMA_InitStructure.DMA_Priority = DMA_Priority_High;
+    DMA_InitStructure.DMA_M2M = DMA_M2M_Disable;
+    DMA_Init( BRIDGE_RX_DMA, &DMA_InitStructure );
+
+    DMA_DeInit( BRIDGE_TX_DMA );
+    DMA_InitStructure.DMA_MemoryBaseAddr = (uint32_t)s_down_buf;
+    DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralDST;
+    DMA_InitStructure.DMA_BufferSize = 1;
+    DMA_InitStructure.DMA_Mode = DMA_Mode_Normal;
+    DMA_InitStructure.DMA_Priority = DMA_Priority_Medium;
+    DMA_Init( BRIDGE_TX_DMA, &DMA_InitStructure );
+
+    USART_DMACmd( USART1, USART_DMAReq_Rx | USART_DMAReq_Tx, ENABLE );
+    DMA_Cmd( BRIDGE_RX_DMA, ENABLE );
+}
+
+
+/*--------------------------------------------------------
+CIPSEND of a batch finished
+--------------------------------------------------------*/
+static void bridge_up_done( esp_at_result_type result, void *ctx )
+{
+    timer_ticks_t       lat;        /* batch latency                */
+
+    (void)ctx;
+    s_up_busy = false;
+
+    if( s_up_stale )
+    {
+        /* the ring was dropped while the batch was in flight */
+        s_up_stale = false;
+        return;
+    }
+
+    if( result != ESP_AT_OK )
+    {
+        /*--------------------------------------------------------
+        Keep the batch, it is resent once the link is back
+        --------------------------------------------------------*/
+        s_stats.up_errors++;
+        s_up_open  = true;
+        s_up_first = s_up_start;
+        return;
+    }
+
+    s_rx_rd    = ( s_rx_rd + s_up_len ) % BRIDGE_RX_BUF_SZ;
+    s_rx_pend -= s_up_len;
+
+    lat = timer_get_ticks() - s_up_start;
+    s_stats.up_bytes   += s_up_len;
+    s_stats.up_sends++;
+    s_stats.up_lat_last = lat;
+    s_stats.up_lat_sum += lat;
+    if( lat > s_stats.up_lat_max )
+    {
+        s_stats.up_lat_max = lat;
+    }
+}
+
+
+/*--------------------------------------------------------
+Track the state of the bridged link
+--------------------------------------------------------*/
+static void bridge_urc( const char *line )
+{
+    if( s_state == BRIDGE_STOPPED || line[ 0 ] != '0' + s_cfg.link )
+    {
+        return;
+    }
+
+    if( strcmp( &line[ 1 ], ",CLOSED" ) == 0
+     || strcmp( &line[ 1 ], ",CONNECT FAIL" ) == 0 )
+    {
+        s_retry_at = timer_get_ticks() + BRIDGE_RETRY_TICKS;
+        s_state    = BRIDGE_RETRY;
+    }
+}
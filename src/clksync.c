@@ -0,0 +1,162 @@
+/*----------------------------------------------------------------------
+                            INCLUDES
+----------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "clksync.h"
+#include "proto.h"
+#include "shell.h"
+#include "telem_wire.h"
+#include "timer.h"
+
+/*----------------------------------------------------------------------
+                            VARIABLES
+----------------------------------------------------------------------*/
+
+static clksync_type     s_sync;     /* last TIME_SET                */
+
+/*----------------------------------------------------------------------
+                            PROCEDURES
+----------------------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+static void clksync_set( const proto_frame_type *frame );
+static int8_t clksync_shell( shell_ctx_type *ctx, uint8_t argc, char *argv[] );
+static void clksync_time( const proto_frame_type *frame );
+
+SHELL_CMD( "clock", "device and host clocks", clksync_shell );
+
+
+/*--------------------------------------------------------
+Register the clock messages
+--------------------------------------------------------*/
+void clksync_init( void )
+{
+    memset( &s_sync, 0, sizeof( s_sync ) );
+
+    proto_register( PROTO_T_TIME_REQ, clksync_time );
+    proto_register( PROTO_T_TIME_SET, clksync_set );
+}
+
+
+/*--------------------------------------------------------
+Convert a device time to host time, false until the host
+has sent a TIME_SET
+--------------------------------------------------------*/
+bool clksync_to_host( uint64_t dev_us, uint64_t *host_us )
+{
+    int64_t             d;          /* time since the reference     */
+
+    if( s_sync.set_at == 0 )
+    {
+        return false;
+    }
+
+    d        = (int64_t)( dev_us - s_sync.ref_dev );
+    *host_us = s_sync.ref_host + (uint64_t)( d + d * s_sync.rate_ppb / 1000000000 );
+    return true;
+}
+
+
+/*--------------------------------------------------------
+Current host time
+--------------------------------------------------------*/
+bool clksync_host_now( uint64_t *host_us )
+{
+    return clksync_to_host( timer_get_us(), host_us );
+}
+
+
+/*--------------------------------------------------------
+Get a copy of the synchronization state
+--------------------------------------------------------*/
+void clksync_get( clksync_type *sync )
+{
+    *sync = s_sync;
+}
+
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Take the host's fit
+--------------------------------------------------------*/
+static void clksync_set( const proto_frame_type *frame )
+{
+    uint8_t             status;     /* reply status                 */
+
+    status = PROTO_ST_BAD_LEN;
+    if( frame->len == PROTO_TIME_SET_SZ )
+    {
+        s_sync.ref_dev  = telem_get_u64( &frame->payload[ 0 ] );
+        s_sync.ref_host = telem_get_u64( &frame->payload[ 8 ] );
+        s_sync.rate_ppb = (int32_t)telem_get_u32( &frame->payload[ 16 ] );
+        s_sync.error_us = telem_get_u32( &frame->payload[ 20 ] );
+        s_sync.set_at   = timer_get_us();
+        status = PROTO_ST_OK;
+    }
+
+    proto_reply( PROTO_T_STATUS, frame->seq, &status, 1 );
+}
+
+
+/*--------------------------------------------------------
+Shell command: print the device time and its host view
+--------------------------------------------------------*/
+static int8_t clksync_shell( shell_ctx_type *ctx, uint8_t argc, char *argv[] )
+{
+    uint64_t            now;        /* device time                  */
+    uint64_t            host;       /* host time                    */
+
+    (void)ctx;
+    (void)argv;
+    if( argc != 1 )
+    {
+        return SHELL_USAGE;
+    }
+
+    now = timer_get_us();
+    shell_printf( "device %lu.%06lu s\n", (unsigned long)( now / 1000000 ),
+                  (unsigned long)( now % 1000000 ) );
+    if( !clksync_to_host( now, &host ) )
+    {
+        shell_printf( "not synchronized\n" );
+        return SHELL_DONE;
+    }
+
+    shell_printf( "host %lu.%06lu s, +-%lu us, rate %ld ppb, set %lu s ago\n",
+                  (unsigned long)( host / 1000000 ),
+                  (unsigned long)( host % 1000000 ),
+                  (unsigned long)s_sync.error_us, (long)s_sync.rate_ppb,
+                  (unsigned long)( ( now - s_sync.set_at ) / 1000000 ) );
+    return SHELL_DONE;
+}
+
+
+/*--------------------------------------------------------
+Answer a TIME_REQ. The reply is built in the transmit
+buffer so the send time is taken as late as possible.
+--------------------------------------------------------*/
+static void clksync_time( const proto_frame_type *frame )
+{
+    uint8_t            *p;          /* reply payload                */
+    uint8_t             status;     /* reply status                 */
+
+    if( frame->len < 8 )
+    {
+        status = PROTO_ST_BAD_LEN;
+        proto_reply( PROTO_T_STATUS, frame->seq, &status, 1 );
+        return;
+    }
+
+    p = proto_tx_payload();
+    memmove( &p[ 0 ], frame->payload, 8 );
+    telem_put_u64( &p[ 8 ], frame->rx_us );
+    telem_put_u64( &p[ 16 ], timer_get_us() );
+    proto_reply( PROTO_T_TIME_REPLY, frame->seq, p, PROTO_TIME_SZ );
+}
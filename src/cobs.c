@@ -0,0 +1,80 @@
+/*----------------------------------------------------------------------
+                            INCLUDES
+----------------------------------------------------------------------*/
+
+#include "cobs.h"
+
+/*----------------------------------------------------------------------
+                            PROCEDURES
+----------------------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Encode in place. Each 0x00 is replaced by the distance to
+the next one, buf[ 0 ] holds the distance to the first.
+As no run can reach COBS_BLOCK_MAX no code bytes have to
+be inserted, so nothing moves.
+--------------------------------------------------------*/
+uint16_t cobs_encode( uint8_t *buf, uint16_t len )
+{
+    uint16_t            i;          /* data index                   */
+    uint16_t            code_pos;   /* where the open run's code is */
+
+    if( len > COBS_BLOCK_MAX )
+    {
+        return 0;
+    }
+
+    code_pos = 0;
+    for( i = 1; i <= len; i++ )
+    {
+        if( buf[ i ] == 0 )
+        {
+            buf[ code_pos ] = (uint8_t)( i - code_pos );
+            code_pos = i;
+        }
+    }
+    buf[ code_pos ] = (uint8_t)( i - code_pos );
+
+    return len + 1;
+}
+
+
+/*--------------------------------------------------------
+Decode in place. The output never gets ahead of the
+input, a zero or an overlong run marks the data as
+malformed.
+--------------------------------------------------------*/
+int16_t cobs_decode( uint8_t *buf, uint16_t len )
+{
+    uint16_t            in;         /* next encoded byte            */
+    uint16_t            out;        /* next decoded byte            */
+    uint8_t             code;       /* current run code             */
+    uint8_t             i;          /* run byte counter             */
+
+    in  = 0;
+    out = 0;
+    while( in < len )
+    {
+        code = buf[ in++ ];
+        if( code == 0 || in + code - 1 > len )
+        {
+            return COBS_ERR;
+        }
+
+        for( i = 1; i < code; i++ )
+        {
+            if( buf[ in ] == 0 )
+            {
+                return COBS_ERR;
+            }
+            buf[ out++ ] = buf[ in++ ];
+        }
+
+        if( code != 0xFF && in < len )
+        {
+            buf[ out++ ] = 0;
+        }
+    }
+
+    return (int16_t)out;
+}
@@ -0,0 +1,580 @@
+/*----------------------------------------------------------------------
+                            INCLUDES
+----------------------------------------------------------------------*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "conn.h"
+#include "esp_at.h"
+#include "shell.h"
+
+#if( CONN_ENABLE )
+
+/*----------------------------------------------------------------------
+                            CONSTANTS
+----------------------------------------------------------------------*/
+
+#define CONN_ADDR_SZ        16      /* dotted IPv4 address and NUL  */
+#define CONN_DNS_TIMEOUT    10000   /* AT+CIPDOMAIN timeout, ms     */
+#define CONN_DNS_RETRY_MS   30000   /* wait after a failed lookup   */
+#define CONN_STALE_MS       10000   /* down this long, look up the  */
+                                    /* address again                */
+#define CONN_CMD_SZ         ( sizeof( "AT+CIPDOMAIN=\"\"" ) + NET_HOST_SZ )
+#define CONN_NONE           0xFF    /* no lookup running            */
+
+/*----------------------------------------------------------------------
+                            TYPES
+----------------------------------------------------------------------*/
+
+typedef struct                      /* pooled connection            */
+{
+    int8_t              sock;       /* socket, < 0 if the slot is   */
+                                    /* free                         */
+    char                host[ NET_HOST_SZ ];
+                                    /* host as conn_get() was given */
+    uint16_t            port;       /* remote port                  */
+    bool                busy;       /* handed out by conn_get()     */
+    bool                up;         /* connected at the last poll   */
+    timer_ticks_t       put_at;     /* last conn_put()              */
+    timer_ticks_t       down_at;    /* went down, or last lookup    */
+} conn_type;
+
+typedef struct                      /* cached host address          */
+{
+    char                name[ NET_HOST_SZ ];
+                                    /* host name, empty if free     */
+    char                addr[ CONN_ADDR_SZ ];
+                                    /* its address                  */
+    bool                valid;      /* addr has been resolved       */
+    bool                lookup;     /* resolve it at the next chance*/
+    timer_ticks_t       due;        /* expiry, or next retry        */
+} conn_dns_type;
+
+/*----------------------------------------------------------------------
+                            VARIABLES
+----------------------------------------------------------------------*/
+
+static conn_cfg_type    s_cfg;      /* settings                     */
+static conn_type        s_conns[ CONN_CNT ];
+                                    /* connection pool              */
+static conn_dns_type    s_dns[ CONN_DNS_CNT ];
+                                    /* address cache                */
+static uint8_t          s_lookup = CONN_NONE;
+                                    /* cache entry being resolved   */
+static bool             s_started;  /* conn_init() was called       */
+static conn_stats_type  s_stats;    /* statistics                   */
+
+/*----------------------------------------------------------------------
+                            PROCEDURES
+----------------------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+static conn_dns_type *conn_dns_add( const char *name );
+static void conn_dns_done( esp_at_result_type result, void *ctx );
+static conn_dns_type *conn_dns_find( const char *name );
+static void conn_dns_poll( void );
+static bool conn_dns_used( const conn_dns_type *dns );
+static void conn_idle_cb( int8_t sock, uint8_t events, void *ctx );
+static bool conn_is_addr( const char *host );
+static int8_t conn_shell( shell_ctx_type *ctx, uint8_t argc, char *argv[] );
+
+SHELL_CMD( "conn", "connection pool and address cache", conn_shell );
+
+
+/*--------------------------------------------------------
+Start the connection manager
+--------------------------------------------------------*/
+void conn_init( const conn_cfg_type *cfg )
+{
+    uint8_t             i;          /* loop counter                 */
+
+    s_cfg = *cfg;
+    for( i = 0; i < CONN_CNT; i++ )
+    {
+        s_conns[ i ].sock = -1;
+    }
+
+    memset( s_dns, 0, sizeof( s_dns ) );
+    memset( &s_stats, 0, sizeof( s_stats ) );
+    s_lookup  = CONN_NONE;
+    s_started = true;
+}
+
+
+/*--------------------------------------------------------
+Close connections idle too long, notice the ones that are
+down and keep the address cache fresh. Call this from the
+main loop after net_poll().
+--------------------------------------------------------*/
+void conn_poll( void )
+{
+    conn_type          *c;          /* pooled connection            */
+    conn_dns_type      *dns;        /* its cached address           */
+    uint8_t             i;          /* loop counter                 */
+
+    if( !s_started )
+    {
+        return;
+    }
+
+    for( i = 0; i < CONN_CNT; i++ )
+    {
+        c = &s_conns[ i ];
+        if( c->sock < 0 )
+        {
+            continue;
+        }
+
+        if( !c->busy && timer_expired( c->put_at + s_cfg.idle ) )
+        {
+            net_close( c->sock );
+            c->sock = -1;
+            s_stats.idle_closes++;
+            continue;
+        }
+
+        if( net_is_open( c->sock ) )
+        {
+            c->up = true;
+            continue;
+        }
+
+        /*--------------------------------------------------------
+        Reopening in the background. If it takes long, the
+        server may have moved: look the name up again.
+        --------------------------------------------------------*/
+        if( c->up )
+        {
+            c->up      = false;
+            c->down_at = timer_get_ticks();
+        }
+        else if( timer_expired( c->down_at + CONN_STALE_MS ) )
+        {
+            dns = conn_dns_find( c->host );
+            if( dns != NULL )
+            {
+                dns->lookup = true;
+            }
+            c->down_at = timer_get_ticks();
+        }
+    }
+
+    conn_dns_poll();
+}
+
+
+/*--------------------------------------------------------
+Get a connection to a host and port for a request. The
+callback gets the socket events until conn_put(). Data
+can be sent at once, it goes out when the connection is
+up (net_is_open()). Returns the socket, or a negative
+CONN_ERR_ code; never net_close() it.
+--------------------------------------------------------*/
+int8_t conn_get( const char *host, uint16_t port, net_cb_type cb, void *ctx )
+{
+    conn_type          *c;          /* connection handed out        */
+    conn_type          *lru;        /* idle connection unused the   */
+                                    /* longest                      */
+    conn_dns_type      *dns;        /* cached address of the host   */
+    const char         *addr;       /* address to connect to        */
+    uint8_t             i;          /* loop counter                 */
+
+    c   = NULL;
+    lru = NULL;
+    for( i = 0; i < CONN_CNT; i++ )
+    {
+        if( s_conns[ i ].sock < 0 )
+        {
+            if( c == NULL )
+            {
+                c = &s_conns[ i ];
+            }
+            continue;
+        }
+
+        if( s_conns[ i ].busy )
+        {
+            continue;
+        }
+
+        if( s_conns[ i ].port == port && strcmp( s_conns[ i ].host, host ) == 0 )
+        {
+            s_conns[ i ].busy = true;
+            net_set_callback( s_conns[ i ].sock, cb, ctx );
+            s_stats.gets++;
+            s_stats.reused++;
+            return s_conns[ i ].sock;
+        }
+
+        if( lru == NULL || (int32_t)( s_conns[ i ].put_at - lru->put_at ) < 0 )
+        {
+            lru = &s_conns[ i ];
+        }
+    }
+
+    /*--------------------------------------------------------
+    No warm connection: open one, in place of the idle one
+    least recently used if the pool is full
+    --------------------------------------------------------*/
+    if( c == NULL )
+    {
+        if( lru == NULL )
+        {
+            return CONN_ERR_FULL;
+        }
+
+        net_close( lru->sock );
+        lru->sock = -1;
+        c = lru;
+    }
+
+    addr = host;
+    if( !conn_is_addr( host ) )
+    {
+        dns = conn_dns_find( host );
+        if( dns == NULL )
+        {
+            dns = conn_dns_add( host );
+        }
+
+        if( dns != NULL && dns->valid )
+        {
+            addr = dns->addr;
+            s_stats.dns_hits++;
+        }
+    }
+
+    c->sock = net_connect( NET_TCP, addr, port, CONN_RX_SZ, CONN_TX_SZ, cb, ctx );
+    if( c->sock < 0 )
+    {
+        c->sock = -1;
+        return CONN_ERR_NET;
+    }
+
+    net_set_persist( c->sock, true );
+    net_set_keepalive( c->sock, s_cfg.keepalive );
+
+    strncpy( c->host, host, NET_HOST_SZ - 1 );
+    c->host[ NET_HOST_SZ - 1 ] = '\0';
+    c->port  = port;
+    c->busy  = true;
+    c->up      = false;
+    c->down_at = timer_get_ticks();
+
+    s_stats.gets++;
+    s_stats.opens++;
+    return c->sock;
+}
+
+
+/*--------------------------------------------------------
+Give a connection back to the pool after a request. Data
+the server sends while it is idle is discarded.
+--------------------------------------------------------*/
+void conn_put( int8_t sock )
+{
+    uint8_t             i;          /* loop counter                 */
+
+    for( i = 0; i < CONN_CNT; i++ )
+    {
+        if( s_conns[ i ].sock == sock && s_conns[ i ].busy )
+        {
+            s_conns[ i ].busy   = false;
+            s_conns[ i ].put_at = timer_get_ticks();
+            net_set_callback( sock, conn_idle_cb, NULL );
+        }
+    }
+}
+
+
+/*--------------------------------------------------------
+Get a copy of the statistics
+--------------------------------------------------------*/
+void conn_get_stats( conn_stats_type *stats )
+{
+    *stats = s_stats;
+}
+
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Add a host name to the address cache, in place of an
+entry no connection uses. NULL if all are in use.
+--------------------------------------------------------*/
+static conn_dns_type *conn_dns_add( const char *name )
+{
+    conn_dns_type      *dns;        /* entry taken                  */
+    uint8_t             i;          /* loop counter                 */
+
+    dns = NULL;
+    for( i = 0; i < CONN_DNS_CNT && dns == NULL; i++ )
+    {
+        if( i != s_lookup
+         && ( s_dns[ i ].name[ 0 ] == '\0' || !conn_dns_used( &s_dns[ i ] ) ) )
+        {
+            dns = &s_dns[ i ];
+        }
+    }
+
+    if( dns == NULL )
+    {
+        return NULL;
+    }
+
+    strncpy( dns->name, name, NET_HOST_SZ - 1 );
+    dns->name[ NET_HOST_SZ - 1 ] = '\0';
+    dns->valid  = false;
+    dns->lookup = true;
+    return dns;
+}
+
+
+/*--------------------------------------------------------
+AT+CIPDOMAIN completed. A new address is cached for the
+TTL and given to the connections to the host; after a
+failure the old one is kept, if any, and the lookup is
+retried later.
+--------------------------------------------------------*/
+static void conn_dns_done( esp_at_result_type result, void *ctx )
+{
+    conn_dns_type      *dns;        /* entry looked up              */
+    const char         *info;       /* "+CIPDOMAIN:<addr>"          */
+    char                addr[ CONN_ADDR_SZ ];
+                                    /* address answered             */
+    uint8_t             len;        /* address length               */
+    uint8_t             i;          /* loop counter                 */
+
+    dns      = &s_dns[ (uintptr_t)ctx ];
+    s_lookup = CONN_NONE;
+
+    info = esp_at_info();
+    len  = 0;
+    if( result == ESP_AT_OK && strncmp( info, "+CIPDOMAIN:", 11 ) == 0 )
+    {
+        for( info += 11; *info != '\0' && len < CONN_ADDR_SZ - 1; info++ )
+        {
+            if( *info != '"' )
+            {
+                addr[ len++ ] = *info;
+            }
+        }
+    }
+    addr[ len ] = '\0';
+
+    if( len == 0 || !conn_is_addr( addr ) )
+    {
+        s_stats.lookup_fails++;
+        dns->due = timer_get_ticks() + CONN_DNS_RETRY_MS;
+        return;
+    }
+
+    dns->due = timer_get_ticks() + s_cfg.dns_ttl * 1000u;
+    if( dns->valid && strcmp( dns->addr, addr ) == 0 )
+    {
+        return;
+    }
+
+    for( i = 0; i < CONN_CNT; i++ )
+    {
+        if( s_conns[ i ].sock >= 0 && strcmp( s_conns[ i ].host, dns->name ) == 0 )
+        {
+            net_set_host( s_conns[ i ].sock, addr );
+            s_stats.moves += dns->valid;
+        }
+    }
+
+    strcpy( dns->addr, addr );
+    dns->valid = true;
+}
+
+
+/*--------------------------------------------------------
+Find the cache entry of a host name, NULL if none
+--------------------------------------------------------*/
+static conn_dns_type *conn_dns_find( const char *name )
+{
+    uint8_t             i;          /* loop counter                 */
+
+    for( i = 0; i < CONN_DNS_CNT; i++ )
+    {
+        if( s_dns[ i ].name[ 0 ] != '\0' && strcmp( s_dns[ i ].name, name ) == 0 )
+        {
+            return &s_dns[ i ];
+        }
+    }
+
+    return NULL;
+}
+
+
+/*--------------------------------------------------------
+Expire cached addresses and start the next lookup. An
+expired address still in use is looked up again and
+used until the answer comes; others are dropped.
+--------------------------------------------------------*/
+static void conn_dns_poll( void )
+{
+    conn_dns_type      *dns;        /* cache entry                  */
+    char                cmd[ CONN_CMD_SZ ];
+                                    /* AT command string            */
+    uint8_t             i;          /* loop counter                 */
+
+    for( i = 0; i < CONN_DNS_CNT; i++ )
+    {
+        dns = &s_dns[ i ];
+        if( dns->name[ 0 ] == '\0' || dns->lookup || i == s_lookup
+         || !timer_expired( dns->due ) )
+        {
+            continue;
+        }
+
+        if( conn_dns_used( dns ) )
+        {
+            dns->lookup = true;
+        }
+        else
+        {
+            dns->name[ 0 ] = '\0';
+            dns->valid     = false;
+        }
+    }
+
+    if( s_lookup != CONN_NONE || esp_at_busy() )
+    {
+        return;
+    }
+
+    for( i = 0; i < CONN_DNS_CNT; i++ )
+    {
+        dns = &s_dns[ i ];
+        if( dns->name[ 0 ] == '\0' || !dns->lookup )
+        {
+            continue;
+        }
+
+        snprintf( cmd, sizeof( cmd ), "AT+CIPDOMAIN=\"%s\"", dns->name );
+        if( esp_at_cmd( cmd, CONN_DNS_TIMEOUT, conn_dns_done, (void *)(uintptr_t)i ) )
+        {
+            s_lookup    = i;
+            dns->lookup = false;
+            s_stats.lookups++;
+        }
+        return;
+    }
+}
+
+
+/*--------------------------------------------------------
+True if a pooled connection goes to the host of an entry
+--------------------------------------------------------*/
+static bool conn_dns_used( const conn_dns_type *dns )
+{
+    uint8_t             i;          /* loop counter                 */
+
+    for( i = 0; i < CONN_CNT; i++ )
+    {
+        if( s_conns[ i ].sock >= 0 && strcmp( s_conns[ i ].host, dns->name ) == 0 )
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*--------------------------------------------------------
+Socket events of an idle connection: drop what the
+server sends so the receive buffer does not fill up
+--------------------------------------------------------*/
+static void conn_idle_cb( int8_t sock, uint8_t events, void *ctx )
+{
+    uint8_t             buf[ 16 ];  /* discarded bytes              */
+
+    (void)ctx;
+
+    if( events & NET_EV_READABLE )
+    {
+        while( net_recv( sock, buf, sizeof( buf ) ) > 0 )
+        {
+        }
+    }
+}
+
+
+/*--------------------------------------------------------
+True if a host is a dotted IPv4 address, which needs no
+lookup
+--------------------------------------------------------*/
+static bool conn_is_addr( const char *host )
+{
+    uint8_t             dots;       /* '.' seen                     */
+
+    for( dots = 0; *host != '\0'; host++ )
+    {
+        if( *host == '.' )
+        {
+            dots++;
+        }
+        else if( *host < '0' || *host > '9' )
+        {
+            return false;
+        }
+    }
+
+    return dots == 3;
+}
+
+
+/*--------------------------------------------------------
+Shell: conn. Prints the pool, the address cache and the
+statistics.
+--------------------------------------------------------*/
+static int8_t conn_shell( shell_ctx_type *ctx, uint8_t argc, char *argv[] )
+{
+    const conn_type    *c;          /* pooled connection            */
+    const conn_dns_type *dns;       /* cache entry                  */
+    uint8_t             i;          /* loop counter                 */
+
+    (void)ctx;
+    (void)argc;
+    (void)argv;
+
+    for( i = 0; i < CONN_CNT; i++ )
+    {
+        c = &s_conns[ i ];
+        if( c->sock >= 0 )
+        {
+            shell_printf( "%u: %s:%u socket %d, %s, %s\n", i, c->host, c->port,
+                          c->sock, net_is_open( c->sock ) ? "up" : "down",
+                          c->busy ? "in use" : "idle" );
+        }
+    }
+
+    for( i = 0; i < CONN_DNS_CNT; i++ )
+    {
+        dns = &s_dns[ i ];
+        if( dns->name[ 0 ] != '\0' )
+        {
+            shell_printf( "%s %s, %ld s\n", dns->name,
+                          dns->valid ? dns->addr : "-",
+                          (long)(int32_t)( dns->due - timer_get_ticks() ) / 1000 );
+        }
+    }
+
+    shell_printf( "gets %lu reused %lu opens %u idle closes %u\n",
+                  (unsigned long)s_stats.gets, (unsigned long)s_stats.reused,
+                  s_stats.opens, s_stats.idle_closes );
+    shell_printf( "dns hits %u lookups %u failed %u moves %u\n", s_stats.dns_hits,
+                  s_stats.lookups, s_stats.lookup_fails, s_stats.moves );
+    return SHELL_DONE;
+}
+
+#endif
@@ -0,0 +1,218 @@
+/*----------------------------------------------------------------------
+                            INCLUDES
+----------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "stm32f10x.h"
+
+#include "defer.h"
+#include "shell.h"
+
+/*----------------------------------------------------------------------
+                            CONSTANTS
+----------------------------------------------------------------------*/
+
+#define DEFER_LEVEL     ( ( 1 << __NVIC_PRIO_BITS ) - 1 )
+                                    /* PendSV priority, the lowest  */
+
+/*----------------------------------------------------------------------
+                            VARIABLES
+----------------------------------------------------------------------*/
+
+static defer_work_type *s_head[ DEFER_PRIO_CNT ];
+                                    /* next to run, by priority     */
+static defer_work_type *s_tail[ DEFER_PRIO_CNT ];
+                                    /* last queued, by priority     */
+static uint16_t         s_backlog;  /* items queued now             */
+static defer_stats_type s_stats;    /* deferred statistics          */
+
+/*----------------------------------------------------------------------
+                            PROCEDURES
+----------------------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+static int8_t defer_shell( shell_ctx_type *ctx, uint8_t argc, char *argv[] );
+static defer_work_type *defer_take( void );
+
+SHELL_CMD( "defer", "deferred interrupt work statistics", defer_shell );
+
+
+/*--------------------------------------------------------
+Set PendSV to the lowest priority
+--------------------------------------------------------*/
+void defer_init( void )
+{
+    memset( s_head, 0, sizeof( s_head ) );
+    memset( s_tail, 0, sizeof( s_tail ) );
+    memset( &s_stats, 0, sizeof( s_stats ) );
+    s_backlog = 0;
+
+    NVIC_SetPriority( PendSV_IRQn, DEFER_LEVEL );
+}
+
+
+/*--------------------------------------------------------
+Set up a work item, before it is first queued
+--------------------------------------------------------*/
+void defer_setup( defer_work_type *work, defer_fn_type fn, uint8_t prio )
+{
+    work->fn     = fn;
+    work->prio   = ( prio < DEFER_PRIO_CNT ) ? prio : DEFER_PRIO_LOW;
+    work->queued = false;
+    work->next   = NULL;
+}
+
+
+/*--------------------------------------------------------
+Queue work to run from PendSV. Callable from interrupts
+of any priority and from the main loop.
+--------------------------------------------------------*/
+void defer_queue( defer_work_type *work )
+{
+    uint32_t            primask;    /* interrupt mask on entry      */
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+
+    if( work->queued )
+    {
+        s_stats.coalesced++;
+    }
+    else
+    {
+        work->queued = true;
+        work->next   = NULL;
+        if( s_head[ work->prio ] == NULL )
+        {
+            s_head[ work->prio ] = work;
+        }
+        else
+        {
+            s_tail[ work->prio ]->next = work;
+        }
+        s_tail[ work->prio ] = work;
+
+        if( ++s_backlog > s_stats.max_backlog )
+        {
+            s_stats.max_backlog = s_backlog;
+        }
+    }
+
+    __set_PRIMASK( primask );
+
+    SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+}
+
+
+/*--------------------------------------------------------
+Hold off deferred work, returns the mask to restore
+--------------------------------------------------------*/
+uint32_t defer_lock( void )
+{
+    uint32_t            prev;       /* BASEPRI on entry             */
+
+    prev = __get_BASEPRI();
+    if( prev == 0 || prev > ( DEFER_LEVEL << ( 8 - __NVIC_PRIO_BITS ) ) )
+    {
+        __set_BASEPRI( DEFER_LEVEL << ( 8 - __NVIC_PRIO_BITS ) );
+    }
+
+    return prev;
+}
+
+
+/*--------------------------------------------------------
+Let deferred work run again
+--------------------------------------------------------*/
+void defer_unlock( uint32_t prev )
+{
+    __set_BASEPRI( prev );
+}
+
+
+/*--------------------------------------------------------
+Get a copy of the deferred statistics
+--------------------------------------------------------*/
+void defer_get_stats( defer_stats_type *stats )
+{
+    uint32_t            primask;    /* interrupt mask on entry      */
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    *stats = s_stats;
+    __set_PRIMASK( primask );
+}
+
+
+/*--------------------------------------------------------
+Run the queued work. Each item is taken off its list
+before it runs, so it can be queued again meanwhile.
+--------------------------------------------------------*/
+void PendSV_Handler( void )
+{
+    defer_work_type    *work;       /* item to run                  */
+
+    while( ( work = defer_take() ) != NULL )
+    {
+        work->fn();
+    }
+}
+
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Shell: defer
+--------------------------------------------------------*/
+static int8_t defer_shell( shell_ctx_type *ctx, uint8_t argc, char *argv[] )
+{
+    defer_stats_type    stats;      /* statistics copy              */
+
+    (void)ctx;
+    (void)argc;
+    (void)argv;
+
+    defer_get_stats( &stats );
+    shell_printf( "runs high %lu normal %lu low %lu\n",
+                  (unsigned long)stats.runs[ DEFER_PRIO_HIGH ],
+                  (unsigned long)stats.runs[ DEFER_PRIO_NORMAL ],
+                  (unsigned long)stats.runs[ DEFER_PRIO_LOW ] );
+    shell_printf( "coalesced %lu max backlog %u\n",
+                  (unsigned long)stats.coalesced, stats.max_backlog );
+    return SHELL_DONE;
+}
+
+
+/*--------------------------------------------------------
+Take the next item, highest priority first
+--------------------------------------------------------*/
+static defer_work_type *defer_take( void )
+{
+    defer_work_type    *work;       /* item taken                   */
+    uint8_t             prio;       /* priority list                */
+
+    __disable_irq();
+
+    work = NULL;
+    for( prio = 0; prio < DEFER_PRIO_CNT; prio++ )
+    {
+        work = s_head[ prio ];
+        if( work != NULL )
+        {
+            s_head[ prio ] = work->next;
+            work->queued   = false;
+            s_backlog--;
+            s_stats.runs[ prio ]++;
+            break;
+        }
+    }
+
+    __enable_irq();
+
+    return work;
+}
@@ -0,0 +1,507 @@
+/*----------------------------------------------------------------------
+                            INCLUDES
+----------------------------------------------------------------------*/
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diag.h"
+#include "diag_map.h"
+#include "proto.h"
+#include "shell.h"
+#include "telem_wire.h"
+#include "timer.h"
+
+/*----------------------------------------------------------------------
+                            TYPES
+----------------------------------------------------------------------*/
+
+typedef struct                      /* queued MEM_READ              */
+{
+    uint32_t            addr;       /* next address to stream       */
+    uint16_t            left;       /* bytes left to stream         */
+    uint8_t             width;      /* access size                  */
+    uint8_t             seq;        /* sequence number of the read  */
+} diag_read_type;
+
+typedef struct                      /* watched address              */
+{
+    uint32_t            addr;       /* address to sample            */
+    uint8_t             width;      /* access size, bytes           */
+} diag_watch_type;
+
+/*----------------------------------------------------------------------
+                            VARIABLES
+----------------------------------------------------------------------*/
+
+static diag_read_type   s_reads[ PROTO_MEM_READ_QUEUE ];
+                                    /* reads, the first streaming   */
+static uint8_t          s_rd_head;  /* read being streamed          */
+static uint8_t          s_rd_cnt;   /* reads queued                 */
+
+static diag_watch_type  s_watch[ PROTO_WATCH_MAX ];
+                                    /* watch list                   */
+static uint8_t          s_watch_cnt;/* entries in the watch list    */
+static volatile uint16_t
+                        s_watch_period;
+                                    /* sample period, 0 if stopped  */
+static uint16_t         s_watch_countdown;
+                                    /* ticks to the next sample     */
+static uint8_t          s_watch_seq;/* sequence number of the watch */
+static uint8_t          s_sample_sz;/* bytes per sample             */
+static uint16_t         s_ring_cap; /* sample slots in the ring     */
+static uint8_t          s_ring[ DIAG_RING_SZ ];
+                                    /* watch samples                */
+static volatile uint16_t
+                        s_ring_head;/* next slot written (ISR)      */
+static volatile uint16_t
+                        s_ring_tail;/* next slot sent (loop)        */
+static volatile uint16_t
+                        s_drops;    /* samples lost, ring full      */
+static timer_ticks_t    s_flush_at; /* send a partial batch by then */
+
+/*----------------------------------------------------------------------
+                            PROCEDURES
+----------------------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+static uint32_t diag_load( uint32_t addr, uint8_t width );
+static void diag_mem_read( const proto_frame_type *frame );
+static void diag_mem_write( const proto_frame_type *frame );
+static int8_t diag_shell_md( shell_ctx_type *ctx, uint8_t argc, char *argv[] );
+static void diag_status( uint8_t seq, uint8_t status );
+static void diag_store( uint32_t addr, uint8_t width, uint32_t value );
+static void diag_tick( void );
+static void diag_watch( const proto_frame_type *frame );
+static void diag_watch_send( void );
+
+SHELL_CMD( "md", "addr [len], dump memory as words", diag_shell_md );
+
+
+/*--------------------------------------------------------
+Register the memory access messages
+--------------------------------------------------------*/
+void diag_init( void )
+{
+    s_rd_head      = 0;
+    s_rd_cnt       = 0;
+    s_watch_period = 0;
+    s_watch_cnt    = 0;
+
+    proto_register( PROTO_T_MEM_READ, diag_mem_read );
+    proto_register( PROTO_T_MEM_WRITE, diag_mem_write );
+    proto_register( PROTO_T_WATCH, diag_watch );
+    timer_add_tick_handler( diag_tick );
+}
+
+
+/*--------------------------------------------------------
+Stream the next piece of a read and any watch samples.
+Call this from the main loop after proto_poll(). Reads
+are queued so the next one starts with no gap on the
+link while the host asks for the one after.
+--------------------------------------------------------*/
+void diag_poll( void )
+{
+    diag_read_type     *rd;         /* read being streamed          */
+    uint8_t            *p;          /* MEM_DATA payload             */
+    uint16_t            len;        /* bytes in this frame          */
+    uint16_t            i;          /* loop counter                 */
+    uint32_t            value;      /* value read                   */
+
+    if( s_rd_cnt != 0 )
+    {
+        rd  = &s_reads[ s_rd_head ];
+        len = ( rd->left < PROTO_MEM_CHUNK ) ? rd->left : PROTO_MEM_CHUNK;
+        p   = proto_tx_payload();
+
+        telem_put_u32( p, rd->addr );
+        for( i = 0; i < len; i += rd->width )
+        {
+            value = diag_load( rd->addr + i, rd->width );
+            memcpy( &p[ 4 + i ], &value, rd->width );
+        }
+
+        rd->addr += len;
+        rd->left -= len;
+        if( rd->left != 0 )
+        {
+            proto_send( PROTO_T_MEM_DATA, 0, rd->seq, p, 4 + len );
+        }
+        else
+        {
+            proto_reply( PROTO_T_MEM_DATA, rd->seq, p, 4 + len );
+            s_rd_head = ( s_rd_head + 1 ) % PROTO_MEM_READ_QUEUE;
+            s_rd_cnt--;
+        }
+    }
+
+    diag_watch_send();
+}
+
+
+/*--------------------------------------------------------
+True if a range is inside the accessible memory map
+--------------------------------------------------------*/
+bool diag_readable( uint32_t addr, uint32_t len )
+{
+    return diag_map_check( addr, len, false );
+}
+
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Read with the given access size. Values are copied out
+of the low bytes of the result, which are the first in
+memory on this little endian core.
+--------------------------------------------------------*/
+static uint32_t diag_load( uint32_t addr, uint8_t width )
+{
+    switch( width )
+    {
+        case 1:
+            return *(volatile const uint8_t *)addr;
+
+        case 2:
+            return *(volatile const uint16_t *)addr;
+
+        default:
+            return *(volatile const uint32_t *)addr;
+    }
+}
+
+
+/*--------------------------------------------------------
+MEM_READ: queue a range to be streamed
+--------------------------------------------------------*/
+static void diag_mem_read( const proto_frame_type *frame )
+{
+    uint32_t            addr;       /* first address                */
+    uint16_t            len;        /* bytes to read                */
+    uint8_t             width;      /* access size                  */
+    diag_read_type     *rd;         /* queue entry                  */
+
+    if( frame->len != 7 )
+    {
+        diag_status( frame->seq, PROTO_ST_BAD_LEN );
+        return;
+    }
+
+    addr  = telem_get_u32( frame->payload );
+    len   = telem_get_u16( &frame->payload[ 4 ] );
+    width = frame->payload[ 6 ];
+
+    if( s_rd_cnt == PROTO_MEM_READ_QUEUE )
+    {
+        diag_status( frame->seq, PROTO_ST_BUSY );
+    }
+    else if( ( width != 1 && width != 2 && width != 4 )
+          || len == 0 || len > PROTO_MEM_READ_MAX
+          || addr % width != 0 || len % width != 0 )
+    {
+        diag_status( frame->seq, PROTO_ST_BAD_LEN );
+    }
+    else if( !diag_map_check( addr, len, false ) )
+    {
+        diag_status( frame->seq, PROTO_ST_BAD_ADDR );
+    }
+    else
+    {
+        rd = &s_reads[ ( s_rd_head + s_rd_cnt ) % PROTO_MEM_READ_QUEUE ];
+        rd->addr  = addr;
+        rd->left  = len;
+        rd->width = width;
+        rd->seq   = frame->seq;
+        s_rd_cnt++;
+    }
+}
+
+
+/*--------------------------------------------------------
+MEM_WRITE: write a range with the given access size
+--------------------------------------------------------*/
+static void diag_mem_write( const proto_frame_type *frame )
+{
+    uint32_t            addr;       /* first address                */
+    uint16_t            len;        /* bytes to write               */
+    uint8_t             width;      /* access size                  */
+    const uint8_t      *data;       /* bytes to write               */
+    uint16_t            i;          /* loop counter                 */
+    uint32_t            value;      /* value to store               */
+
+    if( frame->len < 6 )
+    {
+        diag_status( frame->seq, PROTO_ST_BAD_LEN );
+        return;
+    }
+
+    addr  = telem_get_u32( frame->payload );
+    width = frame->payload[ 4 ];
+    data  = &frame->payload[ 5 ];
+    len   = frame->len - 5;
+
+    if( ( width != 1 && width != 2 && width != 4 )
+     || addr % width != 0 || len % width != 0 )
+    {
+        diag_status( frame->seq, PROTO_ST_BAD_LEN );
+        return;
+    }
+
+    if( !diag_map_check( addr, len, true ) )
+    {
+        diag_status( frame->seq, PROTO_ST_BAD_ADDR );
+        return;
+    }
+
+    for( i = 0; i < len; i += width )
+    {
+        value = ( width == 1 ) ? data[ i ]
+              : ( width == 2 ) ? telem_get_u16( &data[ i ] )
+              : telem_get_u32( &data[ i ] );
+        diag_store( addr + i, width, value );
+    }
+
+    diag_status( frame->seq, PROTO_ST_OK );
+}
+
+
+/*--------------------------------------------------------
+Shell command: dump memory, one line of four words per
+step. val[ 0 ] is the next address, val[ 1 ] the end.
+--------------------------------------------------------*/
+static int8_t diag_shell_md( shell_ctx_type *ctx, uint8_t argc, char *argv[] )
+{
+    uint32_t            addr;       /* line address                 */
+    uint8_t             i;          /* loop counter                 */
+
+    if( ctx->step == 0 )
+    {
+        if( argc < 2 || argc > 3 )
+        {
+            return SHELL_USAGE;
+        }
+
+        ctx->val[ 0 ] = strtoul( argv[ 1 ], NULL, 0 ) & ~3u;
+        ctx->val[ 1 ] = ( argc == 3 ) ? strtoul( argv[ 2 ], NULL, 0 ) : 16;
+        ctx->val[ 1 ] = ctx->val[ 0 ] + ( ( ctx->val[ 1 ] + 3 ) & ~3u );
+        if( !diag_map_check( ctx->val[ 0 ], ctx->val[ 1 ] - ctx->val[ 0 ], false ) )
+        {
+            shell_printf( "not accessible\n" );
+            return SHELL_FAIL;
+        }
+        ctx->step = 1;
+    }
+
+    addr = ctx->val[ 0 ];
+    shell_printf( "%08lx:", (unsigned long)addr );
+    for( i = 0; i < 4 && addr < ctx->val[ 1 ]; i++, addr += 4 )
+    {
+        shell_printf( " %08lx", (unsigned long)diag_load( addr, 4 ) );
+    }
+    shell_printf( "\n" );
+
+    ctx->val[ 0 ] = addr;
+    return ( addr < ctx->val[ 1 ] ) ? SHELL_MORE : SHELL_DONE;
+}
+
+
+/*--------------------------------------------------------
+Answer a request with a status
+--------------------------------------------------------*/
+static void diag_status( uint8_t seq, uint8_t status )
+{
+    proto_reply( PROTO_T_STATUS, seq, &status, 1 );
+}
+
+
+/*--------------------------------------------------------
+Write with the given access size
+--------------------------------------------------------*/
+static void diag_store( uint32_t addr, uint8_t width, uint32_t value )
+{
+    switch( width )
+    {
+        case 1:
+            *(volatile uint8_t *)addr = (uint8_t)value;
+            break;
+
+        case 2:
+            *(volatile uint16_t *)addr = (uint16_t)value;
+            break;
+
+        default:
+            *(volatile uint32_t *)addr = value;
+            break;
+    }
+}
+
+
+/*--------------------------------------------------------
+Take a watch sample every period, called from the tick
+interrupt. A sample that finds the ring full is counted
+and dropped. Head and tail wrap at the slot count, which
+depends on the sample size; one slot is left free to tell
+a full ring from an empty one.
+--------------------------------------------------------*/
+static void diag_tick( void )
+{
+    uint8_t            *p;          /* sample in the ring           */
+    uint8_t             i;          /* loop counter                 */
+    uint16_t            next;       /* head after this sample       */
+    uint32_t            value;      /* sampled value                */
+
+    if( s_watch_period == 0 || --s_watch_countdown != 0 )
+    {
+        return;
+    }
+    s_watch_countdown = s_watch_period;
+
+    next = s_ring_head + 1;
+    if( next == s_ring_cap )
+    {
+        next = 0;
+    }
+
+    if( next == s_ring_tail )
+    {
+        s_drops++;
+        return;
+    }
+
+    p = &s_ring[ s_ring_head * s_sample_sz ];
+    telem_put_u32( p, timer_get_ticks() );
+    p += 4;
+
+    for( i = 0; i < s_watch_cnt; i++ )
+    {
+        value = diag_load( s_watch[ i ].addr, s_watch[ i ].width );
+        memcpy( p, &value, s_watch[ i ].width );
+        p += s_watch[ i ].width;
+    }
+
+    s_ring_head = next;
+}
+
+
+/*--------------------------------------------------------
+WATCH: replace the watch list and start sampling
+--------------------------------------------------------*/
+static void diag_watch( const proto_frame_type *frame )
+{
+    uint16_t            period;     /* sample period, ms            */
+    uint8_t             cnt;        /* watched addresses            */
+    const uint8_t      *entry;      /* watch list entry             */
+    uint8_t             i;          /* loop counter                 */
+    uint8_t             sample_sz;  /* bytes per sample             */
+
+    if( frame->len < 2 || ( frame->len - 2 ) % PROTO_WATCH_ENTRY_SZ != 0
+     || ( frame->len - 2 ) / PROTO_WATCH_ENTRY_SZ > PROTO_WATCH_MAX )
+    {
+        diag_status( frame->seq, PROTO_ST_BAD_LEN );
+        return;
+    }
+
+    period = telem_get_u16( frame->payload );
+    cnt    = ( frame->len - 2 ) / PROTO_WATCH_ENTRY_SZ;
+
+    /*--------------------------------------------------------
+    Stop the sampling while the list changes
+    --------------------------------------------------------*/
+    s_watch_period = 0;
+
+    sample_sz = 4;
+    for( i = 0; i < cnt; i++ )
+    {
+        entry = &frame->payload[ 2 + i * PROTO_WATCH_ENTRY_SZ ];
+        s_watch[ i ].addr  = telem_get_u32( entry );
+        s_watch[ i ].width = entry[ 4 ];
+
+        if( ( s_watch[ i ].width != 1 && s_watch[ i ].width != 2
+           && s_watch[ i ].width != 4 )
+         || s_watch[ i ].addr % s_watch[ i ].width != 0 )
+        {
+            diag_status( frame->seq, PROTO_ST_BAD_LEN );
+            return;
+        }
+
+        if( !diag_map_check( s_watch[ i ].addr, s_watch[ i ].width, false ) )
+        {
+            diag_status( frame->seq, PROTO_ST_BAD_ADDR );
+            return;
+        }
+
+        sample_sz += s_watch[ i ].width;
+    }
+
+    s_watch_cnt       = cnt;
+    s_watch_seq       = frame->seq;
+    s_sample_sz       = sample_sz;
+    s_ring_cap        = DIAG_RING_SZ / sample_sz;
+    s_ring_head       = 0;
+    s_ring_tail       = 0;
+    s_drops           = 0;
+    s_watch_countdown = period;
+    s_flush_at        = timer_get_ticks() + DIAG_FLUSH_TICKS;
+
+    diag_status( frame->seq, PROTO_ST_OK );
+
+    if( cnt != 0 )
+    {
+        s_watch_period = period;
+    }
+}
+
+
+/*--------------------------------------------------------
+Send watch samples once a frame can be filled or the
+oldest one has waited DIAG_FLUSH_TICKS. Samples are
+copied from the ring straight into the frame payload.
+--------------------------------------------------------*/
+static void diag_watch_send( void )
+{
+    uint16_t            avail;      /* samples waiting              */
+    uint16_t            per_frame;  /* samples that fit a frame     */
+    uint16_t            idx;        /* ring index                   */
+    uint8_t            *p;          /* WATCH_DATA payload           */
+    uint8_t             i;          /* loop counter                 */
+
+    if( s_watch_cnt == 0 )
+    {
+        return;
+    }
+
+    avail     = ( s_ring_head + s_ring_cap - s_ring_tail ) % s_ring_cap;
+    per_frame = ( PROTO_PAYLOAD_MAX - PROTO_WATCH_HDR_SZ ) / s_sample_sz;
+    if( avail == 0 || ( avail < per_frame && !timer_expired( s_flush_at ) ) )
+    {
+        return;
+    }
+
+    if( avail > per_frame )
+    {
+        avail = per_frame;
+    }
+
+    p = proto_tx_payload();
+    telem_put_u16( p, s_drops );
+    p[ 2 ] = (uint8_t)avail;
+
+    for( i = 0; i < avail; i++ )
+    {
+        idx = ( s_ring_tail + i ) % s_ring_cap;
+        memcpy( &p[ PROTO_WATCH_HDR_SZ + i * s_sample_sz ],
+                &s_ring[ idx * s_sample_sz ], s_sample_sz );
+    }
+
+    s_ring_tail  = ( s_ring_tail + avail ) % s_ring_cap;
+    s_flush_at   = timer_get_ticks() + DIAG_FLUSH_TICKS;
+
+    proto_send( PROTO_T_WATCH_DATA, 0, s_watch_seq, p,
+                PROTO_WATCH_HDR_SZ + avail * s_sample_sz );
+}
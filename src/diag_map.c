@@ -0,0 +1,81 @@
+/*----------------------------------------------------------------------
+                            INCLUDES
+----------------------------------------------------------------------*/
+
+#include "diag_map.h"
+
+/*----------------------------------------------------------------------
+                            TYPES
+----------------------------------------------------------------------*/
+
+typedef struct                      /* accessible address range     */
+{
+    uint32_t            start;      /* first address                */
+    uint32_t            end;        /* one past the last address    */
+    bool                writable;   /* MEM_WRITE allowed            */
+} diag_region_type;
+
+/*----------------------------------------------------------------------
+                            CONSTANTS
+----------------------------------------------------------------------*/
+
+static const diag_region_type s_regions[] =
+{
+    { 0x08000000, 0x08020000, false },  /* flash                    */
+    { 0x1FFFF000, 0x1FFFF810, false },  /* system memory, unique id,*/
+                                        /* option bytes             */
+    { 0x20000000, 0x20002000, true  },  /* SRAM                     */
+
+    /*--------------------------------------------------------
+    Peripheral blocks of the medium density value line; the
+    gaps between them are reserved and bus fault
+    --------------------------------------------------------*/
+    { 0x40000000, 0x40000C00, true  },  /* TIM2-4                   */
+    { 0x40001000, 0x40001800, true  },  /* TIM6-7                   */
+    { 0x40002800, 0x40003400, true  },  /* RTC, WWDG, IWDG          */
+    { 0x40003800, 0x40003C00, true  },  /* SPI2                     */
+    { 0x40004400, 0x40004C00, true  },  /* USART2-3                 */
+    { 0x40005400, 0x40005C00, true  },  /* I2C1-2                   */
+    { 0x40006C00, 0x40007C00, true  },  /* BKP, PWR, DAC, CEC       */
+    { 0x40010000, 0x40011C00, true  },  /* AFIO, EXTI, GPIOA-E      */
+    { 0x40012400, 0x40012800, true  },  /* ADC1                     */
+    { 0x40012C00, 0x40013400, true  },  /* TIM1, SPI1               */
+    { 0x40013800, 0x40013C00, true  },  /* USART1                   */
+    { 0x40014000, 0x40014C00, true  },  /* TIM15-17                 */
+    { 0x40020000, 0x40020400, true  },  /* DMA1                     */
+    { 0x40021000, 0x40021400, true  },  /* RCC                      */
+    { 0x40022000, 0x40022400, true  },  /* flash interface          */
+    { 0x40023000, 0x40023400, true  },  /* CRC                      */
+
+    { 0xE0000000, 0xE0003000, true  },  /* ITM, DWT, FPB            */
+    { 0xE000E000, 0xE000F000, true  },  /* system control space     */
+    { 0xE0040000, 0xE0042000, true  },  /* TPIU, ETM                */
+    { 0xE00FF000, 0xE0100000, false }   /* ROM table                */
+};
+
+/*----------------------------------------------------------------------
+                            PROCEDURES
+----------------------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Check an access against the memory map. The range must
+start before the end of a region, an address past it
+would make the length left in the region wrap.
+--------------------------------------------------------*/
+bool diag_map_check( uint32_t addr, uint32_t len, bool write )
+{
+    uint8_t             i;          /* loop counter                 */
+
+    for( i = 0; i < sizeof( s_regions ) / sizeof( s_regions[ 0 ] ); i++ )
+    {
+        if( addr >= s_regions[ i ].start
+         && addr < s_regions[ i ].end
+         && len <= s_regions[ i ].end - addr
+         && ( s_regions[ i ].writable || !write ) )
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
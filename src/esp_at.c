@@ -0,0 +1,399 @@
+/*----------------------------------------------------------------------
+                            INCLUDES
+----------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_at.h"
+#include "esp_ipd.h"
+#include "esp_uart.h"
+
+/*----------------------------------------------------------------------
+                            CONSTANTS
+----------------------------------------------------------------------*/
+
+#define AT_INFO_SZ      ESP_LINE_SZ /* saved information line size  */
+#define AT_SEND_CMD_SZ  24          /* "AT+CIPSEND=<id>,<len>"      */
+
+/*----------------------------------------------------------------------
+                            TYPES
+----------------------------------------------------------------------*/
+
+typedef enum                        /* command engine state         */
+{
+    AT_STATE_IDLE,                  /* no command outstanding       */
+    AT_STATE_CMD,                   /* waiting for OK / ERROR       */
+    AT_STATE_SEND_PROMPT,           /* CIPSEND waiting for '>'      */
+    AT_STATE_SEND_DATA,             /* CIPSEND payload DMA running  */
+    AT_STATE_SEND_RESULT            /* waiting for SEND OK          */
+} at_state_type;
+
+/*----------------------------------------------------------------------
+                            VARIABLES
+----------------------------------------------------------------------*/
+
+static at_state_type    s_state;    /* command engine state         */
+static timer_ticks_t    s_deadline; /* current command deadline     */
+static esp_at_done_cb_type
+                        s_done_cb;  /* current command completion   */
+static void            *s_done_ctx; /* completion context           */
+static const void      *s_send_data;/* CIPSEND payload              */
+static uint16_t         s_send_len; /* CIPSEND payload length       */
+static const void      *s_send_data2;
+                                    /* CIPSEND second segment       */
+static uint16_t         s_send_len2;/* second segment length        */
+static timer_ticks_t    s_send_start;
+                                    /* CIPSEND issue time           */
+static char             s_info[ AT_INFO_SZ ];
+                                    /* last information line        */
+static esp_at_urc_cb_type
+                        s_urc_cbs[ ESP_AT_URC_MAX ];
+                                    /* unsolicited line handlers    */
+static esp_at_stats_type
+                        s_stats;    /* command statistics           */
+
+/*----------------------------------------------------------------------
+                            PROCEDURES
+----------------------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+static void at_complete( esp_at_result_type result );
+static void at_handle_line( const char *line );
+static bool at_is_urc( const char *line );
+static void at_start( timer_ticks_t timeout, esp_at_done_cb_type done_cb,
+                      void *ctx );
+
+
+/*--------------------------------------------------------
+Reset the command engine
+--------------------------------------------------------*/
+void esp_at_init( void )
+{
+    s_state = AT_STATE_IDLE;
+    s_info[ 0 ] = '\0';
+    memset( s_urc_cbs, 0, sizeof( s_urc_cbs ) );
+    memset( &s_stats, 0, sizeof( s_stats ) );
+}
+
+
+/*--------------------------------------------------------
+Process received lines and advance the current command.
+Call this from the main loop.
+--------------------------------------------------------*/
+void esp_at_poll( void )
+{
+    const char         *line;       /* received response line       */
+
+    while( ( line = esp_ipd_line() ) != NULL )
+    {
+        at_handle_line( line );
+        esp_ipd_line_release();
+    }
+
+    switch( s_state )
+    {
+        case AT_STATE_SEND_PROMPT:
+            if( esp_ipd_prompt() )
+            {
+                esp_uart_write_dma( s_send_data, s_send_len );
+                s_state = AT_STATE_SEND_DATA;
+            }
+            break;
+
+        case AT_STATE_SEND_DATA:
+            if( !esp_uart_tx_busy() )
+            {
+                if( s_send_len2 != 0 )
+                {
+                    esp_uart_write_dma( s_send_data2, s_send_len2 );
+                    s_send_len2 = 0;
+                }
+                else
+                {
+                    s_state = AT_STATE_SEND_RESULT;
+                }
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    if( s_state != AT_STATE_IDLE && timer_expired( s_deadline ) )
+    {
+        s_stats.timeouts++;
+        at_complete( ESP_AT_TIMEOUT );
+    }
+}
+
+
+/*--------------------------------------------------------
+Check if a command is outstanding
+--------------------------------------------------------*/
+bool esp_at_busy( void )
+{
+    return ( s_state != AT_STATE_IDLE );
+}
+
+
+/*--------------------------------------------------------
+Issue an AT command. The command string is written out
+immediately, the completion callback (may be NULL) runs
+from esp_at_poll(). Returns false if busy.
+--------------------------------------------------------*/
+bool esp_at_cmd( const char *cmd, timer_ticks_t timeout,
+                 esp_at_done_cb_type done_cb, void *ctx )
+{
+    if( esp_at_busy() )
+    {
+        return false;
+    }
+
+    at_start( timeout, done_cb, ctx );
+    s_state = AT_STATE_CMD;
+    esp_uart_write_cmd( cmd );
+
+    return true;
+}
+
+
+/*--------------------------------------------------------
+Send payload data on a link with AT+CIPSEND. The data is
+transferred by DMA once the '>' prompt arrives and must
+stay valid until the completion callback runs. Returns
+false if busy.
+--------------------------------------------------------*/
+bool esp_at_send( uint8_t link, const void *data, uint16_t len,
+                  timer_ticks_t timeout, esp_at_done_cb_type done_cb,
+                  void *ctx )
+{
+    return esp_at_send_split( link, data, len, NULL, 0, timeout, done_cb, ctx );
+}
+
+
+/*--------------------------------------------------------
+Send payload made of two segments with a single CIPSEND,
+e.g. the two halves of a wrapped ring buffer. The module
+just waits for <len1 + len2> bytes after the prompt.
+--------------------------------------------------------*/
+bool esp_at_send_split( uint8_t link, const void *data1, uint16_t len1,
+                        const void *data2, uint16_t len2,
+                        timer_ticks_t timeout, esp_at_done_cb_type done_cb,
+                        void *ctx )
+{
+    char                cmd[ AT_SEND_CMD_SZ ];
+                                    /* CIPSEND command string       */
+    uint16_t            len;        /* total payload length         */
+
+    len = len1 + len2;
+    if( esp_at_busy() || len1 == 0 || len > ESP_AT_SEND_MAX )
+    {
+        return false;
+    }
+
+    /*--------------------------------------------------------
+    Discard any stale prompt before asking for a new one
+    --------------------------------------------------------*/
+    while( esp_ipd_prompt() );
+
+    at_start( timeout, done_cb, ctx );
+    s_send_data  = data1;
+    s_send_len   = len1;
+    s_send_data2 = data2;
+    s_send_len2  = len2;
+    s_send_start = timer_get_ticks();
+    s_state      = AT_STATE_SEND_PROMPT;
+
+    sprintf( cmd, "AT+CIPSEND=%u,%u", link, len );
+    esp_uart_write_cmd( cmd );
+
+    s_stats.sends++;
+    s_stats.send_bytes    += len;
+    s_stats.send_overhead += strlen( cmd ) + 2;
+
+    return true;
+}
+
+
+/*--------------------------------------------------------
+Drop the completion of the current command if it was
+issued with ctx, for a caller that goes away before it
+finishes. The command itself runs to its end.
+--------------------------------------------------------*/
+void esp_at_forget( void *ctx )
+{
+    if( esp_at_busy() && s_done_ctx == ctx )
+    {
+        s_done_cb = NULL;
+    }
+}
+
+
+/*--------------------------------------------------------
+Get the last information line (e.g. "+CIFSR:...") that
+was received while a command was outstanding
+--------------------------------------------------------*/
+const char *esp_at_info( void )
+{
+    return s_info;
+}
+
+
+/*--------------------------------------------------------
+Register a handler for unsolicited lines
+--------------------------------------------------------*/
+bool esp_at_add_urc_handler( esp_at_urc_cb_type urc_cb )
+{
+    uint8_t             i;          /* loop counter                 */
+
+    for( i = 0; i < ESP_AT_URC_MAX; i++ )
+    {
+        if( s_urc_cbs[ i ] == NULL || s_urc_cbs[ i ] == urc_cb )
+        {
+            s_urc_cbs[ i ] = urc_cb;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*--------------------------------------------------------
+Get a copy of the command statistics
+--------------------------------------------------------*/
+void esp_at_get_stats( esp_at_stats_type *stats )
+{
+    *stats = s_stats;
+}
+
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Finish the current command and report the result
+--------------------------------------------------------*/
+static void at_complete( esp_at_result_type result )
+{
+    esp_at_done_cb_type done_cb;    /* completion to run            */
+
+    done_cb = s_done_cb;
+    s_state = AT_STATE_IDLE;
+
+    /*--------------------------------------------------------
+    The engine is idle before the callback runs so the
+    callback can issue the next command right away
+    --------------------------------------------------------*/
+    if( done_cb != NULL )
+    {
+        done_cb( result, s_done_ctx );
+    }
+}
+
+
+/*--------------------------------------------------------
+Classify a received line against the current command
+--------------------------------------------------------*/
+static void at_handle_line( const char *line )
+{
+    uint8_t             i;          /* loop counter                 */
+
+    if( at_is_urc( line ) || s_state == AT_STATE_IDLE )
+    {
+        for( i = 0; i < ESP_AT_URC_MAX && s_urc_cbs[ i ] != NULL; i++ )
+        {
+            s_urc_cbs[ i ]( line );
+        }
+        return;
+    }
+
+    /*--------------------------------------------------------
+    Command echo when the module has not been sent ATE0
+    --------------------------------------------------------*/
+    if( strncmp( line, "AT", 2 ) == 0 )
+    {
+        return;
+    }
+
+    if( strcmp( line, "ERROR" ) == 0
+     || strcmp( line, "FAIL" ) == 0
+     || strcmp( line, "SEND FAIL" ) == 0
+     || strcmp( line, "link is not valid" ) == 0 )
+    {
+        s_stats.errors++;
+        at_complete( ESP_AT_ERROR );
+        return;
+    }
+
+    switch( s_state )
+    {
+        case AT_STATE_CMD:
+            if( strcmp( line, "OK" ) == 0 )
+            {
+                at_complete( ESP_AT_OK );
+                return;
+            }
+            break;
+
+        case AT_STATE_SEND_PROMPT:
+            /* CIPSEND acknowledges with OK before the prompt   */
+            if( strcmp( line, "OK" ) == 0 )
+            {
+                return;
+            }
+            break;
+
+        case AT_STATE_SEND_DATA:
+        case AT_STATE_SEND_RESULT:
+            if( strcmp( line, "SEND OK" ) == 0 )
+            {
+                s_stats.send_ticks += timer_get_ticks() - s_send_start;
+                at_complete( ESP_AT_OK );
+                return;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    strncpy( s_info, line, AT_INFO_SZ - 1 );
+    s_info[ AT_INFO_SZ - 1 ] = '\0';
+}
+
+
+/*--------------------------------------------------------
+Check for lines the module sends on its own
+--------------------------------------------------------*/
+static bool at_is_urc( const char *line )
+{
+    /*--------------------------------------------------------
+    <id>,CONNECT  <id>,CLOSED  <id>,CONNECT FAIL
+    --------------------------------------------------------*/
+    if( line[ 0 ] >= '0' && line[ 0 ] <= '9' && line[ 1 ] == ',' )
+    {
+        return true;
+    }
+
+    return ( strncmp( line, "WIFI ", 5 ) == 0
+          || strcmp( line, "ready" ) == 0 );
+}
+
+
+/*--------------------------------------------------------
+Common command start
+--------------------------------------------------------*/
+static void at_start( timer_ticks_t timeout, esp_at_done_cb_type done_cb,
+                      void *ctx )
+{
+    s_deadline  = timer_get_ticks() + timeout;
+    s_done_cb   = done_cb;
+    s_done_ctx  = ctx;
+    s_info[ 0 ] = '\0';
+    s_stats.cmds++;
+}
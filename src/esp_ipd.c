@@ -0,0 +1,549 @@
+/*----------------------------------------------------------------------
+                            INCLUDES
+----------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "stm32f10x.h"
+#include "defer.h"
+#include "esp_ipd.h"
+
+/*----------------------------------------------------------------------
+                            CONSTANTS
+----------------------------------------------------------------------*/
+
+#define IPD_PREFIX      "+IPD,"     /* received data header prefix  */
+#define IPD_PREFIX_LEN  ( sizeof( IPD_PREFIX ) - 1 )
+#define IPD_LEN_MAX     2048        /* largest +IPD length accepted */
+
+/*----------------------------------------------------------------------
+                            TYPES
+----------------------------------------------------------------------*/
+
+typedef enum                        /* RX stream parser state       */
+{
+    IPD_STATE_LINE_START,           /* first byte of a line         */
+    IPD_STATE_LINE,                 /* inside a response line       */
+    IPD_STATE_HDR_NUM1,             /* +IPD,<id or len>             */
+    IPD_STATE_HDR_NUM2,             /* +IPD,<id>,<len>              */
+    IPD_STATE_PAYLOAD               /* routing payload to a link    */
+} ipd_state_type;
+
+/*--------------------------------------------------------
+Single producer (RX deferred work) / single consumer ring.
+The head is only written by the parser, the tail only
+by the reader, so neither side needs to lock the other.
+--------------------------------------------------------*/
+typedef struct                      /* per link payload ring        */
+{
+    uint8_t            *buf;        /* application supplied buffer  */
+    uint16_t            buf_sz;     /* size of the buffer           */
+    volatile uint16_t   head;       /* next byte written            */
+    volatile uint16_t   tail;       /* next byte read               */
+} ipd_link_type;
+
+/*----------------------------------------------------------------------
+                            VARIABLES
+----------------------------------------------------------------------*/
+
+static ipd_link_type    s_links[ ESP_LINK_CNT ];
+                                    /* per link payload rings       */
+static char             s_lines[ ESP_LINE_CNT ][ ESP_LINE_SZ ];
+                                    /* queued response lines        */
+static uint8_t          s_line_wr;  /* line slot being written      */
+static uint8_t          s_line_rd;  /* oldest queued line slot      */
+static volatile uint8_t s_line_cnt; /* number of queued lines       */
+static uint8_t          s_line_len; /* length of line being written */
+static bool             s_line_keep;/* current line has a free slot */
+static volatile uint8_t s_prompt_cnt;
+                                    /* unclaimed '>' prompts        */
+
+static ipd_state_type   s_state;    /* parser state                 */
+static uint8_t          s_match;    /* +IPD, prefix bytes matched   */
+static uint16_t         s_num1;     /* first header number          */
+static uint16_t         s_num2;     /* second header number         */
+static uint8_t          s_link;     /* link receiving payload       */
+static uint16_t         s_remain;   /* payload bytes remaining      */
+
+static esp_ipd_stats_type
+                        s_stats;    /* parser statistics            */
+
+/*----------------------------------------------------------------------
+                            PROCEDURES
+----------------------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+static void ipd_hdr_error( uint8_t byte );
+static void ipd_line_byte( uint8_t byte );
+static void ipd_line_end( void );
+static void ipd_payload_start( uint8_t link, uint16_t len );
+static void ipd_payload_byte( uint8_t byte );
+
+
+/*--------------------------------------------------------
+Reset the parser and detach all link buffers
+--------------------------------------------------------*/
+void esp_ipd_init( void )
+{
+    memset( s_links, 0, sizeof( s_links ) );
+    memset( &s_stats, 0, sizeof( s_stats ) );
+
+    s_line_wr    = 0;
+    s_line_rd    = 0;
+    s_line_cnt   = 0;
+    s_line_len   = 0;
+    s_prompt_cnt = 0;
+    s_state      = IPD_STATE_LINE_START;
+}
+
+
+/*--------------------------------------------------------
+Feed one received byte to the parser.
+NOTE: called from deferred work (esp_uart.c), or with
+the UART 2 interrupt disabled.
+--------------------------------------------------------*/
+void esp_ipd_feed( uint8_t byte )
+{
+    switch( s_state )
+    {
+        case IPD_STATE_PAYLOAD:
+            ipd_payload_byte( byte );
+            break;
+
+        case IPD_STATE_HDR_NUM1:
+            if( byte >= '0' && byte <= '9'
+             && s_num1 <= ( IPD_LEN_MAX - ( byte - '0' ) ) / 10 )
+            {
+                s_num1 = s_num1 * 10 + ( byte - '0' );
+            }
+            else if( byte == ',' )
+            {
+                /* +IPD,<id>,<len>: multiple connection mode    */
+                s_num2  = 0;
+                s_state = IPD_STATE_HDR_NUM2;
+            }
+            else if( byte == ':' )
+            {
+                /* +IPD,<len>: single connection mode, link 0   */
+                ipd_payload_start( 0, s_num1 );
+            }
+            else
+            {
+                ipd_hdr_error( byte );
+            }
+            break;
+
+        case IPD_STATE_HDR_NUM2:
+            if( byte >= '0' && byte <= '9'
+             && s_num2 <= ( IPD_LEN_MAX - ( byte - '0' ) ) / 10 )
+            {
+                s_num2 = s_num2 * 10 + ( byte - '0' );
+            }
+            else if( byte == ':' && s_num1 < ESP_LINK_CNT )
+            {
+                ipd_payload_start( (uint8_t)s_num1, s_num2 );
+            }
+            else
+            {
+                ipd_hdr_error( byte );
+            }
+            break;
+
+        case IPD_STATE_LINE_START:
+            /*--------------------------------------------------------
+            CIPSEND answers with "> " and no line ending, so the
+            prompt is recognized as the first byte of a line.
+            --------------------------------------------------------*/
+            if( byte == '>' )
+            {
+                s_prompt_cnt++;
+                s_stats.prompts++;
+                break;
+            }
+
+            if( byte == ' ' || byte == '\r' || byte == '\n' )
+            {
+                break;
+            }
+
+            s_match     = 0;
+            s_line_len  = 0;
+            s_line_keep = ( s_line_cnt < ESP_LINE_CNT );
+            s_state     = IPD_STATE_LINE;
+            ipd_line_byte( byte );
+            break;
+
+        case IPD_STATE_LINE:
+        default:
+            ipd_line_byte( byte );
+            break;
+    }
+}
+
+
+/*--------------------------------------------------------
+Attach an application buffer to a link. Payload for a
+link without a buffer is counted and discarded. A buffer
+of no size is ignored, the link keeps the one it has.
+--------------------------------------------------------*/
+void esp_ipd_link_attach( uint8_t link, uint8_t *buf, uint16_t buf_sz )
+{
+    uint32_t            lock;       /* deferred work mask on entry  */
+
+    if( link >= ESP_LINK_CNT || ( buf != NULL && buf_sz == 0 ) )
+    {
+        return;
+    }
+
+    lock = defer_lock();
+
+    s_links[ link ].buf    = buf;
+    s_links[ link ].buf_sz = buf_sz;
+    s_links[ link ].head   = 0;
+    s_links[ link ].tail   = 0;
+
+    defer_unlock( lock );
+}
+
+
+/*--------------------------------------------------------
+Buffer attached to a link, or NULL, so a borrower can
+attach it again when done
+--------------------------------------------------------*/
+uint8_t *esp_ipd_link_buf( uint8_t link, uint16_t *buf_sz )
+{
+    if( link >= ESP_LINK_CNT )
+    {
+        *buf_sz = 0;
+        return NULL;
+    }
+
+    *buf_sz = s_links[ link ].buf_sz;
+    return s_links[ link ].buf;
+}
+
+
+/*--------------------------------------------------------
+Number of payload bytes waiting on a link
+--------------------------------------------------------*/
+uint16_t esp_ipd_link_avail( uint8_t link )
+{
+    ipd_link_type      *l;          /* link ring                    */
+    uint16_t            head;       /* snapshot of the write index  */
+
+    if( link >= ESP_LINK_CNT || s_links[ link ].buf == NULL )
+    {
+        return 0;
+    }
+
+    l    = &s_links[ link ];
+    head = l->head;
+
+    return ( head >= l->tail ) ? head - l->tail : l->buf_sz - l->tail + head;
+}
+
+
+/*--------------------------------------------------------
+Get the longest contiguous run of payload bytes waiting
+on a link without copying. The span stays valid until it
+is released with esp_ipd_link_consume().
+--------------------------------------------------------*/
+uint16_t esp_ipd_link_span( uint8_t link, const uint8_t **span )
+{
+    ipd_link_type      *l;          /* link ring                    */
+    uint16_t            head;       /* snapshot of the write index  */
+
+    if( link >= ESP_LINK_CNT || s_links[ link ].buf == NULL )
+    {
+        return 0;
+    }
+
+    l     = &s_links[ link ];
+    head  = l->head;
+    *span = &l->buf[ l->tail ];
+
+    return ( head >= l->tail ) ? head - l->tail : l->buf_sz - l->tail;
+}
+
+
+/*--------------------------------------------------------
+Release payload bytes previously returned as a span
+--------------------------------------------------------*/
+void esp_ipd_link_consume( uint8_t link, uint16_t bytes )
+{
+    ipd_link_type      *l;          /* link ring                    */
+    uint16_t            avail;      /* bytes waiting on the link    */
+
+    avail = esp_ipd_link_avail( link );
+    if( bytes > avail )
+    {
+        bytes = avail;
+    }
+
+    if( bytes == 0 )
+    {
+        return;
+    }
+
+    l       = &s_links[ link ];
+    l->tail = ( l->tail + bytes ) % l->buf_sz;
+}
+
+
+/*--------------------------------------------------------
+Copy payload bytes out of a link ring.
+This has a signature similar to read() of unistd.h.
+--------------------------------------------------------*/
+uint16_t esp_ipd_link_read( uint8_t link, void *buf, uint16_t bytes )
+{
+    const uint8_t      *span;       /* contiguous payload run       */
+    uint16_t            span_len;   /* length of the run            */
+    uint16_t            copied;     /* bytes copied so far          */
+
+    copied = 0;
+
+    /*--------------------------------------------------------
+    At most two spans when the ring data wraps around
+    --------------------------------------------------------*/
+    while( copied < bytes )
+    {
+        span_len = esp_ipd_link_span( link, &span );
+        if( span_len == 0 )
+        {
+            break;
+        }
+
+        if( span_len > bytes - copied )
+        {
+            span_len = bytes - copied;
+        }
+
+        memcpy( (uint8_t *)buf + copied, span, span_len );
+        esp_ipd_link_consume( link, span_len );
+        copied += span_len;
+    }
+
+    return copied;
+}
+
+
+/*--------------------------------------------------------
+Get the oldest queued response line, NULL if none. The
+line stays valid until esp_ipd_line_release().
+--------------------------------------------------------*/
+const char *esp_ipd_line( void )
+{
+    if( s_line_cnt == 0 )
+    {
+        return NULL;
+    }
+
+    return s_lines[ s_line_rd ];
+}
+
+
+/*--------------------------------------------------------
+Release the oldest queued response line
+--------------------------------------------------------*/
+void esp_ipd_line_release( void )
+{
+    uint32_t            lock;       /* deferred work mask on entry  */
+
+    if( s_line_cnt == 0 )
+    {
+        return;
+    }
+
+    s_line_rd = ( s_line_rd + 1 ) % ESP_LINE_CNT;
+
+    lock = defer_lock();
+    s_line_cnt--;
+    defer_unlock( lock );
+}
+
+
+/*--------------------------------------------------------
+Claim a CIPSEND '>' prompt if one has been received
+--------------------------------------------------------*/
+bool esp_ipd_prompt( void )
+{
+    bool                claimed;    /* a prompt was pending         */
+    uint32_t            lock;       /* deferred work mask on entry  */
+
+    lock = defer_lock();
+
+    claimed = ( s_prompt_cnt > 0 );
+    if( claimed )
+    {
+        s_prompt_cnt--;
+    }
+
+    defer_unlock( lock );
+
+    return claimed;
+}
+
+
+/*--------------------------------------------------------
+Get a copy of the parser statistics
+--------------------------------------------------------*/
+void esp_ipd_get_stats( esp_ipd_stats_type *stats )
+{
+    uint32_t            lock;       /* deferred work mask on entry  */
+
+    lock = defer_lock();
+    *stats = s_stats;
+    defer_unlock( lock );
+}
+
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Malformed +IPD header, or a number longer than any length
+the module sends: count it and go on with the header as
+an ordinary line. The byte that ended it is part of that
+line, it may be the line ending.
+--------------------------------------------------------*/
+static void ipd_hdr_error( uint8_t byte )
+{
+    s_stats.hdr_errors++;
+    s_match = IPD_PREFIX_LEN + 1;
+    s_state = IPD_STATE_LINE;
+    ipd_line_byte( byte );
+}
+
+
+/*--------------------------------------------------------
+Handle a byte of a response line. The +IPD, prefix is
+matched as the line is built up, no line is ever parsed
+after the fact.
+--------------------------------------------------------*/
+static void ipd_line_byte( uint8_t byte )
+{
+    if( byte == '\n' )
+    {
+        ipd_line_end();
+        return;
+    }
+
+    if( byte == '\r' )
+    {
+        return;
+    }
+
+    if( s_match < IPD_PREFIX_LEN && s_match == s_line_len )
+    {
+        if( byte == (uint8_t)IPD_PREFIX[ s_match ] )
+        {
+            s_match++;
+        }
+        else
+        {
+            s_match = IPD_PREFIX_LEN + 1;
+        }
+    }
+
+    if( s_line_keep && s_line_len < ESP_LINE_SZ - 1 )
+    {
+        s_lines[ s_line_wr ][ s_line_len ] = (char)byte;
+    }
+
+    if( s_line_len < UINT8_MAX )
+    {
+        s_line_len++;
+    }
+
+    /*--------------------------------------------------------
+    Whole prefix seen, the rest is a header not a line
+    --------------------------------------------------------*/
+    if( s_match == IPD_PREFIX_LEN )
+    {
+        s_num1  = 0;
+        s_state = IPD_STATE_HDR_NUM1;
+    }
+}
+
+
+/*--------------------------------------------------------
+Complete the line being written and queue it
+--------------------------------------------------------*/
+static void ipd_line_end( void )
+{
+    uint8_t             len;        /* stored line length           */
+
+    s_state = IPD_STATE_LINE_START;
+
+    if( !s_line_keep )
+    {
+        s_stats.line_drops++;
+        return;
+    }
+
+    len = ( s_line_len < ESP_LINE_SZ - 1 ) ? s_line_len : ESP_LINE_SZ - 1;
+    s_lines[ s_line_wr ][ len ] = '\0';
+
+    s_line_wr = ( s_line_wr + 1 ) % ESP_LINE_CNT;
+    s_line_cnt++;
+}
+
+
+/*--------------------------------------------------------
+Header complete, start routing payload bytes
+--------------------------------------------------------*/
+static void ipd_payload_start( uint8_t link, uint16_t len )
+{
+    if( len == 0 || len > IPD_LEN_MAX )
+    {
+        if( len != 0 )
+        {
+            s_stats.hdr_errors++;
+        }
+        s_state = IPD_STATE_LINE_START;
+        return;
+    }
+
+    s_link   = link;
+    s_remain = len;
+    s_state  = IPD_STATE_PAYLOAD;
+}
+
+
+/*--------------------------------------------------------
+Store one payload byte directly in the link ring
+--------------------------------------------------------*/
+static void ipd_payload_byte( uint8_t byte )
+{
+    ipd_link_type      *l;          /* link receiving the payload   */
+    uint16_t            next;       /* write index after this byte  */
+
+    l = &s_links[ s_link ];
+
+    if( l->buf != NULL )
+    {
+        next = ( l->head + 1 ) % l->buf_sz;
+        if( next != l->tail )
+        {
+            l->buf[ l->head ] = byte;
+            l->head = next;
+            s_stats.payload_bytes++;
+        }
+        else
+        {
+            s_stats.payload_drops++;
+        }
+    }
+    else
+    {
+        s_stats.payload_drops++;
+    }
+
+    if( --s_remain == 0 )
+    {
+        s_state = IPD_STATE_LINE_START;
+    }
+}
@@ -0,0 +1,463 @@
+/*----------------------------------------------------------------------
+                            INCLUDES
+----------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "stm32f10x.h"
+#include "stm32f10x_gpio.h"
+#include "stm32f10x_rcc.h"
+
+#include "esp_link.h"
+#include "esp_at.h"
+#include "logbuf.h"
+#include "net.h"
+
+/*----------------------------------------------------------------------
+                            CONSTANTS
+----------------------------------------------------------------------*/
+
+#define LINK_RST_GPIO       GPIOA   /* ESP8266 RST, open drain      */
+#define LINK_RST_PIN        GPIO_Pin_1
+#define LINK_RST_TICKS      20      /* reset pin low time, ms       */
+#define LINK_BOOT_TIMEOUT   5000    /* reset to "ready", ms         */
+#define LINK_JOIN_TIMEOUT   20000   /* AT+CWJAP_CUR timeout, ms     */
+#define LINK_JOIN_TRIES     2       /* rejoins before AT+RST        */
+#define LINK_SOFT_TRIES     1       /* AT+RST before the reset pin  */
+#define LINK_STALL_TIMEOUTS 2       /* timeouts since the last good */
+                                    /* probe for a stuck module     */
+#define LINK_CMD_SZ         96      /* AT+CWJAP_CUR command buffer  */
+#define LINK_UID_ADDR       0x1FFFF7E8
+                                    /* device unique id, jitter seed*/
+
+/*----------------------------------------------------------------------
+                            TYPES
+----------------------------------------------------------------------*/
+
+typedef enum                        /* supervisor state             */
+{
+    LINK_UP,                        /* link usable                  */
+    LINK_PROBE,                     /* AT+CWJAP? running            */
+    LINK_BACKOFF,                   /* waiting for the next attempt */
+    LINK_JOIN,                      /* AT+CWJAP_CUR running         */
+    LINK_RESET,                     /* AT+RST running               */
+    LINK_PIN,                       /* reset pin held low           */
+    LINK_BOOT                       /* waiting for "ready"          */
+} link_state_type;
+
+/*----------------------------------------------------------------------
+                            VARIABLES
+----------------------------------------------------------------------*/
+
+static esp_link_cfg_type
+                        s_cfg;      /* supervisor configuration     */
+static link_state_type  s_state;    /* supervisor state             */
+static timer_ticks_t    s_due;      /* next probe, attempt or reset */
+                                    /* step                         */
+static timer_ticks_t    s_down_at;  /* time the link was lost       */
+static uint8_t          s_attempt;  /* recovery attempts so far     */
+static bool             s_ready;    /* "ready" seen since the reset */
+static uint16_t         s_timeouts; /* AT timeouts already counted  */
+static uint32_t         s_cmds;     /* AT commands already counted  */
+static uint16_t         s_errors;   /* AT errors already counted    */
+static uint32_t         s_rand;     /* jitter generator state       */
+static esp_link_stats_type
+                        s_stats;    /* supervisor statistics        */
+
+/*----------------------------------------------------------------------
+                            PROCEDURES
+----------------------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+static timer_ticks_t link_backoff( uint8_t attempt );
+static void link_cmd_done( esp_at_result_type result, void *ctx );
+static void link_fail( void );
+static void link_join( void );
+static void link_lost( void );
+static void link_probe_done( esp_at_result_type result, void *ctx );
+static uint32_t link_rand( void );
+static void link_recover( void );
+static void link_restored( void );
+static void link_urc( const char *line );
+
+
+/*--------------------------------------------------------
+Start supervising. The link is assumed up until the first
+probe says otherwise.
+--------------------------------------------------------*/
+void esp_link_init( const esp_link_cfg_type *cfg )
+{
+    GPIO_InitTypeDef    GPIO_InitStructure;
+    esp_at_stats_type   at_stats;   /* AT engine statistics         */
+    const uint32_t     *uid;        /* device unique id             */
+
+    s_cfg   = *cfg;
+    s_state = LINK_UP;
+    s_due   = timer_get_ticks();
+    memset( &s_stats, 0, sizeof( s_stats ) );
+
+    esp_at_get_stats( &at_stats );
+    s_timeouts = at_stats.timeouts;
+    s_cmds     = at_stats.cmds;
+    s_errors   = at_stats.errors;
+
+    /*--------------------------------------------------------
+    Seed the jitter from the unique id so that devices
+    which lost the same access point retry at different
+    times
+    --------------------------------------------------------*/
+    uid    = (const uint32_t *)LINK_UID_ADDR;
+    s_rand = uid[ 0 ] ^ uid[ 1 ] ^ uid[ 2 ] ^ timer_get_ticks();
+    if( s_rand == 0 )
+    {
+        s_rand = 1;
+    }
+
+    /* Release the reset pin, the module pulls it up        */
+    RCC_APB2PeriphClockCmd( RCC_APB2Periph_GPIOA, ENABLE );
+    GPIO_SetBits( LINK_RST_GPIO, LINK_RST_PIN );
+    GPIO_InitStructure.GPIO_Pin = LINK_RST_PIN;
+    GPIO_InitStructure.GPIO_Speed = GPIO_Speed_2MHz;
+    GPIO_InitStructure.GPIO_Mode = GPIO_Mode_Out_OD;
+    GPIO_Init( LINK_RST_GPIO, &GPIO_InitStructure );
+
+    esp_at_add_urc_handler( link_urc );
+}
+
+
+/*--------------------------------------------------------
+Probe the link and run the recovery steps. Call this from
+the main loop after esp_at_poll() and before net_poll().
+--------------------------------------------------------*/
+void esp_link_poll( void )
+{
+    esp_at_stats_type   at_stats;   /* AT engine statistics         */
+
+    switch( s_state )
+    {
+        case LINK_UP:
+            /*--------------------------------------------------------
+            A module that stops answering commands is as good as
+            disconnected
+            --------------------------------------------------------*/
+            esp_at_get_stats( &at_stats );
+            if( (uint16_t)( at_stats.timeouts - s_timeouts ) >= LINK_STALL_TIMEOUTS )
+            {
+                s_timeouts = at_stats.timeouts;
+                link_lost();
+                break;
+            }
+
+            /*--------------------------------------------------------
+            Commands that ran without an error show the module is
+            working, the probe waits for a quiet period
+            --------------------------------------------------------*/
+            if( at_stats.cmds != s_cmds && at_stats.errors == s_errors )
+            {
+                s_due = timer_get_ticks() + s_cfg.probe_period;
+            }
+            s_cmds   = at_stats.cmds;
+            s_errors = at_stats.errors;
+
+            if( timer_expired( s_due )
+             && esp_at_cmd( "AT+CWJAP?", ESP_AT_TIMEOUT_DFLT, link_probe_done, NULL ) )
+            {
+                s_stats.probes++;
+                s_state = LINK_PROBE;
+            }
+            break;
+
+        case LINK_BACKOFF:
+            if( timer_expired( s_due ) )
+            {
+                link_recover();
+            }
+            break;
+
+        case LINK_PIN:
+            if( timer_expired( s_due ) )
+            {
+                GPIO_SetBits( LINK_RST_GPIO, LINK_RST_PIN );
+                s_state = LINK_BOOT;
+                s_due   = timer_get_ticks() + LINK_BOOT_TIMEOUT;
+            }
+            break;
+
+        case LINK_BOOT:
+            if( s_ready )
+            {
+                link_join();
+            }
+            else if( timer_expired( s_due ) )
+            {
+                link_fail();
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+/*--------------------------------------------------------
+Check if the Wi-Fi link is usable
+--------------------------------------------------------*/
+bool esp_link_up( void )
+{
+    return ( s_state == LINK_UP || s_state == LINK_PROBE );
+}
+
+
+/*--------------------------------------------------------
+Get a copy of the supervisor statistics
+--------------------------------------------------------*/
+void esp_link_get_stats( esp_link_stats_type *stats )
+{
+    *stats = s_stats;
+}
+
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Delay before a recovery attempt: doubles per attempt up to
+the limit, then a random amount of up to half of it is
+taken off
+--------------------------------------------------------*/
+static timer_ticks_t link_backoff( uint8_t attempt )
+{
+    timer_ticks_t       delay;      /* delay without jitter         */
+
+    delay = s_cfg.backoff_min;
+    while( attempt-- > 0 && delay < s_cfg.backoff_max )
+    {
+        delay <<= 1;
+    }
+
+    if( delay > s_cfg.backoff_max )
+    {
+        delay = s_cfg.backoff_max;
+    }
+
+    return delay - link_rand() % ( delay / 2 + 1 );
+}
+
+
+/*--------------------------------------------------------
+AT+CWJAP_CUR or AT+RST finished
+--------------------------------------------------------*/
+static void link_cmd_done( esp_at_result_type result, void *ctx )
+{
+    (void)ctx;
+
+    if( s_state == LINK_JOIN )
+    {
+        if( result == ESP_AT_OK )
+        {
+            link_restored();
+        }
+        else
+        {
+            link_fail();
+        }
+    }
+    else if( s_state == LINK_RESET )
+    {
+        /*--------------------------------------------------------
+        The module may reboot before it gets to say OK
+        --------------------------------------------------------*/
+        s_state = LINK_BOOT;
+        s_due   = timer_get_ticks() + LINK_BOOT_TIMEOUT;
+    }
+}
+
+
+/*--------------------------------------------------------
+A recovery attempt failed, wait before the next one
+--------------------------------------------------------*/
+static void link_fail( void )
+{
+    if( s_attempt < UINT8_MAX )
+    {
+        s_attempt++;
+    }
+
+    s_state = LINK_BACKOFF;
+    s_due   = timer_get_ticks() + link_backoff( s_attempt );
+}
+
+
+/*--------------------------------------------------------
+Rejoin the access point
+--------------------------------------------------------*/
+static void link_join( void )
+{
+    char                cmd[ LINK_CMD_SZ ];
+                                    /* AT command string            */
+
+    snprintf( cmd, sizeof( cmd ), "AT+CWJAP_CUR=\"%s\",\"%s\"",
+              s_cfg.ssid, s_cfg.pass );
+    if( esp_at_cmd( cmd, LINK_JOIN_TIMEOUT, link_cmd_done, NULL ) )
+    {
+        s_stats.rejoins++;
+        s_state = LINK_JOIN;
+    }
+}
+
+
+/*--------------------------------------------------------
+The link is gone. The first attempt waits a short while
+as the module usually rejoins on its own.
+--------------------------------------------------------*/
+static void link_lost( void )
+{
+    if( !esp_link_up() )
+    {
+        return;
+    }
+
+    s_stats.outages++;
+    s_down_at = timer_get_ticks();
+    s_attempt = 0;
+    s_state   = LINK_BACKOFF;
+    s_due     = s_down_at + link_backoff( 0 );
+
+    net_set_link( false );
+    logbuf_printf( "link lost" );
+}
+
+
+/*--------------------------------------------------------
+AT+CWJAP? finished. A timeout is left to the stall check.
+--------------------------------------------------------*/
+static void link_probe_done( esp_at_result_type result, void *ctx )
+{
+    esp_at_stats_type   at_stats;   /* AT engine statistics         */
+
+    (void)ctx;
+
+    if( s_state != LINK_PROBE )
+    {
+        return;
+    }
+
+    s_state = LINK_UP;
+    s_due   = timer_get_ticks() + s_cfg.probe_period;
+
+    if( result == ESP_AT_ERROR
+     || ( result == ESP_AT_OK && strncmp( esp_at_info(), "+CWJAP:", 7 ) != 0 ) )
+    {
+        s_stats.probe_fails++;
+        link_lost();
+    }
+    else if( result == ESP_AT_OK )
+    {
+        /* The module answers, earlier timeouts were not a stall */
+        s_stats.probe_oks++;
+        esp_at_get_stats( &at_stats );
+        s_timeouts = at_stats.timeouts;
+    }
+}
+
+
+/*--------------------------------------------------------
+xorshift32 pseudo random numbers for the jitter
+--------------------------------------------------------*/
+static uint32_t link_rand( void )
+{
+    s_rand ^= s_rand << 13;
+    s_rand ^= s_rand >> 17;
+    s_rand ^= s_rand << 5;
+
+    return s_rand;
+}
+
+
+/*--------------------------------------------------------
+Run the recovery step for the current attempt: rejoin,
+then AT+RST, then the reset pin. A reset is followed by a
+rejoin right away, failing that escalates further.
+--------------------------------------------------------*/
+static void link_recover( void )
+{
+    if( s_attempt < LINK_JOIN_TRIES )
+    {
+        link_join();
+    }
+    else if( s_attempt < LINK_JOIN_TRIES + LINK_SOFT_TRIES )
+    {
+        s_ready = false;
+        if( esp_at_cmd( "AT+RST", ESP_AT_TIMEOUT_DFLT, link_cmd_done, NULL ) )
+        {
+            s_stats.soft_resets++;
+            s_state = LINK_RESET;
+        }
+    }
+    else
+    {
+        s_ready = false;
+        GPIO_ResetBits( LINK_RST_GPIO, LINK_RST_PIN );
+        s_stats.hard_resets++;
+        s_state = LINK_PIN;
+        s_due   = timer_get_ticks() + LINK_RST_TICKS;
+    }
+}
+
+
+/*--------------------------------------------------------
+The link is back, measure how long it was gone
+--------------------------------------------------------*/
+static void link_restored( void )
+{
+    esp_at_stats_type   at_stats;   /* AT engine statistics         */
+    uint32_t            took;       /* reconnect time, ms           */
+
+    if( esp_link_up() )
+    {
+        return;
+    }
+
+    took = timer_get_ticks() - s_down_at;
+    logbuf_printf( "link up after %lu ms", (unsigned long)took );
+    s_stats.reconnects++;
+    s_stats.reconnect_last   = took;
+    s_stats.reconnect_total += took;
+    if( took > s_stats.reconnect_max )
+    {
+        s_stats.reconnect_max = took;
+    }
+
+    esp_at_get_stats( &at_stats );
+    s_timeouts = at_stats.timeouts;
+    s_attempt  = 0;
+    s_state    = LINK_UP;
+    s_due      = timer_get_ticks() + s_cfg.probe_period;
+
+    net_set_link( true );
+}
+
+
+/*--------------------------------------------------------
+Unsolicited Wi-Fi state lines
+--------------------------------------------------------*/
+static void link_urc( const char *line )
+{
+    if( strcmp( line, "WIFI DISCONNECT" ) == 0 )
+    {
+        link_lost();
+    }
+    else if( strcmp( line, "WIFI GOT IP" ) == 0 )
+    {
+        link_restored();
+    }
+    else if( strcmp( line, "ready" ) == 0 )
+    {
+        s_ready = true;
+    }
+}
@@ -0,0 +1,304 @@
+/*----------------------------------------------------------------------
+                            INCLUDES
+----------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "defer.h"
+#include "esp_uart.h"
+#include "esp_ipd.h"
+
+/*----------------------------------------------------------------------
+                            CONSTANTS
+----------------------------------------------------------------------*/
+
+#define ESP_TX_DMA      DMA1_Channel7
+                                    /* DMA channel for USART2_TX    */
+#define ESP_TX_DMA_TC   DMA1_FLAG_TC7
+                                    /* transfer complete flag       */
+#define ESP_RX_RING_SZ  256         /* bytes held for the parser,   */
+                                    /* power of 2                   */
+
+/*----------------------------------------------------------------------
+                            VARIABLES
+----------------------------------------------------------------------*/
+
+static bool             s_tx_dma_active;
+                                    /* DMA transfer in progress     */
+static uint8_t          s_rx_ring[ ESP_RX_RING_SZ ];
+                                    /* received, not yet parsed     */
+static volatile uint16_t s_rx_head; /* next byte to write (ISR)     */
+static volatile uint16_t s_rx_tail; /* next byte to parse           */
+static volatile uint16_t s_rx_drops;/* bytes lost, ring was full    */
+static defer_work_type  s_rx_work;  /* parser run from PendSV       */
+
+/*----------------------------------------------------------------------
+                            PROCEDURES
+----------------------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+static void esp_uart_rx_work( void );
+static void esp_uart_setup_dma( void );
+static void esp_uart_setup_gpio( void );
+static void esp_uart_setup_irq( void );
+static void esp_uart_setup_periph( uint32_t baud_rate );
+
+
+/*--------------------------------------------------------
+Initialize UART 2.
+NOTE: uart_init() must be called first, it sets up the
+system clocks and the NVIC priority grouping.
+--------------------------------------------------------*/
+void esp_uart_init( uint32_t baud_rate )
+{
+    esp_ipd_init();
+
+    s_rx_head  = 0;
+    s_rx_tail  = 0;
+    s_rx_drops = 0;
+    defer_setup( &s_rx_work, esp_uart_rx_work, DEFER_PRIO_HIGH );
+
+    /* Enable USART2 and GPIOA clock                    	*/
+    RCC_APB1PeriphClockCmd( RCC_APB1Periph_USART2, ENABLE );
+    RCC_APB2PeriphClockCmd( RCC_APB2Periph_GPIOA, ENABLE );
+
+    esp_uart_setup_gpio();
+    esp_uart_setup_periph( baud_rate );
+    esp_uart_setup_dma();
+    esp_uart_setup_irq();
+}
+
+
+/*--------------------------------------------------------
+Transmit buffer data out UART 2.
+This has a signature similar to write() of unistd.h.
+NOTE: this function blocks until all data has been
+transmitted.
+--------------------------------------------------------*/
+uint16_t esp_uart_write( const void *buf, uint16_t bytes )
+{
+    uint16_t            i;          /* loop counter                 */
+
+    /*--------------------------------------------------------
+    Let a pending DMA transfer finish before writing
+    --------------------------------------------------------*/
+    while( esp_uart_tx_busy() );
+
+    for( i = 0; i < bytes; i++ )
+    {
+        esp_uart_write_byte( *( (const uint8_t *)buf + i ) );
+    }
+
+    return bytes;
+}
+
+
+/*--------------------------------------------------------
+Write a single byte out UART 2
+--------------------------------------------------------*/
+void esp_uart_write_byte( uint8_t byte )
+{
+    /*--------------------------------------------------------
+    Block waiting for the TX data register to become empty
+    --------------------------------------------------------*/
+    while( USART_GetFlagStatus( USART2, USART_FLAG_TXE ) == RESET );
+
+    USART_SendData( USART2, byte );
+}
+
+
+/*--------------------------------------------------------
+Write an AT command terminated with CR LF.
+Note: the string must be null terminated.
+--------------------------------------------------------*/
+void esp_uart_write_cmd( const char *cmd )
+{
+    esp_uart_write( cmd, strlen( cmd ) );
+    esp_uart_write_byte( '\r' );
+    esp_uart_write_byte( '\n' );
+}
+
+
+/*--------------------------------------------------------
+Start a DMA transfer of buffer data out UART 2. Returns
+false if the previous transfer is still in progress.
+--------------------------------------------------------*/
+bool esp_uart_write_dma( const void *buf, uint16_t bytes )
+{
+    if( esp_uart_tx_busy() )
+    {
+        return false;
+    }
+
+    if( bytes == 0 )
+    {
+        return true;
+    }
+
+    DMA_Cmd( ESP_TX_DMA, DISABLE );
+    ESP_TX_DMA->CMAR = (uint32_t)buf;
+    DMA_SetCurrDataCounter( ESP_TX_DMA, bytes );
+    DMA_ClearFlag( ESP_TX_DMA_TC );
+    s_tx_dma_active = true;
+    DMA_Cmd( ESP_TX_DMA, ENABLE );
+
+    return true;
+}
+
+
+/*--------------------------------------------------------
+Check if a DMA transfer out UART 2 is still in progress
+--------------------------------------------------------*/
+bool esp_uart_tx_busy( void )
+{
+    if( s_tx_dma_active && DMA_GetFlagStatus( ESP_TX_DMA_TC ) != RESET )
+    {
+        DMA_ClearFlag( ESP_TX_DMA_TC );
+        DMA_Cmd( ESP_TX_DMA, DISABLE );
+        s_tx_dma_active = false;
+    }
+
+    return s_tx_dma_active;
+}
+
+
+/*--------------------------------------------------------
+Bytes lost because the parser fell a ring behind
+--------------------------------------------------------*/
+uint16_t esp_uart_rx_drops( void )
+{
+    return s_rx_drops;
+}
+
+
+/*--------------------------------------------------------
+UART 2 interrupt service routine.
+Only the data register is read here; the +IPD parser
+runs as deferred work (defer.h), so a long payload does
+not hold off other interrupts byte after byte.
+--------------------------------------------------------*/
+void USART2_IRQHandler( void )
+{
+    uint8_t             byte;       /* received byte                */
+
+    if( USART_GetITStatus( USART2, USART_IT_RXNE ) != RESET )
+    {
+        byte = (uint8_t)USART_ReceiveData( USART2 );
+
+        if( (uint16_t)( s_rx_head - s_rx_tail ) < ESP_RX_RING_SZ )
+        {
+            s_rx_ring[ s_rx_head % ESP_RX_RING_SZ ] = byte;
+            s_rx_head++;
+        }
+        else
+        {
+            s_rx_drops++;
+        }
+
+        defer_queue( &s_rx_work );
+    }
+}
+
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Feed the received bytes to the parser, from PendSV
+--------------------------------------------------------*/
+static void esp_uart_rx_work( void )
+{
+    while( s_rx_tail != s_rx_head )
+    {
+        esp_ipd_feed( s_rx_ring[ s_rx_tail % ESP_RX_RING_SZ ] );
+        s_rx_tail++;
+    }
+}
+
+
+/*--------------------------------------------------------
+Setup the UART 2 TX DMA channel. The memory address and
+count are filled in for each transfer.
+--------------------------------------------------------*/
+static void esp_uart_setup_dma( void )
+{
+    DMA_InitTypeDef     DMA_InitStructure;
+
+    RCC_AHBPeriphClockCmd( RCC_AHBPeriph_DMA1, ENABLE );
+
+    DMA_DeInit( ESP_TX_DMA );
+    DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)&USART2->DR;
+    DMA_InitStructure.DMA_MemoryBaseAddr = 0;
+    DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralDST;
+    DMA_InitStructure.DMA_BufferSize = 1;
+    DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+    DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+    DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+    DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+    DMA_InitStructure.DMA_Mode = DMA_Mode_Normal;
+    DMA_InitStructure.DMA_Priority = DMA_Priority_Medium;
+    DMA_InitStructure.DMA_M2M = DMA_M2M_Disable;
+    DMA_Init( ESP_TX_DMA, &DMA_InitStructure );
+
+    USART_DMACmd( USART2, USART_DMAReq_Tx, ENABLE );
+    s_tx_dma_active = false;
+}
+
+
+/*--------------------------------------------------------
+Setup UART 2 input/output pins
+--------------------------------------------------------*/
+static void esp_uart_setup_gpio( void )
+{
+    GPIO_InitTypeDef    GPIO_InitStructure;
+
+    /* Configure USART2 Rx (PA3) as input floating          */
+    GPIO_InitStructure.GPIO_Pin = GPIO_Pin_3;
+    GPIO_InitStructure.GPIO_Mode = GPIO_Mode_IN_FLOATING;
+    GPIO_Init( GPIOA, &GPIO_InitStructure );
+
+    /* Configure USART2 Tx (PA2) as alternate function push-pull */
+    GPIO_InitStructure.GPIO_Pin = GPIO_Pin_2;
+    GPIO_InitStructure.GPIO_Speed = GPIO_Speed_50MHz;
+    GPIO_InitStructure.GPIO_Mode = GPIO_Mode_AF_PP;
+    GPIO_Init( GPIOA, &GPIO_InitStructure );
+}
+
+
+/*--------------------------------------------------------
+Setup UART 2 RX interrupt
+--------------------------------------------------------*/
+static void esp_uart_setup_irq( void )
+{
+    NVIC_InitTypeDef    NVIC_InitStructure;
+
+    USART_ITConfig( USART2, USART_IT_RXNE, ENABLE );
+
+    /* Enable the USART 2 Interrupt 						*/
+    NVIC_InitStructure.NVIC_IRQChannel = USART2_IRQn;
+    NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 0;
+    NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
+    NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+    NVIC_Init( &NVIC_InitStructure );
+}
+
+
+/*--------------------------------------------------------
+Configure UART 2 for the ESP8266, 8N1 without flow control
+--------------------------------------------------------*/
+static void esp_uart_setup_periph( uint32_t baud_rate )
+{
+    USART_InitTypeDef   USART_InitStructure;
+
+    USART_InitStructure.USART_BaudRate = baud_rate;
+    USART_InitStructure.USART_WordLength = USART_WordLength_8b;
+    USART_InitStructure.USART_StopBits = USART_StopBits_1;
+    USART_InitStructure.USART_Parity = USART_Parity_No;
+    USART_InitStructure.USART_HardwareFlowControl = USART_HardwareFlowControl_None;
+    USART_InitStructure.USART_Mode = USART_Mode_Rx | USART_Mode_Tx;
+    USART_Init( USART2, &USART_InitStructure );
+    USART_Cmd( USART2, ENABLE );
+}
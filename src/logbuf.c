@@ -0,0 +1,344 @@
+/*----------------------------------------------------------------------
+                            INCLUDES
+----------------------------------------------------------------------*/
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "stm32f10x.h"
+
+#include "logbuf.h"
+#include "diag.h"
+#include "proto.h"
+#include "shell.h"
+#include "telem_wire.h"
+#include "timer.h"
+
+/*----------------------------------------------------------------------
+                            TYPES
+----------------------------------------------------------------------*/
+
+typedef struct                      /* readout in progress          */
+{
+    bool                active;     /* frames still to send         */
+    uint8_t             seq;        /* sequence number of LOG_OPEN  */
+    uint8_t             source;     /* PROTO_LOG_SRC_...            */
+    uint32_t            addr;       /* memory range start           */
+    uint32_t            len;        /* memory range length          */
+    uint32_t            next;       /* next offset to send          */
+    uint32_t            limit;      /* host credit, offset          */
+    timer_ticks_t       idle_at;    /* end if no credit by then     */
+} logbuf_stream_type;
+
+/*----------------------------------------------------------------------
+                            VARIABLES
+----------------------------------------------------------------------*/
+
+static uint8_t          s_ring[ LOGBUF_SZ ];
+                                    /* log text                     */
+static volatile uint32_t
+                        s_end;      /* bytes logged since reset     */
+static logbuf_stream_type
+                        s_stream;   /* readout in progress          */
+
+/*----------------------------------------------------------------------
+                            PROCEDURES
+----------------------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+static void logbuf_credit( const proto_frame_type *frame );
+static void logbuf_end( uint8_t status, uint32_t end );
+static void logbuf_open( const proto_frame_type *frame );
+static int8_t logbuf_shell( shell_ctx_type *ctx, uint8_t argc, char *argv[] );
+
+SHELL_CMD( "log", "[text], log a line or show the log offsets", logbuf_shell );
+
+
+/*--------------------------------------------------------
+Register the readout messages
+--------------------------------------------------------*/
+void logbuf_init( void )
+{
+    memset( &s_stream, 0, sizeof( s_stream ) );
+
+    proto_register( PROTO_T_LOG_OPEN, logbuf_open );
+    proto_register( PROTO_T_LOG_CREDIT, logbuf_credit );
+}
+
+
+/*--------------------------------------------------------
+Send the next frame of the readout, if the host has
+credit for it. Call this from the main loop.
+--------------------------------------------------------*/
+void logbuf_poll( void )
+{
+    uint8_t            *p;          /* LOG_DATA payload             */
+    uint32_t            end;        /* end of the stream            */
+    uint32_t            oldest;     /* oldest offset in the ring    */
+    uint32_t            pos;        /* ring index                   */
+    uint16_t            len;        /* bytes in this frame          */
+    uint16_t            first;      /* bytes before the ring wraps  */
+
+    if( !s_stream.active )
+    {
+        return;
+    }
+
+    if( s_stream.source == PROTO_LOG_SRC_RING )
+    {
+        end    = s_end;
+        oldest = ( end > LOGBUF_SZ ) ? end - LOGBUF_SZ : 0;
+        if( s_stream.next < oldest )
+        {
+            logbuf_end( PROTO_ST_GONE, oldest );
+            return;
+        }
+    }
+    else
+    {
+        end = s_stream.len;
+    }
+
+    if( s_stream.next >= end )
+    {
+        logbuf_end( PROTO_ST_OK, end );
+        return;
+    }
+
+    if( (int32_t)( s_stream.limit - s_stream.next ) <= 0 )
+    {
+        if( timer_expired( s_stream.idle_at ) )
+        {
+            logbuf_end( PROTO_ST_BUSY, s_stream.next );
+        }
+        return;
+    }
+
+    len = PROTO_LOG_CHUNK;
+    if( end - s_stream.next < len )
+    {
+        len = (uint16_t)( end - s_stream.next );
+    }
+    if( s_stream.limit - s_stream.next < len )
+    {
+        len = (uint16_t)( s_stream.limit - s_stream.next );
+    }
+
+    p = proto_tx_payload();
+    telem_put_u32( p, s_stream.next );
+    if( s_stream.source == PROTO_LOG_SRC_RING )
+    {
+        /*--------------------------------------------------------
+        Check and copy with interrupts off, so a line logged
+        from an interrupt since the check above can not have
+        overwritten the bytes or do so half way through
+        --------------------------------------------------------*/
+        __disable_irq();
+        oldest = ( s_end > LOGBUF_SZ ) ? s_end - LOGBUF_SZ : 0;
+        if( s_stream.next < oldest )
+        {
+            __enable_irq();
+            logbuf_end( PROTO_ST_GONE, oldest );
+            return;
+        }
+        pos   = s_stream.next % LOGBUF_SZ;
+        first = ( LOGBUF_SZ - pos < len ) ? (uint16_t)( LOGBUF_SZ - pos ) : len;
+        memcpy( &p[ 4 ], &s_ring[ pos ], first );
+        memcpy( &p[ 4 + first ], s_ring, len - first );
+        __enable_irq();
+    }
+    else
+    {
+        memcpy( &p[ 4 ], (const void *)( s_stream.addr + s_stream.next ), len );
+    }
+
+    proto_send( PROTO_T_LOG_DATA, 0, s_stream.seq, p, 4 + len );
+    s_stream.next += len;
+}
+
+
+/*--------------------------------------------------------
+Add bytes to the log ring. May be called from interrupts.
+--------------------------------------------------------*/
+void logbuf_write( const void *data, uint16_t len )
+{
+    const uint8_t      *src;        /* next byte to copy            */
+    uint32_t            primask;    /* interrupt state to restore   */
+    uint32_t            end;        /* ring end                     */
+
+    src = data;
+    if( len > LOGBUF_SZ )
+    {
+        src += len - LOGBUF_SZ;
+        len  = LOGBUF_SZ;
+    }
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    end = s_end;
+    while( len-- > 0 )
+    {
+        s_ring[ end++ % LOGBUF_SZ ] = *src++;
+    }
+    s_end = end;
+    __set_PRIMASK( primask );
+}
+
+
+/*--------------------------------------------------------
+Log one line, stamped with the tick count. Longer lines
+are cut to LOGBUF_LINE_MAX.
+--------------------------------------------------------*/
+void logbuf_printf( const char *fmt, ... )
+{
+    char                line[ LOGBUF_LINE_MAX ];
+                                    /* formatted line               */
+    va_list             args;       /* format arguments             */
+    int                 len;        /* stamp length                 */
+    int                 n;          /* text length                  */
+
+    len = snprintf( line, sizeof( line ), "%lu ",
+                    (unsigned long)timer_get_ticks() );
+
+    va_start( args, fmt );
+    n = vsnprintf( &line[ len ], sizeof( line ) - len - 1, fmt, args );
+    va_end( args );
+
+    if( n < 0 )
+    {
+        return;
+    }
+    len += n;
+    if( len > (int)sizeof( line ) - 2 )
+    {
+        len = sizeof( line ) - 2;
+    }
+    line[ len++ ] = '\n';
+
+    logbuf_write( line, (uint16_t)len );
+}
+
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+
+/*--------------------------------------------------------
+New credit from the host; a stale grant, older than one
+that already arrived, does not take credit back
+--------------------------------------------------------*/
+static void logbuf_credit( const proto_frame_type *frame )
+{
+    uint32_t            limit;      /* new limit offset             */
+
+    if( !s_stream.active || frame->seq != s_stream.seq || frame->len != 4 )
+    {
+        return;
+    }
+
+    limit = telem_get_u32( frame->payload );
+    if( (int32_t)( limit - s_stream.limit ) > 0 )
+    {
+        s_stream.limit   = limit;
+        s_stream.idle_at = timer_get_ticks() + PROTO_LOG_IDLE_MS;
+    }
+}
+
+
+/*--------------------------------------------------------
+Finish the readout
+--------------------------------------------------------*/
+static void logbuf_end( uint8_t status, uint32_t end )
+{
+    uint8_t             reply[ PROTO_LOG_END_SZ ];
+                                    /* LOG_END payload              */
+
+    reply[ 0 ] = status;
+    telem_put_u32( &reply[ 1 ], end );
+    s_stream.active = false;
+    proto_reply( PROTO_T_LOG_END, s_stream.seq, reply, sizeof( reply ) );
+}
+
+
+/*--------------------------------------------------------
+Start a readout, ending the one before it
+--------------------------------------------------------*/
+static void logbuf_open( const proto_frame_type *frame )
+{
+    uint8_t             status;     /* reply status                 */
+    uint8_t             source;     /* PROTO_LOG_SRC_...            */
+    uint32_t            addr;       /* memory range start           */
+    uint32_t            len;        /* memory range length          */
+
+    if( s_stream.active )
+    {
+        logbuf_end( PROTO_ST_FAIL, s_stream.next );
+    }
+
+    source = ( frame->len >= 1 ) ? frame->payload[ 0 ] : 0xFF;
+    addr   = 0;
+    len    = 0;
+    status = PROTO_ST_OK;
+    if( source == PROTO_LOG_SRC_RING && frame->len == PROTO_LOG_OPEN_SZ )
+    {
+        /* offsets beyond the end are checked when sending */
+    }
+    else if( source == PROTO_LOG_SRC_MEM && frame->len == PROTO_LOG_OPEN_SZ + 8 )
+    {
+        addr = telem_get_u32( &frame->payload[ PROTO_LOG_OPEN_SZ ] );
+        len  = telem_get_u32( &frame->payload[ PROTO_LOG_OPEN_SZ + 4 ] );
+        if( !diag_readable( addr, len ) )
+        {
+            status = PROTO_ST_BAD_ADDR;
+        }
+    }
+    else
+    {
+        status = PROTO_ST_BAD_LEN;
+    }
+
+    if( status != PROTO_ST_OK )
+    {
+        proto_reply( PROTO_T_STATUS, frame->seq, &status, 1 );
+        return;
+    }
+
+    s_stream.seq     = frame->seq;
+    s_stream.source  = source;
+    s_stream.addr    = addr;
+    s_stream.len     = len;
+    s_stream.next    = telem_get_u32( &frame->payload[ 1 ] );
+    s_stream.limit   = telem_get_u32( &frame->payload[ 5 ] );
+    s_stream.idle_at = timer_get_ticks() + PROTO_LOG_IDLE_MS;
+    s_stream.active  = true;
+}
+
+
+/*--------------------------------------------------------
+Shell command: log a line, or show the ring's offsets
+--------------------------------------------------------*/
+static int8_t logbuf_shell( shell_ctx_type *ctx, uint8_t argc, char *argv[] )
+{
+    uint32_t            end;        /* bytes logged                 */
+
+    (void)ctx;
+    if( argc == 2 )
+    {
+        logbuf_printf( "%s", argv[ 1 ] );
+        return SHELL_DONE;
+    }
+    if( argc != 1 )
+    {
+        return SHELL_USAGE;
+    }
+
+    end = s_end;
+    shell_printf( "offsets %lu..%lu\n",
+                  (unsigned long)( ( end > LOGBUF_SZ ) ? end - LOGBUF_SZ : 0 ),
+                  (unsigned long)end );
+    return SHELL_DONE;
+}
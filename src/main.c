@@ -8,6 +8,25 @@
 #include "timer.h"
 #include "led.h"
 #include "uart_print.h"
+#include "esp_uart.h"
+#include "esp_at.h"
+#include "async.h"
+#include "bench.h"
+#include "bridge.h"
+#include "clksync.h"
+#include "conn.h"
+#include "defer.h"
+#include "diag.h"
+#include "esp_link.h"
+#include "logbuf.h"
+#include "metrics.h"
+#include "mqtt.h"
+#include "net.h"
+#include "ota.h"
+#include "proto.h"
+#include "shell.h"
+#include "telemetry.h"
+#include "vect.h"
 
 /*----------------------------------------------------------------------
                             CONSTANTS
@@ -15,8 +34,56 @@
 
 #define LED_ON_PERCENT	50			/* LED blink percentage 		*/
 #define BLINK_ON_TICKS  ( TIMER_FREQUENCY_HZ * LED_ON_PERCENT / 100 )
-#define BLINK_OFF_TICKS ( TIMER_FREQUENCY_HZ - BLINK_ON_TICKS )
 #define UART1_BAUD_RATE 115200      /* baud rate for UART 1 data    */
+#define ESP_BAUD_RATE   115200      /* baud rate for ESP8266 UART 2 */
+
+/*--------------------------------------------------------
+Access point the ESP8266 rejoins after an outage, and how
+the link supervisor paces its probes and retries
+--------------------------------------------------------*/
+#define WIFI_SSID       "scalog"
+#define WIFI_PASS       "scalog-pass"
+#define WIFI_PROBE_MS   30000       /* probe a quiet link, ms       */
+#define WIFI_BACKOFF_MIN 1000       /* first retry delay, ms        */
+#define WIFI_BACKOFF_MAX 60000      /* longest retry delay, ms      */
+
+/*--------------------------------------------------------
+A freshly installed OTA image is kept once it has run this
+long with the Wi-Fi link probed good (or, as a bridge, the
+TCP connection up). A reset before then costs it a try and
+the bootloader rolls back when the tries run out.
+--------------------------------------------------------*/
+#define OTA_TRIAL_MS    10000       /* run time before confirming   */
+
+/*--------------------------------------------------------
+Broker the MQTT client connects to at start, when built
+with MQTT_ENABLE (mqtt.h)
+--------------------------------------------------------*/
+#define MQTT_HOST       "192.168.1.10"
+                                    /* broker address               */
+#define MQTT_PORT       1883        /* broker port                  */
+#define MQTT_CLIENT_ID  "scalog"    /* client identifier            */
+
+/*--------------------------------------------------------
+Collector the telemetry uplink sends to, when built with
+TELEM_ENABLE (telemetry.h). Modules queue their records
+with telem_put().
+--------------------------------------------------------*/
+#define TELEM_HOST      "192.168.1.10"
+                                    /* collector address            */
+#define TELEM_PORT      5001        /* collector UDP port           */
+#define TELEM_DEVICE_ID 1           /* id in every datagram         */
+#define TELEM_WINDOW_MS 1000        /* batching window, ms          */
+
+/*--------------------------------------------------------
+TCP server a BRIDGE_ENABLE build (bridge.h) bridges UART 1
+to. The ESP8266 must already be joined to the access point.
+--------------------------------------------------------*/
+#define BRIDGE_HOST     "192.168.1.10"
+                                    /* TCP server to bridge to      */
+#define BRIDGE_PORT     5000        /* TCP server port              */
+#define BRIDGE_FLUSH_SZ 256         /* send after this many bytes   */
+#define BRIDGE_IDLE_MS  5           /* send after console idle, ms  */
 
 
 #pragma GCC diagnostic ignored "-Wunused-parameter"
@@ -31,46 +98,167 @@ int main( int argc, char* argv[] )
     /*--------------------------------------------------------
     Local variables
     --------------------------------------------------------*/
-    uint16_t            bytes_read; /* number of UART bytes read    */
-    char                uart_rx_data[ 20 ];
-                                    /* UART RX data buffer          */
-    char                uart_tx_data[ 20 ];
-                                    /* UART TX data buffer          */
+#if( BRIDGE_ENABLE )
+    bridge_cfg_type     bridge_cfg; /* bridge configuration         */
+#else
+    esp_link_cfg_type   link_cfg;   /* link supervisor settings     */
+    esp_link_stats_type link_stats; /* link supervisor statistics   */
+#if( CONN_ENABLE )
+    conn_cfg_type       conn_cfg;   /* connection pool settings     */
+#endif
+#if( MQTT_ENABLE )
+    mqtt_cfg_type       mqtt_cfg;   /* MQTT broker connection       */
+#endif
+#endif
+    bool                confirmed;  /* running image is confirmed   */
 
     /*--------------------------------------------------------
     Initialization
     --------------------------------------------------------*/
+    vect_init();
     timer_start();
+    defer_init();
     led_init();
     uart_init( UART1_BAUD_RATE );
+    uart_stdio_init();
+    esp_uart_init( ESP_BAUD_RATE );
+    esp_at_init();
+    confirmed = false;
 
+#if( BRIDGE_ENABLE )
     /*--------------------------------------------------------
-    Forever loop
+    Bridge loop, never returns
     --------------------------------------------------------*/
-	while( 1 )
+    bridge_cfg.host       = BRIDGE_HOST;
+    bridge_cfg.port       = BRIDGE_PORT;
+    bridge_cfg.link       = 0;
+    bridge_cfg.flush_size = BRIDGE_FLUSH_SZ;
+    bridge_cfg.flush_idle = BRIDGE_IDLE_MS;
+    bridge_start( &bridge_cfg );
+
+    while( 1 )
     {
-		blink_led_on();
-        timer_sleep( BLINK_ON_TICKS );
-
-		blink_led_off();
-        timer_sleep( BLINK_OFF_TICKS );
-
-        /*--------------------------------------------------------
-        Attempt to read up to n bytes from the UART
-        --------------------------------------------------------*/
-        bytes_read = uart_read( &uart_rx_data, 15 );
-
-        /*--------------------------------------------------------
-        Null terminate data read
-        --------------------------------------------------------*/
-        uart_rx_data[ bytes_read ] = '\0';
-
-        /*--------------------------------------------------------
-        Reply message
-        --------------------------------------------------------*/
-        sprintf( uart_tx_data, "read %d bytes: %s", bytes_read, uart_rx_data );
-        uart_write_msg( uart_tx_data );
+        esp_at_poll();
+        bridge_poll();
+        async_poll();
+
+        if( !confirmed && bridge_connected()
+         && timer_get_ticks() >= OTA_TRIAL_MS )
+        {
+            ota_confirm();
+            confirmed = true;
+        }
+
+        if( timer_get_ticks() % TIMER_FREQUENCY_HZ < BLINK_ON_TICKS )
+        {
+            blink_led_on();
+        }
+        else
+        {
+            blink_led_off();
+        }
+    }
+#else
+
+    /*--------------------------------------------------------
+    Forever loop, serving the UART 1 control protocol and the
+    ESP8266 sockets. Left out of a bridge build so that the
+    linker drops the modules only it uses.
+    --------------------------------------------------------*/
+    net_init();
+    link_cfg.ssid         = WIFI_SSID;
+    link_cfg.pass         = WIFI_PASS;
+    link_cfg.probe_period = WIFI_PROBE_MS;
+    link_cfg.backoff_min  = WIFI_BACKOFF_MIN;
+    link_cfg.backoff_max  = WIFI_BACKOFF_MAX;
+    esp_link_init( &link_cfg );
+
+    proto_init();
+    diag_init();
+    clksync_init();
+    logbuf_init();
+    if( shell_init() != 0 )
+    {
+        /* shell still works, but each command is a table search */
+        fprintf( stderr, "shell: stale shell_table.h, commands searched\n" );
+        logbuf_printf( "shell: stale shell_table.h, commands searched" );
+    }
+#if( BENCH_ENABLE )
+    bench_init();
+#endif
+
+#if( CONN_ENABLE )
+    conn_cfg.dns_ttl   = CONN_DNS_TTL_DFLT;
+    conn_cfg.idle      = CONN_IDLE_DFLT;
+    conn_cfg.keepalive = CONN_KEEPALIVE_DFLT;
+    conn_init( &conn_cfg );
+#endif
+#if( MQTT_ENABLE )
+    mqtt_cfg.host      = MQTT_HOST;
+    mqtt_cfg.port      = MQTT_PORT;
+    mqtt_cfg.client_id = MQTT_CLIENT_ID;
+    mqtt_cfg.keepalive = MQTT_KEEPALIVE_DFLT;
+    mqtt_cfg.batch     = MQTT_BATCH_DFLT;
+    mqtt_init( &mqtt_cfg );
+#endif
+#if( TELEM_ENABLE )
+    telem_init( TELEM_HOST, TELEM_PORT, TELEM_DEVICE_ID, TELEM_WINDOW_MS );
+#endif
+#if( METRICS_ENABLE )
+    if( metrics_init( METRICS_PORT_DFLT, METRICS_PERIOD_DFLT ) != 0 )
+    {
+        logbuf_printf( "metrics: no server" );
+    }
+#endif
+
+    while( 1 )
+    {
+        esp_at_poll();
+        esp_link_poll();
+        net_poll();
+        ota_poll();
+#if( CONN_ENABLE )
+        conn_poll();
+#endif
+#if( MQTT_ENABLE )
+        mqtt_poll();
+#endif
+#if( TELEM_ENABLE )
+        telem_poll();
+#endif
+#if( METRICS_ENABLE )
+        metrics_poll();
+#endif
+
+        proto_poll();
+        diag_poll();
+        logbuf_poll();
+        shell_poll();
+#if( BENCH_ENABLE )
+        bench_poll();
+#endif
+        async_poll();
+
+        if( !confirmed && timer_get_ticks() >= OTA_TRIAL_MS )
+        {
+            esp_link_get_stats( &link_stats );
+            if( link_stats.probe_oks != 0 && esp_link_up() )
+            {
+                ota_confirm();
+                confirmed = true;
+            }
+        }
+
+        if( timer_get_ticks() % TIMER_FREQUENCY_HZ < BLINK_ON_TICKS )
+        {
+            blink_led_on();
+        }
+        else
+        {
+            blink_led_off();
+        }
     }
+#endif
 }
 
 
@@ -0,0 +1,519 @@
+/*----------------------------------------------------------------------
+                            INCLUDES
+----------------------------------------------------------------------*/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "defer.h"
+#include "esp_at.h"
+#include "esp_ipd.h"
+#include "esp_link.h"
+#include "metrics.h"
+#include "net.h"
+#include "proto.h"
+#include "shell.h"
+#include "uart_print.h"
+
+#if( METRICS_ENABLE )
+
+/*----------------------------------------------------------------------
+                            CONSTANTS
+----------------------------------------------------------------------*/
+
+#define METRICS_RX_SZ       64      /* socket receive buffer        */
+#define METRICS_TX_SZ       256     /* socket transmit buffer       */
+#define METRICS_HDR_SZ      96      /* room for the HTTP header     */
+#define METRICS_IDLE_MS     5000    /* wait for the request         */
+#define METRICS_READ_SZ     16      /* bytes read per net_recv()    */
+
+#if METRICS_HDR_SZ >= METRICS_TEXT_SZ
+#error "the snapshot must have room for a body"
+#endif
+
+/*----------------------------------------------------------------------
+                            TYPES
+----------------------------------------------------------------------*/
+
+typedef enum                        /* scrape client state          */
+{
+    METRICS_C_FREE,                 /* slot unused                  */
+    METRICS_C_REQUEST,              /* reading the request          */
+    METRICS_C_REPLY                 /* sending the snapshot         */
+} metrics_client_state_type;
+
+typedef struct                      /* scrape client                */
+{
+    metrics_client_state_type state;/* client state                 */
+    int8_t              sock;       /* accepted socket              */
+    uint8_t             newlines;   /* line ends in a row seen      */
+    uint16_t            pos;        /* next byte of the snapshot    */
+    timer_ticks_t       deadline;   /* request must be in by then   */
+} metrics_client_type;
+
+typedef void (*metrics_src_type)( void );
+                                    /* puts a group of metrics      */
+
+/*----------------------------------------------------------------------
+                            VARIABLES
+----------------------------------------------------------------------*/
+
+static char             s_text[ METRICS_TEXT_SZ ];
+                                    /* snapshot, the body from      */
+                                    /* s_text[ METRICS_HDR_SZ ]     */
+static uint16_t         s_start;    /* start of the HTTP header     */
+static uint16_t         s_len;      /* end of the body              */
+static bool             s_ready;    /* snapshot complete            */
+static uint8_t          s_readers;  /* clients sending it           */
+static bool             s_full;     /* a line did not fit           */
+static uint8_t          s_src;      /* next group to put, 0 if the  */
+                                    /* snapshot is not started      */
+static timer_ticks_t    s_period;   /* snapshot refresh, ms         */
+static timer_ticks_t    s_next_at;  /* next snapshot start          */
+static bool             s_started;  /* metrics_init() succeeded     */
+static metrics_client_type s_clients[ METRICS_CLIENT_CNT ];
+                                    /* scrapes in progress          */
+static metrics_stats_type s_stats;  /* endpoint statistics          */
+
+/*----------------------------------------------------------------------
+                            PROCEDURES
+----------------------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+static void metrics_build( void );
+static void metrics_client( metrics_client_type *c );
+static void metrics_put( const char *name, int8_t ch, uint32_t value );
+static void metrics_release( metrics_client_type *c );
+static int8_t metrics_shell( shell_ctx_type *ctx, uint8_t argc, char *argv[] );
+static void metrics_sock_cb( int8_t sock, uint8_t events, void *ctx );
+static void metrics_src_at( void );
+static void metrics_src_link( void );
+static void metrics_src_net( void );
+static void metrics_src_proto( void );
+static void metrics_src_sys( void );
+static void metrics_src_uart( void );
+
+SHELL_CMD( "metrics", "[port]", metrics_shell );
+
+/*--------------------------------------------------------
+Groups of metrics, one is put per metrics_poll()
+--------------------------------------------------------*/
+static const metrics_src_type s_sources[] =
+{
+    metrics_src_sys,
+    metrics_src_net,
+    metrics_src_at,
+    metrics_src_link,
+    metrics_src_proto,
+    metrics_src_uart
+};
+
+#define METRICS_SRC_CNT     ( sizeof( s_sources ) / sizeof( s_sources[ 0 ] ) )
+
+
+/*--------------------------------------------------------
+Start the server on a port, a snapshot is taken every
+period ms
+--------------------------------------------------------*/
+int8_t metrics_init( uint16_t port, timer_ticks_t period )
+{
+    int8_t              rc;         /* result                       */
+
+    rc = net_listen( port, METRICS_RX_SZ, METRICS_TX_SZ, metrics_sock_cb, NULL );
+    if( rc < 0 )
+    {
+        return rc;
+    }
+
+    s_period  = period;
+    s_next_at = timer_get_ticks();
+    s_started = true;
+    return 0;
+}
+
+
+/*--------------------------------------------------------
+Serve the scrapes and put the next group of metrics.
+Call this from the main loop after net_poll().
+--------------------------------------------------------*/
+void metrics_poll( void )
+{
+    uint8_t             i;          /* loop counter                 */
+
+    if( !s_started )
+    {
+        return;
+    }
+
+    for( i = 0; i < METRICS_CLIENT_CNT; i++ )
+    {
+        if( s_clients[ i ].state != METRICS_C_FREE )
+        {
+            metrics_client( &s_clients[ i ] );
+        }
+    }
+
+    metrics_build();
+}
+
+
+/*--------------------------------------------------------
+Get a copy of the endpoint statistics
+--------------------------------------------------------*/
+void metrics_get_stats( metrics_stats_type *stats )
+{
+    *stats = s_stats;
+}
+
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Put the next group of metrics in the snapshot. A new
+snapshot is started once the period is over and no
+scrape is sending the last one; the last group puts the
+HTTP header in front of the body.
+--------------------------------------------------------*/
+static void metrics_build( void )
+{
+    char                hdr[ METRICS_HDR_SZ ];
+                                    /* HTTP header                  */
+    int                 n;          /* header length                */
+
+    if( s_src == 0 )
+    {
+        if( !timer_expired( s_next_at ) || s_readers != 0 )
+        {
+            return;
+        }
+
+        s_next_at = timer_get_ticks() + s_period;
+        s_ready   = false;
+        s_len     = METRICS_HDR_SZ;
+        s_full    = false;
+    }
+
+    s_sources[ s_src++ ]();
+    if( s_src < METRICS_SRC_CNT )
+    {
+        return;
+    }
+
+    s_src = 0;
+    n = snprintf( hdr, sizeof( hdr ), "HTTP/1.0 200 OK\r\n"
+                  "Content-Type: text/plain; version=0.0.4\r\n"
+                  "Content-Length: %u\r\n\r\n", s_len - METRICS_HDR_SZ );
+    s_start = (uint16_t)( METRICS_HDR_SZ - n );
+    memcpy( &s_text[ s_start ], hdr, n );
+    s_ready = true;
+
+    s_stats.snapshots++;
+    s_stats.len = s_len - METRICS_HDR_SZ;
+    if( s_full )
+    {
+        s_stats.truncated++;
+    }
+}
+
+
+/*--------------------------------------------------------
+Read the request of a client and send it the snapshot.
+Any request gets it, once a blank line has ended the
+request header.
+--------------------------------------------------------*/
+static void metrics_client( metrics_client_type *c )
+{
+    uint8_t             buf[ METRICS_READ_SZ ];
+                                    /* request bytes                */
+    int16_t             n;          /* bytes read or sent           */
+    int16_t             i;          /* byte index                   */
+    uint16_t            room;       /* TX buffer space              */
+
+    if( c->state == METRICS_C_REQUEST )
+    {
+        while( c->newlines < 2 && ( n = net_recv( c->sock, buf, sizeof( buf ) ) ) > 0 )
+        {
+            for( i = 0; i < n && c->newlines < 2; i++ )
+            {
+                if( buf[ i ] == '\n' )
+                {
+                    c->newlines++;
+                }
+                else if( buf[ i ] != '\r' )
+                {
+                    c->newlines = 0;
+                }
+            }
+        }
+
+        if( c->newlines < 2 || !s_ready )
+        {
+            if( timer_expired( c->deadline ) )
+            {
+                metrics_release( c );
+            }
+            return;
+        }
+
+        c->state = METRICS_C_REPLY;
+        c->pos   = s_start;
+        s_readers++;
+    }
+
+    room = METRICS_TX_SZ - 1 - net_tx_pending( c->sock );
+    if( room > s_len - c->pos )
+    {
+        room = s_len - c->pos;
+    }
+
+    n = net_send( c->sock, &s_text[ c->pos ], room );
+    if( n > 0 )
+    {
+        c->pos += n;
+    }
+
+    if( c->pos == s_len )
+    {
+        s_stats.scrapes++;
+        net_push( c->sock );
+        metrics_release( c );
+    }
+}
+
+
+/*--------------------------------------------------------
+Put one line, name{ch="n"} value for a channel ch >= 0.
+The snapshot ends at the first line that does not fit.
+--------------------------------------------------------*/
+static void metrics_put( const char *name, int8_t ch, uint32_t value )
+{
+    uint16_t            room;       /* space left in the buffer     */
+    int                 n;          /* line length                  */
+
+    if( s_full )
+    {
+        return;
+    }
+
+    room = METRICS_TEXT_SZ - s_len;
+    if( ch >= 0 )
+    {
+        n = snprintf( &s_text[ s_len ], room, "%s{ch=\"%d\"} %lu\n",
+                      name, ch, (unsigned long)value );
+    }
+    else
+    {
+        n = snprintf( &s_text[ s_len ], room, "%s %lu\n",
+                      name, (unsigned long)value );
+    }
+
+    if( n < 0 || n >= room )
+    {
+        s_full = true;
+        return;
+    }
+    s_len += (uint16_t)n;
+}
+
+
+/*--------------------------------------------------------
+Close the socket of a client, sent data still goes out,
+and free its slot
+--------------------------------------------------------*/
+static void metrics_release( metrics_client_type *c )
+{
+    if( c->state == METRICS_C_REPLY )
+    {
+        s_readers--;
+    }
+
+    net_close( c->sock );
+    c->state = METRICS_C_FREE;
+}
+
+
+/*--------------------------------------------------------
+Shell: metrics [port]. Starts the server on a port, or
+prints the endpoint statistics.
+--------------------------------------------------------*/
+static int8_t metrics_shell( shell_ctx_type *ctx, uint8_t argc, char *argv[] )
+{
+    int8_t              rc;         /* result                       */
+
+    (void)ctx;
+
+    if( argc == 2 )
+    {
+        rc = metrics_init( (uint16_t)strtoul( argv[ 1 ], NULL, 0 ),
+                           METRICS_PERIOD_DFLT );
+        if( rc < 0 )
+        {
+            shell_printf( "listen failed %d\n", rc );
+            return SHELL_FAIL;
+        }
+        return SHELL_DONE;
+    }
+
+    if( argc != 1 )
+    {
+        return SHELL_USAGE;
+    }
+
+    shell_printf( "%s, %lu scrapes, %u refused\n", s_started ? "serving" : "stopped",
+                  (unsigned long)s_stats.scrapes, s_stats.refused );
+    shell_printf( "%lu snapshots of %u bytes, %u truncated\n",
+                  (unsigned long)s_stats.snapshots, s_stats.len, s_stats.truncated );
+    return SHELL_DONE;
+}
+
+
+/*--------------------------------------------------------
+Socket events: a slot for each connection accepted, none
+after the peer closed it
+--------------------------------------------------------*/
+static void metrics_sock_cb( int8_t sock, uint8_t events, void *ctx )
+{
+    uint8_t             i;          /* loop counter                 */
+
+    (void)ctx;
+
+    if( events & NET_EV_ACCEPT )
+    {
+        for( i = 0; i < METRICS_CLIENT_CNT; i++ )
+        {
+            if( s_clients[ i ].state == METRICS_C_FREE )
+            {
+                s_clients[ i ].state    = METRICS_C_REQUEST;
+                s_clients[ i ].sock     = sock;
+                s_clients[ i ].newlines = 0;
+                s_clients[ i ].deadline = timer_get_ticks() + METRICS_IDLE_MS;
+                return;
+            }
+        }
+
+        s_stats.refused++;
+        net_close( sock );
+        return;
+    }
+
+    if( events & ( NET_EV_CLOSED | NET_EV_ERROR ) )
+    {
+        for( i = 0; i < METRICS_CLIENT_CNT; i++ )
+        {
+            if( s_clients[ i ].state != METRICS_C_FREE && s_clients[ i ].sock == sock )
+            {
+                metrics_release( &s_clients[ i ] );
+            }
+        }
+    }
+}
+
+
+/*--------------------------------------------------------
+Metrics: AT command channel (esp_at.h, esp_ipd.h)
+--------------------------------------------------------*/
+static void metrics_src_at( void )
+{
+    esp_at_stats_type   at;         /* command statistics           */
+    esp_ipd_stats_type  ipd;        /* +IPD statistics              */
+
+    esp_at_get_stats( &at );
+    esp_ipd_get_stats( &ipd );
+
+    metrics_put( "scalog_at_cmds_total", -1, at.cmds );
+    metrics_put( "scalog_at_errors_total", -1, at.errors );
+    metrics_put( "scalog_at_timeouts_total", -1, at.timeouts );
+    metrics_put( "scalog_ipd_bytes_total", -1, ipd.payload_bytes );
+    metrics_put( "scalog_ipd_drop_bytes_total", -1, ipd.payload_drops );
+    metrics_put( "scalog_ipd_line_drops_total", -1, ipd.line_drops );
+}
+
+
+/*--------------------------------------------------------
+Metrics: Wi-Fi link supervisor (esp_link.h)
+--------------------------------------------------------*/
+static void metrics_src_link( void )
+{
+    esp_link_stats_type link;       /* supervisor statistics        */
+
+    esp_link_get_stats( &link );
+
+    metrics_put( "scalog_link_outages_total", -1, link.outages );
+    metrics_put( "scalog_link_reconnects_total", -1, link.reconnects );
+    metrics_put( "scalog_link_resets_total", -1, link.soft_resets + link.hard_resets );
+    metrics_put( "scalog_link_reconnect_max_ms", -1, link.reconnect_max );
+}
+
+
+/*--------------------------------------------------------
+Metrics: sockets (net.h)
+--------------------------------------------------------*/
+static void metrics_src_net( void )
+{
+    net_stats_type      net;        /* socket statistics            */
+
+    net_get_stats( &net );
+
+    metrics_put( "scalog_net_writes_total", -1, net.writes );
+    metrics_put( "scalog_net_sends_total", -1, net.sends );
+    metrics_put( "scalog_net_send_bytes_total", -1, net.payload_bytes );
+    metrics_put( "scalog_net_reopens_total", -1, net.reopens );
+}
+
+
+/*--------------------------------------------------------
+Metrics: UART 1 protocol (proto.h)
+--------------------------------------------------------*/
+static void metrics_src_proto( void )
+{
+    proto_stats_type    proto;      /* protocol statistics          */
+
+    proto_get_stats( &proto );
+
+    metrics_put( "scalog_proto_rx_frames_total", -1, proto.rx_frames );
+    metrics_put( "scalog_proto_tx_frames_total", -1, proto.tx_frames );
+    metrics_put( "scalog_proto_errors_total", -1, (uint32_t)proto.cobs_errors
+                 + proto.hdr_errors + proto.len_errors + proto.crc_errors );
+    metrics_put( "scalog_proto_overflows_total", -1, proto.overflows );
+}
+
+
+/*--------------------------------------------------------
+Metrics: uptime, deferred work (defer.h) and the
+endpoint itself
+--------------------------------------------------------*/
+static void metrics_src_sys( void )
+{
+    defer_stats_type    defer;      /* deferred work statistics     */
+
+    defer_get_stats( &defer );
+
+    metrics_put( "scalog_uptime_seconds", -1, timer_get_ticks() / 1000 );
+    metrics_put( "scalog_defer_backlog_max", -1, defer.max_backlog );
+    metrics_put( "scalog_metrics_scrapes_total", -1, s_stats.scrapes );
+}
+
+
+/*--------------------------------------------------------
+Metrics: UART 1 channels (uart_print.h), the deepest
+each TX queue has been
+--------------------------------------------------------*/
+static void metrics_src_uart( void )
+{
+    uart_mux_stats_type mux;        /* channel statistics           */
+    uint8_t             ch;         /* loop counter                 */
+
+    for( ch = 0; ch < UART_MUX_CH_CNT; ch++ )
+    {
+        uart_mux_get_stats( ch, &mux );
+        metrics_put( "scalog_uart_queued_max_bytes", (int8_t)ch, mux.max_queued );
+    }
+}
+
+#endif
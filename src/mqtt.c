@@ -0,0 +1,982 @@
+/*----------------------------------------------------------------------
+                            INCLUDES
+----------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "logbuf.h"
+#include "mqtt.h"
+#include "net.h"
+#include "shell.h"
+
+#if( MQTT_ENABLE )
+
+/*----------------------------------------------------------------------
+                            CONSTANTS
+----------------------------------------------------------------------*/
+
+#define MQTT_RX_SZ          256     /* socket receive buffer        */
+#define MQTT_TX_SZ          512     /* socket transmit buffer       */
+#define MQTT_HDR_MAX        3       /* fixed header, 2 length bytes */
+#define MQTT_BODY_MAX       ( MQTT_TX_SZ / 2 )
+                                    /* longest packet built         */
+#define MQTT_CONNACK_MS     5000    /* wait for CONNACK             */
+#define MQTT_RETRY_MS       5000    /* wait before reconnecting     */
+#define MQTT_READ_SZ        32      /* bytes read per net_recv()    */
+
+/*--------------------------------------------------------
+Control packet types, first byte of the fixed header
+with the flags each type requires
+--------------------------------------------------------*/
+#define MQTT_P_CONNECT      0x10
+#define MQTT_P_CONNACK      0x20
+#define MQTT_P_PUBLISH      0x30
+#define MQTT_P_PUBACK       0x40
+#define MQTT_P_SUBSCRIBE    0x82
+#define MQTT_P_SUBACK       0x90
+#define MQTT_P_PINGREQ      0xC0
+#define MQTT_P_PINGRESP     0xD0
+#define MQTT_P_TYPE_MASK    0xF0
+
+#define MQTT_F_DUP          0x08    /* PUBLISH sent before          */
+#define MQTT_F_QOS1         0x02    /* PUBLISH at QoS 1             */
+#define MQTT_F_QOS_MASK     0x06
+
+#define MQTT_CONNECT_CLEAN  0x02    /* CONNECT flag, clean session  */
+#define MQTT_LEVEL          4       /* protocol level of 3.1.1      */
+#define MQTT_SUBACK_FAIL    0x80    /* SUBACK return code           */
+
+/*----------------------------------------------------------------------
+                            TYPES
+----------------------------------------------------------------------*/
+
+typedef enum                        /* receive parser state         */
+{
+    MQTT_RX_TYPE,                   /* first byte                   */
+    MQTT_RX_LEN,                    /* remaining length             */
+    MQTT_RX_BODY                    /* variable header and payload  */
+} mqtt_rx_state_type;
+
+typedef struct                      /* subscription                 */
+{
+    char                filter[ MQTT_TOPIC_MAX + 1 ];
+                                    /* topic filter                 */
+    uint8_t             qos;        /* QoS asked for                */
+    bool                pending;    /* SUBSCRIBE still to send      */
+    mqtt_msg_cb_type    cb;         /* message callback, NULL if    */
+                                    /* the slot is free             */
+    void               *ctx;        /* callback context             */
+} mqtt_sub_type;
+
+typedef struct                      /* QoS 1 publish awaiting PUBACK*/
+{
+    uint16_t            id;         /* packet identifier            */
+    uint16_t            len;        /* packet length, 0 if free     */
+    timer_ticks_t       resend_at;  /* time to send it again        */
+    uint8_t             pkt[ MQTT_QOS1_PKT_MAX ];
+                                    /* the PUBLISH packet           */
+} mqtt_inflight_type;
+
+/*----------------------------------------------------------------------
+                            VARIABLES
+----------------------------------------------------------------------*/
+
+static char             s_host[ NET_HOST_SZ ];
+                                    /* broker address               */
+static char             s_client_id[ MQTT_CLIENT_ID_MAX + 1 ];
+                                    /* client identifier            */
+static uint16_t         s_port;     /* broker port                  */
+static uint16_t         s_keepalive;/* keep alive, s                */
+static timer_ticks_t    s_batch;    /* publish coalescing, ms       */
+static mqtt_state_type  s_state;    /* client state                 */
+static int8_t           s_sock = -1;/* broker socket, < 0 if closed */
+static timer_ticks_t    s_deadline; /* CONNACK wait or reconnect    */
+static timer_ticks_t    s_last_tx;  /* time of the last packet sent */
+static bool             s_ping_wait;/* PINGREQ not yet answered     */
+static timer_ticks_t    s_ping_due; /* PINGRESP must be in by then  */
+static uint16_t         s_next_id;  /* last packet identifier used  */
+static uint8_t          s_pkt[ MQTT_HDR_MAX + MQTT_BODY_MAX ];
+                                    /* packet being built, the body */
+                                    /* from s_pkt[ MQTT_HDR_MAX ]   */
+static mqtt_sub_type    s_subs[ MQTT_SUBS_MAX ];
+                                    /* subscriptions                */
+static mqtt_inflight_type s_inflight[ MQTT_INFLIGHT_MAX ];
+                                    /* QoS 1 publishes not acked    */
+static mqtt_rx_state_type s_rx_state;
+                                    /* receive parser state         */
+static uint8_t          s_rx_type;  /* packet type and flags        */
+static uint32_t         s_rx_len;   /* remaining length             */
+static uint8_t          s_rx_shift; /* length bits decoded          */
+static uint32_t         s_rx_got;   /* body bytes received          */
+static uint8_t          s_rx_buf[ MQTT_RX_PKT_MAX ];
+                                    /* body of the packet           */
+static mqtt_stats_type  s_stats;    /* client statistics            */
+
+/*----------------------------------------------------------------------
+                            PROCEDURES
+----------------------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+static void mqtt_connack( void );
+static void mqtt_drop( const char *why );
+static uint16_t mqtt_finish( uint8_t type, uint16_t body_len, uint8_t **start );
+static void mqtt_handle( void );
+static void mqtt_open( void );
+static void mqtt_publish_rx( void );
+static uint8_t *mqtt_put_str( uint8_t *p, const char *str, uint16_t len );
+static void mqtt_put_u16( uint8_t *p, uint16_t value );
+static void mqtt_rx( uint8_t byte );
+static bool mqtt_send( const uint8_t *pkt, uint16_t len, bool push );
+static void mqtt_send_pending( void );
+static bool mqtt_send_short( uint8_t type, uint16_t id );
+static int8_t mqtt_shell( shell_ctx_type *ctx, uint8_t argc, char *argv[] );
+static void mqtt_shell_msg( const char *topic, uint16_t topic_len,
+                            const uint8_t *payload, uint16_t len, void *ctx );
+static void mqtt_sock_cb( int8_t sock, uint8_t events, void *ctx );
+static bool mqtt_topic_match( const char *filter, const char *topic,
+                              uint16_t len );
+
+SHELL_CMD( "mqtt", "[open host port [id] | pub topic text [qos] | sub filter]",
+           mqtt_shell );
+
+
+/*--------------------------------------------------------
+Start the client, it connects and keeps reconnecting to
+the broker. net_init() must be called first.
+--------------------------------------------------------*/
+void mqtt_init( const mqtt_cfg_type *cfg )
+{
+    uint8_t             i;          /* loop counter                 */
+
+    if( s_sock >= 0 )
+    {
+        net_close( s_sock );
+        s_sock = -1;
+    }
+
+    strncpy( s_host, cfg->host, sizeof( s_host ) - 1 );
+    s_host[ sizeof( s_host ) - 1 ] = '\0';
+    strncpy( s_client_id, cfg->client_id, sizeof( s_client_id ) - 1 );
+    s_client_id[ sizeof( s_client_id ) - 1 ] = '\0';
+    s_port      = cfg->port;
+    s_keepalive = cfg->keepalive;
+    s_batch     = cfg->batch;
+
+    memset( &s_stats, 0, sizeof( s_stats ) );
+    for( i = 0; i < MQTT_INFLIGHT_MAX; i++ )
+    {
+        s_inflight[ i ].len = 0;
+    }
+
+    mqtt_open();
+}
+
+
+/*--------------------------------------------------------
+Read and handle what the broker sent, keep the session
+alive and resend what is due. Call this from the main
+loop after net_poll().
+--------------------------------------------------------*/
+void mqtt_poll( void )
+{
+    uint8_t             buf[ MQTT_READ_SZ ];
+                                    /* bytes read from the socket   */
+    int16_t             n;          /* bytes read                   */
+    int16_t             i;          /* byte index                   */
+    timer_ticks_t       now;        /* current time                 */
+
+    switch( s_state )
+    {
+        case MQTT_RETRY:
+            if( timer_expired( s_deadline ) )
+            {
+                mqtt_open();
+            }
+            return;
+
+        case MQTT_CONNECTING:
+        case MQTT_CONNECTED:
+            break;
+
+        default:
+            return;
+    }
+
+    while( s_sock >= 0 && ( n = net_recv( s_sock, buf, sizeof( buf ) ) ) > 0 )
+    {
+        for( i = 0; i < n && s_sock >= 0; i++ )
+        {
+            mqtt_rx( buf[ i ] );
+        }
+    }
+
+    now = timer_get_ticks();
+    if( s_state == MQTT_CONNECTING )
+    {
+        if( timer_expired( s_deadline ) )
+        {
+            mqtt_drop( "no CONNACK" );
+        }
+        return;
+    }
+
+    if( s_state != MQTT_CONNECTED )
+    {
+        return;
+    }
+
+    /*--------------------------------------------------------
+    Keep alive, counted from the last packet sent
+    --------------------------------------------------------*/
+    if( s_keepalive != 0 )
+    {
+        if( s_ping_wait && timer_expired( s_ping_due ) )
+        {
+            mqtt_drop( "no PINGRESP" );
+            return;
+        }
+
+        if( !s_ping_wait && timer_expired( s_last_tx + s_keepalive * 1000u )
+         && mqtt_send_short( MQTT_P_PINGREQ, 0 ) )
+        {
+            s_ping_wait = true;
+            s_ping_due  = now + s_keepalive * 500u;
+            s_stats.pings++;
+        }
+    }
+
+    mqtt_send_pending();
+}
+
+
+/*--------------------------------------------------------
+Queue a PUBLISH at QoS 0 or 1. It goes out with the other
+packets queued within the batching window. A QoS 1
+publish is kept, up to MQTT_INFLIGHT_MAX at once, and
+sent again until the broker acknowledges it.
+--------------------------------------------------------*/
+int8_t mqtt_publish( const char *topic, const void *payload, uint16_t len,
+                     uint8_t qos )
+{
+    uint8_t            *p;          /* body being built             */
+    uint8_t            *pkt;        /* packet start                 */
+    uint16_t            topic_len;  /* topic length                 */
+    uint16_t            pkt_len;    /* packet length                */
+    mqtt_inflight_type *slot;       /* kept copy of a QoS 1 publish */
+    uint8_t             i;          /* loop counter                 */
+
+    if( s_state != MQTT_CONNECTED )
+    {
+        return MQTT_ERR_STATE;
+    }
+
+    if( qos > 1 )
+    {
+        return MQTT_ERR_ARG;
+    }
+
+    topic_len = (uint16_t)strlen( topic );
+    if( topic_len == 0 || topic_len > MQTT_TOPIC_MAX
+     || 2 + topic_len + 2 * qos + len > MQTT_BODY_MAX )
+    {
+        return MQTT_ERR_LEN;
+    }
+
+    slot = NULL;
+    if( qos == 1 )
+    {
+        for( i = 0; i < MQTT_INFLIGHT_MAX && slot == NULL; i++ )
+        {
+            if( s_inflight[ i ].len == 0 )
+            {
+                slot = &s_inflight[ i ];
+            }
+        }
+
+        if( slot == NULL )
+        {
+            return MQTT_ERR_FULL;
+        }
+    }
+
+    p = mqtt_put_str( &s_pkt[ MQTT_HDR_MAX ], topic, topic_len );
+    if( qos == 1 )
+    {
+        s_next_id = ( s_next_id == 0xFFFF ) ? 1 : s_next_id + 1;
+        mqtt_put_u16( p, s_next_id );
+        p += 2;
+    }
+    memcpy( p, payload, len );
+    p += len;
+
+    pkt_len = mqtt_finish( MQTT_P_PUBLISH | ( qos ? MQTT_F_QOS1 : 0 ),
+                           (uint16_t)( p - &s_pkt[ MQTT_HDR_MAX ] ), &pkt );
+    if( slot != NULL && pkt_len > MQTT_QOS1_PKT_MAX )
+    {
+        return MQTT_ERR_LEN;
+    }
+
+    if( !mqtt_send( pkt, pkt_len, false ) )
+    {
+        return MQTT_ERR_FULL;
+    }
+
+    if( slot != NULL )
+    {
+        memcpy( slot->pkt, pkt, pkt_len );
+        slot->len       = pkt_len;
+        slot->id        = s_next_id;
+        slot->resend_at = timer_get_ticks() + MQTT_RESEND_MS;
+    }
+
+    s_stats.published++;
+    return 0;
+}
+
+
+/*--------------------------------------------------------
+Subscribe to a topic filter at QoS 0 or 1, or change the
+callback of one subscribed before. The filter is copied.
+--------------------------------------------------------*/
+int8_t mqtt_subscribe( const char *filter, uint8_t qos, mqtt_msg_cb_type cb,
+                       void *ctx )
+{
+    mqtt_sub_type      *sub;        /* slot for the subscription    */
+    uint8_t             i;          /* loop counter                 */
+
+    if( qos > 1 || cb == NULL || filter[ 0 ] == '\0' )
+    {
+        return MQTT_ERR_ARG;
+    }
+
+    if( strlen( filter ) > MQTT_TOPIC_MAX )
+    {
+        return MQTT_ERR_LEN;
+    }
+
+    sub = NULL;
+    for( i = 0; i < MQTT_SUBS_MAX; i++ )
+    {
+        if( s_subs[ i ].cb != NULL && strcmp( s_subs[ i ].filter, filter ) == 0 )
+        {
+            sub = &s_subs[ i ];
+            break;
+        }
+
+        if( s_subs[ i ].cb == NULL && sub == NULL )
+        {
+            sub = &s_subs[ i ];
+        }
+    }
+
+    if( sub == NULL )
+    {
+        return MQTT_ERR_FULL;
+    }
+
+    strcpy( sub->filter, filter );
+    sub->qos     = qos;
+    sub->cb      = cb;
+    sub->ctx     = ctx;
+    sub->pending = true;
+
+    if( s_state == MQTT_CONNECTED )
+    {
+        mqtt_send_pending();
+    }
+    return 0;
+}
+
+
+/*--------------------------------------------------------
+Get the client state
+--------------------------------------------------------*/
+mqtt_state_type mqtt_get_state( void )
+{
+    return s_state;
+}
+
+
+/*--------------------------------------------------------
+Get a copy of the client statistics
+--------------------------------------------------------*/
+void mqtt_get_stats( mqtt_stats_type *stats )
+{
+    *stats = s_stats;
+}
+
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+
+/*--------------------------------------------------------
+CONNACK: the session is up, subscribe again and resend
+the QoS 1 publishes the last session left unacknowledged
+--------------------------------------------------------*/
+static void mqtt_connack( void )
+{
+    uint8_t             i;          /* loop counter                 */
+
+    if( s_state != MQTT_CONNECTING || s_rx_len != 2 )
+    {
+        return;
+    }
+
+    s_stats.last_rc = s_rx_buf[ 1 ];
+    if( s_rx_buf[ 1 ] != 0 )
+    {
+        s_stats.refused++;
+        mqtt_drop( "refused" );
+        return;
+    }
+
+    s_state     = MQTT_CONNECTED;
+    s_ping_wait = false;
+    s_stats.connects++;
+    logbuf_printf( "mqtt connected to %s", s_host );
+
+    for( i = 0; i < MQTT_SUBS_MAX; i++ )
+    {
+        s_subs[ i ].pending = ( s_subs[ i ].cb != NULL );
+    }
+
+    for( i = 0; i < MQTT_INFLIGHT_MAX; i++ )
+    {
+        s_inflight[ i ].resend_at = timer_get_ticks();
+    }
+
+    mqtt_send_pending();
+}
+
+
+/*--------------------------------------------------------
+Close the connection and reconnect after a while
+--------------------------------------------------------*/
+static void mqtt_drop( const char *why )
+{
+    if( s_sock >= 0 )
+    {
+        net_close( s_sock );
+        s_sock = -1;
+    }
+
+    if( s_state == MQTT_CONNECTED || s_state == MQTT_CONNECTING )
+    {
+        logbuf_printf( "mqtt dropped, %s", why );
+    }
+
+    s_state    = MQTT_RETRY;
+    s_deadline = timer_get_ticks() + MQTT_RETRY_MS;
+}
+
+
+/*--------------------------------------------------------
+Put the fixed header in front of the body built at
+s_pkt[ MQTT_HDR_MAX ] and return the packet length
+--------------------------------------------------------*/
+static uint16_t mqtt_finish( uint8_t type, uint16_t body_len, uint8_t **start )
+{
+    uint8_t            *p;          /* header byte being written    */
+
+    p = &s_pkt[ MQTT_HDR_MAX ];
+    if( body_len >= 0x80 )
+    {
+        *--p = (uint8_t)( body_len >> 7 );
+        *--p = (uint8_t)( ( body_len & 0x7F ) | 0x80 );
+    }
+    else
+    {
+        *--p = (uint8_t)body_len;
+    }
+    *--p = type;
+
+    *start = p;
+    return (uint16_t)( &s_pkt[ MQTT_HDR_MAX ] - p + body_len );
+}
+
+
+/*--------------------------------------------------------
+Handle a complete packet in s_rx_buf
+--------------------------------------------------------*/
+static void mqtt_handle( void )
+{
+    uint16_t            id;         /* packet identifier            */
+    uint8_t             i;          /* loop counter                 */
+
+    switch( s_rx_type & MQTT_P_TYPE_MASK )
+    {
+        case MQTT_P_CONNACK:
+            mqtt_connack();
+            break;
+
+        case MQTT_P_PUBLISH:
+            mqtt_publish_rx();
+            break;
+
+        case MQTT_P_PUBACK:
+            if( s_rx_len < 2 )
+            {
+                break;
+            }
+
+            id = (uint16_t)( ( s_rx_buf[ 0 ] << 8 ) | s_rx_buf[ 1 ] );
+            for( i = 0; i < MQTT_INFLIGHT_MAX; i++ )
+            {
+                if( s_inflight[ i ].len != 0 && s_inflight[ i ].id == id )
+                {
+                    s_inflight[ i ].len = 0;
+                    s_stats.acked++;
+                }
+            }
+            break;
+
+        case MQTT_P_SUBACK:
+            if( s_rx_len >= 3 && s_rx_buf[ 2 ] == MQTT_SUBACK_FAIL )
+            {
+                s_stats.refused++;
+            }
+            break;
+
+        case MQTT_P_PINGRESP:
+            s_ping_wait = false;
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+/*--------------------------------------------------------
+Open the TCP connection to the broker, CONNECT is sent
+once it is up
+--------------------------------------------------------*/
+static void mqtt_open( void )
+{
+    s_rx_state  = MQTT_RX_TYPE;
+    s_ping_wait = false;
+
+    s_sock = net_connect( NET_TCP, s_host, s_port, MQTT_RX_SZ, MQTT_TX_SZ,
+                          mqtt_sock_cb, NULL );
+    if( s_sock < 0 )
+    {
+        s_state    = MQTT_RETRY;
+        s_deadline = timer_get_ticks() + MQTT_RETRY_MS;
+        return;
+    }
+
+    net_set_flush_delay( s_sock, s_batch );
+    s_state = MQTT_TCP;
+}
+
+
+/*--------------------------------------------------------
+Received PUBLISH: pass it to every matching subscription
+and acknowledge it at QoS 1
+--------------------------------------------------------*/
+static void mqtt_publish_rx( void )
+{
+    uint16_t            topic_len;  /* topic length                 */
+    uint16_t            pos;        /* payload start                */
+    uint8_t             qos;        /* QoS of the message           */
+    bool                matched;    /* some subscription took it    */
+    uint8_t             i;          /* loop counter                 */
+
+    qos = ( s_rx_type & MQTT_F_QOS_MASK ) >> 1;
+    if( s_rx_len < 2 || qos > 1 )
+    {
+        s_stats.dropped++;
+        return;
+    }
+
+    topic_len = (uint16_t)( ( s_rx_buf[ 0 ] << 8 ) | s_rx_buf[ 1 ] );
+    pos       = 2 + topic_len + 2 * qos;
+    if( pos > s_rx_len )
+    {
+        s_stats.dropped++;
+        return;
+    }
+
+    s_stats.received++;
+    matched = false;
+    for( i = 0; i < MQTT_SUBS_MAX; i++ )
+    {
+        if( s_subs[ i ].cb != NULL
+         && mqtt_topic_match( s_subs[ i ].filter, (const char *)&s_rx_buf[ 2 ], topic_len ) )
+        {
+            s_subs[ i ].cb( (const char *)&s_rx_buf[ 2 ], topic_len, &s_rx_buf[ pos ],
+                            (uint16_t)( s_rx_len - pos ), s_subs[ i ].ctx );
+            matched = true;
+        }
+    }
+
+    if( !matched )
+    {
+        s_stats.dropped++;
+    }
+
+    if( qos == 1 )
+    {
+        mqtt_send_short( MQTT_P_PUBACK, (uint16_t)( ( s_rx_buf[ 2 + topic_len ] << 8 )
+                                                  | s_rx_buf[ 3 + topic_len ] ) );
+    }
+}
+
+
+/*--------------------------------------------------------
+Put a length prefixed string, return the byte after it
+--------------------------------------------------------*/
+static uint8_t *mqtt_put_str( uint8_t *p, const char *str, uint16_t len )
+{
+    mqtt_put_u16( p, len );
+    memcpy( &p[ 2 ], str, len );
+    return &p[ 2 + len ];
+}
+
+
+/*--------------------------------------------------------
+Put a 16 bit value, big endian as MQTT has it
+--------------------------------------------------------*/
+static void mqtt_put_u16( uint8_t *p, uint16_t value )
+{
+    p[ 0 ] = (uint8_t)( value >> 8 );
+    p[ 1 ] = (uint8_t)value;
+}
+
+
+/*--------------------------------------------------------
+Receive parser, one byte at a time. A packet longer than
+MQTT_RX_PKT_MAX is skipped; a malformed length drops the
+connection, as the stream can not be resynchronized.
+--------------------------------------------------------*/
+static void mqtt_rx( uint8_t byte )
+{
+    switch( s_rx_state )
+    {
+        case MQTT_RX_TYPE:
+            s_rx_type  = byte;
+            s_rx_len   = 0;
+            s_rx_shift = 0;
+            s_rx_state = MQTT_RX_LEN;
+            break;
+
+        case MQTT_RX_LEN:
+            s_rx_len   |= (uint32_t)( byte & 0x7F ) << s_rx_shift;
+            s_rx_shift += 7;
+            if( byte & 0x80 )
+            {
+                if( s_rx_shift >= 28 )
+                {
+                    mqtt_drop( "bad length" );
+                }
+                break;
+            }
+
+            s_rx_got   = 0;
+            s_rx_state = MQTT_RX_BODY;
+            if( s_rx_len == 0 )
+            {
+                s_rx_state = MQTT_RX_TYPE;
+                mqtt_handle();
+            }
+            break;
+
+        default:
+            if( s_rx_got < MQTT_RX_PKT_MAX )
+            {
+                s_rx_buf[ s_rx_got ] = byte;
+            }
+
+            if( ++s_rx_got == s_rx_len )
+            {
+                s_rx_state = MQTT_RX_TYPE;
+                if( s_rx_len <= MQTT_RX_PKT_MAX )
+                {
+                    mqtt_handle();
+                }
+                else
+                {
+                    s_stats.dropped++;
+                }
+            }
+            break;
+    }
+}
+
+
+/*--------------------------------------------------------
+Queue a whole packet on the socket, false if it does not
+fit now. Control packets are pushed out at once,
+publishes wait for the batching window.
+--------------------------------------------------------*/
+static bool mqtt_send( const uint8_t *pkt, uint16_t len, bool push )
+{
+    if( s_sock < 0 || MQTT_TX_SZ - 1 - net_tx_pending( s_sock ) < len
+     || net_send( s_sock, pkt, len ) != (int16_t)len )
+    {
+        return false;
+    }
+
+    if( push )
+    {
+        net_push( s_sock );
+    }
+
+    s_last_tx = timer_get_ticks();
+    return true;
+}
+
+
+/*--------------------------------------------------------
+Send the subscriptions not yet sent and the QoS 1
+publishes due again, as far as there is room
+--------------------------------------------------------*/
+static void mqtt_send_pending( void )
+{
+    mqtt_sub_type      *sub;        /* subscription                 */
+    mqtt_inflight_type *slot;       /* QoS 1 publish                */
+    uint8_t            *p;          /* body being built             */
+    uint8_t            *pkt;        /* packet start                 */
+    uint16_t            len;        /* packet length                */
+    uint8_t             i;          /* loop counter                 */
+
+    for( i = 0; i < MQTT_SUBS_MAX; i++ )
+    {
+        sub = &s_subs[ i ];
+        if( sub->cb == NULL || !sub->pending )
+        {
+            continue;
+        }
+
+        s_next_id = ( s_next_id == 0xFFFF ) ? 1 : s_next_id + 1;
+        mqtt_put_u16( &s_pkt[ MQTT_HDR_MAX ], s_next_id );
+        p    = mqtt_put_str( &s_pkt[ MQTT_HDR_MAX + 2 ], sub->filter,
+                             (uint16_t)strlen( sub->filter ) );
+        *p++ = sub->qos;
+
+        len = mqtt_finish( MQTT_P_SUBSCRIBE, (uint16_t)( p - &s_pkt[ MQTT_HDR_MAX ] ), &pkt );
+        if( !mqtt_send( pkt, len, true ) )
+        {
+            return;
+        }
+        sub->pending = false;
+    }
+
+    for( i = 0; i < MQTT_INFLIGHT_MAX; i++ )
+    {
+        slot = &s_inflight[ i ];
+        if( slot->len == 0 || !timer_expired( slot->resend_at ) )
+        {
+            continue;
+        }
+
+        slot->pkt[ 0 ] |= MQTT_F_DUP;
+        if( !mqtt_send( slot->pkt, slot->len, false ) )
+        {
+            return;
+        }
+        slot->resend_at = timer_get_ticks() + MQTT_RESEND_MS;
+        s_stats.resent++;
+    }
+}
+
+
+/*--------------------------------------------------------
+Send a packet of a packet identifier or nothing: PUBACK,
+PINGREQ
+--------------------------------------------------------*/
+static bool mqtt_send_short( uint8_t type, uint16_t id )
+{
+    uint8_t             pkt[ 4 ];   /* the packet                   */
+
+    pkt[ 0 ] = type;
+    if( type == MQTT_P_PINGREQ )
+    {
+        pkt[ 1 ] = 0;
+        return mqtt_send( pkt, 2, true );
+    }
+
+    pkt[ 1 ] = 2;
+    mqtt_put_u16( &pkt[ 2 ], id );
+    return mqtt_send( pkt, 4, true );
+}
+
+
+/*--------------------------------------------------------
+Shell: mqtt [open host port [id] | pub topic text [qos]
+| sub filter]. Without arguments prints the client
+state; messages for "mqtt sub" go to the log (logbuf.h).
+--------------------------------------------------------*/
+static int8_t mqtt_shell( shell_ctx_type *ctx, uint8_t argc, char *argv[] )
+{
+    static const char *const names[] =
+        { "idle", "tcp", "connecting", "connected", "retry" };
+    mqtt_cfg_type       cfg;        /* "open" configuration         */
+    int8_t              rc;         /* result                       */
+    uint8_t             i;          /* loop counter                 */
+    uint8_t             inflight;   /* QoS 1 publishes not acked    */
+
+    (void)ctx;
+
+    if( argc >= 4 && argc <= 5 && strcmp( argv[ 1 ], "open" ) == 0 )
+    {
+        cfg.host      = argv[ 2 ];
+        cfg.port      = (uint16_t)strtoul( argv[ 3 ], NULL, 0 );
+        cfg.client_id = ( argc == 5 ) ? argv[ 4 ] : "scalog";
+        cfg.keepalive = MQTT_KEEPALIVE_DFLT;
+        cfg.batch     = MQTT_BATCH_DFLT;
+        mqtt_init( &cfg );
+        return SHELL_DONE;
+    }
+
+    if( argc >= 4 && argc <= 5 && strcmp( argv[ 1 ], "pub" ) == 0 )
+    {
+        rc = mqtt_publish( argv[ 2 ], argv[ 3 ], (uint16_t)strlen( argv[ 3 ] ),
+                           ( argc == 5 ) ? (uint8_t)strtoul( argv[ 4 ], NULL, 0 ) : 0 );
+        if( rc < 0 )
+        {
+            shell_printf( "publish failed %d\n", rc );
+            return SHELL_FAIL;
+        }
+        return SHELL_DONE;
+    }
+
+    if( argc == 3 && strcmp( argv[ 1 ], "sub" ) == 0 )
+    {
+        rc = mqtt_subscribe( argv[ 2 ], 1, mqtt_shell_msg, NULL );
+        if( rc < 0 )
+        {
+            shell_printf( "subscribe failed %d\n", rc );
+            return SHELL_FAIL;
+        }
+        return SHELL_DONE;
+    }
+
+    if( argc != 1 )
+    {
+        return SHELL_USAGE;
+    }
+
+    inflight = 0;
+    for( i = 0; i < MQTT_INFLIGHT_MAX; i++ )
+    {
+        inflight += ( s_inflight[ i ].len != 0 );
+    }
+
+    shell_printf( "%s %s:%u, %u connects, %u refused, rc %u\n", names[ s_state ],
+                  s_host, s_port, s_stats.connects, s_stats.refused, s_stats.last_rc );
+    shell_printf( "published %lu acked %lu resent %u in flight %u\n",
+                  (unsigned long)s_stats.published, (unsigned long)s_stats.acked,
+                  s_stats.resent, inflight );
+    shell_printf( "received %lu dropped %u pings %u\n",
+                  (unsigned long)s_stats.received, s_stats.dropped, s_stats.pings );
+    return SHELL_DONE;
+}
+
+
+/*--------------------------------------------------------
+Log a message for the "mqtt sub" subscription
+--------------------------------------------------------*/
+static void mqtt_shell_msg( const char *topic, uint16_t topic_len,
+                            const uint8_t *payload, uint16_t len, void *ctx )
+{
+    (void)ctx;
+
+    logbuf_printf( "mqtt %.*s: %.*s", (int)topic_len, topic, (int)len,
+                   (const char *)payload );
+}
+
+
+/*--------------------------------------------------------
+Socket events: CONNECT once the connection is up, a
+reconnect after it is lost
+--------------------------------------------------------*/
+static void mqtt_sock_cb( int8_t sock, uint8_t events, void *ctx )
+{
+    uint8_t            *p;          /* body being built             */
+    uint8_t            *pkt;        /* packet start                 */
+    uint16_t            len;        /* packet length                */
+
+    (void)sock;
+    (void)ctx;
+
+    if( events & ( NET_EV_CLOSED | NET_EV_ERROR ) )
+    {
+        mqtt_drop( "connection lost" );
+        return;
+    }
+
+    if( ( events & NET_EV_CONNECTED ) == 0 || s_state != MQTT_TCP )
+    {
+        return;
+    }
+
+    p    = mqtt_put_str( &s_pkt[ MQTT_HDR_MAX ], "MQTT", 4 );
+    *p++ = MQTT_LEVEL;
+    *p++ = MQTT_CONNECT_CLEAN;
+    mqtt_put_u16( p, s_keepalive );
+    p    = mqtt_put_str( p + 2, s_client_id, (uint16_t)strlen( s_client_id ) );
+
+    len = mqtt_finish( MQTT_P_CONNECT, (uint16_t)( p - &s_pkt[ MQTT_HDR_MAX ] ), &pkt );
+    if( !mqtt_send( pkt, len, true ) )
+    {
+        mqtt_drop( "no room" );
+        return;
+    }
+
+    s_state    = MQTT_CONNECTING;
+    s_deadline = timer_get_ticks() + MQTT_CONNACK_MS;
+}
+
+
+/*--------------------------------------------------------
+True if a topic matches a filter. '+' matches one level,
+a trailing '#' the rest including the parent level;
+topics starting with '$' only match filters naming it.
+--------------------------------------------------------*/
+static bool mqtt_topic_match( const char *filter, const char *topic,
+                              uint16_t len )
+{
+    uint16_t            i;          /* topic index                  */
+
+    if( len > 0 && topic[ 0 ] == '$' && ( filter[ 0 ] == '+' || filter[ 0 ] == '#' ) )
+    {
+        return false;
+    }
+
+    for( i = 0; *filter != '\0'; filter++ )
+    {
+        if( *filter == '#' )
+        {
+            return true;
+        }
+
+        if( *filter == '+' )
+        {
+            while( i < len && topic[ i ] != '/' )
+            {
+                i++;
+            }
+            continue;
+        }
+
+        if( i >= len )
+        {
+            return strcmp( filter, "/#" ) == 0;
+        }
+
+        if( *filter != topic[ i ] )
+        {
+            return false;
+        }
+        i++;
+    }
+
+    return i == len;
+}
+
+#endif
@@ -0,0 +1,1108 @@
+/*----------------------------------------------------------------------
+                            INCLUDES
+----------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "net.h"
+#include "esp_at.h"
+
+/*----------------------------------------------------------------------
+                            CONSTANTS
+----------------------------------------------------------------------*/
+
+#define NET_CMD_SZ          72      /* longest AT command built     */
+#define NET_CONN_TIMEOUT    10000   /* CIPSTART timeout, ms         */
+#define NET_SEND_TIMEOUT    2000    /* CIPSEND timeout, ms          */
+#define NET_BUF_MIN         16      /* smallest RX / TX buffer      */
+#define NET_REOPEN_DELAY    1000    /* persistent socket retry, ms  */
+
+/*----------------------------------------------------------------------
+                            TYPES
+----------------------------------------------------------------------*/
+
+typedef enum                        /* socket state                 */
+{
+    NET_STATE_FREE,                 /* not in use                   */
+    NET_STATE_CONNECTING,           /* CIPSTART queued or running   */
+    NET_STATE_OPEN,                 /* connected                    */
+    NET_STATE_CLOSING,              /* flushing TX, then CIPCLOSE   */
+    NET_STATE_CLOSED                /* peer closed, await net_close */
+} net_state_type;
+
+typedef struct                      /* socket data                  */
+{
+    net_state_type      state;      /* socket state                 */
+    net_proto_type      proto;      /* TCP or UDP                   */
+    bool                start_sent; /* CIPSTART has been issued     */
+    bool                link_taken; /* the link id is held by a     */
+                                    /* connection the socket did    */
+                                    /* not open, close it first     */
+    char                host[ NET_HOST_SZ ];
+                                    /* remote host for CIPSTART     */
+    uint16_t            port;       /* remote port for CIPSTART     */
+    uint16_t            pool_off;   /* offset of buffers in pool    */
+    uint16_t            pool_sz;    /* RX + TX size, 0 if none      */
+    uint8_t            *tx_buf;     /* TX ring                      */
+    uint16_t            tx_sz;      /* TX ring size                 */
+    uint16_t            tx_head;    /* next byte queued             */
+    uint16_t            tx_tail;    /* oldest unsent byte           */
+    uint16_t            tx_inflight;/* bytes in the current CIPSEND */
+    timer_ticks_t       tx_first;   /* oldest unsent byte queued at */
+    timer_ticks_t       flush_delay;/* write coalescing delay, ms   */
+    bool                push;       /* flush requested by net_push()*/
+    uint16_t            rx_seen;    /* RX bytes already signalled   */
+    bool                want_write; /* net_send() was cut short     */
+    bool                persist;    /* reopen after the link drops  */
+    uint16_t            keepalive;  /* TCP keep alive, s, 0 if off  */
+    timer_ticks_t       retry_at;   /* next CIPSTART attempt        */
+    net_cb_type         cb;         /* readiness callback           */
+    void               *ctx;        /* callback context             */
+} net_sock_type;
+
+typedef struct                      /* listening server data        */
+{
+    bool                active;     /* net_listen() was called      */
+    bool                started;    /* CIPSERVER completed          */
+    uint16_t            port;       /* local port                   */
+    uint16_t            rx_sz;      /* RX size for accepted sockets */
+    uint16_t            tx_sz;      /* TX size for accepted sockets */
+    net_cb_type         cb;         /* accept callback              */
+    void               *ctx;        /* callback context             */
+} net_listener_type;
+
+/*----------------------------------------------------------------------
+                            VARIABLES
+----------------------------------------------------------------------*/
+
+static uint8_t          s_pool[ NET_BUF_BUDGET ];
+                                    /* socket buffer budget         */
+static net_sock_type    s_socks[ NET_SOCK_CNT ];
+                                    /* sockets, indexed by link id  */
+static net_listener_type
+                        s_listener; /* listening server             */
+static bool             s_mux_done; /* AT+CIPMUX=1 completed        */
+static bool             s_link_up;  /* Wi-Fi link usable            */
+static uint8_t          s_next;     /* round robin start socket     */
+static uint32_t         s_writes;   /* net_send() calls with data   */
+static uint32_t         s_sends;    /* CIPSEND chunks issued        */
+static uint32_t         s_payload;  /* bytes sent in those chunks   */
+static uint16_t         s_reopens;  /* persistent sockets reopened  */
+
+/*----------------------------------------------------------------------
+                            PROCEDURES
+----------------------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+static void net_close_done( esp_at_result_type result, void *ctx );
+static void net_drop( int8_t sock, uint8_t events );
+static void net_event( int8_t sock, uint8_t events );
+static void net_free( int8_t sock );
+static bool net_issue( void );
+static bool net_issue_sock( int8_t sock );
+static bool net_flush_due( const net_sock_type *s );
+static void net_mux_done( esp_at_result_type result, void *ctx );
+static bool net_open( int8_t sock, uint16_t rx_sz, uint16_t tx_sz );
+static bool net_pool_alloc( uint16_t size, uint16_t *off );
+static void net_send_done( esp_at_result_type result, void *ctx );
+static void net_server_done( esp_at_result_type result, void *ctx );
+static void net_start_done( esp_at_result_type result, void *ctx );
+static void net_taken_done( esp_at_result_type result, void *ctx );
+static uint16_t net_tx_used( const net_sock_type *s );
+static void net_urc( const char *line );
+
+
+/*--------------------------------------------------------
+Reset all sockets. esp_at_init() must be called first.
+--------------------------------------------------------*/
+void net_init( void )
+{
+    memset( s_socks, 0, sizeof( s_socks ) );
+    memset( &s_listener, 0, sizeof( s_listener ) );
+    s_mux_done = false;
+    s_link_up  = true;
+    s_next     = 0;
+    s_writes   = 0;
+    s_sends    = 0;
+    s_payload  = 0;
+    s_reopens  = 0;
+
+    esp_at_add_urc_handler( net_urc );
+}
+
+
+/*--------------------------------------------------------
+Signal readable sockets and issue the next AT command.
+Call this from the main loop after esp_at_poll().
+--------------------------------------------------------*/
+void net_poll( void )
+{
+    int8_t              sock;       /* loop counter                 */
+    uint16_t            avail;      /* RX bytes waiting             */
+
+    for( sock = 0; sock < NET_SOCK_CNT; sock++ )
+    {
+        if( s_socks[ sock ].state != NET_STATE_OPEN
+         && s_socks[ sock ].state != NET_STATE_CLOSED )
+        {
+            continue;
+        }
+
+        avail = esp_ipd_link_avail( sock );
+        if( avail > s_socks[ sock ].rx_seen )
+        {
+            s_socks[ sock ].rx_seen = avail;
+            net_event( sock, NET_EV_READABLE );
+        }
+    }
+
+    if( esp_at_busy() || !s_link_up )
+    {
+        return;
+    }
+
+    if( !s_mux_done )
+    {
+        esp_at_cmd( "AT+CIPMUX=1", ESP_AT_TIMEOUT_DFLT, net_mux_done, NULL );
+        return;
+    }
+
+    net_issue();
+}
+
+
+/*--------------------------------------------------------
+Open a TCP or UDP connection. Returns the socket, or a
+negative NET_ERR_ code. NET_EV_CONNECTED or NET_EV_ERROR
+is signalled once the connection attempt completes.
+--------------------------------------------------------*/
+int8_t net_connect( net_proto_type proto, const char *host, uint16_t port,
+                    uint16_t rx_sz, uint16_t tx_sz, net_cb_type cb,
+                    void *ctx )
+{
+    int8_t              sock;       /* loop counter                 */
+
+    for( sock = 0; sock < NET_SOCK_CNT; sock++ )
+    {
+        if( s_socks[ sock ].state == NET_STATE_FREE )
+        {
+            break;
+        }
+    }
+
+    if( sock == NET_SOCK_CNT )
+    {
+        return NET_ERR_NO_SOCK;
+    }
+
+    if( !net_open( sock, rx_sz, tx_sz ) )
+    {
+        return NET_ERR_NO_MEM;
+    }
+
+    s_socks[ sock ].state = NET_STATE_CONNECTING;
+    s_socks[ sock ].proto = proto;
+    s_socks[ sock ].port  = port;
+    s_socks[ sock ].cb    = cb;
+    s_socks[ sock ].ctx   = ctx;
+    strncpy( s_socks[ sock ].host, host, NET_HOST_SZ - 1 );
+    s_socks[ sock ].host[ NET_HOST_SZ - 1 ] = '\0';
+    s_socks[ sock ].retry_at = timer_get_ticks();
+
+    return sock;
+}
+
+
+/*--------------------------------------------------------
+Start a TCP server on a local port. Each connection is
+given its own socket and signalled to the callback with
+NET_EV_ACCEPT. The module supports one server at a time.
+--------------------------------------------------------*/
+int8_t net_listen( uint16_t port, uint16_t rx_sz, uint16_t tx_sz,
+                   net_cb_type cb, void *ctx )
+{
+    if( s_listener.active )
+    {
+        return NET_ERR_BUSY;
+    }
+
+    s_listener.active  = true;
+    s_listener.started = false;
+    s_listener.port    = port;
+    s_listener.rx_sz   = rx_sz;
+    s_listener.tx_sz   = tx_sz;
+    s_listener.cb      = cb;
+    s_listener.ctx     = ctx;
+
+    return 0;
+}
+
+
+/*--------------------------------------------------------
+Change the callback of a socket, e.g. after accept
+--------------------------------------------------------*/
+void net_set_callback( int8_t sock, net_cb_type cb, void *ctx )
+{
+    if( sock < 0 || sock >= NET_SOCK_CNT )
+    {
+        return;
+    }
+
+    s_socks[ sock ].cb  = cb;
+    s_socks[ sock ].ctx = ctx;
+}
+
+
+/*--------------------------------------------------------
+Queue data for transmission. Returns the number of bytes
+queued, which is less than requested when the TX buffer
+is full (NET_EV_WRITABLE follows), or a NET_ERR_ code.
+This has a signature similar to send() of sys/socket.h.
+--------------------------------------------------------*/
+int16_t net_send( int8_t sock, const void *buf, uint16_t bytes )
+{
+    net_sock_type      *s;          /* socket                       */
+    uint16_t            space;      /* free TX bytes                */
+    uint16_t            run;        /* bytes up to the ring end     */
+
+    if( sock < 0 || sock >= NET_SOCK_CNT )
+    {
+        return NET_ERR_BAD_SOCK;
+    }
+
+    s = &s_socks[ sock ];
+    if( s->state == NET_STATE_CLOSED )
+    {
+        return NET_ERR_CLOSED;
+    }
+
+    if( s->state != NET_STATE_OPEN && s->state != NET_STATE_CONNECTING )
+    {
+        return NET_ERR_BAD_SOCK;
+    }
+
+    space = s->tx_sz - 1 - net_tx_used( s );
+    if( bytes > space )
+    {
+        bytes = space;
+        s->want_write = true;
+    }
+
+    if( bytes == 0 )
+    {
+        return 0;
+    }
+
+    /*--------------------------------------------------------
+    The flush delay runs from the oldest unsent byte
+    --------------------------------------------------------*/
+    if( s->tx_head == s->tx_tail )
+    {
+        s->tx_first = timer_get_ticks();
+    }
+    s_writes++;
+
+    /*--------------------------------------------------------
+    Copy in at most two runs when the ring wraps around
+    --------------------------------------------------------*/
+    run = s->tx_sz - s->tx_head;
+    if( run > bytes )
+    {
+        run = bytes;
+    }
+
+    memcpy( &s->tx_buf[ s->tx_head ], buf, run );
+    memcpy( s->tx_buf, (const uint8_t *)buf + run, bytes - run );
+    s->tx_head = ( s->tx_head + bytes ) % s->tx_sz;
+
+    return bytes;
+}
+
+
+/*--------------------------------------------------------
+Read received data. Returns the number of bytes copied,
+0 if none are waiting, or a NET_ERR_ code.
+This has a signature similar to recv() of sys/socket.h.
+--------------------------------------------------------*/
+int16_t net_recv( int8_t sock, void *buf, uint16_t bytes )
+{
+    uint16_t            copied;     /* bytes returned               */
+
+    if( sock < 0 || sock >= NET_SOCK_CNT
+     || s_socks[ sock ].state == NET_STATE_FREE )
+    {
+        return NET_ERR_BAD_SOCK;
+    }
+
+    copied = esp_ipd_link_read( sock, buf, bytes );
+    s_socks[ sock ].rx_seen = esp_ipd_link_avail( sock );
+
+    return copied;
+}
+
+
+/*--------------------------------------------------------
+Close a socket. Queued TX data is sent first, then the
+socket and its buffers are released.
+--------------------------------------------------------*/
+int8_t net_close( int8_t sock )
+{
+    net_sock_type      *s;          /* socket                       */
+
+    if( sock < 0 || sock >= NET_SOCK_CNT
+     || s_socks[ sock ].state == NET_STATE_FREE )
+    {
+        return NET_ERR_BAD_SOCK;
+    }
+
+    s = &s_socks[ sock ];
+    s->cb = NULL;
+
+    if( s->state == NET_STATE_CLOSED
+     || ( s->state == NET_STATE_CONNECTING && !s->start_sent && !s->link_taken ) )
+    {
+        net_free( sock );
+    }
+    else
+    {
+        if( s->state == NET_STATE_CONNECTING && !s->start_sent )
+        {
+            /* the link is someone else's, close it unsent */
+            s->tx_head = s->tx_tail;
+        }
+        s->state = NET_STATE_CLOSING;
+    }
+
+    return 0;
+}
+
+
+/*--------------------------------------------------------
+Check if a socket is connected
+--------------------------------------------------------*/
+bool net_is_open( int8_t sock )
+{
+    return ( sock >= 0 && sock < NET_SOCK_CNT
+          && s_socks[ sock ].state == NET_STATE_OPEN );
+}
+
+
+/*--------------------------------------------------------
+Set how long small writes are held back to be coalesced
+with later ones
+--------------------------------------------------------*/
+void net_set_flush_delay( int8_t sock, timer_ticks_t delay )
+{
+    if( sock >= 0 && sock < NET_SOCK_CNT )
+    {
+        s_socks[ sock ].flush_delay = delay;
+    }
+}
+
+
+/*--------------------------------------------------------
+Make a socket reopen its connection when it is lost
+instead of signalling NET_EV_CLOSED
+--------------------------------------------------------*/
+void net_set_persist( int8_t sock, bool persist )
+{
+    if( sock >= 0 && sock < NET_SOCK_CNT )
+    {
+        s_socks[ sock ].persist = persist;
+    }
+}
+
+
+/*--------------------------------------------------------
+Have the module probe an idle TCP connection every
+seconds (CIPSTART keep alive, 1-7200 s, 0 for none). Set
+it before the connection is made, a persistent socket
+keeps it for every reopen.
+--------------------------------------------------------*/
+void net_set_keepalive( int8_t sock, uint16_t seconds )
+{
+    if( sock >= 0 && sock < NET_SOCK_CNT )
+    {
+        s_socks[ sock ].keepalive = seconds;
+    }
+}
+
+
+/*--------------------------------------------------------
+Change the remote host of a socket. A connection that is
+up stays where it is, the next CIPSTART (a persistent
+socket reopening) goes to the new host.
+--------------------------------------------------------*/
+void net_set_host( int8_t sock, const char *host )
+{
+    if( sock >= 0 && sock < NET_SOCK_CNT )
+    {
+        strncpy( s_socks[ sock ].host, host, NET_HOST_SZ - 1 );
+        s_socks[ sock ].host[ NET_HOST_SZ - 1 ] = '\0';
+    }
+}
+
+
+/*--------------------------------------------------------
+Report the state of the Wi-Fi link, see esp_link.h. While
+it is down no commands are issued; connections are lost,
+persistent sockets wait to be reopened. Once it is up
+again the module is assumed to have been reset, so the
+connection mode and the server are set up again.
+--------------------------------------------------------*/
+void net_set_link( bool up )
+{
+    int8_t              sock;       /* loop counter                 */
+
+    if( up == s_link_up )
+    {
+        return;
+    }
+
+    s_link_up = up;
+    if( up )
+    {
+        s_mux_done         = false;
+        s_listener.started = false;
+        return;
+    }
+
+    for( sock = 0; sock < NET_SOCK_CNT; sock++ )
+    {
+        switch( s_socks[ sock ].state )
+        {
+            case NET_STATE_OPEN:
+                net_drop( sock, NET_EV_CLOSED );
+                break;
+
+            case NET_STATE_CONNECTING:
+                if( s_socks[ sock ].start_sent )
+                {
+                    net_drop( sock, NET_EV_ERROR );
+                }
+                break;
+
+            case NET_STATE_CLOSING:
+                net_free( sock );
+                break;
+
+            default:
+                break;
+        }
+    }
+}
+
+
+/*--------------------------------------------------------
+Send all queued data without waiting for the flush delay
+--------------------------------------------------------*/
+void net_push( int8_t sock )
+{
+    if( sock >= 0 && sock < NET_SOCK_CNT
+     && s_socks[ sock ].tx_head != s_socks[ sock ].tx_tail )
+    {
+        s_socks[ sock ].push = true;
+    }
+}
+
+
+/*--------------------------------------------------------
+Number of bytes queued or in flight on a socket
+--------------------------------------------------------*/
+uint16_t net_tx_pending( int8_t sock )
+{
+    if( sock < 0 || sock >= NET_SOCK_CNT || s_socks[ sock ].tx_sz == 0 )
+    {
+        return 0;
+    }
+
+    return net_tx_used( &s_socks[ sock ] );
+}
+
+
+/*--------------------------------------------------------
+Get write coalescing statistics
+--------------------------------------------------------*/
+void net_get_stats( net_stats_type *stats )
+{
+    esp_at_stats_type   at_stats;   /* AT engine statistics         */
+
+    esp_at_get_stats( &at_stats );
+
+    stats->writes         = s_writes;
+    stats->sends          = s_sends;
+    stats->payload_bytes  = s_payload;
+    stats->bytes_per_send = ( s_sends != 0 ) ? s_payload / s_sends : 0;
+    stats->efficiency_pct = ( at_stats.send_bytes != 0 )
+        ? (uint8_t)( (uint64_t)at_stats.send_bytes * 100
+                   / ( at_stats.send_bytes + at_stats.send_overhead ) )
+        : 0;
+    stats->ms_per_send    = ( at_stats.sends != 0 )
+        ? at_stats.send_ticks / at_stats.sends : 0;
+    stats->reopens        = s_reopens;
+}
+
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+
+/*--------------------------------------------------------
+CIPCLOSE finished, the link is gone either way
+--------------------------------------------------------*/
+static void net_close_done( esp_at_result_type result, void *ctx )
+{
+    int8_t              sock;       /* socket closed                */
+
+    (void)result;
+    sock = (int8_t)(intptr_t)ctx;
+
+    if( s_socks[ sock ].state == NET_STATE_CLOSING )
+    {
+        net_free( sock );
+    }
+}
+
+
+/*--------------------------------------------------------
+The connection of a socket is gone. A persistent socket
+keeps its queued data and goes back to connecting, others
+are closed and told with events.
+--------------------------------------------------------*/
+static void net_drop( int8_t sock, uint8_t events )
+{
+    net_sock_type      *s;          /* socket                       */
+
+    s = &s_socks[ sock ];
+    s->tx_inflight = 0;
+
+    if( !s->persist )
+    {
+        s->state = NET_STATE_CLOSED;
+        net_event( sock, events );
+        return;
+    }
+
+    if( s->state == NET_STATE_OPEN )
+    {
+        s_reopens++;
+    }
+
+    s->state      = NET_STATE_CONNECTING;
+    s->start_sent = false;
+    s->retry_at   = timer_get_ticks() + NET_REOPEN_DELAY;
+}
+
+
+/*--------------------------------------------------------
+Run the callback of a socket
+--------------------------------------------------------*/
+static void net_event( int8_t sock, uint8_t events )
+{
+    if( s_socks[ sock ].cb != NULL )
+    {
+        s_socks[ sock ].cb( sock, events, s_socks[ sock ].ctx );
+    }
+}
+
+
+/*--------------------------------------------------------
+Release a socket and its buffers
+--------------------------------------------------------*/
+static void net_free( int8_t sock )
+{
+    esp_ipd_link_attach( sock, NULL, 0 );
+    memset( &s_socks[ sock ], 0, sizeof( s_socks[ sock ] ) );
+}
+
+
+/*--------------------------------------------------------
+Issue the next AT command any socket is waiting for.
+Sockets take turns so one busy socket can not starve
+the others.
+--------------------------------------------------------*/
+static bool net_issue( void )
+{
+    char                cmd[ NET_CMD_SZ ];
+                                    /* AT command string            */
+    uint8_t             i;          /* loop counter                 */
+    int8_t              sock;       /* socket being checked         */
+
+    if( s_listener.active && !s_listener.started )
+    {
+        sprintf( cmd, "AT+CIPSERVER=1,%u", s_listener.port );
+        return esp_at_cmd( cmd, ESP_AT_TIMEOUT_DFLT, net_server_done, NULL );
+    }
+
+    for( i = 0; i < NET_SOCK_CNT; i++ )
+    {
+        sock = ( s_next + i ) % NET_SOCK_CNT;
+        if( net_issue_sock( sock ) )
+        {
+            s_next = ( sock + 1 ) % NET_SOCK_CNT;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*--------------------------------------------------------
+Issue the AT command a socket is waiting for, if any
+--------------------------------------------------------*/
+static bool net_issue_sock( int8_t sock )
+{
+    net_sock_type      *s;          /* socket                       */
+    char                cmd[ NET_CMD_SZ ];
+                                    /* AT command string            */
+    uint16_t            used;       /* queued TX bytes              */
+    uint16_t            len;        /* TX bytes up to the ring end  */
+
+    s = &s_socks[ sock ];
+
+    switch( s->state )
+    {
+        case NET_STATE_CONNECTING:
+            if( s->start_sent || !timer_expired( s->retry_at ) )
+            {
+                return false;
+            }
+
+            if( s->link_taken )
+            {
+                sprintf( cmd, "AT+CIPCLOSE=%d", sock );
+                return esp_at_cmd( cmd, ESP_AT_TIMEOUT_DFLT, net_taken_done,
+                                   (void *)(intptr_t)sock );
+            }
+
+            len = (uint16_t)snprintf( cmd, sizeof( cmd ), "AT+CIPSTART=%d,\"%s\",\"%s\",%u",
+                                      sock, ( s->proto == NET_UDP ) ? "UDP" : "TCP",
+                                      s->host, s->port );
+            if( s->proto == NET_TCP && s->keepalive != 0 && len < sizeof( cmd ) )
+            {
+                snprintf( &cmd[ len ], sizeof( cmd ) - len, ",%u", s->keepalive );
+            }
+            s->start_sent = esp_at_cmd( cmd, NET_CONN_TIMEOUT, net_start_done,
+                                        (void *)(intptr_t)sock );
+            return s->start_sent;
+
+        case NET_STATE_OPEN:
+        case NET_STATE_CLOSING:
+            if( s->tx_inflight != 0 )
+            {
+                return false;
+            }
+
+            used = net_tx_used( s );
+            if( used != 0 )
+            {
+                if( !net_flush_due( s ) )
+                {
+                    return false;
+                }
+
+                if( used > ESP_AT_SEND_MAX )
+                {
+                    used = ESP_AT_SEND_MAX;
+                }
+
+                /*--------------------------------------------------------
+                A wrapped ring goes out as one CIPSEND in two parts
+                --------------------------------------------------------*/
+                len = s->tx_sz - s->tx_tail;
+                if( len > used )
+                {
+                    len = used;
+                }
+
+                if( esp_at_send_split( sock, &s->tx_buf[ s->tx_tail ], len,
+                                       s->tx_buf, used - len,
+                                       NET_SEND_TIMEOUT, net_send_done,
+                                       (void *)(intptr_t)sock ) )
+                {
+                    s->tx_inflight = used;
+                    if( used == net_tx_used( s ) )
+                    {
+                        s->push = false;
+                    }
+                    s_sends++;
+                    s_payload += used;
+                    return true;
+                }
+                return false;
+            }
+
+            if( s->state == NET_STATE_CLOSING )
+            {
+                sprintf( cmd, "AT+CIPCLOSE=%d", sock );
+                return esp_at_cmd( cmd, ESP_AT_TIMEOUT_DFLT, net_close_done,
+                                   (void *)(intptr_t)sock );
+            }
+            return false;
+
+        default:
+            return false;
+    }
+}
+
+
+/*--------------------------------------------------------
+Check if queued TX data should go out now. A full chunk
+is worth a command round trip, smaller amounts wait for
+more writes until the flush delay expires.
+--------------------------------------------------------*/
+static bool net_flush_due( const net_sock_type *s )
+{
+    uint16_t            chunk;      /* full chunk size              */
+
+    chunk = s->tx_sz - 1;
+    if( chunk > ESP_AT_SEND_MAX )
+    {
+        chunk = ESP_AT_SEND_MAX;
+    }
+
+    return ( s->push
+          || s->state == NET_STATE_CLOSING
+          || net_tx_used( s ) >= chunk
+          || timer_expired( s->tx_first + s->flush_delay ) );
+}
+
+
+/*--------------------------------------------------------
+CIPMUX finished. The module refuses CIPMUX while a link
+is open, which means it is already in the right mode.
+--------------------------------------------------------*/
+static void net_mux_done( esp_at_result_type result, void *ctx )
+{
+    (void)ctx;
+
+    if( result != ESP_AT_TIMEOUT )
+    {
+        s_mux_done = true;
+    }
+}
+
+
+/*--------------------------------------------------------
+Allocate buffers for a socket and attach the RX ring to
+the +IPD parser
+--------------------------------------------------------*/
+static bool net_open( int8_t sock, uint16_t rx_sz, uint16_t tx_sz )
+{
+    net_sock_type      *s;          /* socket                       */
+    uint16_t            off;        /* pool offset of the buffers   */
+
+    if( rx_sz < NET_BUF_MIN )
+    {
+        rx_sz = NET_BUF_MIN;
+    }
+
+    if( tx_sz < NET_BUF_MIN )
+    {
+        tx_sz = NET_BUF_MIN;
+    }
+
+    if( !net_pool_alloc( rx_sz + tx_sz, &off ) )
+    {
+        return false;
+    }
+
+    s = &s_socks[ sock ];
+    memset( s, 0, sizeof( *s ) );
+    s->pool_off = off;
+    s->pool_sz  = rx_sz + tx_sz;
+    s->tx_buf   = &s_pool[ off + rx_sz ];
+    s->tx_sz    = tx_sz;
+    s->flush_delay = NET_FLUSH_DELAY_DFLT;
+
+    esp_ipd_link_attach( sock, &s_pool[ off ], rx_sz );
+
+    return true;
+}
+
+
+/*--------------------------------------------------------
+First fit allocation from the buffer budget. Candidate
+blocks start at the pool start or right after a block
+in use.
+--------------------------------------------------------*/
+static bool net_pool_alloc( uint16_t size, uint16_t *off )
+{
+    uint8_t             i;          /* candidate loop counter       */
+    uint8_t             j;          /* overlap loop counter         */
+    uint16_t            cand;       /* candidate offset             */
+    const net_sock_type
+                       *s;          /* socket owning a block        */
+
+    for( i = 0; i <= NET_SOCK_CNT; i++ )
+    {
+        if( i == NET_SOCK_CNT )
+        {
+            cand = 0;
+        }
+        else if( s_socks[ i ].pool_sz != 0 )
+        {
+            cand = s_socks[ i ].pool_off + s_socks[ i ].pool_sz;
+        }
+        else
+        {
+            continue;
+        }
+
+        if( cand + size > NET_BUF_BUDGET )
+        {
+            continue;
+        }
+
+        for( j = 0; j < NET_SOCK_CNT; j++ )
+        {
+            s = &s_socks[ j ];
+            if( s->pool_sz != 0
+             && cand < s->pool_off + s->pool_sz
+             && s->pool_off < cand + size )
+            {
+                break;
+            }
+        }
+
+        if( j == NET_SOCK_CNT )
+        {
+            *off = cand;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*--------------------------------------------------------
+CIPSEND finished
+--------------------------------------------------------*/
+static void net_send_done( esp_at_result_type result, void *ctx )
+{
+    net_sock_type      *s;          /* socket                       */
+    int8_t              sock;       /* socket id                    */
+
+    sock = (int8_t)(intptr_t)ctx;
+    s    = &s_socks[ sock ];
+
+    if( s->tx_inflight == 0 )
+    {
+        return;
+    }
+
+    if( result == ESP_AT_OK )
+    {
+        s->tx_tail = ( s->tx_tail + s->tx_inflight ) % s->tx_sz;
+    }
+
+    s->tx_inflight = 0;
+
+    /*--------------------------------------------------------
+    A timeout is retried, an error means the link is gone
+    --------------------------------------------------------*/
+    if( result == ESP_AT_ERROR && s->state == NET_STATE_OPEN )
+    {
+        net_drop( sock, NET_EV_CLOSED );
+        return;
+    }
+
+    if( result == ESP_AT_ERROR && s->state == NET_STATE_CLOSING )
+    {
+        net_free( sock );
+        return;
+    }
+
+    if( result == ESP_AT_OK && s->want_write && s->state == NET_STATE_OPEN )
+    {
+        s->want_write = false;
+        net_event( sock, NET_EV_WRITABLE );
+    }
+}
+
+
+/*--------------------------------------------------------
+CIPSERVER finished
+--------------------------------------------------------*/
+static void net_server_done( esp_at_result_type result, void *ctx )
+{
+    (void)ctx;
+
+    if( result == ESP_AT_OK )
+    {
+        s_listener.started = true;
+    }
+}
+
+
+/*--------------------------------------------------------
+CIPSTART finished. ALREADY CONNECTED means the link id is
+held by another connection, one accepted by the server
+or left over from a CIPSTART that timed out; it is not
+this socket's, so it is closed and CIPSTART tried again.
+--------------------------------------------------------*/
+static void net_start_done( esp_at_result_type result, void *ctx )
+{
+    net_sock_type      *s;          /* socket                       */
+    int8_t              sock;       /* socket id                    */
+    bool                ok;         /* link is up                   */
+
+    sock = (int8_t)(intptr_t)ctx;
+    s    = &s_socks[ sock ];
+    ok   = ( result == ESP_AT_OK );
+
+    if( !ok && strcmp( esp_at_info(), "ALREADY CONNECTED" ) == 0 )
+    {
+        if( s->state == NET_STATE_CONNECTING )
+        {
+            s->link_taken = true;
+            s->start_sent = false;
+            s->retry_at   = timer_get_ticks();
+        }
+        else if( s->state == NET_STATE_CLOSING )
+        {
+            /* nothing queued may go to that peer, just close it */
+            s->tx_head = s->tx_tail;
+        }
+        return;
+    }
+
+    if( s->state == NET_STATE_CONNECTING )
+    {
+        if( ok )
+        {
+            s->state = NET_STATE_OPEN;
+            net_event( sock, NET_EV_CONNECTED );
+        }
+        else
+        {
+            net_drop( sock, NET_EV_ERROR );
+        }
+    }
+    else if( s->state == NET_STATE_CLOSING && !ok )
+    {
+        net_free( sock );
+    }
+}
+
+
+/*--------------------------------------------------------
+CIPCLOSE of a link held by a connection the socket did not
+open finished, the link is free either way
+--------------------------------------------------------*/
+static void net_taken_done( esp_at_result_type result, void *ctx )
+{
+    int8_t              sock;       /* socket                       */
+
+    (void)result;
+    sock = (int8_t)(intptr_t)ctx;
+    s_socks[ sock ].link_taken = false;
+}
+
+
+/*--------------------------------------------------------
+Number of bytes queued in the TX ring. A connection
+refused for lack of buffers has no ring.
+--------------------------------------------------------*/
+static uint16_t net_tx_used( const net_sock_type *s )
+{
+    if( s->tx_sz == 0 )
+    {
+        return 0;
+    }
+
+    return ( s->tx_head + s->tx_sz - s->tx_tail ) % s->tx_sz;
+}
+
+
+/*--------------------------------------------------------
+Track link state changes reported by the module
+--------------------------------------------------------*/
+static void net_urc( const char *line )
+{
+    net_sock_type      *s;          /* socket                       */
+    int8_t              sock;       /* link id of the line          */
+    const char         *what;       /* text after "<id>,"           */
+
+    if( line[ 0 ] < '0' || line[ 0 ] >= '0' + NET_SOCK_CNT || line[ 1 ] != ',' )
+    {
+        return;
+    }
+
+    sock = line[ 0 ] - '0';
+    s    = &s_socks[ sock ];
+    what = &line[ 2 ];
+
+    if( strcmp( what, "CONNECT" ) == 0 )
+    {
+        if( s->state == NET_STATE_CONNECTING && s->start_sent )
+        {
+            s->state = NET_STATE_OPEN;
+            net_event( sock, NET_EV_CONNECTED );
+        }
+        else if( s->state == NET_STATE_CONNECTING )
+        {
+            /* The server was given the id net_connect() reserved */
+            s->link_taken = true;
+        }
+        else if( s->state == NET_STATE_FREE && s_listener.active )
+        {
+            /*--------------------------------------------------------
+            Incoming connection on the server. Without buffer
+            space it is accepted and closed again right away.
+            --------------------------------------------------------*/
+            if( net_open( sock, s_listener.rx_sz, s_listener.tx_sz ) )
+            {
+                s->state = NET_STATE_OPEN;
+                s->cb    = s_listener.cb;
+                s->ctx   = s_listener.ctx;
+                net_event( sock, NET_EV_ACCEPT );
+            }
+            else
+            {
+                /* no TX ring, CIPCLOSE goes out right away */
+                s->state = NET_STATE_CLOSING;
+            }
+        }
+    }
+    else if( strcmp( what, "CLOSED" ) == 0
+          || strcmp( what, "CONNECT FAIL" ) == 0 )
+    {
+        switch( s->state )
+        {
+            case NET_STATE_CONNECTING:
+                if( s->start_sent )
+                {
+                    net_drop( sock, NET_EV_ERROR );
+                }
+                else
+                {
+                    s->link_taken = false;
+                }
+                break;
+
+            case NET_STATE_OPEN:
+                net_drop( sock, NET_EV_CLOSED );
+                break;
+
+            case NET_STATE_CLOSING:
+                if( s->tx_inflight == 0 )
+                {
+                    net_free( sock );
+                }
+                else
+                {
+                    s->tx_head = s->tx_tail;
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+}
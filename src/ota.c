@@ -0,0 +1,455 @@
+/*----------------------------------------------------------------------
+                            INCLUDES
+----------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stm32f10x.h"
+
+#include "ota.h"
+#include "net.h"
+#include "shell.h"
+#include "timer.h"
+#include "vect.h"
+
+/*----------------------------------------------------------------------
+                            CONSTANTS
+----------------------------------------------------------------------*/
+
+#define OTA_RX_SZ           512     /* socket receive buffer        */
+#define OTA_TX_SZ           32      /* socket transmit buffer       */
+#define OTA_CHUNK_SZ        64      /* bytes programmed at a time   */
+#define OTA_TIMEOUT_TICKS   10000   /* abort without progress, ms   */
+#define OTA_REQ_SZ          24      /* request line buffer          */
+
+/*----------------------------------------------------------------------
+                            VARIABLES
+----------------------------------------------------------------------*/
+
+static ota_status_type  s_status;   /* update progress              */
+static int8_t           s_sock = -1;/* image server socket          */
+static timer_ticks_t    s_deadline; /* abort if no progress by then */
+static uint8_t          s_hdr[ OTA_IMG_HDR_SZ ];
+                                    /* image header being received  */
+static uint8_t          s_hdr_len;  /* header bytes received        */
+static uint32_t         s_erase_addr;
+                                    /* next page to erase           */
+static uint32_t         s_erase_end;/* end of the pages to erase    */
+static uint32_t         s_crc;      /* expected image CRC           */
+static uint8_t          s_chunk[ OTA_CHUNK_SZ ];
+                                    /* data waiting to be programmed*/
+static uint8_t          s_chunk_len;/* bytes in s_chunk             */
+
+/*----------------------------------------------------------------------
+                            PROCEDURES
+----------------------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+static void ota_data( void );
+static void ota_fail( const char *reason );
+static void ota_finish( void );
+static void ota_header( void );
+static int8_t ota_shell( shell_ctx_type *ctx, uint8_t argc, char *argv[] );
+static void ota_sock_cb( int8_t sock, uint8_t events, void *ctx );
+
+SHELL_CMD( "ota", "[host port], show or start an update", ota_shell );
+
+
+/*--------------------------------------------------------
+Start downloading an image for the inactive slot from a
+TCP image server
+--------------------------------------------------------*/
+int8_t ota_start( const char *host, uint16_t port )
+{
+    if( s_status.state >= OTA_CONNECT && s_status.state <= OTA_DATA )
+    {
+        return OTA_ERR_BUSY;
+    }
+
+    memset( &s_status, 0, sizeof( s_status ) );
+    s_status.slot = ota_running_slot() ^ 1;
+    s_hdr_len     = 0;
+    s_chunk_len   = 0;
+
+    s_sock = net_connect( NET_TCP, host, port, OTA_RX_SZ, OTA_TX_SZ,
+                          ota_sock_cb, NULL );
+    if( s_sock < 0 )
+    {
+        ota_fail( "no socket" );
+        return OTA_ERR_NO_SOCK;
+    }
+
+    s_status.state = OTA_CONNECT;
+    s_deadline     = timer_get_ticks() + OTA_TIMEOUT_TICKS;
+
+    return 0;
+}
+
+
+/*--------------------------------------------------------
+Advance the update, call this from the main loop
+--------------------------------------------------------*/
+void ota_poll( void )
+{
+    switch( s_status.state )
+    {
+    case OTA_HEADER:
+        ota_header();
+        break;
+
+    case OTA_ERASE:
+        /*--------------------------------------------------------
+        One page per call, the CPU stalls for the whole erase.
+        The server sends nothing until asked so no UART data is
+        lost meanwhile.
+        --------------------------------------------------------*/
+        if( !ota_flash_erase( s_erase_addr ) )
+        {
+            ota_fail( "erase" );
+            break;
+        }
+
+        s_erase_addr += OTA_PAGE_SZ;
+        s_deadline    = timer_get_ticks() + OTA_TIMEOUT_TICKS;
+        if( s_erase_addr >= s_erase_end )
+        {
+            net_send( s_sock, "GET\n", 4 );
+            net_push( s_sock );
+            s_status.state = OTA_DATA;
+        }
+        break;
+
+    case OTA_DATA:
+        ota_data();
+        break;
+
+    default:
+        break;
+    }
+
+    if( s_status.state >= OTA_CONNECT && s_status.state <= OTA_DATA
+     && timer_expired( s_deadline ) )
+    {
+        ota_fail( "timeout" );
+    }
+}
+
+
+/*--------------------------------------------------------
+Get a copy of the update progress
+--------------------------------------------------------*/
+void ota_get_status( ota_status_type *status )
+{
+    *status = s_status;
+}
+
+
+/*--------------------------------------------------------
+Slot this image runs from, where its linked vector table
+is. VTOR does not tell once the table is copied to RAM
+(vect.h).
+--------------------------------------------------------*/
+uint8_t ota_running_slot( void )
+{
+    return ( (uint32_t)__isr_vectors >= OTA_SLOT_B_ADDR ) ? 1 : 0;
+}
+
+
+/*--------------------------------------------------------
+Version of the running image, 0 if not installed by OTA
+--------------------------------------------------------*/
+uint32_t ota_running_version( void )
+{
+    const ota_meta_type *cur;       /* boot record in effect        */
+
+    cur = ota_meta_current();
+    if( cur == NULL )
+    {
+        return 0;
+    }
+
+    return cur->slot[ ota_running_slot() ].version;
+}
+
+
+/*--------------------------------------------------------
+Mark a trial image as good so the bootloader keeps it.
+Call once the application is known to work.
+--------------------------------------------------------*/
+void ota_confirm( void )
+{
+    const ota_meta_type *cur;       /* boot record in effect        */
+    ota_meta_type       rec;        /* confirmed record             */
+
+    cur = ota_meta_current();
+    if( cur == NULL
+     || cur->state != OTA_STATE_TRIAL
+     || cur->active != ota_running_slot() )
+    {
+        return;
+    }
+
+    rec       = *cur;
+    rec.state = OTA_STATE_CONFIRMED;
+    ota_meta_write( &rec );
+}
+
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Program received image data. Data is collected into
+s_chunk and programmed in even sized pieces, an odd
+trailing byte waits for the next read.
+--------------------------------------------------------*/
+static void ota_data( void )
+{
+    int16_t             n;          /* bytes read                   */
+    uint32_t            want;       /* image bytes not yet read     */
+    uint8_t             even;       /* bytes that can be programmed */
+
+    while( s_status.received < s_status.size )
+    {
+        want = s_status.size - s_status.received - s_chunk_len;
+        if( want > (uint32_t)( OTA_CHUNK_SZ - s_chunk_len ) )
+        {
+            want = OTA_CHUNK_SZ - s_chunk_len;
+        }
+
+        n = net_recv( s_sock, &s_chunk[ s_chunk_len ], (uint16_t)want );
+        if( n <= 0 )
+        {
+            if( n < 0 )
+            {
+                ota_fail( "connection lost" );
+            }
+            return;
+        }
+
+        s_chunk_len += n;
+        even = s_chunk_len & ~1;
+        if( !ota_flash_write( OTA_SLOT_ADDR( s_status.slot ) + s_status.received,
+                              s_chunk, even ) )
+        {
+            ota_fail( "program" );
+            return;
+        }
+
+        s_status.received += even;
+        s_chunk_len       -= even;
+        s_chunk[ 0 ]       = s_chunk[ even ];
+        s_deadline         = timer_get_ticks() + OTA_TIMEOUT_TICKS;
+    }
+
+    ota_finish();
+}
+
+
+/*--------------------------------------------------------
+Abort the update
+--------------------------------------------------------*/
+static void ota_fail( const char *reason )
+{
+    if( s_sock >= 0 )
+    {
+        net_close( s_sock );
+        s_sock = -1;
+    }
+
+    s_status.state = OTA_FAILED;
+    s_status.error = reason;
+}
+
+
+/*--------------------------------------------------------
+Verify the programmed image and switch to it. The running
+slot is carried over as the rollback target, with an
+unknown size if it was not installed by OTA.
+--------------------------------------------------------*/
+static void ota_finish( void )
+{
+    const ota_meta_type *cur;       /* boot record in effect        */
+    ota_meta_type       rec;        /* new boot record              */
+    ota_slot_info_type  info;       /* new slot contents            */
+
+    info.version = s_status.version;
+    info.size    = s_status.size;
+    info.crc     = s_crc;
+    if( !ota_slot_valid( s_status.slot, &info ) )
+    {
+        ota_fail( "verify" );
+        return;
+    }
+
+    cur = ota_meta_current();
+    if( cur != NULL )
+    {
+        rec = *cur;
+    }
+    else
+    {
+        memset( &rec, 0, sizeof( rec ) );
+    }
+
+    rec.slot[ s_status.slot ] = info;
+    rec.active = s_status.slot;
+    rec.state  = OTA_STATE_TRIAL;
+    if( !ota_meta_write( &rec ) )
+    {
+        ota_fail( "boot record" );
+        return;
+    }
+
+    net_close( s_sock );
+    s_sock         = -1;
+    s_status.state = OTA_DONE;
+}
+
+
+/*--------------------------------------------------------
+Collect and check the image header, then start erasing
+the pages the image needs
+--------------------------------------------------------*/
+static void ota_header( void )
+{
+    int16_t             n;          /* bytes read                   */
+    ota_img_hdr_type    hdr;        /* image header                 */
+    uint32_t            slot_addr;  /* start of the slot            */
+
+    n = net_recv( s_sock, &s_hdr[ s_hdr_len ], OTA_IMG_HDR_SZ - s_hdr_len );
+    if( n <= 0 )
+    {
+        return;
+    }
+
+    s_hdr_len += n;
+    if( s_hdr_len < OTA_IMG_HDR_SZ )
+    {
+        return;
+    }
+
+    memcpy( &hdr, s_hdr, sizeof( hdr ) );
+    if( hdr.magic != OTA_IMG_MAGIC )
+    {
+        ota_fail( "bad header" );
+        return;
+    }
+
+    if( hdr.size == 0 || hdr.size > OTA_SLOT_SZ || hdr.size % 4 != 0 )
+    {
+        ota_fail( "bad size" );
+        return;
+    }
+
+    if( hdr.version <= ota_running_version() )
+    {
+        ota_fail( "old version" );
+        return;
+    }
+
+    s_status.version = hdr.version;
+    s_status.size    = hdr.size;
+    s_crc            = hdr.crc;
+
+    slot_addr      = OTA_SLOT_ADDR( s_status.slot );
+    s_erase_addr   = slot_addr;
+    s_erase_end    = slot_addr + ( ( hdr.size + OTA_PAGE_SZ - 1 ) & ~( OTA_PAGE_SZ - 1 ) );
+    s_deadline     = timer_get_ticks() + OTA_TIMEOUT_TICKS;
+    s_status.state = OTA_ERASE;
+}
+
+
+/*--------------------------------------------------------
+Shell command: show the running image and the update
+progress, or start an update
+--------------------------------------------------------*/
+static int8_t ota_shell( shell_ctx_type *ctx, uint8_t argc, char *argv[] )
+{
+    static const char *const names[] =
+        { "idle", "connect", "header", "erase", "data", "done", "failed" };
+
+    (void)ctx;
+
+    if( argc == 3 )
+    {
+        if( ota_start( argv[ 1 ], (uint16_t)strtoul( argv[ 2 ], NULL, 0 ) ) < 0 )
+        {
+            shell_printf( "%s\n", s_status.error ? s_status.error : "busy" );
+            return SHELL_FAIL;
+        }
+        return SHELL_DONE;
+    }
+
+    if( argc != 1 )
+    {
+        return SHELL_USAGE;
+    }
+
+    shell_printf( "slot %c version %lu\n", ota_running_slot() ? 'B' : 'A',
+                  (unsigned long)ota_running_version() );
+    shell_printf( "update %s", names[ s_status.state ] );
+    if( s_status.state != OTA_IDLE )
+    {
+        shell_printf( ", slot %c version %lu, %lu/%lu bytes",
+                      s_status.slot ? 'B' : 'A',
+                      (unsigned long)s_status.version,
+                      (unsigned long)s_status.received,
+                      (unsigned long)s_status.size );
+    }
+    if( s_status.state == OTA_FAILED )
+    {
+        shell_printf( ": %s", s_status.error );
+    }
+    shell_printf( "\n" );
+
+    return SHELL_DONE;
+}
+
+
+/*--------------------------------------------------------
+Socket events. The request names the slot so the server
+can send the image linked for it.
+--------------------------------------------------------*/
+static void ota_sock_cb( int8_t sock, uint8_t events, void *ctx )
+{
+    char                req[ OTA_REQ_SZ ];
+                                    /* request line                 */
+    int                 len;        /* request length               */
+
+    (void)ctx;
+
+    if( events & ( NET_EV_CLOSED | NET_EV_ERROR ) )
+    {
+        /*--------------------------------------------------------
+        The server may close as soon as it has sent the last
+        bytes, they are still buffered. Only an image that
+        stops short of its size is lost.
+        --------------------------------------------------------*/
+        if( ( events & NET_EV_CLOSED ) && s_status.state == OTA_DATA )
+        {
+            ota_data();
+        }
+        if( s_status.state != OTA_DONE && s_status.state != OTA_FAILED )
+        {
+            ota_fail( "connection lost" );
+        }
+        return;
+    }
+
+    if( ( events & NET_EV_CONNECTED ) && s_status.state == OTA_CONNECT )
+    {
+        len = snprintf( req, sizeof( req ), "OTA %c %lu\n",
+                        s_status.slot ? 'B' : 'A',
+                        (unsigned long)ota_running_version() );
+        net_send( sock, req, (uint16_t)len );
+        net_push( sock );
+        s_status.state = OTA_HEADER;
+        s_deadline     = timer_get_ticks() + OTA_TIMEOUT_TICKS;
+    }
+}
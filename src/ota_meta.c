@@ -0,0 +1,217 @@
+/*----------------------------------------------------------------------
+                            INCLUDES
+----------------------------------------------------------------------*/
+
+#include <stddef.h>
+#include <string.h>
+
+#include "stm32f10x.h"
+#include "stm32f10x_crc.h"
+#include "stm32f10x_flash.h"
+#include "stm32f10x_rcc.h"
+
+#include "ota_meta.h"
+
+/*----------------------------------------------------------------------
+                            CONSTANTS
+----------------------------------------------------------------------*/
+
+#define META_CRC_WORDS      ( offsetof( ota_meta_type, crc ) / 4 )
+#define FLASH_ERR_FLAGS     ( FLASH_FLAG_EOP | FLASH_FLAG_PGERR | FLASH_FLAG_WRPRTERR )
+
+/*----------------------------------------------------------------------
+                            PROCEDURES
+----------------------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+static bool ota_meta_valid( const ota_meta_type *rec );
+
+
+/*--------------------------------------------------------
+Get the boot record in effect, NULL if neither record
+page holds a valid one
+--------------------------------------------------------*/
+const ota_meta_type *ota_meta_current( void )
+{
+    const ota_meta_type *rec;       /* record being checked         */
+    const ota_meta_type *best;      /* newest valid record          */
+    uint8_t             page;       /* record page index            */
+
+    best = NULL;
+    for( page = 0; page < OTA_META_PAGES; page++ )
+    {
+        rec = (const ota_meta_type *)( OTA_META_ADDR + page * OTA_PAGE_SZ );
+        if( ota_meta_valid( rec )
+         && ( best == NULL || (int32_t)( rec->seq - best->seq ) > 0 ) )
+        {
+            best = rec;
+        }
+    }
+
+    return best;
+}
+
+
+/*--------------------------------------------------------
+Write a new boot record. The magic, sequence number and
+CRC of rec are filled in. The record goes to the page not
+holding the current one, so a power loss at any point
+leaves one of the two in effect.
+--------------------------------------------------------*/
+bool ota_meta_write( ota_meta_type *rec )
+{
+    const ota_meta_type *cur;       /* record in effect             */
+    uint32_t            addr;       /* page to write                */
+
+    cur = ota_meta_current();
+
+    rec->magic    = OTA_META_MAGIC;
+    rec->seq      = ( cur == NULL ) ? 1 : cur->seq + 1;
+    rec->reserved = 0xFFFF;
+    rec->crc      = ota_crc32( 0xFFFFFFFF, (const uint32_t *)rec, META_CRC_WORDS );
+    memset( rec->tries, 0xFF, sizeof( rec->tries ) );
+
+    addr = OTA_META_ADDR;
+    if( cur == (const ota_meta_type *)OTA_META_ADDR )
+    {
+        addr += OTA_PAGE_SZ;
+    }
+
+    if( !ota_flash_erase( addr )
+     || !ota_flash_write( addr, rec, sizeof( *rec ) ) )
+    {
+        return false;
+    }
+
+    return memcmp( (const void *)addr, rec, sizeof( *rec ) ) == 0;
+}
+
+
+/*--------------------------------------------------------
+Use up one boot of a trial image. Returns false if all
+tries have been used already.
+--------------------------------------------------------*/
+bool ota_meta_use_try( const ota_meta_type *rec )
+{
+    uint8_t             i;          /* tries index                  */
+    uint16_t            used;       /* value of a used entry        */
+
+    used = 0;
+    for( i = 0; i < OTA_TRIAL_BOOTS; i++ )
+    {
+        if( rec->tries[ i ] == 0xFFFF )
+        {
+            return ota_flash_write( (uint32_t)&rec->tries[ i ], &used, sizeof( used ) );
+        }
+    }
+
+    return false;
+}
+
+
+/*--------------------------------------------------------
+Check that a slot holds a bootable image: the vector table
+must point into RAM and into the slot, and when the size
+is known the image CRC must match. The CRC is computed by
+the CRC unit directly from flash.
+--------------------------------------------------------*/
+bool ota_slot_valid( uint8_t slot, const ota_slot_info_type *info )
+{
+    uint32_t            addr;       /* slot start                   */
+    const uint32_t     *vec;        /* image vector table           */
+    uint32_t            crc;        /* computed image CRC           */
+
+    addr = OTA_SLOT_ADDR( slot );
+    vec  = (const uint32_t *)addr;
+
+    if( vec[ 0 ] <= OTA_RAM_ADDR || vec[ 0 ] > OTA_RAM_ADDR + OTA_RAM_SZ
+     || ( vec[ 1 ] & 1 ) == 0
+     || vec[ 1 ] < addr || vec[ 1 ] >= addr + OTA_SLOT_SZ )
+    {
+        return false;
+    }
+
+    if( info == NULL || info->size == 0 )
+    {
+        return true;
+    }
+
+    if( info->size > OTA_SLOT_SZ || info->size % 4 != 0 )
+    {
+        return false;
+    }
+
+    RCC_AHBPeriphClockCmd( RCC_AHBPeriph_CRC, ENABLE );
+    CRC_ResetDR();
+    crc = CRC_CalcBlockCRC( (uint32_t *)addr, info->size / 4 );
+
+    return crc == info->crc;
+}
+
+
+/*--------------------------------------------------------
+Erase the flash page starting at addr
+--------------------------------------------------------*/
+bool ota_flash_erase( uint32_t addr )
+{
+    FLASH_Status        status;     /* erase result                 */
+
+    FLASH_Unlock();
+    FLASH_ClearFlag( FLASH_ERR_FLAGS );
+    status = FLASH_ErasePage( addr );
+    FLASH_Lock();
+
+    return status == FLASH_COMPLETE;
+}
+
+
+/*--------------------------------------------------------
+Program erased flash. addr and bytes must be even, data
+may be unaligned. The CPU stalls while each half word is
+programmed but interrupts are taken in between.
+--------------------------------------------------------*/
+bool ota_flash_write( uint32_t addr, const void *data, uint32_t bytes )
+{
+    const uint8_t      *src;        /* next source bytes            */
+    uint16_t            half;       /* half word to program         */
+    FLASH_Status        status;     /* program result               */
+
+    src    = data;
+    status = FLASH_COMPLETE;
+
+    FLASH_Unlock();
+    FLASH_ClearFlag( FLASH_ERR_FLAGS );
+    while( bytes >= 2 && status == FLASH_COMPLETE )
+    {
+        half = (uint16_t)( src[ 0 ] | ( src[ 1 ] << 8 ) );
+        if( half != 0xFFFF )
+        {
+            status = FLASH_ProgramHalfWord( addr, half );
+        }
+
+        addr  += 2;
+        src   += 2;
+        bytes -= 2;
+    }
+    FLASH_Lock();
+
+    return status == FLASH_COMPLETE;
+}
+
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Check the magic, active slot and CRC of a record
+--------------------------------------------------------*/
+static bool ota_meta_valid( const ota_meta_type *rec )
+{
+    return rec->magic == OTA_META_MAGIC
+        && rec->active < OTA_SLOT_CNT
+        && ( rec->state == OTA_STATE_CONFIRMED || rec->state == OTA_STATE_TRIAL )
+        && rec->crc == ota_crc32( 0xFFFFFFFF, (const uint32_t *)rec, META_CRC_WORDS );
+}
@@ -0,0 +1,592 @@
+/*----------------------------------------------------------------------
+                            INCLUDES
+----------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "proto.h"
+#include "cobs.h"
+#include "shell.h"
+#include "timer.h"
+#include "uart_print.h"
+
+/*----------------------------------------------------------------------
+                            CONSTANTS
+----------------------------------------------------------------------*/
+
+#if PROTO_ENC_MAX > UART_MUX_UNIT_MAX
+#error "a frame must go out as one UART unit"
+#endif
+
+#if PROTO_CH_CNT != UART_MUX_CH_CNT || PROTO_CH_CONTROL != UART_MUX_CH_URGENT \
+ || PROTO_CH_CONSOLE != UART_MUX_CH_CONSOLE
+#error "protocol channels must be the UART channels"
+#endif
+
+/*----------------------------------------------------------------------
+                            TYPES
+----------------------------------------------------------------------*/
+
+typedef struct                      /* receive slot                 */
+{
+    uint8_t             buf[ PROTO_ENC_MAX ];
+                                    /* encoded, then decoded frame  */
+    uint16_t            len;        /* encoded length               */
+    uint64_t            rx_us;      /* time of the delimiter        */
+    volatile bool       ready;      /* complete, owned by the loop  */
+} proto_slot_type;
+
+typedef enum                        /* remembered request state     */
+{
+    PROTO_DUP_FREE,                 /* slot unused                  */
+    PROTO_DUP_OPEN,                 /* being served                 */
+    PROTO_DUP_REPLIED,              /* done, final reply kept       */
+    PROTO_DUP_RERUN                 /* done, reply too long to keep */
+} proto_dup_state_type;
+
+typedef struct                      /* remembered request           */
+{
+    uint8_t             type;       /* message type                 */
+    uint8_t             seq;        /* sequence number              */
+    uint16_t            crc;        /* payload CRC                  */
+    uint8_t             state;      /* proto_dup_state_type         */
+    uint8_t             reply_type; /* final reply type             */
+    uint8_t             reply_len;  /* final reply length           */
+    uint8_t             reply[ PROTO_DUP_REPLY_MAX ];
+                                    /* final reply payload          */
+} proto_dup_type;
+
+typedef struct                      /* message type handler         */
+{
+    uint8_t             type;       /* message type                 */
+    proto_handler_type  handler;    /* handler function             */
+} proto_entry_type;
+
+/*----------------------------------------------------------------------
+                            VARIABLES
+----------------------------------------------------------------------*/
+
+static proto_slot_type  s_rx[ PROTO_RX_SLOTS ];
+                                    /* receive slots                */
+static uint8_t          s_rx_head;  /* slot being filled (ISR)      */
+static uint8_t          s_rx_tail;  /* next slot to handle (loop)   */
+static uint16_t         s_rx_len;   /* bytes in the slot being      */
+                                    /* filled (ISR)                 */
+static bool             s_rx_skip;  /* dropping to the next         */
+                                    /* delimiter (ISR)              */
+static uint8_t          s_tx[ PROTO_ENC_MAX ];
+                                    /* frame at s_tx[ 1 ], encoded  */
+                                    /* in place                     */
+static proto_entry_type s_handlers[ PROTO_HANDLER_MAX ];
+                                    /* registered message types     */
+static proto_stats_type s_stats;    /* protocol statistics          */
+static proto_dup_type   s_dups[ PROTO_DUP_SLOTS ];
+                                    /* recent requests              */
+static uint8_t          s_dup_next; /* slot to reuse next           */
+
+/*----------------------------------------------------------------------
+                            PROCEDURES
+----------------------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+static uint8_t proto_channel( uint8_t type, uint8_t seq );
+static uint16_t proto_console( const void *buf, uint16_t bytes, bool urgent );
+static bool proto_duplicate( const proto_frame_type *frame, uint16_t crc );
+static uint16_t proto_encode( uint8_t *enc, uint8_t type, uint8_t flags,
+                              uint8_t seq, uint16_t len );
+static void proto_handle( uint8_t *buf, uint16_t len, uint64_t rx_us );
+static void proto_nak( uint8_t seq, uint8_t reason );
+static void proto_ping( const proto_frame_type *frame );
+static void proto_rx_byte( uint8_t byte );
+static int8_t proto_shell_stats( shell_ctx_type *ctx, uint8_t argc,
+                                 char *argv[] );
+static int8_t proto_transmit( uint8_t ch, uint8_t type, uint8_t flags,
+                              uint8_t seq, const void *payload, uint16_t len );
+
+SHELL_CMD( "proto", "control protocol statistics", proto_shell_stats );
+
+
+/*--------------------------------------------------------
+Take over UART 1 receive, and stdio output, which is sent
+as PROTO_T_CONSOLE frames from now on. uart_init() must
+be called first.
+--------------------------------------------------------*/
+void proto_init( void )
+{
+    memset( s_rx, 0, sizeof( s_rx ) );
+    memset( s_handlers, 0, sizeof( s_handlers ) );
+    memset( &s_stats, 0, sizeof( s_stats ) );
+    memset( s_dups, 0, sizeof( s_dups ) );
+    s_dup_next = 0;
+    s_rx_head = 0;
+    s_rx_tail = 0;
+    s_rx_len  = 0;
+    s_rx_skip = false;
+
+    proto_register( PROTO_T_PING, proto_ping );
+    uart_set_rx_handler( proto_rx_byte );
+    uart_set_console( proto_console );
+}
+
+
+/*--------------------------------------------------------
+Handle received frames, call this from the main loop
+--------------------------------------------------------*/
+void proto_poll( void )
+{
+    proto_slot_type    *slot;       /* slot being handled           */
+
+    while( s_rx[ s_rx_tail ].ready )
+    {
+        slot = &s_rx[ s_rx_tail ];
+        proto_handle( slot->buf, slot->len, slot->rx_us );
+
+        slot->ready = false;
+        s_rx_tail = ( s_rx_tail + 1 ) % PROTO_RX_SLOTS;
+    }
+}
+
+
+/*--------------------------------------------------------
+Register the handler of a message type, replacing any
+earlier one
+--------------------------------------------------------*/
+int8_t proto_register( uint8_t type, proto_handler_type handler )
+{
+    uint8_t             i;          /* loop counter                 */
+
+    for( i = 0; i < PROTO_HANDLER_MAX; i++ )
+    {
+        if( s_handlers[ i ].handler == NULL || s_handlers[ i ].type == type )
+        {
+            s_handlers[ i ].type    = type;
+            s_handlers[ i ].handler = handler;
+            return 0;
+        }
+    }
+
+    return PROTO_ERR_FULL;
+}
+
+
+/*--------------------------------------------------------
+Payload area of the transmit frame. Data written here and
+passed to proto_send() is sent without a copy.
+--------------------------------------------------------*/
+uint8_t *proto_tx_payload( void )
+{
+    return &s_tx[ 1 + PROTO_HDR_SZ ];
+}
+
+
+/*--------------------------------------------------------
+Build, encode and queue a frame on the channel of its
+request or type (proto_wire.h). Blocks until the frame
+has been queued whole.
+--------------------------------------------------------*/
+int8_t proto_send( uint8_t type, uint8_t flags, uint8_t seq,
+                   const void *payload, uint16_t len )
+{
+    return proto_transmit( proto_channel( type, seq ), type, flags, seq,
+                           payload, len );
+}
+
+
+/*--------------------------------------------------------
+Send the last reply to a request, remembering it if it
+is short enough to be sent again for a retransmitted
+copy of the request
+--------------------------------------------------------*/
+int8_t proto_reply( uint8_t type, uint8_t seq, const void *payload,
+                    uint16_t len )
+{
+    uint8_t             i;          /* loop counter                 */
+    proto_dup_type     *dup;        /* the request's slot           */
+    uint8_t             ch;         /* channel, while still open    */
+
+    ch = proto_channel( type, seq );
+    for( i = 0; i < PROTO_DUP_SLOTS; i++ )
+    {
+        dup = &s_dups[ i ];
+        if( dup->state != PROTO_DUP_OPEN || dup->seq != seq )
+        {
+            continue;
+        }
+
+        if( len <= PROTO_DUP_REPLY_MAX )
+        {
+            dup->reply_type = type;
+            dup->reply_len  = (uint8_t)len;
+            memcpy( dup->reply, payload, len );
+            dup->state = PROTO_DUP_REPLIED;
+        }
+        else
+        {
+            dup->state = PROTO_DUP_RERUN;
+        }
+        break;
+    }
+
+    return proto_transmit( ch, type, 0, seq, payload, len );
+}
+
+
+/*--------------------------------------------------------
+Get a copy of the protocol statistics
+--------------------------------------------------------*/
+void proto_get_stats( proto_stats_type *stats )
+{
+    *stats = s_stats;
+}
+
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Channel of a frame: that of the request it answers while
+the request is open, so all its replies stay in order,
+else that of its type
+--------------------------------------------------------*/
+static uint8_t proto_channel( uint8_t type, uint8_t seq )
+{
+    uint8_t             i;          /* loop counter                 */
+
+    for( i = 0; i < PROTO_DUP_SLOTS; i++ )
+    {
+        if( s_dups[ i ].state == PROTO_DUP_OPEN && s_dups[ i ].seq == seq )
+        {
+            type = s_dups[ i ].type;
+            break;
+        }
+    }
+
+    switch( type )
+    {
+        case PROTO_T_MEM_READ:
+        case PROTO_T_MEM_DATA:
+        case PROTO_T_WATCH_DATA:
+            return PROTO_CH_BULK;
+
+        case PROTO_T_LOG_OPEN:
+        case PROTO_T_LOG_DATA:
+        case PROTO_T_LOG_END:
+            return PROTO_CH_LOG;
+
+        case PROTO_T_SHELL:
+        case PROTO_T_SHELL_OUT:
+        case PROTO_T_CONSOLE:
+            return PROTO_CH_CONSOLE;
+
+        default:
+            return PROTO_CH_CONTROL;
+    }
+}
+
+
+/*--------------------------------------------------------
+Console handler: stdio output as PROTO_T_CONSOLE frames,
+stderr on the control channel. The frame is built on the
+stack, as output may come from an interrupt while the
+loop is building one in s_tx.
+--------------------------------------------------------*/
+static uint16_t proto_console( const void *buf, uint16_t bytes, bool urgent )
+{
+    uint8_t             enc[ PROTO_ENC_MAX ];
+                                    /* frame at enc[ 1 ]            */
+    uint8_t             ch;         /* channel                      */
+    uint16_t            done;       /* bytes sent                   */
+    uint16_t            n;          /* bytes in this frame          */
+
+    ch = urgent ? PROTO_CH_CONTROL : PROTO_CH_CONSOLE;
+    for( done = 0; done < bytes; done += n )
+    {
+        n = bytes - done;
+        if( n > PROTO_PAYLOAD_MAX )
+        {
+            n = PROTO_PAYLOAD_MAX;
+        }
+
+        memcpy( &enc[ 1 + PROTO_HDR_SZ ], (const uint8_t *)buf + done, n );
+        uart_mux_write( ch, enc, proto_encode( enc, PROTO_T_CONSOLE,
+                                               PROTO_F_CH( ch ), 0, n ) );
+        s_stats.tx_frames++;
+    }
+
+    return bytes;
+}
+
+
+/*--------------------------------------------------------
+Check a request against the recent ones. A new one is
+remembered and dispatched; a retransmitted copy is
+dropped while the original is served, answered with the
+kept reply once it is done, or dispatched again if none
+was kept.
+--------------------------------------------------------*/
+static bool proto_duplicate( const proto_frame_type *frame, uint16_t crc )
+{
+    uint8_t             i;          /* loop counter                 */
+    proto_dup_type     *dup;        /* matching or reused slot      */
+
+    for( i = 0; i < PROTO_DUP_SLOTS; i++ )
+    {
+        dup = &s_dups[ i ];
+        if( dup->state == PROTO_DUP_FREE || dup->seq != frame->seq
+         || dup->type != frame->type || dup->crc != crc )
+        {
+            continue;
+        }
+
+        s_stats.duplicates++;
+        switch( dup->state )
+        {
+            case PROTO_DUP_REPLIED:
+                proto_send( dup->reply_type, 0, dup->seq, dup->reply,
+                            dup->reply_len );
+                return true;
+
+            case PROTO_DUP_RERUN:
+                dup->state = PROTO_DUP_OPEN;
+                return false;
+
+            default:
+                return true;
+        }
+    }
+
+    dup = &s_dups[ s_dup_next ];
+    s_dup_next = ( s_dup_next + 1 ) % PROTO_DUP_SLOTS;
+
+    dup->type  = frame->type;
+    dup->seq   = frame->seq;
+    dup->crc   = crc;
+    dup->state = PROTO_DUP_OPEN;
+
+    return false;
+}
+
+
+/*--------------------------------------------------------
+Fill in the header and CRC of the frame at enc[ 1 ], its
+payload already in place, and encode it in place. Returns
+the bytes to send, delimiter included.
+--------------------------------------------------------*/
+static uint16_t proto_encode( uint8_t *enc, uint8_t type, uint8_t flags,
+                              uint8_t seq, uint16_t len )
+{
+    uint8_t            *frame;      /* frame start in enc           */
+    uint16_t            crc;        /* payload CRC                  */
+    uint16_t            enc_len;    /* encoded length               */
+
+    frame = &enc[ 1 ];
+    frame[ 0 ] = type;
+    frame[ 1 ] = flags;
+    frame[ 2 ] = seq;
+    frame[ 3 ] = (uint8_t)len;
+    frame[ 4 ] = (uint8_t)( len >> 8 );
+    frame[ 5 ] = proto_crc8( frame, 5 );
+
+    crc = proto_crc16( &frame[ PROTO_HDR_SZ ], len );
+    frame[ PROTO_HDR_SZ + len ]     = (uint8_t)crc;
+    frame[ PROTO_HDR_SZ + len + 1 ] = (uint8_t)( crc >> 8 );
+
+    enc_len = cobs_encode( enc, PROTO_HDR_SZ + len + PROTO_CRC_SZ );
+    enc[ enc_len ] = 0;
+
+    return enc_len + 1;
+}
+
+
+/*--------------------------------------------------------
+Decode and check one frame in its slot, then dispatch it
+--------------------------------------------------------*/
+static void proto_handle( uint8_t *buf, uint16_t len, uint64_t rx_us )
+{
+    int16_t             dec_len;    /* decoded frame length         */
+    proto_frame_type    frame;      /* decoded frame                */
+    uint16_t            crc;        /* received payload CRC         */
+    uint8_t             i;          /* loop counter                 */
+    uint8_t             reason;     /* NAK reason                   */
+
+    dec_len = cobs_decode( buf, len );
+    if( dec_len < 0 )
+    {
+        s_stats.cobs_errors++;
+        return;
+    }
+
+    if( dec_len < PROTO_HDR_SZ + PROTO_CRC_SZ
+     || proto_crc8( buf, 5 ) != buf[ 5 ] )
+    {
+        s_stats.hdr_errors++;
+        return;
+    }
+
+    frame.type    = buf[ 0 ];
+    frame.flags   = buf[ 1 ];
+    frame.seq     = buf[ 2 ];
+    frame.len     = (uint16_t)( buf[ 3 ] | ( buf[ 4 ] << 8 ) );
+    frame.payload = &buf[ PROTO_HDR_SZ ];
+    frame.rx_us   = rx_us;
+
+    if( PROTO_HDR_SZ + frame.len + PROTO_CRC_SZ != dec_len )
+    {
+        s_stats.len_errors++;
+        if( ( frame.flags & PROTO_F_NOREPLY ) == 0 )
+        {
+            proto_nak( frame.seq, PROTO_NAK_LEN );
+        }
+        return;
+    }
+
+    crc = (uint16_t)( frame.payload[ frame.len ] | ( frame.payload[ frame.len + 1 ] << 8 ) );
+    if( proto_crc16( frame.payload, frame.len ) != crc )
+    {
+        s_stats.crc_errors++;
+        if( ( frame.flags & PROTO_F_NOREPLY ) == 0 )
+        {
+            proto_nak( frame.seq, PROTO_NAK_CRC );
+        }
+        return;
+    }
+
+    s_stats.rx_frames++;
+    if( ( frame.flags & PROTO_F_NOREPLY ) == 0 && proto_duplicate( &frame, crc ) )
+    {
+        return;
+    }
+
+    for( i = 0; i < PROTO_HANDLER_MAX && s_handlers[ i ].handler != NULL; i++ )
+    {
+        if( s_handlers[ i ].type == frame.type )
+        {
+            s_handlers[ i ].handler( &frame );
+            return;
+        }
+    }
+
+    s_stats.unknown++;
+    if( frame.flags & PROTO_F_NOREPLY )
+    {
+        return;
+    }
+    reason = PROTO_NAK_TYPE;
+    proto_reply( PROTO_T_NAK, frame.seq, &reason, 1 );
+}
+
+
+/*--------------------------------------------------------
+Reject a frame whose header could be trusted
+--------------------------------------------------------*/
+static void proto_nak( uint8_t seq, uint8_t reason )
+{
+    proto_send( PROTO_T_NAK, 0, seq, &reason, 1 );
+}
+
+
+/*--------------------------------------------------------
+Answer a ping with its own payload
+--------------------------------------------------------*/
+static void proto_ping( const proto_frame_type *frame )
+{
+    proto_reply( PROTO_T_PONG, frame->seq, frame->payload, frame->len );
+}
+
+
+/*--------------------------------------------------------
+Collect bytes into the current receive slot, called from
+the UART 1 interrupt. A frame that does not fit, or finds
+no free slot, is skipped up to its delimiter; the frames
+around it are not affected.
+--------------------------------------------------------*/
+static void proto_rx_byte( uint8_t byte )
+{
+    proto_slot_type    *slot;       /* slot being filled            */
+
+    slot = &s_rx[ s_rx_head ];
+
+    if( byte == 0 )
+    {
+        if( s_rx_skip )
+        {
+            s_rx_skip = false;
+        }
+        else if( s_rx_len != 0 )
+        {
+            slot->len   = s_rx_len;
+            slot->rx_us = timer_get_us();
+            slot->ready = true;
+            s_rx_head   = ( s_rx_head + 1 ) % PROTO_RX_SLOTS;
+        }
+
+        s_rx_len = 0;
+        return;
+    }
+
+    if( s_rx_skip )
+    {
+        return;
+    }
+
+    if( slot->ready || s_rx_len >= PROTO_ENC_MAX - 1 )
+    {
+        s_stats.overflows++;
+        s_rx_skip = true;
+        return;
+    }
+
+    slot->buf[ s_rx_len++ ] = byte;
+}
+
+
+/*--------------------------------------------------------
+Shell command: print the protocol statistics
+--------------------------------------------------------*/
+static int8_t proto_shell_stats( shell_ctx_type *ctx, uint8_t argc,
+                                 char *argv[] )
+{
+    (void)ctx;
+    (void)argc;
+    (void)argv;
+
+    shell_printf( "rx %lu tx %lu\n", (unsigned long)s_stats.rx_frames,
+                  (unsigned long)s_stats.tx_frames );
+    shell_printf( "cobs %u hdr %u len %u crc %u overflow %u unknown %u dup %u\n",
+                  s_stats.cobs_errors, s_stats.hdr_errors, s_stats.len_errors,
+                  s_stats.crc_errors, s_stats.overflows, s_stats.unknown,
+                  s_stats.duplicates );
+    return SHELL_DONE;
+}
+
+
+/*--------------------------------------------------------
+Build the frame in s_tx and queue it on a channel, tagged
+with it
+--------------------------------------------------------*/
+static int8_t proto_transmit( uint8_t ch, uint8_t type, uint8_t flags,
+                              uint8_t seq, const void *payload, uint16_t len )
+{
+    uint8_t            *frame;      /* frame start in s_tx          */
+
+    if( len > PROTO_PAYLOAD_MAX )
+    {
+        return PROTO_ERR_LEN;
+    }
+
+    frame = &s_tx[ 1 ];
+    if( payload != &frame[ PROTO_HDR_SZ ] )
+    {
+        memmove( &frame[ PROTO_HDR_SZ ], payload, len );
+    }
+
+    flags = (uint8_t)( ( flags & ~PROTO_F_CH_MASK ) | PROTO_F_CH( ch ) );
+    uart_mux_write( ch, s_tx, proto_encode( s_tx, type, flags, seq, len ) );
+
+    s_stats.tx_frames++;
+
+    return 0;
+}
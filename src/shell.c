@@ -0,0 +1,358 @@
+/*----------------------------------------------------------------------
+                            INCLUDES
+----------------------------------------------------------------------*/
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "shell.h"
+#include "shell_hash.h"
+#include "shell_table.h"
+#include "proto.h"
+#include "timer.h"
+
+/*----------------------------------------------------------------------
+                            VARIABLES
+----------------------------------------------------------------------*/
+
+extern const shell_cmd_type __shell_cmds_start[];
+extern const shell_cmd_type __shell_cmds_end[];
+                                    /* from sections.ld             */
+
+static bool             s_hashed;   /* commands placed in s_slots,  */
+                                    /* else they are searched       */
+static uint8_t          s_slots[ SHELL_HASH_SZ ];
+                                    /* command index per hash slot  */
+static char             s_line[ SHELL_LINE_MAX ];
+                                    /* line, split into arguments   */
+static char            *s_argv[ SHELL_ARGS_MAX ];
+                                    /* arguments in s_line          */
+static uint8_t          s_argc;     /* number of arguments          */
+static const shell_cmd_type
+                       *s_cmd;      /* running command, or NULL     */
+static shell_ctx_type   s_ctx;      /* running command's state      */
+static uint8_t          s_seq;      /* sequence number of the line  */
+static char             s_out[ PROTO_PAYLOAD_MAX ];
+                                    /* output not yet sent          */
+static uint16_t         s_out_len;  /* bytes in s_out               */
+
+/*----------------------------------------------------------------------
+                            PROCEDURES
+----------------------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+static void shell_finish( int8_t result );
+static void shell_flush( void );
+static void shell_line( const proto_frame_type *frame );
+static const shell_cmd_type *shell_lookup( const char *name );
+static uint8_t shell_split( char *line, char *argv[] );
+static int8_t shell_help( shell_ctx_type *ctx, uint8_t argc, char *argv[] );
+static int8_t shell_uptime( shell_ctx_type *ctx, uint8_t argc, char *argv[] );
+
+SHELL_CMD( "help", "list the commands", shell_help );
+SHELL_CMD( "uptime", "time since reset", shell_uptime );
+
+
+/*--------------------------------------------------------
+Place the commands in the dispatch table with the seed
+from shell_table.h and register for shell lines. The
+shell is registered either way; if the seed does not fit
+the linked commands they are found by searching the
+table, and the caller should report SHELL_ERR_HASH.
+--------------------------------------------------------*/
+int8_t shell_init( void )
+{
+    s_hashed = shell_hash_place( __shell_cmds_start,
+                                 __shell_cmds_end - __shell_cmds_start,
+                                 SHELL_SEED, s_slots );
+
+    s_cmd     = NULL;
+    s_out_len = 0;
+    proto_register( PROTO_T_SHELL, shell_line );
+
+    return s_hashed ? 0 : SHELL_ERR_HASH;
+}
+
+
+/*--------------------------------------------------------
+Run a step of the current command and send its output,
+call this from the main loop after proto_poll()
+--------------------------------------------------------*/
+void shell_poll( void )
+{
+    int8_t              result;     /* command result               */
+
+    if( s_cmd == NULL )
+    {
+        return;
+    }
+
+    result = s_cmd->fn( &s_ctx, s_argc, s_argv );
+    if( result == SHELL_MORE )
+    {
+        shell_flush();
+        return;
+    }
+
+    if( result == SHELL_USAGE )
+    {
+        shell_printf( "usage: %s %s\n", s_cmd->name, s_cmd->usage );
+    }
+
+    shell_finish( result );
+}
+
+
+/*--------------------------------------------------------
+Formatted command output. Output is sent a frame at a
+time; a full frame is sent right away, blocking while it
+is written to the UART, the rest at the end of the step.
+--------------------------------------------------------*/
+void shell_printf( const char *fmt, ... )
+{
+    va_list             args;       /* format arguments             */
+    int                 len;        /* formatted length             */
+
+    va_start( args, fmt );
+    len = vsnprintf( &s_out[ s_out_len ], sizeof( s_out ) - s_out_len,
+                     fmt, args );
+    va_end( args );
+
+    if( len < 0 )
+    {
+        return;
+    }
+
+    if( s_out_len + len >= (int)sizeof( s_out ) && s_out_len != 0 )
+    {
+        /*--------------------------------------------------------
+        Did not fit behind earlier output, send that and format
+        again at the start of the buffer
+        --------------------------------------------------------*/
+        shell_flush();
+
+        va_start( args, fmt );
+        len = vsnprintf( s_out, sizeof( s_out ), fmt, args );
+        va_end( args );
+
+        if( len < 0 )
+        {
+            return;
+        }
+    }
+
+    s_out_len += len;
+    if( s_out_len >= sizeof( s_out ) )
+    {
+        /* truncated to one frame, without the terminator */
+        s_out_len = sizeof( s_out ) - 1;
+        shell_flush();
+    }
+}
+
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+
+/*--------------------------------------------------------
+End the running command and report its result
+--------------------------------------------------------*/
+static void shell_finish( int8_t result )
+{
+    uint8_t             status;     /* STATUS code                  */
+
+    shell_flush();
+
+    status = ( result == SHELL_DONE ) ? PROTO_ST_OK : PROTO_ST_FAIL;
+    proto_reply( PROTO_T_STATUS, s_seq, &status, 1 );
+
+    s_cmd = NULL;
+}
+
+
+/*--------------------------------------------------------
+Send buffered output
+--------------------------------------------------------*/
+static void shell_flush( void )
+{
+    if( s_out_len == 0 )
+    {
+        return;
+    }
+
+    proto_send( PROTO_T_SHELL_OUT, 0, s_seq, s_out, s_out_len );
+    s_out_len = 0;
+}
+
+
+/*--------------------------------------------------------
+PROTO_T_SHELL: take a command line. The command runs from
+shell_poll(), the frame is only valid during this call.
+--------------------------------------------------------*/
+static void shell_line( const proto_frame_type *frame )
+{
+    uint8_t             status;     /* STATUS code                  */
+
+    if( s_cmd != NULL )
+    {
+        status = PROTO_ST_BUSY;
+        proto_reply( PROTO_T_STATUS, frame->seq, &status, 1 );
+        return;
+    }
+
+    if( frame->len >= SHELL_LINE_MAX )
+    {
+        status = PROTO_ST_BAD_LEN;
+        proto_reply( PROTO_T_STATUS, frame->seq, &status, 1 );
+        return;
+    }
+
+    s_seq = frame->seq;
+    memcpy( s_line, frame->payload, frame->len );
+    s_line[ frame->len ] = '\0';
+    s_argc = shell_split( s_line, s_argv );
+    if( s_argc == 0 )
+    {
+        shell_finish( SHELL_DONE );
+        return;
+    }
+
+    s_cmd = shell_lookup( s_argv[ 0 ] );
+    if( s_cmd == NULL )
+    {
+        shell_printf( "unknown command: %s\n", s_argv[ 0 ] );
+        shell_flush();
+        status = PROTO_ST_NO_CMD;
+        proto_reply( PROTO_T_STATUS, frame->seq, &status, 1 );
+        return;
+    }
+
+    memset( &s_ctx, 0, sizeof( s_ctx ) );
+}
+
+
+/*--------------------------------------------------------
+Find a command: one hash, one compare, or a search of the
+table if the seed did not fit
+--------------------------------------------------------*/
+static const shell_cmd_type *shell_lookup( const char *name )
+{
+    const shell_cmd_type *cmd;      /* command compared             */
+    uint8_t             idx;        /* command index                */
+
+    if( !s_hashed )
+    {
+        for( cmd = __shell_cmds_start; cmd < __shell_cmds_end; cmd++ )
+        {
+            if( strcmp( cmd->name, name ) == 0 )
+            {
+                return cmd;
+            }
+        }
+
+        return NULL;
+    }
+
+    idx = s_slots[ shell_hash( name, SHELL_SEED ) ];
+    if( idx == SHELL_NO_CMD
+     || strcmp( __shell_cmds_start[ idx ].name, name ) != 0 )
+    {
+        return NULL;
+    }
+
+    return &__shell_cmds_start[ idx ];
+}
+
+
+/*--------------------------------------------------------
+Split a line into arguments in place: separators are
+overwritten with terminators and argv points into the
+line. Double quotes group words, anything past
+SHELL_ARGS_MAX arguments is ignored.
+--------------------------------------------------------*/
+static uint8_t shell_split( char *line, char *argv[] )
+{
+    uint8_t             argc;       /* arguments found              */
+    char                end;        /* character ending the arg     */
+
+    argc = 0;
+    while( argc < SHELL_ARGS_MAX )
+    {
+        while( *line == ' ' || *line == '\t' || *line == '\r' || *line == '\n' )
+        {
+            line++;
+        }
+
+        if( *line == '\0' )
+        {
+            break;
+        }
+
+        end = ' ';
+        if( *line == '"' )
+        {
+            end = '"';
+            line++;
+        }
+
+        argv[ argc++ ] = line;
+        while( *line != '\0' && *line != end
+            && ( end == '"' || ( *line != '\t' && *line != '\r' && *line != '\n' ) ) )
+        {
+            line++;
+        }
+
+        if( *line == '\0' )
+        {
+            break;
+        }
+        *line++ = '\0';
+    }
+
+    return argc;
+}
+
+
+/*--------------------------------------------------------
+help: one command per step so a long list does not hold
+up the loop
+--------------------------------------------------------*/
+static int8_t shell_help( shell_ctx_type *ctx, uint8_t argc, char *argv[] )
+{
+    const shell_cmd_type *cmd;      /* command to list              */
+
+    (void)argc;
+    (void)argv;
+
+    cmd = &__shell_cmds_start[ ctx->step++ ];
+    if( cmd >= __shell_cmds_end )
+    {
+        return SHELL_DONE;
+    }
+
+    shell_printf( "%-10s %s\n", cmd->name, cmd->usage );
+    return SHELL_MORE;
+}
+
+
+/*--------------------------------------------------------
+uptime
+--------------------------------------------------------*/
+static int8_t shell_uptime( shell_ctx_type *ctx, uint8_t argc, char *argv[] )
+{
+    uint32_t            ms;         /* milliseconds since reset     */
+
+    (void)ctx;
+    (void)argc;
+    (void)argv;
+
+    ms = timer_get_ticks() * ( 1000u / TIMER_FREQUENCY_HZ );
+    shell_printf( "%lu.%03lu s\n", (unsigned long)( ms / 1000 ),
+                  (unsigned long)( ms % 1000 ) );
+    return SHELL_DONE;
+}
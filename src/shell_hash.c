@@ -0,0 +1,83 @@
+/*----------------------------------------------------------------------
+                            INCLUDES
+----------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "shell_hash.h"
+
+/*----------------------------------------------------------------------
+                            PROCEDURES
+----------------------------------------------------------------------*/
+
+/*--------------------------------------------------------
+FNV-1a with the seed mixed into the offset basis, folded
+to a dispatch slot
+--------------------------------------------------------*/
+uint32_t shell_hash( const char *name, uint32_t seed )
+{
+    uint32_t            h;          /* running hash                 */
+
+    h = 2166136261u ^ ( seed * 0x9E3779B9u );
+    while( *name != '\0' )
+    {
+        h ^= (uint8_t)*name++;
+        h *= 16777619u;
+    }
+
+    return ( h ^ ( h >> 16 ) ) & ( SHELL_HASH_SZ - 1 );
+}
+
+
+/*--------------------------------------------------------
+Fill the dispatch slots with command indices for a seed,
+in one pass. False if two commands share a slot, the
+slots are then undefined.
+--------------------------------------------------------*/
+bool shell_hash_place( const shell_cmd_type *cmds, uint16_t cnt,
+                       uint32_t seed, uint8_t slots[ SHELL_HASH_SZ ] )
+{
+    uint16_t            i;          /* command index                */
+    uint32_t            slot;       /* dispatch slot                */
+
+    if( cnt >= SHELL_NO_CMD || cnt > SHELL_HASH_SZ )
+    {
+        return false;
+    }
+
+    memset( slots, SHELL_NO_CMD, SHELL_HASH_SZ );
+    for( i = 0; i < cnt; i++ )
+    {
+        slot = shell_hash( cmds[ i ].name, seed );
+        if( slots[ slot ] != SHELL_NO_CMD )
+        {
+            return false;
+        }
+        slots[ slot ] = (uint8_t)i;
+    }
+
+    return true;
+}
+
+
+/*--------------------------------------------------------
+Search for a seed that gives every command a slot of its
+own, which with a table several times larger than the
+command count takes a few tries. Returns the seed, or
+SHELL_NO_SEED with the slots undefined.
+--------------------------------------------------------*/
+int16_t shell_hash_build( const shell_cmd_type *cmds, uint16_t cnt,
+                          uint8_t slots[ SHELL_HASH_SZ ] )
+{
+    uint16_t            seed;       /* seed being tried             */
+
+    for( seed = 0; seed < SHELL_SEED_TRIES; seed++ )
+    {
+        if( shell_hash_place( cmds, cnt, seed, slots ) )
+        {
+            return (int16_t)seed;
+        }
+    }
+
+    return SHELL_NO_SEED;
+}
@@ -0,0 +1,320 @@
+/*----------------------------------------------------------------------
+                            INCLUDES
+----------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "stm32f10x.h"
+
+#include "telemetry.h"
+#include "net.h"
+#include "shell.h"
+
+#if( TELEM_ENABLE )
+
+/*----------------------------------------------------------------------
+                            CONSTANTS
+----------------------------------------------------------------------*/
+
+#define TELEM_DGRAM_SZ      256     /* datagram size, <= DGRAM_MAX  */
+#define TELEM_RX_SZ         16      /* UDP replies are not used     */
+#define TELEM_RETRY_TICKS   5000    /* wait before reopening, ms    */
+#define TELEM_BENCH_FIELDS  3       /* fields of a benchmark record */
+#define TELEM_BENCH_DFLT    200     /* default benchmark records    */
+
+/*----------------------------------------------------------------------
+                            VARIABLES
+----------------------------------------------------------------------*/
+
+static uint8_t          s_dgram[ TELEM_DGRAM_SZ ];
+                                    /* datagram being batched       */
+static uint16_t         s_len;      /* bytes used in the datagram   */
+static timer_ticks_t    s_base;     /* time of the first record     */
+static timer_ticks_t    s_last;     /* time of the last record      */
+static telem_hist_type  s_hist;     /* metric values in the datagram*/
+static timer_ticks_t    s_window;   /* batching window, ms          */
+static uint16_t         s_device_id;/* id sent in every header      */
+static const char      *s_host;     /* collector address            */
+static uint16_t         s_port;     /* collector port               */
+static int8_t           s_sock;     /* UDP socket, < 0 if closed    */
+static timer_ticks_t    s_retry_at; /* time to reopen the socket    */
+static telem_stats_type s_stats;    /* publisher statistics         */
+
+/*----------------------------------------------------------------------
+                            PROCEDURES
+----------------------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+static void telem_flush( void );
+static void telem_open( void );
+static int8_t telem_shell_bench( shell_ctx_type *ctx, uint8_t argc, char *argv[] );
+static void telem_sock_cb( int8_t sock, uint8_t events, void *ctx );
+
+SHELL_CMD( "venc", "[records], time the record encoders", telem_shell_bench );
+
+/*--------------------------------------------------------
+Start publishing to a UDP collector. net_init() must be
+called first.
+--------------------------------------------------------*/
+void telem_init( const char *host, uint16_t port, uint16_t device_id,
+                 timer_ticks_t window )
+{
+    memset( &s_stats, 0, sizeof( s_stats ) );
+    s_host      = host;
+    s_port      = port;
+    s_device_id = device_id;
+    s_window    = window;
+    s_len       = 0;
+    s_sock      = -1;
+
+    telem_open();
+}
+
+
+/*--------------------------------------------------------
+Queue one record. The record is dropped, and counted, if
+the datagram is full and the previous one is still being
+sent. A metric that changes slowly costs 3 bytes per
+record instead of 7 in the fixed layout.
+--------------------------------------------------------*/
+void telem_put( uint8_t id, int32_t value )
+{
+    timer_ticks_t       now;        /* current time                 */
+    int32_t            *last;       /* metric's previous value      */
+    uint32_t            delta;      /* change since the last value  */
+
+    now = timer_get_ticks();
+
+    if( s_len != 0 && s_len + TELEM_REC_MAX > TELEM_DGRAM_SZ )
+    {
+        telem_flush();
+        if( s_len != 0 )
+        {
+            s_stats.drops++;
+            return;
+        }
+    }
+
+    if( s_len == 0 )
+    {
+        s_base     = now;
+        s_last     = now;
+        s_hist.cnt = 0;
+        s_len      = TELEM_HDR_SZ;
+    }
+
+    s_dgram[ s_len++ ] = id;
+    s_len += varenc_put_uvar( &s_dgram[ s_len ], now - s_last );
+
+    last  = telem_hist_slot( &s_hist, id );
+    delta = (uint32_t)value - (uint32_t)( last ? *last : 0 );
+    s_len += varenc_put_uvar( &s_dgram[ s_len ], varenc_zigzag( (int32_t)delta ) );
+    if( last != NULL )
+    {
+        *last = value;
+    }
+
+    s_last = now;
+    s_stats.records++;
+}
+
+
+/*--------------------------------------------------------
+Send the datagram once its window has expired, reopen
+the socket after an error. Call this from the main loop.
+--------------------------------------------------------*/
+void telem_poll( void )
+{
+    if( s_sock < 0 )
+    {
+        if( timer_expired( s_retry_at ) )
+        {
+            telem_open();
+        }
+        return;
+    }
+
+    if( s_len != 0 && timer_expired( s_base + s_window ) )
+    {
+        telem_flush();
+    }
+}
+
+
+/*--------------------------------------------------------
+Get a copy of the publisher statistics
+--------------------------------------------------------*/
+void telem_get_stats( telem_stats_type *stats )
+{
+    *stats = s_stats;
+}
+
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Fill in the header and hand the datagram to the socket.
+Only done while nothing else is queued on the socket so
+each datagram goes out as a CIPSEND of its own.
+--------------------------------------------------------*/
+static void telem_flush( void )
+{
+    if( s_len == 0 || !net_is_open( s_sock ) || net_tx_pending( s_sock ) != 0 )
+    {
+        return;
+    }
+
+    s_dgram[ 0 ] = TELEM_MAGIC;
+    s_dgram[ 1 ] = TELEM_VERSION;
+    telem_put_u16( &s_dgram[ 2 ], s_device_id );
+    telem_put_u32( &s_dgram[ 4 ], s_stats.seq );
+    telem_put_u32( &s_dgram[ 8 ], s_base );
+    telem_put_u16( &s_dgram[ 12 ], s_len - TELEM_HDR_SZ );
+
+    if( net_send( s_sock, s_dgram, s_len ) == (int16_t)s_len )
+    {
+        net_push( s_sock );
+        s_stats.seq++;
+        s_stats.dgrams++;
+        s_len = 0;
+    }
+}
+
+
+/*--------------------------------------------------------
+Open the UDP socket to the collector
+--------------------------------------------------------*/
+static void telem_open( void )
+{
+    s_sock = net_connect( NET_UDP, s_host, s_port, TELEM_RX_SZ,
+                          TELEM_DGRAM_SZ + 1, telem_sock_cb, NULL );
+    if( s_sock < 0 )
+    {
+        s_retry_at = timer_get_ticks() + TELEM_RETRY_TICKS;
+        return;
+    }
+
+    net_set_flush_delay( s_sock, 0 );
+}
+
+
+/*--------------------------------------------------------
+Shell command: time the record encoders with the cycle
+counter. The records stand in for a sensor sampled every
+10 ms: time, a value that wanders by a few counts, and an
+event counter that rarely moves. Each record is coded as
+three telemetry records and as one varenc record; the
+sizes are compared with the fixed layout. Timing covers
+the encoding only, with interrupts left on.
+--------------------------------------------------------*/
+static int8_t telem_shell_bench( shell_ctx_type *ctx, uint8_t argc, char *argv[] )
+{
+    static uint8_t      out[ TELEM_DGRAM_SZ ];
+                                    /* encoder output, thrown away  */
+    varenc_ctx_type     enc;        /* varenc stream                */
+    telem_hist_type     hist;       /* telemetry metric values      */
+    int32_t             rec[ TELEM_BENCH_FIELDS ];
+                                    /* record being coded           */
+    int32_t            *last;       /* metric's previous value      */
+    uint32_t            records;    /* records to code              */
+    uint32_t            seed;       /* noise generator              */
+    uint32_t            start;      /* cycle count at the start     */
+    uint32_t            telem_cyc;  /* cycles in the telemetry code */
+    uint32_t            venc_cyc;   /* cycles in varenc             */
+    uint32_t            telem_sz;   /* bytes, telemetry records     */
+    uint32_t            venc_sz;    /* bytes, varenc stream         */
+    uint32_t            i;          /* loop counter                 */
+    uint16_t            len;        /* bytes in out                 */
+    uint8_t             f;          /* field counter                */
+    int16_t             n;          /* bytes from one varenc call   */
+
+    (void)ctx;
+    if( argc > 2 )
+    {
+        return SHELL_USAGE;
+    }
+    records = ( argc == 2 ) ? strtoul( argv[ 1 ], NULL, 0 ) : TELEM_BENCH_DFLT;
+    if( records == 0 )
+    {
+        return SHELL_USAGE;
+    }
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL        |= DWT_CTRL_CYCCNTENA_Msk;
+
+    varenc_init( &enc, TELEM_BENCH_FIELDS );
+    hist.cnt  = 0;
+    seed      = 1;
+    rec[ 0 ]  = 0;
+    rec[ 1 ]  = 2048;
+    rec[ 2 ]  = 0;
+    telem_cyc = 0;
+    venc_cyc  = 0;
+    telem_sz  = 0;
+    venc_sz   = 0;
+
+    for( i = 0; i < records; i++ )
+    {
+        seed      = seed * 1103515245 + 12345;
+        rec[ 0 ] += 10;
+        rec[ 1 ] += (int32_t)( ( seed >> 16 ) % 7 ) - 3;
+        rec[ 2 ] += ( ( seed >> 24 ) == 0 );
+
+        /* Same steps as telem_put(), output restarted per datagram */
+        start = DWT->CYCCNT;
+        len   = 0;
+        for( f = 0; f < TELEM_BENCH_FIELDS; f++ )
+        {
+            out[ len++ ] = f;
+            len  += varenc_put_uvar( &out[ len ], ( f == 0 ) ? 10 : 0 );
+            last  = telem_hist_slot( &hist, f );
+            len  += varenc_put_uvar( &out[ len ],
+                        varenc_zigzag( (int32_t)( (uint32_t)rec[ f ] - (uint32_t)*last ) ) );
+            *last = rec[ f ];
+        }
+        telem_cyc += DWT->CYCCNT - start;
+        telem_sz  += len;
+
+        start = DWT->CYCCNT;
+        n     = varenc_put( &enc, rec, out, sizeof( out ) );
+        venc_cyc += DWT->CYCCNT - start;
+        venc_sz  += n;
+    }
+
+    start = DWT->CYCCNT;
+    n     = varenc_flush( &enc, out, sizeof( out ) );
+    venc_cyc += DWT->CYCCNT - start;
+    venc_sz  += n;
+
+    shell_printf( "%lu records, fixed %lu bytes\n", (unsigned long)records,
+                  (unsigned long)( records * TELEM_BENCH_FIELDS * TELEM_REC_SZ ) );
+    shell_printf( "telem %lu bytes %lu cyc/rec\n", (unsigned long)telem_sz,
+                  (unsigned long)( telem_cyc / records ) );
+    shell_printf( "varenc %lu bytes %lu cyc/rec\n", (unsigned long)venc_sz,
+                  (unsigned long)( venc_cyc / records ) );
+    return SHELL_DONE;
+}
+
+
+/*--------------------------------------------------------
+Socket events, the socket is reopened after an error
+--------------------------------------------------------*/
+static void telem_sock_cb( int8_t sock, uint8_t events, void *ctx )
+{
+    (void)ctx;
+
+    if( events & ( NET_EV_CLOSED | NET_EV_ERROR ) )
+    {
+        net_close( sock );
+        s_sock     = -1;
+        s_retry_at = timer_get_ticks() + TELEM_RETRY_TICKS;
+        s_stats.reconnects++;
+    }
+}
+
+#endif
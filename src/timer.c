@@ -16,6 +16,10 @@ timer_tick (void);
 // ----------------------------------------------------------------------------
 
 volatile timer_ticks_t timer_delayCount;
+volatile timer_ticks_t timer_ticks;
+volatile uint32_t timer_wraps;
+
+static timer_tick_handler_t timer_handlers[TIMER_TICK_HANDLERS];
 
 // ----------------------------------------------------------------------------
 
@@ -36,14 +40,62 @@ timer_sleep (timer_ticks_t ticks)
     ;
 }
 
+int
+timer_add_tick_handler (timer_tick_handler_t handler)
+{
+  for (unsigned int i = 0; i < TIMER_TICK_HANDLERS; ++i)
+    {
+      if (timer_handlers[i] == 0)
+        {
+          timer_handlers[i] = handler;
+          return 0;
+        }
+    }
+
+  return -1;
+}
+
+uint64_t
+timer_get_us (void)
+{
+  uint32_t primask = __get_PRIMASK ();
+  __disable_irq ();
+
+  uint32_t val = SysTick->VAL;
+  uint64_t ticks = ((uint64_t) timer_wraps << 32) | timer_ticks;
+  if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk)
+    {
+      // The counter has reloaded but the tick is not counted yet.
+      val = SysTick->VAL;
+      ++ticks;
+    }
+
+  __set_PRIMASK (primask);
+
+  // SysTick counts down from LOAD to 0 once per tick.
+  uint32_t load = SysTick->LOAD + 1;
+  return ticks * (1000000u / TIMER_FREQUENCY_HZ)
+      + (load - 1 - val) * (1000000u / TIMER_FREQUENCY_HZ) / load;
+}
+
 void
 timer_tick (void)
 {
+  if (++timer_ticks == 0)
+    {
+      ++timer_wraps;
+    }
+
   // Decrement to zero the counter used by the delay routine.
   if (timer_delayCount != 0u)
     {
       --timer_delayCount;
     }
+
+  for (unsigned int i = 0; i < TIMER_TICK_HANDLERS && timer_handlers[i] != 0; ++i)
+    {
+      timer_handlers[i] ();
+    }
 }
 
 // ----- SysTick_Handler() ----------------------------------------------------
@@ -2,38 +2,62 @@
                             INCLUDES
 ----------------------------------------------------------------------*/
 
+#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 
+#include "shell.h"
 #include "uart_print.h"
+#include "vect.h"
 
 /*----------------------------------------------------------------------
                             CONSTANTS
 ----------------------------------------------------------------------*/
 
-#define UART_RX_BUF_SZ  1024        /* UART read buffer size        */
+#define UART_RX_BUF_SZ  128         /* read() input, the control    */
+                                    /* protocol has its own handler */
+#define UART_MUX_URGENT_SZ 160      /* channel 0 ring               */
+#define UART_MUX_CONSOLE_SZ 160     /* channel 1 ring, uart_write() */
+#define UART_MUX_LOG_SZ 160         /* channel 2 ring               */
+#define UART_MUX_BULK_SZ 288        /* channel 3 ring               */
+#define UART_MUX_HDR_SZ 2           /* unit length ahead of a unit  */
+#define UART_MUX_QUANTUM_DFLT 128   /* bytes per turn, channels 1-3 */
+#define UART_STDOUT_BUF_SZ 128      /* stdout buffer, longest line  */
+#define UART_STDIN_BUF_SZ 64        /* stdin buffer                 */
+
+#if UART_MUX_UNIT_MAX + UART_MUX_HDR_SZ >= UART_MUX_URGENT_SZ \
+ || UART_MUX_UNIT_MAX + UART_MUX_HDR_SZ >= UART_MUX_CONSOLE_SZ \
+ || UART_MUX_UNIT_MAX + UART_MUX_HDR_SZ >= UART_MUX_LOG_SZ \
+ || UART_MUX_UNIT_MAX + UART_MUX_HDR_SZ >= UART_MUX_BULK_SZ
+#error "every channel ring must hold a whole unit"
+#endif
 
 /*----------------------------------------------------------------------
                             TYPES
 ----------------------------------------------------------------------*/
 
 /*--------------------------------------------------------
-TODO convert this to a ring buffer to eliminate possible
-overruns while processing the data with interrupts
-disabled (hardware has only a single byte for RX/TX)
+Byte ring shared with the interrupt. One side only moves
+head, the other only tail, so neither needs interrupts
+disabled; one byte is left free to tell full from empty.
 --------------------------------------------------------*/
 typedef struct                      /* UART interrupt buffer data   */
 {
-    uint8_t            *buf_ptr_start;
-                                    /* pointer to beginning of buffer*/
-    uint8_t            *buf_ptr_cur;/* pointer to current spot in buf*/
-    uint16_t            buf_sz;     /* size of the buffer            */
-    uint16_t            num_bytes;  /* number of bytes in the buffer */
-    bool                error_rx_full;
-                                    /* UART RX buffer full  		 */
-    bool                error_overrun;
-                                    /* out of memory error occurred  */
-} uart_irq_buf_type;
+    uint8_t            *buf;        /* ring storage                 */
+    uint16_t            buf_sz;     /* size of the ring             */
+    volatile uint16_t   head;       /* next byte to write           */
+    volatile uint16_t   tail;       /* next byte to read            */
+    volatile bool       error_rx_full;
+                                    /* UART RX buffer full          */
+    volatile bool       error_overrun;
+                                    /* byte lost in the peripheral  */
+} uart_ring_type;
+
+/*--------------------------------------------------------
+A transmit ring holds whole units, each after its length
+as u16 LE; the interrupt only changes channel between
+units.
+--------------------------------------------------------*/
 
 /*----------------------------------------------------------------------
                             VARIABLES
@@ -41,9 +65,41 @@ typedef struct                      /* UART interrupt buffer data   */
 
 static uint8_t          s_uart_rx_buf[ UART_RX_BUF_SZ ];
                                     /* UART read buffer             */
-static uart_irq_buf_type
-                        s_uart_rx_buf_data;
-                                    /* UART RX buffer data          */
+static uint8_t          s_uart_urgent_buf[ UART_MUX_URGENT_SZ ];
+static uint8_t          s_uart_console_buf[ UART_MUX_CONSOLE_SZ ];
+static uint8_t          s_uart_log_buf[ UART_MUX_LOG_SZ ];
+static uint8_t          s_uart_bulk_buf[ UART_MUX_BULK_SZ ];
+                                    /* UART write buffers           */
+static uart_ring_type   s_rx = { s_uart_rx_buf, UART_RX_BUF_SZ, 0, 0, false, false };
+                                    /* received bytes (ISR writes)  */
+static uart_ring_type   s_tx[ UART_MUX_CH_CNT ] =
+    {
+    { s_uart_urgent_buf, UART_MUX_URGENT_SZ, 0, 0, false, false },
+    { s_uart_console_buf, UART_MUX_CONSOLE_SZ, 0, 0, false, false },
+    { s_uart_log_buf, UART_MUX_LOG_SZ, 0, 0, false, false },
+    { s_uart_bulk_buf, UART_MUX_BULK_SZ, 0, 0, false, false }
+    };                              /* units to send by channel     */
+                                    /* (ISR reads)                  */
+static uint16_t         s_quantum[ UART_MUX_CH_CNT ] =
+    { 0, UART_MUX_QUANTUM_DFLT, UART_MUX_QUANTUM_DFLT, UART_MUX_QUANTUM_DFLT };
+                                    /* bytes per turn by channel    */
+static uint16_t         s_deficit[ UART_MUX_CH_CNT ];
+                                    /* bytes a channel may still    */
+                                    /* send this turn (ISR)         */
+static uint8_t          s_turn = 1; /* channel whose turn it is     */
+static uint8_t          s_cur_ch;   /* channel being sent (ISR)     */
+static volatile uint16_t s_cur_left;/* bytes left of its unit       */
+static uart_mux_stats_type s_mux_stats[ UART_MUX_CH_CNT ];
+                                    /* statistics by channel        */
+static volatile uart_console_type
+                        s_console;  /* stdio output handler, if any */
+static char             s_stdout_buf[ UART_STDOUT_BUF_SZ ];
+                                    /* stdout line buffer           */
+static char             s_stdin_buf[ UART_STDIN_BUF_SZ ];
+                                    /* stdin buffer                 */
+static volatile uart_rx_handler_type
+                        s_rx_handler;
+                                    /* receive handler, if any      */
 
 /*----------------------------------------------------------------------
                             PROCEDURES
@@ -52,13 +108,26 @@ static uart_irq_buf_type
 /*--------------------------------------------------------
 Local functions
 --------------------------------------------------------*/
-static void uart_irq_buf_reset( uart_irq_buf_type *irq_buf );
+static bool uart_can_wait( void );
+static void uart_isr_handler( void );
+static void uart_isr_ring( void );
+static int8_t uart_mux_shell( shell_ctx_type *ctx, uint8_t argc, char *argv[] );
+static uint8_t uart_mux_next( void );
+static uint16_t uart_ring_copy( uart_ring_type *ring, uint16_t head,
+                                const uint8_t *src, uint16_t len );
+static void uart_ring_reset( uart_ring_type *ring );
+static uint16_t uart_ring_unit( const uart_ring_type *ring );
+static void uart_rx_byte( uint8_t byte );
+static void uart_rx_ring( uint8_t byte );
 static void uart_setup_clock( void );
 static void uart_setup_gpio( void );
 static void uart_setup_irq( void );
 static void uart_setup_periph( uint32_t baud_rate );
-static void uart_wait_tx_ready( void );
+static void uart_tx_poll( void );
+static bool uart_unit_put( uint8_t ch, const uint8_t *src, uint16_t len );
 
+SHELL_CMD( "mux", "[ch quantum], UART 1 channel statistics and shares",
+           uart_mux_shell );
 
 /*--------------------------------------------------------
 Initialize UART 1
@@ -72,130 +141,204 @@ void uart_init( uint32_t baud_rate )
 }
 
 
+/*--------------------------------------------------------
+Buffer stdio for UART 1. stdout is line buffered, so a
+printf() reaches uart_console() as one block per line,
+and stderr is unbuffered so each call goes straight on
+to the urgent channel. Reads of stdin never wait, getchar()
+returns EOF with errno EAGAIN when nothing has arrived;
+clearerr( stdin ) before reading again.
+--------------------------------------------------------*/
+void uart_stdio_init( void )
+{
+    setvbuf( stdout, s_stdout_buf, _IOLBF, sizeof( s_stdout_buf ) );
+    setvbuf( stderr, NULL, _IONBF, 0 );
+    setvbuf( stdin, s_stdin_buf, _IOFBF, sizeof( s_stdin_buf ) );
+}
+
+
 /*--------------------------------------------------------
 Get UART 1 RX data which has been read via interrupt.
-This has a signature similar to read() of unistd.h.
+This has a signature similar to read() of unistd.h, it
+does not wait and returns 0 when nothing has arrived.
 --------------------------------------------------------*/
 uint16_t uart_read( void *buf, uint16_t bytes_req )
 {
     /*--------------------------------------------------------
     Local variables
     --------------------------------------------------------*/
-    uint16_t            bytes_ret;  /* number of bytes to copy      */
-    uint16_t            bytes_rem;  /* number of bytes remaining    */
+    uint16_t            bytes_ret;  /* number of bytes copied       */
+    uint16_t            tail;       /* next byte to read            */
 
     /*--------------------------------------------------------
     Check for UART errors
     --------------------------------------------------------*/
-    if( s_uart_rx_buf_data.error_rx_full == true )
+    if( s_rx.error_rx_full == true )
     {
-        /*--------------------------------------------------------
-        Clear UART RX buffer data
-        --------------------------------------------------------*/
-        uart_irq_buf_reset( &s_uart_rx_buf_data );
-
-        /*--------------------------------------------------------
-        Return error status
-        --------------------------------------------------------*/
+        uart_ring_reset( &s_rx );
         return ERR_UART_RX_BUF_FULL;
     }
 
-    if( s_uart_rx_buf_data.error_overrun == true )
+    if( s_rx.error_overrun == true )
     {
-        /*--------------------------------------------------------
-        Clear UART RX buffer data
-        --------------------------------------------------------*/
-        uart_irq_buf_reset( &s_uart_rx_buf_data );
-
-        /*--------------------------------------------------------
-        Return error status
-        --------------------------------------------------------*/
+        uart_ring_reset( &s_rx );
         return ERR_UART_OVERRUN;
     }
 
     /*--------------------------------------------------------
-    Disable UART interrupts while processing.
-    NOTE: consider removing when implementing ring buffer.
+    Copy out of the ring, the interrupt only moves head
     --------------------------------------------------------*/
-    NVIC_DisableIRQ( USART1_IRQn );
+    tail = s_rx.tail;
+    for( bytes_ret = 0; bytes_ret < bytes_req && tail != s_rx.head; bytes_ret++ )
+    {
+        ( (uint8_t *)buf )[ bytes_ret ] = s_rx.buf[ tail ];
+        tail = ( tail + 1 ) % s_rx.buf_sz;
+    }
+    s_rx.tail = tail;
+
+    return bytes_ret;
+}
+
+
+/*--------------------------------------------------------
+Queue buffer data for UART 1 on the console channel.
+This has a signature similar to write() of unistd.h.
+--------------------------------------------------------*/
+uint16_t uart_write( const void *buf, uint16_t bytes )
+{
+    return uart_mux_write( UART_MUX_CH_CONSOLE, buf, bytes );
+}
+
+
+/*--------------------------------------------------------
+Queue bytes on the urgent channel, for error output. They
+go out ahead of everything queued on the other channels,
+but never inside a unit already being sent.
+--------------------------------------------------------*/
+uint16_t uart_write_urgent( const void *buf, uint16_t bytes )
+{
+    return uart_mux_write( UART_MUX_CH_URGENT, buf, bytes );
+}
+
 
+/*--------------------------------------------------------
+Queue data on a channel, sent by the TX interrupt. Up to
+UART_MUX_UNIT_MAX bytes are queued as one unit and go out
+unbroken by other channels; longer writes are split. The
+call waits only while the channel's ring is full. With
+interrupts masked, or from an interrupt that UART 1 can
+not preempt, the rings are drained by polling instead.
+--------------------------------------------------------*/
+uint16_t uart_mux_write( uint8_t ch, const void *buf, uint16_t bytes )
+{
     /*--------------------------------------------------------
-    Check if requested number of bytes can be returned
+    Local variables
     --------------------------------------------------------*/
-    if( bytes_req <= s_uart_rx_buf_data.num_bytes )
+    const uint8_t      *src;        /* next byte to queue           */
+    uint16_t            left;       /* bytes still to queue         */
+    uint16_t            n;          /* bytes in this unit           */
+    bool                waited;     /* counted as a wait            */
+
+    if( ch >= UART_MUX_CH_CNT )
     {
-        /*--------------------------------------------------------
-        Get the requested number of bytes from the UART RX buffer
-        --------------------------------------------------------*/
-        bytes_ret = bytes_req;
-        bytes_rem = s_uart_rx_buf_data.num_bytes - bytes_req;
+        return 0;
     }
-    else
+
+    src    = buf;
+    left   = bytes;
+    waited = false;
+    while( left > 0 )
     {
-        /*--------------------------------------------------------
-        Get all of the bytes from the UART RX buffer
-        --------------------------------------------------------*/
-        bytes_ret = s_uart_rx_buf_data.num_bytes;
-        bytes_rem = 0;
+        n = ( left > UART_MUX_UNIT_MAX ) ? UART_MUX_UNIT_MAX : left;
+        if( !uart_unit_put( ch, src, n ) )
+        {
+            if( !waited )
+            {
+                s_mux_stats[ ch ].waits++;
+                waited = true;
+            }
+            if( !uart_can_wait() )
+            {
+                uart_tx_poll();
+            }
+            continue;
+        }
+        USART_ITConfig( USART1, USART_IT_TXE, ENABLE );
+
+        src  += n;
+        left -= n;
     }
 
-    /*--------------------------------------------------------
-    Copy received data to return buffer
-    --------------------------------------------------------*/
-    memcpy( buf, s_uart_rx_buf_data.buf_ptr_start, bytes_ret );
+    if( !uart_can_wait() )
+    {
+        uart_tx_poll();
+    }
 
-    /*--------------------------------------------------------
-    Move any remaining buffer data which needs to be copied
-    back to the beginning of the buffer. This does nothing if
-    bytes remaining is zero.
-    NOTE: this will not be necessary if a ring buffer is
-    implemented.
-    --------------------------------------------------------*/
-    memmove( s_uart_rx_buf_data.buf_ptr_start, s_uart_rx_buf_data.buf_ptr_start + bytes_ret, bytes_rem );
+    return bytes;
+}
 
-    /*--------------------------------------------------------
-    Update buffer data
-    --------------------------------------------------------*/
-    s_uart_rx_buf_data.buf_ptr_cur = s_uart_rx_buf_data.buf_ptr_start;
-    s_uart_rx_buf_data.num_bytes   = bytes_rem;
 
-    /*--------------------------------------------------------
-    Re-enable UART interrupts.
-    --------------------------------------------------------*/
-    NVIC_EnableIRQ( USART1_IRQn );
+/*--------------------------------------------------------
+Set the bytes a channel other than the urgent one may
+send per turn. Channels that have data share the UART in
+proportion to their quanta.
+--------------------------------------------------------*/
+int8_t uart_mux_config( uint8_t ch, uint16_t quantum )
+{
+    if( ch == UART_MUX_CH_URGENT || ch >= UART_MUX_CH_CNT
+     || quantum < UART_MUX_QUANTUM_MIN || quantum > UART_MUX_QUANTUM_MAX )
+    {
+        return ERR_UART_MUX_ARG;
+    }
 
-    /*--------------------------------------------------------
-    Return number of bytes copied to buffer
-    --------------------------------------------------------*/
-    return bytes_ret;
+    s_quantum[ ch ] = quantum;
+    return 0;
 }
 
 
 /*--------------------------------------------------------
-Transmit buffer data out UART 1.
-This has a signature similar to write() of unistd.h.
-NOTE: this function blocks until all data has been
-transmitted.
+Get a copy of a channel's statistics
 --------------------------------------------------------*/
-uint16_t uart_write( const void *buf, uint16_t bytes )
+void uart_mux_get_stats( uint8_t ch, uart_mux_stats_type *stats )
+{
+    if( ch < UART_MUX_CH_CNT )
+    {
+        *stats = s_mux_stats[ ch ];
+    }
+}
+
+
+/*--------------------------------------------------------
+Send stdio output (_write.c) through a handler, which
+frames it for a protocol sharing UART 1, or raw again
+with NULL
+--------------------------------------------------------*/
+void uart_set_console( uart_console_type handler )
+{
+    s_console = handler;
+}
+
+
+/*--------------------------------------------------------
+Write stdio output, through the console handler if one
+is set, else raw: stdout on the console channel, stderr
+(urgent) on the urgent one
+--------------------------------------------------------*/
+uint16_t uart_console( const void *buf, uint16_t bytes, bool urgent )
 {
     /*--------------------------------------------------------
     Local variables
     --------------------------------------------------------*/
-    uint16_t            i;          /* loop counter                 */
+    uart_console_type   handler;    /* console handler              */
 
-    /*--------------------------------------------------------
-    Loop over all bytes in the buffer
-    --------------------------------------------------------*/
-    for( i = 0; i < bytes; i++ )
+    handler = s_console;
+    if( handler != NULL )
     {
-        /*--------------------------------------------------------
-        Write the byte out the UART
-        --------------------------------------------------------*/
-        uart_write_byte( *( (uint8_t*)buf + i ) );
+        return handler( buf, bytes, urgent );
     }
 
-    return bytes;
+    return uart_mux_write( urgent ? UART_MUX_CH_URGENT : UART_MUX_CH_CONSOLE,
+                           buf, bytes );
 }
 
 
@@ -204,12 +347,7 @@ Write a single byte out UART 1
 --------------------------------------------------------*/
 void uart_write_byte( uint8_t byte )
 {
-    uart_wait_tx_ready();
-
-    /*--------------------------------------------------------
-    Send byte out UART
-    --------------------------------------------------------*/
-    USART_SendData( USART1, byte );
+    uart_write( &byte, 1 );
 }
 
 
@@ -220,74 +358,332 @@ Note: the string must be null terminated.
 void uart_write_msg( char *msg )
 {
     uart_write( msg, strlen( msg ) );
-    uart_write_byte( '\n' );
-    uart_write_byte( '\r' );
+    uart_write( "\n\r", 2 );
 }
 
 
 /*--------------------------------------------------------
-UART 1 interrupt service routine.
-Note: This handles both RX and TX interrupts if
-configured. TX interrupts are currently disabled.
+Wait until everything queued has been sent
+--------------------------------------------------------*/
+void uart_flush( void )
+{
+    uint8_t             ch;         /* channel index                */
+
+    for( ch = 0; ch < UART_MUX_CH_CNT; ch++ )
+    {
+        while( s_tx[ ch ].head != s_tx[ ch ].tail || s_cur_left != 0 )
+        {
+            if( !uart_can_wait() )
+            {
+                uart_tx_poll();
+            }
+        }
+    }
+
+    while( USART_GetFlagStatus( USART1, USART_FLAG_TC ) == RESET );
+}
+
+
+/*--------------------------------------------------------
+Hand received bytes to a handler from the interrupt, or
+buffer them for uart_read() again with NULL. The UART 1
+vector is pointed at the interrupt routine for the mode
+(vect.h), the handler is set before that routine can run
+and cleared after it no longer can.
+--------------------------------------------------------*/
+void uart_set_rx_handler( uart_rx_handler_type handler )
+{
+    if( handler != NULL )
+    {
+        s_rx_handler = handler;
+        vect_set( USART1_IRQn, uart_isr_handler );
+    }
+    else
+    {
+        vect_set( USART1_IRQn, uart_isr_ring );
+        s_rx_handler = NULL;
+    }
+}
+
+
+/*--------------------------------------------------------
+Run bytes through the receive path as if they had arrived
+on UART 1, for replaying captures (bench.h). The UART 1
+interrupt is held off meanwhile.
+--------------------------------------------------------*/
+void uart_inject( const void *buf, uint16_t bytes )
+{
+    /*--------------------------------------------------------
+    Local variables
+    --------------------------------------------------------*/
+    uint16_t            i;          /* byte index                   */
+
+    NVIC_DisableIRQ( USART1_IRQn );
+
+    for( i = 0; i < bytes; i++ )
+    {
+        uart_rx_byte( ( (const uint8_t *)buf )[ i ] );
+    }
+
+    NVIC_EnableIRQ( USART1_IRQn );
+}
+
+
+/*--------------------------------------------------------
+UART 1 interrupt service routine, linked into the vector
+table. It serves either receive mode; once the table is
+in RAM uart_set_rx_handler() installs the routine for
+the mode in use instead.
 --------------------------------------------------------*/
 void USART1_IRQHandler( void )
 {
+    if( s_rx_handler != NULL )
+    {
+        uart_isr_handler();
+    }
+    else
+    {
+        uart_isr_ring();
+    }
+}
+
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+
+/*--------------------------------------------------------
+True if the TX interrupt can run, so a full ring drains
+while waiting
+--------------------------------------------------------*/
+static bool uart_can_wait( void )
+{
+    uint32_t            active;     /* active exception number      */
+
+    if( __get_PRIMASK() != 0 )
+    {
+        return false;
+    }
+
     /*--------------------------------------------------------
-    Check if UART 1 has an RX data byte
+    UART 1 runs at the highest priority, so it preempts
+    everything but NMI, hard faults and handlers of its own
+    level. Exception numbers map to IRQn_Type less 16.
     --------------------------------------------------------*/
-    if( USART_GetITStatus( USART1, USART_IT_RXNE ) != RESET )
+    active = __get_IPSR();
+    return active == 0
+        || ( active >= 4 && NVIC_GetPriority( (IRQn_Type)( (int32_t)active - 16 ) ) != 0 );
+}
+
+
+/*--------------------------------------------------------
+UART 1 interrupt, received bytes go to the receive
+handler. Reading the data register clears RXNE and an
+overrun; the TX interrupt is enabled while there are
+bytes to send.
+--------------------------------------------------------*/
+static void uart_isr_handler( void )
+{
+    if( USART_GetITStatus( USART1, USART_IT_RXNE ) != RESET
+     || USART_GetFlagStatus( USART1, USART_FLAG_ORE ) != RESET )
+    {
+        s_rx_handler( (uint8_t)USART_ReceiveData( USART1 ) );
+    }
+
+    if( USART_GetITStatus( USART1, USART_IT_TXE ) != RESET )
+    {
+        uart_tx_poll();
+    }
+}
+
+
+/*--------------------------------------------------------
+UART 1 interrupt, received bytes are buffered for
+uart_read()
+--------------------------------------------------------*/
+static void uart_isr_ring( void )
+{
+    if( USART_GetITStatus( USART1, USART_IT_RXNE ) != RESET
+     || USART_GetFlagStatus( USART1, USART_FLAG_ORE ) != RESET )
     {
-        /*--------------------------------------------------------
-        Check if UART RX buffer is full
-        --------------------------------------------------------*/
-        if( s_uart_rx_buf_data.num_bytes >= s_uart_rx_buf_data.buf_sz )
+        if( USART_GetFlagStatus( USART1, USART_FLAG_ORE ) != RESET )
         {
-            /*--------------------------------------------------------
-            Set overrun error
-            --------------------------------------------------------*/
-            s_uart_rx_buf_data.error_rx_full = true;
+            s_rx.error_overrun = true;
+        }
+
+        uart_rx_ring( (uint8_t)USART_ReceiveData( USART1 ) );
+    }
+
+    if( USART_GetITStatus( USART1, USART_IT_TXE ) != RESET )
+    {
+        uart_tx_poll();
+    }
+}
+
+
+/*--------------------------------------------------------
+Pick the channel of the next unit, called at a unit
+boundary with something queued. The urgent channel goes
+first; the others take turns by deficit round robin, a
+turn adds the channel's quantum to what it may send and
+its units go while that covers them. A channel found
+empty loses what it had saved.
+--------------------------------------------------------*/
+static uint8_t uart_mux_next( void )
+{
+    uint8_t             ch;         /* channel whose turn it is     */
+    uint16_t            len;        /* its next unit's length       */
+
+    if( s_tx[ UART_MUX_CH_URGENT ].head != s_tx[ UART_MUX_CH_URGENT ].tail )
+    {
+        return UART_MUX_CH_URGENT;
+    }
+
+    for( ;; )
+    {
+        ch = s_turn;
+        if( s_tx[ ch ].head == s_tx[ ch ].tail )
+        {
+            s_deficit[ ch ] = 0;
         }
         else
         {
-            /*--------------------------------------------------------
-            Receive data byte
-            --------------------------------------------------------*/
-            *s_uart_rx_buf_data.buf_ptr_cur = USART_ReceiveData( USART1 );
-
-            /*--------------------------------------------------------
-            Advance the current buffer pointer
-            --------------------------------------------------------*/
-            s_uart_rx_buf_data.buf_ptr_cur++;
-
-            /*--------------------------------------------------------
-            Increment the number of bytes in the buffer
-            --------------------------------------------------------*/
-            s_uart_rx_buf_data.num_bytes++;
+            len = uart_ring_unit( &s_tx[ ch ] );
+            if( s_deficit[ ch ] >= len )
+            {
+                s_deficit[ ch ] -= len;
+                return ch;
+            }
         }
+
+        s_turn = ( ch + 1 < UART_MUX_CH_CNT ) ? ch + 1 : UART_MUX_CH_URGENT + 1;
+        s_deficit[ s_turn ] += s_quantum[ s_turn ];
     }
 }
 
 
 /*--------------------------------------------------------
-Local functions
+Shell: mux [ch quantum]. Sets a channel's share, then
+prints each channel's quantum, queue and statistics.
+--------------------------------------------------------*/
+static int8_t uart_mux_shell( shell_ctx_type *ctx, uint8_t argc, char *argv[] )
+{
+    uint8_t             ch;         /* channel index                */
+    uart_ring_type     *ring;       /* its ring                     */
+
+    (void)ctx;
+    if( argc != 1 && argc != 3 )
+    {
+        return SHELL_USAGE;
+    }
+
+    if( argc == 3
+     && uart_mux_config( (uint8_t)strtoul( argv[ 1 ], NULL, 0 ),
+                         (uint16_t)strtoul( argv[ 2 ], NULL, 0 ) ) != 0 )
+    {
+        shell_printf( "channel 1-%u, quantum %u-%u\n", UART_MUX_CH_CNT - 1,
+                      UART_MUX_QUANTUM_MIN, UART_MUX_QUANTUM_MAX );
+        return SHELL_FAIL;
+    }
+
+    for( ch = 0; ch < UART_MUX_CH_CNT; ch++ )
+    {
+        ring = &s_tx[ ch ];
+        shell_printf( "%u quantum %u queued %u/%u max %u units %lu bytes %lu waits %u\n",
+                      ch, s_quantum[ ch ],
+                      ( ring->head + ring->buf_sz - ring->tail ) % ring->buf_sz,
+                      ring->buf_sz - 1, s_mux_stats[ ch ].max_queued,
+                      (unsigned long)s_mux_stats[ ch ].units,
+                      (unsigned long)s_mux_stats[ ch ].bytes,
+                      s_mux_stats[ ch ].waits );
+    }
+    return SHELL_DONE;
+}
+
+
+/*--------------------------------------------------------
+Copy bytes into a ring from head on, wrapping, and return
+the index after them. There must be room.
 --------------------------------------------------------*/
+static uint16_t uart_ring_copy( uart_ring_type *ring, uint16_t head,
+                                const uint8_t *src, uint16_t len )
+{
+    uint16_t            first;      /* bytes before the ring wraps  */
+
+    first = ring->buf_sz - head;
+    if( first > len )
+    {
+        first = len;
+    }
+
+    memcpy( &ring->buf[ head ], src, first );
+    memcpy( ring->buf, src + first, len - first );
+    return ( head + len ) % ring->buf_sz;
+}
+
 
 /*--------------------------------------------------------
-Reset interrupt buffer data with interrupt protection
+Empty the RX ring and clear its errors
 --------------------------------------------------------*/
-static void uart_irq_buf_reset( uart_irq_buf_type *irq_buf )
+static void uart_ring_reset( uart_ring_type *ring )
 {
     NVIC_DisableIRQ( USART1_IRQn );
 
-    irq_buf->num_bytes     = 0;
-    irq_buf->buf_ptr_cur   = irq_buf->buf_ptr_start;
-    irq_buf->error_rx_full = false;
-    irq_buf->error_overrun = false;
+    ring->tail          = ring->head;
+    ring->error_rx_full = false;
+    ring->error_overrun = false;
 
     NVIC_EnableIRQ( USART1_IRQn );
 }
 
 
+/*--------------------------------------------------------
+Length of the unit at the tail of a transmit ring
+--------------------------------------------------------*/
+static uint16_t uart_ring_unit( const uart_ring_type *ring )
+{
+    return (uint16_t)( ring->buf[ ring->tail ]
+                     | ( ring->buf[ ( ring->tail + 1 ) % ring->buf_sz ] << 8 ) );
+}
+
+
+/*--------------------------------------------------------
+Pass a received byte to the handler if one is installed,
+else buffer it for uart_read()
+--------------------------------------------------------*/
+static void uart_rx_byte( uint8_t byte )
+{
+    if( s_rx_handler != NULL )
+    {
+        s_rx_handler( byte );
+    }
+    else
+    {
+        uart_rx_ring( byte );
+    }
+}
+
+
+/*--------------------------------------------------------
+Buffer a received byte for uart_read()
+--------------------------------------------------------*/
+static void uart_rx_ring( uint8_t byte )
+{
+    uint16_t            next;       /* ring index after the byte    */
+
+    next = ( s_rx.head + 1 ) % s_rx.buf_sz;
+    if( next == s_rx.tail )
+    {
+        /* The byte is dropped, it has been read from DR */
+        s_rx.error_rx_full = true;
+        return;
+    }
+
+    s_rx.buf[ s_rx.head ] = byte;
+    s_rx.head = next;
+}
+
+
 /*--------------------------------------------------------
 Setup processor clocks to use UART 1
 --------------------------------------------------------*/
@@ -362,14 +758,16 @@ static void uart_setup_irq( void )
     NVIC_InitTypeDef    NVIC_InitStructure;
 
     /*--------------------------------------------------------
-    Enable UART 1 RX interrupt
-    NOTE: use the following line to enable TX interrupt:
-    USART_ITConfig( USART1, USART_IT_TXE, ENABLE );
+    Enable UART 1 RX interrupt. The TX interrupt is enabled
+    by uart_write() when there is something to send.
     --------------------------------------------------------*/
     USART_ITConfig( USART1, USART_IT_RXNE, ENABLE );
 
-    /* Configure the NVIC Preemption Priority Bits 			*/
-    NVIC_PriorityGroupConfig( NVIC_PriorityGroup_0 );
+    /*--------------------------------------------------------
+    All four priority bits preempt, so device interrupts at
+    0 preempt SysTick and deferred work (defer.h) at 15
+    --------------------------------------------------------*/
+    NVIC_PriorityGroupConfig( NVIC_PriorityGroup_4 );
 
     /* Enable the USART 1 Interrupt 						*/
     NVIC_InitStructure.NVIC_IRQChannel = USART1_IRQn;
@@ -377,16 +775,6 @@ static void uart_setup_irq( void )
     NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
     NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
     NVIC_Init( &NVIC_InitStructure );
-
-    /*--------------------------------------------------------
-    Setup UART RX buffer state data
-    --------------------------------------------------------*/
-    s_uart_rx_buf_data.buf_sz        = UART_RX_BUF_SZ;
-    s_uart_rx_buf_data.num_bytes     = 0;
-    s_uart_rx_buf_data.buf_ptr_start = s_uart_rx_buf;
-    s_uart_rx_buf_data.buf_ptr_cur   = s_uart_rx_buf;
-    s_uart_rx_buf_data.error_rx_full = false;
-    s_uart_rx_buf_data.error_overrun = false;
 }
 
 
@@ -426,14 +814,83 @@ static void uart_setup_periph( uint32_t baud_rate )
 
 
 /*--------------------------------------------------------
-Wait for UART 1 transmit to become ready
+Move one byte to the data register if it is empty. At the
+end of a unit the next channel is picked; the TX
+interrupt is turned off once all rings are empty. Called
+from the interrupt, and polled when the interrupt can not
+run.
 --------------------------------------------------------*/
-static void uart_wait_tx_ready( void )
+static void uart_tx_poll( void )
 {
-    /*--------------------------------------------------------
-    Block waiting for the TX data register to become empty
-    --------------------------------------------------------*/
-    while( USART_GetFlagStatus( USART1, USART_FLAG_TXE ) == RESET );
+    uart_ring_type     *ring;       /* ring to send from            */
+    uint8_t             ch;         /* channel index                */
+
+    if( USART_GetFlagStatus( USART1, USART_FLAG_TXE ) == RESET )
+    {
+        return;
+    }
+
+    if( s_cur_left == 0 )
+    {
+        for( ch = 0; ch < UART_MUX_CH_CNT && s_tx[ ch ].head == s_tx[ ch ].tail; ch++ );
+        if( ch == UART_MUX_CH_CNT )
+        {
+            USART_ITConfig( USART1, USART_IT_TXE, DISABLE );
+            return;
+        }
+
+        s_cur_ch   = uart_mux_next();
+        ring       = &s_tx[ s_cur_ch ];
+        s_cur_left = uart_ring_unit( ring );
+        ring->tail = ( ring->tail + UART_MUX_HDR_SZ ) % ring->buf_sz;
+
+        s_mux_stats[ s_cur_ch ].units++;
+        s_mux_stats[ s_cur_ch ].bytes += s_cur_left;
+    }
+
+    ring = &s_tx[ s_cur_ch ];
+    USART_SendData( USART1, ring->buf[ ring->tail ] );
+    ring->tail = ( ring->tail + 1 ) % ring->buf_sz;
+    s_cur_left--;
 }
 
 
+/*--------------------------------------------------------
+Queue one unit on a channel if it fits whole. Writers may
+be interrupted by other writers, so the space is claimed
+with interrupts masked.
+--------------------------------------------------------*/
+static bool uart_unit_put( uint8_t ch, const uint8_t *src, uint16_t len )
+{
+    uart_ring_type     *ring;       /* channel's ring               */
+    uint32_t            primask;    /* interrupt mask on entry      */
+    uint16_t            head;       /* next byte to write           */
+    uint16_t            used;       /* bytes queued after the unit  */
+    uint8_t             hdr[ UART_MUX_HDR_SZ ];
+                                    /* unit length                  */
+
+    ring     = &s_tx[ ch ];
+    hdr[ 0 ] = (uint8_t)len;
+    hdr[ 1 ] = (uint8_t)( len >> 8 );
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+
+    head = ring->head;
+    used = ( head + ring->buf_sz - ring->tail ) % ring->buf_sz + UART_MUX_HDR_SZ + len;
+    if( used >= ring->buf_sz )
+    {
+        __set_PRIMASK( primask );
+        return false;
+    }
+
+    head = uart_ring_copy( ring, head, hdr, UART_MUX_HDR_SZ );
+    ring->head = uart_ring_copy( ring, head, src, len );
+    if( used > s_mux_stats[ ch ].max_queued )
+    {
+        s_mux_stats[ ch ].max_queued = used;
+    }
+
+    __set_PRIMASK( primask );
+    return true;
+}
@@ -0,0 +1,235 @@
+/*----------------------------------------------------------------------
+                            INCLUDES
+----------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "varenc.h"
+
+/*----------------------------------------------------------------------
+                            PROCEDURES
+----------------------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+static void varenc_step( varenc_ctx_type *ctx, int32_t *rec );
+
+
+/*--------------------------------------------------------
+Start a stream
+--------------------------------------------------------*/
+void varenc_init( varenc_ctx_type *ctx, uint8_t fields )
+{
+    memset( ctx, 0, sizeof( *ctx ) );
+    ctx->fields = ( fields > VARENC_FIELDS_MAX ) ? VARENC_FIELDS_MAX : fields;
+}
+
+
+/*--------------------------------------------------------
+Write an unsigned varint
+--------------------------------------------------------*/
+uint8_t varenc_put_uvar( uint8_t *p, uint32_t v )
+{
+    uint8_t             n;          /* bytes written                */
+
+    n = 0;
+    while( v >= 0x80 )
+    {
+        p[ n++ ] = (uint8_t)( v | 0x80 );
+        v >>= 7;
+    }
+    p[ n++ ] = (uint8_t)v;
+
+    return n;
+}
+
+
+/*--------------------------------------------------------
+Read an unsigned varint
+--------------------------------------------------------*/
+uint8_t varenc_get_uvar( const uint8_t *p, uint16_t len, uint32_t *v )
+{
+    uint8_t             n;          /* bytes read                   */
+    uint32_t            val;        /* value so far                 */
+
+    val = 0;
+    for( n = 0; n < len && n < VARENC_UVAR_MAX; n++ )
+    {
+        val |= (uint32_t)( p[ n ] & 0x7F ) << ( 7 * n );
+        if( ( p[ n ] & 0x80 ) == 0 )
+        {
+            *v = val;
+            return n + 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*--------------------------------------------------------
+Encode one record. Deltas use 32 bit wrap around, so a
+counter that overflows costs no more than any other step.
+--------------------------------------------------------*/
+int16_t varenc_put( varenc_ctx_type *ctx, const int32_t *rec,
+                    uint8_t *out, uint16_t room )
+{
+    int32_t             delta[ VARENC_FIELDS_MAX ];
+                                    /* this record's deltas         */
+    uint8_t             mask;       /* fields with a delta          */
+    uint8_t             i;          /* loop counter                 */
+    uint16_t            len;        /* bytes written                */
+    int16_t             n;          /* bytes of the flushed run     */
+
+    for( i = 0; i < ctx->fields; i++ )
+    {
+        delta[ i ] = (int32_t)( (uint32_t)rec[ i ] - (uint32_t)ctx->prev[ i ] );
+    }
+
+    if( memcmp( delta, ctx->delta, ctx->fields * sizeof( delta[ 0 ] ) ) == 0
+     && ctx->run < VARENC_RUN_MAX )
+    {
+        memcpy( ctx->prev, rec, ctx->fields * sizeof( rec[ 0 ] ) );
+        ctx->run++;
+        return 0;
+    }
+
+    if( room < VARENC_REC_MAX + VARENC_UVAR_MAX )
+    {
+        return VARENC_ERR_ROOM;
+    }
+
+    n = varenc_flush( ctx, out, room );
+    len = (uint16_t)n;
+
+    mask = 0;
+    for( i = 0; i < ctx->fields; i++ )
+    {
+        mask |= ( delta[ i ] != 0 ) << i;
+    }
+
+    len += varenc_put_uvar( &out[ len ], (uint32_t)mask << 1 );
+    for( i = 0; i < ctx->fields; i++ )
+    {
+        if( delta[ i ] != 0 )
+        {
+            len += varenc_put_uvar( &out[ len ], varenc_zigzag( delta[ i ] ) );
+        }
+    }
+
+    memcpy( ctx->prev, rec, ctx->fields * sizeof( rec[ 0 ] ) );
+    memcpy( ctx->delta, delta, ctx->fields * sizeof( delta[ 0 ] ) );
+
+    return (int16_t)len;
+}
+
+
+/*--------------------------------------------------------
+Write the pending run, if any
+--------------------------------------------------------*/
+int16_t varenc_flush( varenc_ctx_type *ctx, uint8_t *out, uint16_t room )
+{
+    uint8_t             n;          /* bytes written                */
+
+    if( ctx->run == 0 )
+    {
+        return 0;
+    }
+
+    if( room < VARENC_UVAR_MAX )
+    {
+        return VARENC_ERR_ROOM;
+    }
+
+    n = varenc_put_uvar( out, ( (uint32_t)ctx->run << 1 ) | 1 );
+    ctx->run = 0;
+
+    return n;
+}
+
+
+/*--------------------------------------------------------
+Decode one record
+--------------------------------------------------------*/
+int16_t varenc_get( varenc_ctx_type *ctx, const uint8_t *in, uint16_t len,
+                    int32_t *rec )
+{
+    uint32_t            token;      /* record token                 */
+    uint32_t            v;          /* field varint                 */
+    uint16_t            pos;        /* bytes read                   */
+    uint8_t             n;          /* varint length                */
+    uint8_t             i;          /* loop counter                 */
+
+    if( ctx->run != 0 )
+    {
+        ctx->run--;
+        varenc_step( ctx, rec );
+        return 0;
+    }
+
+    pos = varenc_get_uvar( in, len, &token );
+    if( pos == 0 )
+    {
+        return VARENC_ERR_DATA;
+    }
+
+    if( token & 1 )
+    {
+        if( token >> 1 == 0 || token >> 1 > VARENC_RUN_MAX )
+        {
+            return VARENC_ERR_DATA;
+        }
+
+        /*--------------------------------------------------------
+        The token's bytes are used by the first record of the
+        run, the rest come from ctx->run
+        --------------------------------------------------------*/
+        ctx->run = (uint16_t)( ( token >> 1 ) - 1 );
+        varenc_step( ctx, rec );
+        return (int16_t)pos;
+    }
+
+    token >>= 1;
+    if( token >> ctx->fields != 0 )
+    {
+        return VARENC_ERR_DATA;
+    }
+
+    for( i = 0; i < ctx->fields; i++ )
+    {
+        ctx->delta[ i ] = 0;
+        if( token & ( 1u << i ) )
+        {
+            n = varenc_get_uvar( &in[ pos ], len - pos, &v );
+            if( n == 0 )
+            {
+                return VARENC_ERR_DATA;
+            }
+            pos += n;
+            ctx->delta[ i ] = varenc_unzigzag( v );
+        }
+    }
+
+    varenc_step( ctx, rec );
+    return (int16_t)pos;
+}
+
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Apply the current deltas to the previous record
+--------------------------------------------------------*/
+static void varenc_step( varenc_ctx_type *ctx, int32_t *rec )
+{
+    uint8_t             i;          /* loop counter                 */
+
+    for( i = 0; i < ctx->fields; i++ )
+    {
+        ctx->prev[ i ] = (int32_t)( (uint32_t)ctx->prev[ i ] + (uint32_t)ctx->delta[ i ] );
+        rec[ i ] = ctx->prev[ i ];
+    }
+}
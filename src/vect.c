@@ -0,0 +1,154 @@
+/*----------------------------------------------------------------------
+                            INCLUDES
+----------------------------------------------------------------------*/
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "shell.h"
+#include "vect.h"
+
+/*----------------------------------------------------------------------
+                            CONSTANTS
+----------------------------------------------------------------------*/
+
+#if VECT_CNT * 4 > VECT_ALIGN
+#error "the vector table must fit its alignment"
+#endif
+
+#define VECT_FIRST          2       /* NMI, after SP and reset      */
+
+/*----------------------------------------------------------------------
+                            VARIABLES
+----------------------------------------------------------------------*/
+
+#if( VECT_RAM )
+static vect_handler_type s_table[ VECT_CNT ] __attribute__(( aligned( VECT_ALIGN ) ));
+                                    /* vector table in use          */
+#endif
+static const vect_handler_type
+                       *s_flash;    /* table it was copied from     */
+static bool             s_in_ram;   /* VTOR points at s_table       */
+
+/*----------------------------------------------------------------------
+                            PROCEDURES
+----------------------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+static int8_t vect_shell( shell_ctx_type *ctx, uint8_t argc, char *argv[] );
+
+SHELL_CMD( "vect", "handlers swapped at run time", vect_shell );
+
+
+/*--------------------------------------------------------
+Copy the vector table to RAM and use the copy
+--------------------------------------------------------*/
+void vect_init( void )
+{
+    uint32_t            primask;    /* interrupt mask on entry      */
+
+    s_flash = (const vect_handler_type *)SCB->VTOR;
+
+#if( VECT_RAM )
+    primask = __get_PRIMASK();
+    __disable_irq();
+
+    memcpy( s_table, s_flash, sizeof( s_table ) );
+    __DSB();
+    SCB->VTOR = (uint32_t)s_table;
+    __DSB();
+    __ISB();
+    s_in_ram = true;
+
+    __set_PRIMASK( primask );
+#else
+    (void)primask;
+#endif
+}
+
+
+/*--------------------------------------------------------
+Install the handler of an interrupt or system exception
+--------------------------------------------------------*/
+int8_t vect_set( IRQn_Type irq, vect_handler_type handler )
+{
+    int32_t             idx;        /* index in the table           */
+
+    idx = (int32_t)irq + VECT_SYS_CNT;
+    if( idx < VECT_FIRST || idx >= VECT_CNT )
+    {
+        return VECT_ERR_IRQ;
+    }
+
+    if( !s_in_ram )
+    {
+        return VECT_ERR_FLASH;
+    }
+
+#if( VECT_RAM )
+    s_table[ idx ] = handler;
+    __DSB();
+#else
+    (void)handler;
+#endif
+
+    return 0;
+}
+
+
+/*--------------------------------------------------------
+Handler an interrupt or system exception runs now, NULL
+for no such vector
+--------------------------------------------------------*/
+vect_handler_type vect_get( IRQn_Type irq )
+{
+    int32_t             idx;        /* index in the table           */
+
+    idx = (int32_t)irq + VECT_SYS_CNT;
+    if( idx < VECT_FIRST || idx >= VECT_CNT )
+    {
+        return NULL;
+    }
+
+    return ( (const vect_handler_type *)SCB->VTOR )[ idx ];
+}
+
+
+/*--------------------------------------------------------
+Local functions
+--------------------------------------------------------*/
+
+/*--------------------------------------------------------
+Shell: vect. Prints where the table is and each handler
+that is not the one linked in.
+--------------------------------------------------------*/
+static int8_t vect_shell( shell_ctx_type *ctx, uint8_t argc, char *argv[] )
+{
+    int32_t             idx;        /* index in the table           */
+    vect_handler_type   cur;        /* handler in use               */
+
+    (void)ctx;
+    (void)argc;
+    (void)argv;
+
+    shell_printf( "table at 0x%08lx, %s\n", (unsigned long)SCB->VTOR,
+                  s_in_ram ? "RAM" : "flash" );
+    if( !s_in_ram )
+    {
+        return SHELL_DONE;
+    }
+
+    for( idx = VECT_FIRST; idx < VECT_CNT; idx++ )
+    {
+        cur = vect_get( (IRQn_Type)( idx - VECT_SYS_CNT ) );
+        if( cur != s_flash[ idx ] )
+        {
+            shell_printf( "irq %ld: 0x%08lx, linked 0x%08lx\n",
+                          (long)( idx - VECT_SYS_CNT ), (unsigned long)cur,
+                          (unsigned long)s_flash[ idx ] );
+        }
+    }
+    return SHELL_DONE;
+}
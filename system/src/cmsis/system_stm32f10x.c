@@ -63,6 +63,7 @@
   */
 
 #include "stm32f10x.h"
+#include "vect.h"           /* __isr_vectors */
 
 /**
   * @}
@@ -264,7 +265,8 @@ void SystemInit (void)
 #ifdef VECT_TAB_SRAM
   SCB->VTOR = SRAM_BASE | VECT_TAB_OFFSET; /* Vector Table Relocation in Internal SRAM. */
 #else
-  SCB->VTOR = FLASH_BASE | VECT_TAB_OFFSET; /* Vector Table Relocation in Internal FLASH. */
+  /* The image may run from either OTA slot, use the table it was linked with. */
+  SCB->VTOR = (uint32_t)__isr_vectors; /* Vector Table Relocation in Internal FLASH. */
 #endif 
 }
 
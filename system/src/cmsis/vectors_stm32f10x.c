@@ -6,6 +6,7 @@
 // ----------------------------------------------------------------------------
 
 #include "cortexm/ExceptionHandlers.h"
+#include "vect.h" // __isr_vectors declaration
 
 // ----------------------------------------------------------------------------
 